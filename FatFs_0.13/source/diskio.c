@@ -64,11 +64,14 @@ DRESULT disk_read (
 	if (SD_ReadBlocks_DMA(buff, sector, count) != 0)
 		return RES_ERROR;
 
-	// wait for the read operation to be completed
+	// wait for the read operation to be completed: the core sleeps until the
+	// next interrupt instead of spinning, but the caller (and the scheduler)
+	// still waits for the whole transfer
 	uint32_t start_tick = systick_get_tick_count();
 	while (SD_GetContext() != SD_CONTEXT_NONE) {
 		if ((systick_get_tick_count()-start_tick) > DISK_READ_TIMEOUT_MS)
 			return RES_ERROR;
+		__WFI();
 	}
 	
 	return RES_OK;
@@ -0,0 +1,44 @@
+HOST_PATH=project/host
+
+# Firmware's sources which run unchanged on the host
+HOST_SRCS += $(PROJECT_PATH)/sources/kernel.c
+HOST_SRCS += $(PROJECT_PATH)/sources/clock_configuration.c
+HOST_SRCS += $(PROJECT_PATH)/sources/debug_printf.c
+HOST_SRCS += $(PROJECT_PATH)/sources/oled.c
+HOST_SRCS += $(PROJECT_PATH)/sources/output_i2s.c
+HOST_SRCS += $(PROJECT_PATH)/sources/mp3_player.c
+HOST_SRCS += $(PROJECT_PATH)/sources/mp3_index.c
+HOST_SRCS += $(PROJECT_PATH)/sources/mp3_tags.c
+HOST_SRCS += $(PROJECT_PATH)/sources/shell.c
+HOST_SRCS += $(PROJECT_PATH)/sources/buttons.c
+HOST_SRCS += $(PROJECT_PATH)/sources/file_manager.c
+HOST_SRCS += $(PROJECT_PATH)/sources/eeprom.c
+HOST_SRCS += $(PROJECT_PATH)/sources/Si468x.c
+HOST_SRCS += $(PROJECT_PATH)/sources/sgtl5000.c
+HOST_SRCS += $(PROJECT_PATH)/ui/main_menu/main_menu.c
+HOST_SRCS += $(PROJECT_PATH)/ui/file_browser/file_browser.c
+HOST_SRCS += $(PROJECT_PATH)/ui/music_player/music_player.c
+HOST_SRCS += $(filter $(FATFS_PATH)/%,$(SRCS))
+HOST_SRCS += $(filter $(LIBMAD_PATH)/%,$(SRCS))
+
+# Simulated hardware
+HOST_SRCS += $(HOST_PATH)/sources/main.c
+HOST_SRCS += $(HOST_PATH)/sources/mcu.c
+HOST_SRCS += $(HOST_PATH)/sources/systick.c
+HOST_SRCS += $(HOST_PATH)/sources/cycle_counter.c
+HOST_SRCS += $(HOST_PATH)/sources/timer.c
+HOST_SRCS += $(HOST_PATH)/sources/uart.c
+HOST_SRCS += $(HOST_PATH)/sources/keypad.c
+HOST_SRCS += $(HOST_PATH)/sources/fsmc.c
+HOST_SRCS += $(HOST_PATH)/sources/sd_card.c
+HOST_SRCS += $(HOST_PATH)/sources/i2s.c
+HOST_SRCS += $(HOST_PATH)/sources/i2c.c
+HOST_SRCS += $(HOST_PATH)/sources/spi.c
+HOST_SRCS += $(HOST_PATH)/sources/tuner.c
+HOST_SRCS += $(HOST_PATH)/sources/devices.c
+HOST_SRCS += $(HOST_PATH)/sources/sched_bench.c
+HOST_SRCS += $(HOST_PATH)/sources/isr_stress.c
+HOST_SRCS += $(HOST_PATH)/sources/ui_load.c
+
+# The host's includes come first, since they wrap the device's header
+HOST_INCS = -I$(HOST_PATH)/includes $(INCS)
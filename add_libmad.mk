@@ -12,4 +12,9 @@ SRCS += ${LIBMAD_PATH}/synth.c
 SRCS += ${LIBMAD_PATH}/timer.c
 SRCS += ${LIBMAD_PATH}/version.c
 
+# The assembly IMDCT of long blocks, for the target only
+ifneq ($(filter -DASO_IMDCT,$(LIBMAD_OPTIONS)),)
+ASMS += ${LIBMAD_PATH}/imdct_l_arm.S
+endif
+
 INCS += -I$(LIBMAD_PATH)/
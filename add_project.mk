@@ -18,11 +18,14 @@ SRCS += $(PROJECT_PATH)/sources/uart.c
 SRCS += $(PROJECT_PATH)/sources/interrupts.c
 SRCS += $(PROJECT_PATH)/sources/systick.c
 SRCS += $(PROJECT_PATH)/sources/mp3_player.c
+SRCS += $(PROJECT_PATH)/sources/mp3_index.c
+SRCS += $(PROJECT_PATH)/sources/mp3_tags.c
 SRCS += $(PROJECT_PATH)/sources/sgtl5000.c
 SRCS += $(PROJECT_PATH)/sources/shell.c
 SRCS += $(PROJECT_PATH)/sources/utils.c
 SRCS += $(PROJECT_PATH)/sources/buttons.c
 SRCS += $(PROJECT_PATH)/sources/file_manager.c
+SRCS += $(PROJECT_PATH)/sources/cycle_counter.c
 				
 INCS += -I$(PROJECT_PATH)/includes
 
@@ -442,7 +442,9 @@ int run_sync(struct mad_decoder *decoder)
 	}
       }
 
+# if !defined(OPT_PCM16_ONLY)
       mad_synth_frame(synth, frame);
+# endif
 
       if (decoder->output_func) {
 	switch (decoder->output_func(decoder->cb_data,
@@ -36,6 +36,16 @@ mad_fixed_t mad_f_abs(mad_fixed_t x)
   return x < 0 ? -x : x;
 }
 
+# if defined(FPM_FLOAT)
+/*
+ * NAME:	fixed->div()
+ * DESCRIPTION:	perform division using floating-point math
+ */
+mad_fixed_t mad_f_div(mad_fixed_t x, mad_fixed_t y)
+{
+  return x / y;
+}
+# else
 /*
  * NAME:	fixed->div()
  * DESCRIPTION:	perform division using fixed-point math
@@ -79,3 +89,4 @@ mad_fixed_t mad_f_div(mad_fixed_t x, mad_fixed_t y)
 
   return q << bits;
 }
+# endif
@@ -22,7 +22,12 @@
 # ifndef LIBMAD_FIXED_H
 # define LIBMAD_FIXED_H
 
-# if SIZEOF_INT >= 4
+# if defined(FPM_FLOAT)
+typedef float mad_fixed_t;
+
+typedef float mad_fixed64hi_t;
+typedef float mad_fixed64lo_t;
+# elif SIZEOF_INT >= 4
 typedef   signed int mad_fixed_t;
 
 typedef   signed int mad_fixed64hi_t;
@@ -41,7 +46,7 @@ typedef unsigned long mad_fixed64lo_t;
 # endif
 
 # if defined(FPM_FLOAT)
-typedef double mad_sample_t;
+typedef float mad_sample_t;
 # else
 typedef mad_fixed_t mad_sample_t;
 # endif
@@ -103,17 +108,44 @@ typedef mad_fixed_t mad_sample_t;
 
 # define mad_f_fromint(x)	((x) << MAD_F_FRACBITS)
 
+# define mad_f_fromraw(x)	((mad_fixed_t) (x))
+				/* (x is an integer in the fixed-point format) */
+
 # define mad_f_add(x, y)	((x) + (y))
 # define mad_f_sub(x, y)	((x) - (y))
 
 # if defined(FPM_FLOAT)
-#  error "FPM_FLOAT not yet supported"
 
+/*
+ * This version works in single precision, for targets with a floating-point
+ * unit such as the Cortex-M4 FPv4-SP. The scale is unchanged (MAD_F_ONE is
+ * 1.0) and the constants written in the fixed-point format are converted at
+ * compile time, so the same tables serve both versions. The accumulators of
+ * MAD_F_ML0()/MAD_F_MLA() are plain floats: only the "lo" half is used.
+ */
 #  undef MAD_F
-#  define MAD_F(x)		mad_f_todouble(x)
+#  define MAD_F(x)		((mad_fixed_t) ((x) / (double) (1L << MAD_F_FRACBITS)))
+
+#  undef MAD_F_MIN
+#  undef MAD_F_MAX
+#  define MAD_F_MIN		((mad_fixed_t) -8.0)
+#  define MAD_F_MAX		((mad_fixed_t) +8.0)
+
+#  undef mad_f_tofixed
+#  undef mad_f_todouble
+#  define mad_f_tofixed(x)	((mad_fixed_t) (x))
+#  define mad_f_todouble(x)	((double) (x))
+
+#  undef mad_f_intpart
+#  undef mad_f_fromint
+#  undef mad_f_fromraw
+#  define mad_f_intpart(x)	((signed long) (x))
+#  define mad_f_fromint(x)	((mad_fixed_t) (x))
+#  define mad_f_fromraw(x)	((mad_fixed_t) (x) *  \
+				 (1.0f / (1L << MAD_F_FRACBITS)))
 
 #  define mad_f_mul(x, y)	((x) * (y))
-#  define mad_f_scale64
+#  define mad_f_scale64(hi, lo)	((void) (hi), (mad_fixed_t) (lo))
 
 #  undef ASO_ZEROCHECK
 
@@ -295,6 +327,83 @@ mad_fixed_t mad_f_mul_inline(mad_fixed_t x, mad_fixed_t y)
 
 #  define MAD_F_SCALEBITS  MAD_F_FRACBITS
 
+/* --- Cortex-M4 ----------------------------------------------------------- */
+
+# elif defined(FPM_CORTEXM4)
+
+/*
+ * This Thumb-2 version is as accurate as FPM_64BIT with OPT_ACCURACY: the
+ * 64-bit products and sums are rounded to nearest when scaled, at no cost
+ * as in the ARM V4 version. (SMMULR is not used since it drops 32 bits, so
+ * the 4 least significant bits of the result would be lost.)
+ *
+ * On other targets, such as the host build, the same rounding is done in C
+ * so that the results are bit-exact.
+ */
+#  if defined(__thumb2__)
+#   define mad_f_mul(x, y)  \
+    ({ mad_fixed64hi_t __hi;  \
+       mad_fixed64lo_t __lo;  \
+       mad_fixed_t __result;  \
+       asm ("smull	%0, %1, %3, %4\n\t"  \
+	    "lsrs	%0, %0, %5\n\t"  \
+	    "adc	%2, %0, %1, lsl %6"  \
+	    : "=&r" (__lo), "=&r" (__hi), "=r" (__result)  \
+	    : "%r" (x), "r" (y),  \
+	      "M" (MAD_F_SCALEBITS), "M" (32 - MAD_F_SCALEBITS)  \
+	    : "cc");  \
+       __result;  \
+    })
+
+#   define MAD_F_MLX(hi, lo, x, y)  \
+    asm ("smull	%0, %1, %2, %3"  \
+	 : "=&r" (lo), "=&r" (hi)  \
+	 : "%r" (x), "r" (y))
+
+#   define MAD_F_MLA(hi, lo, x, y)  \
+    asm ("smlal	%0, %1, %2, %3"  \
+	 : "+r" (lo), "+r" (hi)  \
+	 : "%r" (x), "r" (y))
+
+#   define mad_f_scale64(hi, lo)  \
+    ({ mad_fixed_t __result;  \
+       asm ("lsrs	%0, %1, %3\n\t"  \
+	    "adc	%0, %0, %2, lsl %4"  \
+	    : "=&r" (__result)  \
+	    : "r" (lo), "r" (hi),  \
+	      "M" (MAD_F_SCALEBITS), "M" (32 - MAD_F_SCALEBITS)  \
+	    : "cc");  \
+       __result;  \
+    })
+#  else
+#   define MAD_F_JOIN64(hi, lo)  \
+    ((mad_fixed64_t) (((unsigned long long) (mad_fixed64lo_t) (hi) << 32) |  \
+		      (mad_fixed64lo_t) (lo)))
+
+#   define mad_f_mul(x, y)  \
+    ((mad_fixed_t)  \
+     ((((mad_fixed64_t) (x) * (y)) +  \
+       (1L << (MAD_F_SCALEBITS - 1))) >> MAD_F_SCALEBITS))
+
+#   define MAD_F_MLX(hi, lo, x, y)  \
+    do { mad_fixed64_t __product = (mad_fixed64_t) (x) * (y);  \
+	 (lo) = (mad_fixed64lo_t) __product;  \
+	 (hi) = (mad_fixed64hi_t) (__product >> 32); } while (0)
+
+#   define MAD_F_MLA(hi, lo, x, y)  \
+    do { mad_fixed64_t __sum = MAD_F_JOIN64((hi), (lo)) +  \
+			       (mad_fixed64_t) (x) * (y);  \
+	 (lo) = (mad_fixed64lo_t) __sum;  \
+	 (hi) = (mad_fixed64hi_t) (__sum >> 32); } while (0)
+
+#   define mad_f_scale64(hi, lo)  \
+    ((mad_fixed_t)  \
+     ((MAD_F_JOIN64((hi), (lo)) +  \
+       (1L << (MAD_F_SCALEBITS - 1))) >> MAD_F_SCALEBITS))
+#  endif
+
+#  define MAD_F_SCALEBITS  MAD_F_FRACBITS
+
 /* --- MIPS ---------------------------------------------------------------- */
 
 # elif defined(FPM_MIPS)
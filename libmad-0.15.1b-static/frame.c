@@ -92,7 +92,8 @@ void mad_frame_init(struct mad_frame *frame)
 {
   mad_header_init(&frame->header);
 
-  frame->options = 0;
+  frame->options  = 0;
+  frame->granules = 0;
 
   mad_frame_mute(frame);
 }
@@ -431,7 +432,30 @@ int mad_header_decode(struct mad_header *header, struct mad_stream *stream)
  */
 int mad_frame_decode(struct mad_frame *frame, struct mad_stream *stream)
 {
-  frame->options = stream->options;
+  unsigned int gr;
+
+  if (mad_frame_decode_data(frame, stream) == -1)
+    return -1;
+
+  for (gr = 0; gr < frame->granules; ++gr)
+    mad_frame_decode_granule(frame, gr);
+
+  return 0;
+}
+
+/*
+ * NAME:	frame->decode_data()
+ * DESCRIPTION:	decode the data of a single frame from a bitstream: Layer III
+ *		frames are left with frame->granules granules, which must be
+ *		filtered in order by mad_frame_decode_granule() before the
+ *		subband samples are complete (the stream is not needed any
+ *		more, so each granule can be filtered and synthesized on its
+ *		own)
+ */
+int mad_frame_decode_data(struct mad_frame *frame, struct mad_stream *stream)
+{
+  frame->options  = stream->options;
+  frame->granules = 0;
 
   /* header() */
   /* error_check() */
@@ -471,6 +495,16 @@ int mad_frame_decode(struct mad_frame *frame, struct mad_stream *stream)
   return -1;
 }
 
+/*
+ * NAME:	frame->decode_granule()
+ * DESCRIPTION:	filter a Layer III granule decoded by mad_frame_decode_data()
+ *		into subband samples
+ */
+void mad_frame_decode_granule(struct mad_frame *frame, unsigned int gr)
+{
+  mad_layer_III_granule(frame, gr);
+}
+
 /*
  * NAME:	frame->mute()
  * DESCRIPTION:	zero all subband values so the frame becomes silent
@@ -64,6 +64,17 @@ struct mad_header {
   mad_timer_t duration;			/* audio playing time of frame */
 };
 
+/*
+ * Layer III granule whose main data is decoded (up to the joint stereo
+ * processing) but which is still to be filtered into subband samples
+ */
+struct mad_granule {
+  mad_fixed_t xr[2][576];		/* frequency lines [ch][line] */
+  unsigned char const *sfbwidth[2];	/* scalefactor band widths [ch] */
+  unsigned char block_type[2];		/* block type [ch] */
+  unsigned char flags[2];		/* Layer III channel flags [ch] */
+};
+
 struct mad_frame {
   struct mad_header header;		/* MPEG audio header */
 
@@ -71,6 +82,9 @@ struct mad_frame {
 
   mad_fixed_t sbsample[2][36][32];	/* synthesis subband filter samples */
   mad_fixed_t overlap[2][32][18];	/* Layer III block overlap data */
+
+  struct mad_granule granule[2];	/* Layer III granules to be filtered */
+  unsigned int granules;		/* how many (0 for Layers I and II) */
 };
 
 # define MAD_NCHANNELS(header)		((header)->mode ? 2 : 1)
@@ -112,6 +126,8 @@ void mad_frame_init(struct mad_frame *);
 void mad_frame_finish(struct mad_frame *);
 
 int mad_frame_decode(struct mad_frame *, struct mad_stream *);
+int mad_frame_decode_data(struct mad_frame *, struct mad_stream *);
+void mad_frame_decode_granule(struct mad_frame *, unsigned int);
 
 void mad_frame_mute(struct mad_frame *);
 
@@ -3107,3 +3107,43 @@ struct hufftable const mad_huff_pair_table[32] = {
   /* 30 */ { hufftab24, 11, 4 },
   /* 31 */ { hufftab24, 13, 4 }
 };
+
+# if defined(OPT_HUFF_LOOKUP)
+#  define S(x, y, len)  \
+    (MAD_HUFF_VALID | MAD_HUFF_SIGNS | (len) |  \
+     (((x) < 0 ? -(x) : (x)) << MAD_HUFF_XSHIFT) |  \
+     (((y) < 0 ? -(y) : (y)) << MAD_HUFF_YSHIFT) |  \
+     ((x) < 0 ? MAD_HUFF_XNEG : 0) | ((y) < 0 ? MAD_HUFF_YNEG : 0))
+#  define U(x, y, hlen)  \
+    (MAD_HUFF_VALID | (hlen) |  \
+     ((x) << MAD_HUFF_XSHIFT) | ((y) << MAD_HUFF_YSHIFT))
+#  define Q1(v)  \
+    ((v) < 0 ? 3 : (v))
+#  define Q(v, w, x, y, len)  \
+    (MAD_HUFF_VALID | MAD_HUFF_SIGNS | (len) |  \
+     (Q1(v) << 10) | (Q1(w) << 8) | (Q1(x) << 6) | (Q1(y) << 4))
+#  define LONG  0
+
+#  include "huff_lookup.dat"
+
+#  undef S
+#  undef U
+#  undef Q1
+#  undef Q
+#  undef LONG
+
+unsigned short const *const mad_huff_quad_lookup[2] = {
+  hufflookA, hufflookB
+};
+
+unsigned short const *const mad_huff_pair_lookup[32] = {
+  hufflook0,  hufflook1,  hufflook2,  hufflook3,
+  0,          hufflook5,  hufflook6,  hufflook7,
+  hufflook8,  hufflook9,  hufflook10, hufflook11,
+  hufflook12, hufflook13, 0,          hufflook15,
+  hufflook16, hufflook16, hufflook16, hufflook16,
+  hufflook16, hufflook16, hufflook16, hufflook16,
+  hufflook24, hufflook24, hufflook24, hufflook24,
+  hufflook24, hufflook24, hufflook24, hufflook24
+};
+# endif
@@ -63,4 +63,30 @@ struct hufftable {
 extern union huffquad const *const mad_huff_quad_table[2];
 extern struct hufftable const mad_huff_pair_table[32];
 
+# if defined(OPT_HUFF_LOOKUP)
+/*
+ * First level lookup tables, indexed by the next MAD_HUFF_LOOKUP_BITS bits of
+ * the stream: an entry decodes a whole code word, together with the sign bits
+ * of its values when they fit too (MAD_HUFF_SIGNS). Entries which need more
+ * bits are 0, and the tables above must be used for them.
+ */
+#  define MAD_HUFF_LOOKUP_BITS	8
+
+enum {
+  MAD_HUFF_LENGTH = 0x000f,	/* bits used by the entry */
+  MAD_HUFF_XSHIFT = 4,		/* pairs: x (0..15) */
+  MAD_HUFF_YSHIFT = 8,		/* pairs: y (0..15) */
+  MAD_HUFF_XNEG   = 0x1000,	/* pairs: x is negative */
+  MAD_HUFF_YNEG   = 0x2000,	/* pairs: y is negative */
+  MAD_HUFF_SIGNS  = 0x4000,	/* the sign bits are included */
+  MAD_HUFF_VALID  = 0x8000
+};
+
+/* quads: v, w, x and y are 2 bits each from bit 4, (negative, not zero) */
+#  define MAD_HUFF_QUAD(entry, i)	(((entry) >> (10 - 2 * (i))) & 3)
+
+extern unsigned short const *const mad_huff_quad_lookup[2];
+extern unsigned short const *const mad_huff_pair_lookup[32];
+# endif
+
 # endif
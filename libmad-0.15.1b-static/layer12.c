@@ -74,22 +74,23 @@ mad_fixed_t const linear_table[14] = {
 static
 mad_fixed_t I_sample(struct mad_bitptr *ptr, unsigned int nb)
 {
+  signed int bits;
   mad_fixed_t sample;
 
-  sample = mad_bit_read(ptr, nb);
+  bits = mad_bit_read(ptr, nb);
 
   /* invert most significant bit, extend sign, then scale to fixed format */
 
-  sample ^= 1 << (nb - 1);
-  sample |= -(sample & (1 << (nb - 1)));
+  bits ^= 1 << (nb - 1);
+  bits |= -(bits & (1 << (nb - 1)));
 
-  sample <<= MAD_F_FRACBITS - (nb - 1);
+  sample = mad_f_fromraw(bits << (MAD_F_FRACBITS - (nb - 1)));
 
   /* requantize the sample */
 
   /* s'' = (2^nb / (2^nb - 1)) * (s''' + 2^(-nb + 1)) */
 
-  sample += MAD_F_ONE >> (nb - 1);
+  sample += mad_f_fromraw(1L << (MAD_F_FRACBITS - (nb - 1)));
 
   return mad_f_mul(sample, linear_table[nb - 2]);
 
@@ -304,7 +305,7 @@ void II_samples(struct mad_bitptr *ptr,
   }
 
   for (s = 0; s < 3; ++s) {
-    mad_fixed_t requantized;
+    signed int requantized;
 
     /* invert most significant bit, extend sign, then scale to fixed format */
 
@@ -317,7 +318,8 @@ void II_samples(struct mad_bitptr *ptr,
 
     /* s'' = C * (s''' + D) */
 
-    output[s] = mad_f_mul(requantized + quantclass->D, quantclass->C);
+    output[s] = mad_f_mul(mad_f_fromraw(requantized) + quantclass->D,
+			  quantclass->C);
 
     /* s' = factor * s'' */
     /* (to be performed by caller) */
@@ -328,7 +328,16 @@ unsigned char const pretab[22] = {
  * table for requantization
  *
  * rq_table[x].mantissa * 2^(rq_table[x].exponent) = x^(4/3)
+ *
+ * (the mantissas are bit fields, so they stay in the fixed-point format
+ * with FPM_FLOAT too)
  */
+# if defined(FPM_FLOAT)
+#  pragma push_macro("MAD_F")
+#  undef  MAD_F
+#  define MAD_F(x)		(x##L)
+# endif
+
 static
 struct fixedfloat {
   unsigned long mantissa  : 27;
@@ -337,6 +346,10 @@ struct fixedfloat {
 # include "rq_table.dat"
 };
 
+# if defined(FPM_FLOAT)
+#  pragma pop_macro("MAD_F")
+# endif
+
 /*
  * fractional powers of two
  * used for requantization and joint stereo decoding
@@ -390,7 +403,6 @@ mad_fixed_t const imdct_s[6][6] = {
 # include "imdct_s.dat"
 };
 
-# if !defined(ASO_IMDCT)
 /*
  * windowing coefficients for long blocks
  * derived from section 2.4.3.4.10.3 of ISO/IEC 11172-3
@@ -420,7 +432,6 @@ mad_fixed_t const window_l[36] = {
   MAD_F(0x04cfb0e2) /* 0.300705800 */, MAD_F(0x03768962) /* 0.216439614 */,
   MAD_F(0x0216a2a2) /* 0.130526192 */, MAD_F(0x00b2aa3e) /* 0.043619387 */,
 };
-# endif  /* ASO_IMDCT */
 
 /*
  * windowing coefficients for short blocks
@@ -875,6 +886,25 @@ void III_exponents(struct channel const *channel,
   }
 }
 
+# if defined(FPM_FLOAT)
+/*
+ * NAME:	III_ldexp()
+ * DESCRIPTION:	scale a single-precision value by a power of 2 (|exp| < 127)
+ */
+static inline
+mad_fixed_t III_ldexp(mad_fixed_t x, signed int exp)
+{
+  union {
+    float value;
+    unsigned int bits;
+  } scale;
+
+  scale.bits = (unsigned int) (127 + exp) << 23;
+
+  return x * scale.value;
+}
+# endif
+
 /*
  * NAME:	III_requantize()
  * DESCRIPTION:	requantize one (positive) value
@@ -890,7 +920,7 @@ mad_fixed_t III_requantize(unsigned int value, signed int exp)
   exp /= 4;
 
   power = &rq_table[value];
-  requantized = power->mantissa;
+  requantized = mad_f_fromraw(power->mantissa);
   exp += power->exponent;
 
   if (exp < 0) {
@@ -899,8 +929,12 @@ mad_fixed_t III_requantize(unsigned int value, signed int exp)
       requantized = 0;
     }
     else {
+# if defined(FPM_FLOAT)
+      requantized = III_ldexp(requantized, exp);
+# else
       requantized += 1L << (-exp - 1);
       requantized >>= -exp;
+# endif
     }
   }
   else {
@@ -913,7 +947,11 @@ mad_fixed_t III_requantize(unsigned int value, signed int exp)
       requantized = MAD_F_MAX;
     }
     else
+# if defined(FPM_FLOAT)
+      requantized = III_ldexp(requantized, exp);
+# else
       requantized <<= exp;
+# endif
   }
 
   return frac ? mad_f_mul(requantized, root_table[3 + frac]) : requantized;
@@ -1273,12 +1311,397 @@ enum mad_error III_huffdecode(struct mad_bitptr *ptr, mad_fixed_t xr[576],
 # undef MASK
 # undef MASK1BIT
 
+# if defined(OPT_HUFF_LOOKUP)
+/*
+ * The lookup decoder below keeps the bits in a 64-bit cache, refilled with a
+ * whole big-endian word when less than 32 bits are left. This is enough for
+ * a code word with the signs, or with linbits after a refill in the middle.
+ * The words come from up to 8 bytes past the end of the Huffman data, which
+ * are within MAD_BUFFER_GUARD as in III_huffdecode().
+ */
+
+/* same as MASK() and MASK1BIT(), with sz up to 63 */
+# define MASK64(cache, sz, bits)  \
+    ((unsigned int) ((cache) >> ((sz) - (bits))) & ((1U << (bits)) - 1))
+# define MASK1BIT64(cache, sz)  \
+    ((unsigned int) ((cache) >> ((sz) - 1)) & 1)
+
+/*
+ * NAME:	III_word()
+ * DESCRIPTION:	read a big-endian 32-bit word at any address
+ */
+static inline
+unsigned int III_word(unsigned char const *byte)
+{
+# if defined(__GNUC__) && defined(__BYTE_ORDER__) &&  \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  unsigned int word;
+
+  /* an unaligned LDR and a REV on Cortex-M */
+
+  memcpy(&word, byte, sizeof(word));
+
+  return __builtin_bswap32(word);
+# else
+  return ((unsigned int) byte[0] << 24) | ((unsigned int) byte[1] << 16) |
+	 ((unsigned int) byte[2] <<  8) |  (unsigned int) byte[3];
+# endif
+}
+
+# define REFILL64(cache, sz, byte, left)  \
+    ((cache)  = ((cache) << 32) | III_word(byte),  \
+     (byte)  += 4,  \
+     (sz)    += 32,  \
+     (left)  -= 32)
+
+# define REQCACHE(requantized, value)  \
+    do {  \
+      if (reqhits & (1 << (value)))  \
+	(requantized) = reqcache[value];  \
+      else {  \
+	reqhits |= (1 << (value));  \
+	(requantized) = reqcache[value] = III_requantize(value, exp);  \
+      }  \
+    } while (0)
+
+# define QUADVALUE(code, i, requantized)  \
+    (MAD_HUFF_QUAD(code, i) == 0 ? 0 :  \
+     MAD_HUFF_QUAD(code, i) == 1 ? (requantized) : -(requantized))
+
+/*
+ * NAME:	III_huffdecode_lookup()
+ * DESCRIPTION:	decode Huffman code words of one channel of one granule,
+ *		whole code words at a time
+ */
+static
+enum mad_error III_huffdecode_lookup(struct mad_bitptr *ptr,
+				     mad_fixed_t xr[576],
+				     struct channel *channel,
+				     unsigned char const *sfbwidth,
+				     unsigned int part2_length)
+{
+  signed int exponents[39], exp;
+  signed int const *expptr;
+  struct mad_bitptr peek;
+  unsigned char const *byte;
+  signed int bits_left, cachesz;
+  register mad_fixed_t *xrptr;
+  mad_fixed_t const *sfbound;
+  register unsigned long long bitcache;
+
+  bits_left = (signed) channel->part2_3_length - (signed) part2_length;
+  if (bits_left < 0)
+    return MAD_ERROR_BADPART3LEN;
+
+  III_exponents(channel, sfbwidth, exponents);
+
+  peek = *ptr;
+  mad_bit_skip(ptr, bits_left);
+
+  /* the bits up to the byte boundary, then whole words */
+
+  cachesz    = mad_bit_bitsleft(&peek);
+  bitcache   = mad_bit_read(&peek, cachesz);
+  bits_left -= cachesz;
+
+  byte = mad_bit_nextbyte(&peek);
+
+  xrptr = &xr[0];
+
+  /* big_values */
+  {
+    unsigned int region, rcount;
+    struct hufftable const *entry;
+    union huffpair const *table;
+    unsigned short const *lookup;
+    unsigned int linbits, startbits, big_values, reqhits;
+    mad_fixed_t reqcache[16];
+
+    sfbound = xrptr + *sfbwidth++;
+    rcount  = channel->region0_count + 1;
+
+    entry     = &mad_huff_pair_table[channel->table_select[region = 0]];
+    table     = entry->table;
+    lookup    = mad_huff_pair_lookup[channel->table_select[region]];
+    linbits   = entry->linbits;
+    startbits = entry->startbits;
+
+    if (table == 0)
+      return MAD_ERROR_BADHUFFTABLE;
+
+    expptr  = &exponents[0];
+    exp     = *expptr++;
+    reqhits = 0;
+
+    big_values = channel->big_values;
+
+    while (big_values-- && cachesz + bits_left > 0) {
+      unsigned int code, x, y;
+      register mad_fixed_t requantized;
+
+      if (xrptr == sfbound) {
+	sfbound += *sfbwidth++;
+
+	/* change table if region boundary */
+
+	if (--rcount == 0) {
+	  if (region == 0)
+	    rcount = channel->region1_count + 1;
+	  else
+	    rcount = 0;  /* all remaining */
+
+	  entry     = &mad_huff_pair_table[channel->table_select[++region]];
+	  table     = entry->table;
+	  lookup    = mad_huff_pair_lookup[channel->table_select[region]];
+	  linbits   = entry->linbits;
+	  startbits = entry->startbits;
+
+	  if (table == 0)
+	    return MAD_ERROR_BADHUFFTABLE;
+	}
+
+	if (exp != *expptr) {
+	  exp = *expptr;
+	  reqhits = 0;
+	}
+
+	++expptr;
+      }
+
+      if (cachesz < 32)
+	REFILL64(bitcache, cachesz, byte, bits_left);
+
+      code = lookup[MASK64(bitcache, cachesz, MAD_HUFF_LOOKUP_BITS)];
+
+      if (code & MAD_HUFF_SIGNS) {
+	/* the whole pair in a single step */
+
+	cachesz -= code & MAD_HUFF_LENGTH;
+
+	x = (code >> MAD_HUFF_XSHIFT) & 0xf;
+	y = (code >> MAD_HUFF_YSHIFT) & 0xf;
+
+	if (x == 0)
+	  xrptr[0] = 0;
+	else {
+	  REQCACHE(requantized, x);
+	  xrptr[0] = (code & MAD_HUFF_XNEG) ? -requantized : requantized;
+	}
+
+	if (y == 0)
+	  xrptr[1] = 0;
+	else {
+	  REQCACHE(requantized, y);
+	  xrptr[1] = (code & MAD_HUFF_YNEG) ? -requantized : requantized;
+	}
+
+	xrptr += 2;
+	continue;
+      }
+
+      /* hcod (0..19) */
+
+      if (code) {
+	cachesz -= code & MAD_HUFF_LENGTH;
+
+	x = (code >> MAD_HUFF_XSHIFT) & 0xf;
+	y = (code >> MAD_HUFF_YSHIFT) & 0xf;
+      }
+      else {
+	union huffpair const *pair;
+	unsigned int clumpsz;
+
+	clumpsz = startbits;
+	pair    = &table[MASK64(bitcache, cachesz, clumpsz)];
+
+	while (!pair->final) {
+	  cachesz -= clumpsz;
+
+	  clumpsz = pair->ptr.bits;
+	  pair    = &table[pair->ptr.offset +
+			   MASK64(bitcache, cachesz, clumpsz)];
+	}
+
+	cachesz -= pair->value.hlen;
+
+	x = pair->value.x;
+	y = pair->value.y;
+      }
+
+      /* x (0..15, then linbits) */
+
+      if (x == 0)
+	xrptr[0] = 0;
+      else {
+	if (x == 15 && linbits) {
+	  if (cachesz < linbits + 2) {
+	    if (cachesz + bits_left <= 0)
+	      return MAD_ERROR_BADHUFFDATA;  /* big_values overrun */
+
+	    REFILL64(bitcache, cachesz, byte, bits_left);
+	  }
+
+	  x += MASK64(bitcache, cachesz, linbits);
+	  cachesz -= linbits;
+
+	  requantized = III_requantize(x, exp);
+	}
+	else
+	  REQCACHE(requantized, x);
+
+	xrptr[0] = MASK1BIT64(bitcache, cachesz--) ?
+	  -requantized : requantized;
+      }
+
+      /* y (0..15, then linbits) */
+
+      if (y == 0)
+	xrptr[1] = 0;
+      else {
+	if (y == 15 && linbits) {
+	  if (cachesz < linbits + 1) {
+	    if (cachesz + bits_left <= 0)
+	      return MAD_ERROR_BADHUFFDATA;  /* big_values overrun */
+
+	    REFILL64(bitcache, cachesz, byte, bits_left);
+	  }
+
+	  y += MASK64(bitcache, cachesz, linbits);
+	  cachesz -= linbits;
+
+	  requantized = III_requantize(y, exp);
+	}
+	else
+	  REQCACHE(requantized, y);
+
+	xrptr[1] = MASK1BIT64(bitcache, cachesz--) ?
+	  -requantized : requantized;
+      }
+
+      xrptr += 2;
+    }
+  }
+
+  if (cachesz + bits_left < 0)
+    return MAD_ERROR_BADHUFFDATA;  /* big_values overrun */
+
+  /* count1 */
+  {
+    union huffquad const *table;
+    unsigned short const *lookup;
+    register mad_fixed_t requantized;
+
+    table  = mad_huff_quad_table[channel->flags & count1table_select];
+    lookup = mad_huff_quad_lookup[channel->flags & count1table_select];
+
+    requantized = III_requantize(1, exp);
+
+    while (cachesz + bits_left > 0 && xrptr <= &xr[572]) {
+      unsigned int code;
+
+      if (cachesz < 32)
+	REFILL64(bitcache, cachesz, byte, bits_left);
+
+      code = lookup[MASK64(bitcache, cachesz, MAD_HUFF_LOOKUP_BITS)];
+
+      if (code)
+	cachesz -= code & MAD_HUFF_LENGTH;
+      else {
+	/* hcod (6) and 3 or 4 signs: make the same entry */
+
+	union huffquad const *quad;
+
+	quad = &table[MASK64(bitcache, cachesz, 4)];
+
+	if (!quad->final) {
+	  cachesz -= 4;
+
+	  quad = &table[quad->ptr.offset +
+			MASK64(bitcache, cachesz, quad->ptr.bits)];
+	}
+
+	cachesz -= quad->value.hlen;
+
+	if (quad->value.v)
+	  code |= (1 | MASK1BIT64(bitcache, cachesz--) << 1) << 10;
+	if (quad->value.w)
+	  code |= (1 | MASK1BIT64(bitcache, cachesz--) << 1) <<  8;
+	if (quad->value.x)
+	  code |= (1 | MASK1BIT64(bitcache, cachesz--) << 1) <<  6;
+	if (quad->value.y)
+	  code |= (1 | MASK1BIT64(bitcache, cachesz--) << 1) <<  4;
+      }
+
+      if (xrptr == sfbound) {
+	sfbound += *sfbwidth++;
+
+	if (exp != *expptr) {
+	  exp = *expptr;
+	  requantized = III_requantize(1, exp);
+	}
+
+	++expptr;
+      }
+
+      /* v, w (0..1) */
+
+      xrptr[0] = QUADVALUE(code, 0, requantized);
+      xrptr[1] = QUADVALUE(code, 1, requantized);
+
+      xrptr += 2;
+
+      if (xrptr == sfbound) {
+	sfbound += *sfbwidth++;
+
+	if (exp != *expptr) {
+	  exp = *expptr;
+	  requantized = III_requantize(1, exp);
+	}
+
+	++expptr;
+      }
+
+      /* x, y (0..1) */
+
+      xrptr[0] = QUADVALUE(code, 2, requantized);
+      xrptr[1] = QUADVALUE(code, 3, requantized);
+
+      xrptr += 2;
+    }
+
+    if (cachesz + bits_left < 0) {
+      /* stuffing bits sloppiness, as in III_huffdecode() */
+
+      xrptr -= 4;
+    }
+  }
+
+  assert(-bits_left <= MAD_BUFFER_GUARD * CHAR_BIT);
+
+  /* rzero */
+  while (xrptr < &xr[576]) {
+    xrptr[0] = 0;
+    xrptr[1] = 0;
+
+    xrptr += 2;
+  }
+
+  return MAD_ERROR_NONE;
+}
+
+# undef MASK64
+# undef MASK1BIT64
+# undef REFILL64
+# undef REQCACHE
+# undef QUADVALUE
+# endif  /* OPT_HUFF_LOOKUP */
+
 /*
  * NAME:	III_reorder()
  * DESCRIPTION:	reorder frequency lines of a short block into subband order
  */
 static
-void III_reorder(mad_fixed_t xr[576], struct channel const *channel,
+void III_reorder(mad_fixed_t xr[576], unsigned int flags,
 		 unsigned char const sfbwidth[39])
 {
   mad_fixed_t tmp[32][3][6];
@@ -1287,7 +1710,7 @@ void III_reorder(mad_fixed_t xr[576], struct channel const *channel,
   /* this is probably wrong for 8000 Hz mixed blocks */
 
   sb = 0;
-  if (channel->flags & mixed_block_flag) {
+  if (flags & mixed_block_flag) {
     sb = 2;
 
     l = 0;
@@ -1573,25 +1996,35 @@ void III_aliasreduce(mad_fixed_t xr[576], int lines)
 }
 
 # if defined(ASO_IMDCT)
+/* the FPMs without MAD_F_MLX() (FPM_FLOAT, FPM_DEFAULT, FPM_64BIT) accumulate
+   scaled products in a single word instead of 64-bit sums */
+#  if !defined(MAD_F_MLX) || MAD_F_FRACBITS != 28
+#   error "ASO_IMDCT needs 28 fractional bits and 64-bit accumulators"
+#  endif
+#  if defined(__arm__)
 void III_imdct_l(mad_fixed_t const [18], mad_fixed_t [36], unsigned int);
+#  endif
 # else
+#  define III_imdct_l_reference  III_imdct_l
+# endif
+
 #  if 1
+/* y[] is written at the even indexes only: sdctII() passes &X[1] for the odd ones */
 static
-void fastsdct(mad_fixed_t const x[9], mad_fixed_t y[18])
+void fastsdct(mad_fixed_t const x[9], mad_fixed_t y[17])
 {
   mad_fixed_t a0,  a1,  a2,  a3,  a4,  a5,  a6,  a7,  a8,  a9,  a10, a11, a12;
   mad_fixed_t a13, a14, a15, a16, a17, a18, a19, a20, a21, a22, a23, a24, a25;
   mad_fixed_t m0,  m1,  m2,  m3,  m4,  m5,  m6,  m7;
 
-  enum {
+  mad_fixed_t const
     c0 =  MAD_F(0x1f838b8d),  /* 2 * cos( 1 * PI / 18) */
     c1 =  MAD_F(0x1bb67ae8),  /* 2 * cos( 3 * PI / 18) */
     c2 =  MAD_F(0x18836fa3),  /* 2 * cos( 4 * PI / 18) */
     c3 =  MAD_F(0x1491b752),  /* 2 * cos( 5 * PI / 18) */
     c4 =  MAD_F(0x0af1d43a),  /* 2 * cos( 7 * PI / 18) */
     c5 =  MAD_F(0x058e86a0),  /* 2 * cos( 8 * PI / 18) */
-    c6 = -MAD_F(0x1e11f642)   /* 2 * cos(16 * PI / 18) */
-  };
+    c6 = -MAD_F(0x1e11f642);  /* 2 * cos(16 * PI / 18) */
 
   a0 = x[3] + x[5];
   a1 = x[3] - x[5];
@@ -2055,12 +2488,12 @@ void imdct36(mad_fixed_t const X[18], mad_fixed_t x[36])
 #  endif
 
 /*
- * NAME:	III_imdct_l()
+ * NAME:	III_imdct_l_reference()
  * DESCRIPTION:	perform IMDCT and windowing for long blocks
  */
 static
-void III_imdct_l(mad_fixed_t const X[18], mad_fixed_t z[36],
-		 unsigned int block_type)
+void III_imdct_l_reference(mad_fixed_t const X[18], mad_fixed_t z[36],
+			   unsigned int block_type)
 {
   unsigned int i;
 
@@ -2139,7 +2572,257 @@ void III_imdct_l(mad_fixed_t const X[18], mad_fixed_t z[36],
     break;
   }
 }
-# endif  /* ASO_IMDCT */
+
+# if defined(ASO_IMDCT) && !defined(__arm__)
+#  define K00  MAD_F(0x0ffc19fd)
+#  define K01  MAD_F(0x00b2aa3e)
+#  define K02  MAD_F(0x0fdcf549)
+#  define K03  MAD_F(0x0216a2a2)
+#  define K04  MAD_F(0x0f9ee890)
+#  define K05  MAD_F(0x03768962)
+#  define K06  MAD_F(0x0f426cb5)
+#  define K07  MAD_F(0x04cfb0e2)
+#  define K08  MAD_F(0x0ec835e8)
+#  define K09  MAD_F(0x061f78aa)
+#  define K10  MAD_F(0x0e313245)
+#  define K11  MAD_F(0x07635284)
+#  define K12  MAD_F(0x0d7e8807)
+#  define K13  MAD_F(0x0898c779)
+#  define K14  MAD_F(0x0cb19346)
+#  define K15  MAD_F(0x09bd7ca0)
+#  define K16  MAD_F(0x0bcbe352)
+#  define K17  MAD_F(0x0acf37ad)
+
+/*
+ * NAME:	III_imdct_l()
+ * DESCRIPTION:	C model of imdct_l_arm.S, for the builds which can't use it
+ *		(such as the host one): the same 64-bit sums are rounded once,
+ *		and the windowing uses the same symmetries of the IMDCT output,
+ *		so that the results are the same
+ */
+static
+void III_imdct_l(mad_fixed_t const X[18], mad_fixed_t x[36],
+		 unsigned int block_type)
+{
+  /* imdct36_long_karray: the coefficients of the inputs in kinput */
+  static mad_fixed_t const karray[12][12] = {
+    {  K17, -K13,  K10, -K06, -K05,  K01, -K00,  K04, -K07,  K11,  K12, -K16 },
+    {  K13,  K07,  K16,  K01,  K10, -K05,  K04, -K11,  K00, -K17,  K06, -K12 },
+    {  K11,  K17,  K05,  K12, -K01,  K06, -K07,  K00, -K13,  K04, -K16,  K10 },
+    {  K07,  K00, -K12,  K05, -K16, -K10,  K11, -K17,  K04,  K13,  K01,  K06 },
+    {  K05,  K10, -K00, -K17,  K07, -K13,  K12,  K06, -K16,  K01, -K11, -K04 },
+    {  K01,  K05, -K07, -K11,  K13,  K17, -K16, -K12,  K10,  K06, -K04, -K00 },
+    { -K16,  K12, -K11,  K07,  K04, -K00, -K01,  K05, -K06,  K10,  K13, -K17 },
+    { -K12,  K06,  K17, -K00, -K11,  K04,  K05, -K10,  K01,  K16, -K07, -K13 },
+    { -K10,  K16,  K04, -K13, -K00,  K07,  K06, -K01, -K12, -K05,  K17,  K11 },
+    { -K06, -K01,  K13,  K04,  K17, -K11, -K10, -K16, -K05,  K12,  K00,  K07 },
+    { -K04, -K11, -K01,  K16,  K06,  K12,  K13, -K07, -K17, -K00, -K10, -K05 },
+    { -K00, -K04, -K06, -K10, -K12, -K16, -K17, -K13, -K11, -K07, -K05, -K01 }
+  };
+  static unsigned char const kinput[12] = {
+    0, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17
+  };
+  /* the partial sum each row starts from (see ct below), and its output */
+  static unsigned char const kindex[12][2] = {
+    { 0,  0 }, { 4,  2 }, { 4,  3 }, { 0,  5 }, { 3,  6 }, { 2,  8 },
+    { 5, 18 }, { 1, 20 }, { 2, 21 }, { 3, 23 }, { 0, 24 }, { 4, 26 }
+  };
+  mad_fixed64hi_t hi, ct00hi, ct01hi, ct04hi, ct06hi, cthi[6];
+  mad_fixed64lo_t lo, ct00lo, ct01lo, ct04lo, ct06lo, ctlo[6];
+  mad_fixed_t t0, ct14, ct15, ct16, ct17;
+  unsigned int i, j;
+
+  /* the sums of X[1], X[4], X[7], X[10], X[13] and X[16] */
+
+  MAD_F_MLX(ct01hi, ct01lo, X[4],   K08);
+  MAD_F_MLA(ct01hi, ct01lo, X[13],  K09);
+
+  MAD_F_MLX(ct00hi, ct00lo, X[4],   K09);
+  MAD_F_MLA(ct00hi, ct00lo, X[13], -K08);
+
+  t0 = X[7] + X[16];
+
+  ct06hi = ct01hi;
+  ct06lo = ct01lo;
+  MAD_F_MLA(ct06hi, ct06lo, t0,    -K08);
+  MAD_F_MLA(ct06hi, ct06lo, X[1],  -K09);
+  MAD_F_MLA(ct06hi, ct06lo, X[10],  K09);
+
+  ct04hi = ct00hi;
+  ct04lo = ct00lo;
+  MAD_F_MLN(ct04hi, ct04lo);
+  MAD_F_MLA(ct04hi, ct04lo, X[1],  -K08);
+  MAD_F_MLA(ct04hi, ct04lo, t0,     K09);
+  MAD_F_MLA(ct04hi, ct04lo, X[10],  K08);
+
+  /* x[4], x[22], x[7], x[1], x[25] and x[19] */
+
+  ct14 = X[0] - X[11] - X[12];
+  ct16 = X[8] - X[3]  + X[15];
+  ct15 = X[2] - X[9]  - X[14];
+  ct17 = X[5] - X[6]  - X[17];
+
+  hi = ct06hi;
+  lo = ct06lo;
+  MAD_F_MLA(hi, lo, ct14 + ct16, -K08);
+  MAD_F_MLA(hi, lo, ct15 + ct17,  K09);
+  x[22] = MAD_F_MLZ(hi, lo);
+
+  hi = ct04hi;
+  lo = ct04lo;
+  MAD_F_MLA(hi, lo, ct14 + ct16,  K09);
+  MAD_F_MLA(hi, lo, ct15 + ct17,  K08);
+  x[4]  = MAD_F_MLZ(hi, lo);
+
+  hi = ct06hi;
+  lo = ct06lo;
+  MAD_F_MLA(hi, lo, ct14,  K03);
+  MAD_F_MLA(hi, lo, ct15,  K15);
+  MAD_F_MLA(hi, lo, ct16,  K14);
+  MAD_F_MLA(hi, lo, ct17, -K02);
+  x[7]  = MAD_F_MLZ(hi, lo);
+
+  hi = ct04hi;
+  lo = ct04lo;
+  MAD_F_MLA(hi, lo, ct14,  K15);
+  MAD_F_MLA(hi, lo, ct15, -K03);
+  MAD_F_MLA(hi, lo, ct17, -K14);
+  MAD_F_MLA(hi, lo, ct16, -K02);
+  x[1]  = MAD_F_MLZ(hi, lo);
+
+  hi = ct04hi;
+  lo = ct04lo;
+  MAD_F_MLA(hi, lo, ct15, -K14);
+  MAD_F_MLA(hi, lo, ct17, -K03);
+  MAD_F_MLA(hi, lo, ct16,  K15);
+  MAD_F_MLA(hi, lo, ct14, -K02);
+  x[25] = MAD_F_MLZ(hi, lo);
+
+  hi = ct06hi;
+  lo = ct06lo;
+  MAD_F_MLN(hi, lo);
+  MAD_F_MLA(hi, lo, ct14, -K14);
+  MAD_F_MLA(hi, lo, ct16, -K03);
+  MAD_F_MLA(hi, lo, ct17, -K15);
+  MAD_F_MLA(hi, lo, ct15,  K02);
+  x[19] = MAD_F_MLZ(hi, lo);
+
+  /* ct02, ct07, -ct07, -ct05, ct03 and ct05 */
+
+  cthi[4] = ct01hi;
+  ctlo[4] = ct01lo;
+  MAD_F_MLN(cthi[4], ctlo[4]);
+  cthi[5] = cthi[4];
+  ctlo[5] = ctlo[4];
+
+  MAD_F_MLA(cthi[5], ctlo[5], X[16], -K14);
+  MAD_F_MLA(cthi[5], ctlo[5], X[7],  -K03);
+  MAD_F_MLA(cthi[5], ctlo[5], X[10],  K02);
+  MAD_F_MLA(cthi[5], ctlo[5], X[1],   K15);
+
+  MAD_F_MLA(cthi[4], ctlo[4], X[10], -K15);
+  MAD_F_MLA(cthi[4], ctlo[4], X[16], -K03);
+  MAD_F_MLA(cthi[4], ctlo[4], X[7],  -K14);
+  MAD_F_MLA(cthi[4], ctlo[4], X[1],  -K02);
+
+  cthi[3] = cthi[5];
+  ctlo[3] = ctlo[5];
+  MAD_F_MLN(cthi[3], ctlo[3]);
+
+  cthi[0] = ct00hi;
+  ctlo[0] = ct00lo;
+  MAD_F_MLA(cthi[0], ctlo[0], X[10],  K03);
+  MAD_F_MLA(cthi[0], ctlo[0], X[1],  -K14);
+  MAD_F_MLA(cthi[0], ctlo[0], X[7],   K02);
+  MAD_F_MLA(cthi[0], ctlo[0], X[16], -K15);
+
+  cthi[1] = ct00hi;
+  ctlo[1] = ct00lo;
+  MAD_F_MLN(cthi[1], ctlo[1]);
+  MAD_F_MLA(cthi[1], ctlo[1], X[1],   K03);
+  MAD_F_MLA(cthi[1], ctlo[1], X[10], -K14);
+  MAD_F_MLA(cthi[1], ctlo[1], X[16], -K02);
+  MAD_F_MLA(cthi[1], ctlo[1], X[7],   K15);
+
+  cthi[2] = cthi[1];
+  ctlo[2] = ctlo[1];
+  MAD_F_MLN(cthi[2], ctlo[2]);
+
+  /* the other outputs of x[0..8] and x[18..26] */
+
+  for (i = 0; i < 12; ++i) {
+    hi = cthi[kindex[i][0]];
+    lo = ctlo[kindex[i][0]];
+    for (j = 0; j < 12; ++j)
+      MAD_F_MLA(hi, lo, X[kinput[j]], karray[i][j]);
+    x[kindex[i][1]] = MAD_F_MLZ(hi, lo);
+  }
+
+  /* windowing, with x[9..17] = -x[8..0] and x[27..35] = x[26..18] */
+
+  if (block_type == 3) {  /* stop block */
+    for (i = 12; i < 18; ++i) x[i] = -x[17 - i];
+    for (i =  9; i < 12; ++i) x[i] = mad_f_mul(-x[17 - i], window_s[i - 6]);
+    for (i =  6; i <  9; ++i) x[i] = mad_f_mul(x[i], window_s[i - 6]);
+    for (i =  0; i <  6; ++i) x[i] = 0;
+  }
+  else {
+    for (i =  9; i < 18; ++i) x[i] = mad_f_mul(-x[17 - i], window_l[i]);
+    for (i =  0; i <  9; ++i) x[i] = mad_f_mul(x[i], window_l[i]);
+  }
+
+  if (block_type == 1) {  /* start block */
+    for (i = 27; i < 30; ++i) x[i] = mad_f_mul(x[53 - i], window_s[i - 18]);
+    for (i = 24; i < 27; ++i) x[i] = mad_f_mul(x[i], window_s[i - 18]);
+    for (i = 30; i < 36; ++i) x[i] = 0;
+  }
+  else {
+    for (i = 27; i < 36; ++i) x[i] = mad_f_mul(x[53 - i], window_l[i]);
+    for (i = 18; i < 27; ++i) x[i] = mad_f_mul(x[i], window_l[i]);
+  }
+}
+
+#  undef K00
+#  undef K01
+#  undef K02
+#  undef K03
+#  undef K04
+#  undef K05
+#  undef K06
+#  undef K07
+#  undef K08
+#  undef K09
+#  undef K10
+#  undef K11
+#  undef K12
+#  undef K13
+#  undef K14
+#  undef K15
+#  undef K16
+#  undef K17
+# endif
+
+/*
+ * NAME:	layer->III_imdct_l()
+ * DESCRIPTION:	perform IMDCT and windowing for long blocks (exported for
+ *		benchmarking)
+ */
+void mad_layer_III_imdct_l(mad_fixed_t const X[18], mad_fixed_t z[36],
+			   unsigned int block_type)
+{
+  III_imdct_l(X, z, block_type);
+}
+
+/*
+ * NAME:	layer->III_imdct_l_reference()
+ * DESCRIPTION:	perform IMDCT and windowing for long blocks with the C version
+ *		(exported for benchmarking)
+ */
+void mad_layer_III_imdct_l_reference(mad_fixed_t const X[18], mad_fixed_t z[36],
+				     unsigned int block_type)
+{
+  III_imdct_l_reference(X, z, block_type);
+}
 
 /*
  * NAME:	III_imdct_s()
@@ -2344,7 +3027,9 @@ void III_freqinver(mad_fixed_t sample[18][32], unsigned int sb)
 
 /*
  * NAME:	III_decode()
- * DESCRIPTION:	decode frame main_data
+ * DESCRIPTION:	decode frame main_data into the spectra of the granules, which
+ *		are left to III_filter() (frame->granules tells how many have
+ *		been decoded, also on errors)
  */
 static
 enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
@@ -2375,8 +3060,9 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
 
   for (gr = 0; gr < ngr; ++gr) {
     struct granule *granule = &si->gr[gr];
-    unsigned char const *sfbwidth[2];
-    mad_fixed_t xr[2][576];
+    struct mad_granule *output = &frame->granule[gr];
+    unsigned char const **sfbwidth = output->sfbwidth;
+    mad_fixed_t (*xr)[576] = output->xr;
     unsigned int ch;
     enum mad_error error;
 
@@ -2400,9 +3086,18 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
             gr == 0 ? 0 : si->scfsi[ch]);
       }
 
+# if defined(OPT_HUFF_LOOKUP)
+      if (!(frame->options & MAD_OPTION_HUFFREFERENCE))
+	error = III_huffdecode_lookup(ptr, xr[ch], channel, sfbwidth[ch],
+				      part2_length);
+      else
+# endif
       error = III_huffdecode(ptr, xr[ch], channel, sfbwidth[ch], part2_length);
       if (error)
         return error;
+
+      output->block_type[ch] = channel->block_type;
+      output->flags[ch]      = channel->flags;
     }
 
     /* joint stereo processing */
@@ -2413,105 +3108,140 @@ enum mad_error III_decode(struct mad_bitptr *ptr, struct mad_frame *frame,
         return error;
     }
 
-    /* reordering, alias reduction, IMDCT, overlap-add, frequency inversion */
+    frame->granules = gr + 1;
+  }
 
-    for (ch = 0; ch < nch; ++ch) {
-      struct channel const *channel = &granule->ch[ch];
-      mad_fixed_t (*sample)[32] = &frame->sbsample[ch][18 * gr];
-      unsigned int sb, l, i, sblimit;
-      mad_fixed_t output[36];
+  return MAD_ERROR_NONE;
+}
 
-      if (channel->block_type == 2) {
-        III_reorder(xr[ch], channel, sfbwidth[ch]);
+/*
+ * NAME:	III_filter()
+ * DESCRIPTION:	turn the spectrum of a decoded granule into subband samples
+ */
+static
+void III_filter(struct mad_frame *frame, unsigned int gr)
+{
+  struct mad_granule *granule = &frame->granule[gr];
+  unsigned int nch, ch;
+
+  nch = MAD_NCHANNELS(&frame->header);
+
+  /* reordering, alias reduction, IMDCT, overlap-add, frequency inversion */
+
+  for (ch = 0; ch < nch; ++ch) {
+    mad_fixed_t *xr = granule->xr[ch];
+    unsigned int block_type = granule->block_type[ch];
+    unsigned int flags = granule->flags[ch];
+    mad_fixed_t (*sample)[32] = &frame->sbsample[ch][18 * gr];
+    unsigned int sb, l, i, sblimit;
+    mad_fixed_t output[36];
+
+    if (block_type == 2) {
+      III_reorder(xr, flags, granule->sfbwidth[ch]);
 
 # if !defined(OPT_STRICT)
-        /*
-         * According to ISO/IEC 11172-3, "Alias reduction is not applied for
-         * granules with block_type == 2 (short block)." However, other
-         * sources suggest alias reduction should indeed be performed on the
-         * lower two subbands of mixed blocks. Most other implementations do
-         * this, so by default we will too.
-         */
-        if (channel->flags & mixed_block_flag)
-          III_aliasreduce(xr[ch], 36);
+      /*
+       * According to ISO/IEC 11172-3, "Alias reduction is not applied for
+       * granules with block_type == 2 (short block)." However, other
+       * sources suggest alias reduction should indeed be performed on the
+       * lower two subbands of mixed blocks. Most other implementations do
+       * this, so by default we will too.
+       */
+      if (flags & mixed_block_flag)
+        III_aliasreduce(xr, 36);
 # endif
-      }
-      else
-        III_aliasreduce(xr[ch], 576);
+    }
+    else
+      III_aliasreduce(xr, 576);
 
-      l = 0;
+    l = 0;
 
-      /* subbands 0-1 */
+    /* subbands 0-1 */
 
-      if (channel->block_type != 2 || (channel->flags & mixed_block_flag)) {
-        unsigned int block_type;
+    if (block_type != 2 || (flags & mixed_block_flag)) {
+      unsigned int long_block_type;
 
-        block_type = channel->block_type;
-        if (channel->flags & mixed_block_flag)
-          block_type = 0;
+      long_block_type = block_type;
+      if (flags & mixed_block_flag)
+        long_block_type = 0;
 
-        /* long blocks */
-        for (sb = 0; sb < 2; ++sb, l += 18) {
-          III_imdct_l(&xr[ch][l], output, block_type);
-          III_overlap(output, frame->overlap[ch][sb], sample, sb);
-        }
+      /* long blocks */
+      for (sb = 0; sb < 2; ++sb, l += 18) {
+        III_imdct_l(&xr[l], output, long_block_type);
+        III_overlap(output, frame->overlap[ch][sb], sample, sb);
       }
-      else {
-        /* short blocks */
-        for (sb = 0; sb < 2; ++sb, l += 18) {
-          III_imdct_s(&xr[ch][l], output);
-          III_overlap(output, frame->overlap[ch][sb], sample, sb);
-        }
+    }
+    else {
+      /* short blocks */
+      for (sb = 0; sb < 2; ++sb, l += 18) {
+        III_imdct_s(&xr[l], output);
+        III_overlap(output, frame->overlap[ch][sb], sample, sb);
       }
+    }
 
-      III_freqinver(sample, 1);
+    III_freqinver(sample, 1);
 
-      /* (nonzero) subbands 2-31 */
+    /* (nonzero) subbands 2-31 */
 
-      i = 576;
-      while (i > 36 && xr[ch][i - 1] == 0)
-        --i;
+    i = 576;
+    while (i > 36 && xr[i - 1] == 0)
+      --i;
 
-      sblimit = 32 - (576 - i) / 18;
+    sblimit = 32 - (576 - i) / 18;
 
-      if (channel->block_type != 2) {
-        /* long blocks */
-        for (sb = 2; sb < sblimit; ++sb, l += 18) {
-          III_imdct_l(&xr[ch][l], output, channel->block_type);
-          III_overlap(output, frame->overlap[ch][sb], sample, sb);
+    /* the subbands above a reduced output rate are not synthesized */
 
-          if (sb & 1)
-            III_freqinver(sample, sb);
-        }
-      }
-      else {
-        /* short blocks */
-        for (sb = 2; sb < sblimit; ++sb, l += 18) {
-          III_imdct_s(&xr[ch][l], output);
-          III_overlap(output, frame->overlap[ch][sb], sample, sb);
-
-          if (sb & 1)
-            III_freqinver(sample, sb);
-        }
-      }
+    if ((frame->options & MAD_OPTION_QUARTERSAMPLERATE) && sblimit > 8)
+      sblimit = 8;
+    else if ((frame->options & MAD_OPTION_HALFSAMPLERATE) && sblimit > 16)
+      sblimit = 16;
 
-      /* remaining (zero) subbands */
+    if (block_type != 2) {
+      /* long blocks */
+      for (sb = 2; sb < sblimit; ++sb, l += 18) {
+        III_imdct_l(&xr[l], output, block_type);
+        III_overlap(output, frame->overlap[ch][sb], sample, sb);
 
-      for (sb = sblimit; sb < 32; ++sb) {
-        III_overlap_z(frame->overlap[ch][sb], sample, sb);
+        if (sb & 1)
+          III_freqinver(sample, sb);
+      }
+    }
+    else {
+      /* short blocks */
+      for (sb = 2; sb < sblimit; ++sb, l += 18) {
+        III_imdct_s(&xr[l], output);
+        III_overlap(output, frame->overlap[ch][sb], sample, sb);
 
         if (sb & 1)
           III_freqinver(sample, sb);
       }
     }
+
+    /* remaining (zero) subbands */
+
+    for (sb = sblimit; sb < 32; ++sb) {
+      III_overlap_z(frame->overlap[ch][sb], sample, sb);
+
+      if (sb & 1)
+        III_freqinver(sample, sb);
+    }
   }
+}
 
-  return MAD_ERROR_NONE;
+/*
+ * NAME:	layer->III_granule()
+ * DESCRIPTION:	filter one of the granules decoded by mad_layer_III() into
+ *		subband samples
+ */
+void mad_layer_III_granule(struct mad_frame *frame, unsigned int gr)
+{
+  III_filter(frame, gr);
 }
 
 /*
  * NAME:	layer->III()
- * DESCRIPTION:	decode a single Layer III frame
+ * DESCRIPTION:	decode a single Layer III frame, leaving its granules to be
+ *		filtered by mad_layer_III_granule()
  */
 int mad_layer_III(struct mad_stream *stream, struct mad_frame *frame)
 {
@@ -2629,6 +3359,13 @@ int mad_layer_III(struct mad_stream *stream, struct mad_frame *frame)
   if (result == 0) {
     error = III_decode(&ptr, frame, &si, nch);
     if (error) {
+      unsigned int gr;
+
+      /* the granules before the error are filtered anyway */
+      for (gr = 0; gr < frame->granules; ++gr)
+        III_filter(frame, gr);
+      frame->granules = 0;
+
       stream->error = error;
       result = -1;
     }
@@ -26,5 +26,10 @@
 # include "frame.h"
 
 int mad_layer_III(struct mad_stream *, struct mad_frame *);
+void mad_layer_III_granule(struct mad_frame *, unsigned int);
+void mad_layer_III_imdct_l(mad_fixed_t const [18], mad_fixed_t [36],
+			   unsigned int);
+void mad_layer_III_imdct_l_reference(mad_fixed_t const [18], mad_fixed_t [36],
+				     unsigned int);
 
 # endif
@@ -26,10 +26,15 @@
 # include "global.h"
 
 # include <stdlib.h>
+# include <string.h>
 
 # include "bit.h"
 # include "stream.h"
 
+/* nonzero if any byte of the (unsigned long) word is 0xff */
+# define HAS_FF_BYTE(word)  \
+    ((~(word) - (~0UL / 0xff)) & (word) & ((~0UL / 0xff) << 7))
+
 /*
  * NAME:	stream->init()
  * DESCRIPTION:	initialize stream struct
@@ -95,18 +100,34 @@ void mad_stream_skip(struct mad_stream *stream, unsigned long length)
 
 /*
  * NAME:	stream->sync()
- * DESCRIPTION:	locate the next stream sync word
+ * DESCRIPTION:	locate the next stream sync word (skipping the data a word at
+ *		a time while it holds no 0xff byte)
  */
 int mad_stream_sync(struct mad_stream *stream)
 {
   register unsigned char const *ptr, *end;
+  unsigned long word;
 
   ptr = mad_bit_nextbyte(&stream->ptr);
   end = stream->bufend;
 
-  while (ptr < end - 1 &&
-	 !(ptr[0] == 0xff && (ptr[1] & 0xe0) == 0xe0))
+  while (ptr < end - 1) {
+    /* aligned words without any 0xff byte can't hold the start of a sync word */
+    if ((unsigned long) ptr % sizeof(word) == 0) {
+      while (ptr + sizeof(word) <= end - 1) {
+	memcpy(&word, ptr, sizeof(word));
+	if (HAS_FF_BYTE(word))
+	  break;
+	ptr += sizeof(word);
+      }
+      if (ptr >= end - 1)
+	break;
+    }
+
+    if (ptr[0] == 0xff && (ptr[1] & 0xe0) == 0xe0)
+      break;
     ++ptr;
+  }
 
   if (end - ptr < MAD_BUFFER_GUARD)
     return -1;
@@ -546,6 +546,7 @@ mad_fixed_t const D[17][32] = {
 # include "D.dat"
 };
 
+# if !defined(OPT_PCM16_ONLY)
 # if defined(ASO_SYNTH)
 void synth_full(struct mad_synth *, struct mad_frame const *,
 		unsigned int, unsigned int);
@@ -855,3 +856,701 @@ void mad_synth_frame(struct mad_synth *synth, struct mad_frame const *frame)
 
   synth->phase = (synth->phase + ns) % 16;
 }
+# endif  /* OPT_PCM16_ONLY */
+
+/*
+ * NAME:	pcm16_dither()
+ * DESCRIPTION:	return the dither to be added to a sample, with 13 bits below
+ *		the LSB of the 16-bit output (0 if disabled)
+ */
+static inline
+signed int pcm16_dither(struct mad_pcm16 *pcm)
+{
+  if (!(pcm->options & MAD_PCM16_DITHER))
+    return 0;
+
+  /* triangular dither in (-1, +1) LSB, then rounding to the nearest */
+
+  pcm->seed = pcm->seed * 1664525 + 1013904223;
+
+  return (signed int) (pcm->seed >> 19) -
+         (signed int) ((pcm->seed >> 6) & 0x1fff) + (1 << 12);
+}
+
+/*
+ * NAME:	pcm16_clip()
+ * DESCRIPTION:	clip an integer sample to 16 bits
+ */
+static inline
+signed short pcm16_clip(signed int sample)
+{
+  /* (a single SSAT on ARM) */
+
+  if (sample > 32767)
+    return 32767;
+  if (sample < -32768)
+    return -32768;
+
+  return sample;
+}
+
+/*
+ * NAME:	pcm16()
+ * DESCRIPTION:	clip and scale a sample to 16 bits, optionally with dither
+ */
+static inline
+signed short pcm16(mad_fixed_t sample, struct mad_pcm16 *pcm)
+{
+# if defined(FPM_FLOAT)
+  /* the offset makes the conversion round towards minus infinity */
+
+  float scaled = sample * 32768.0f + 32768.0f +
+                 pcm16_dither(pcm) * (1.0f / 8192);
+
+  if (scaled >= 65536.0f)
+    return 32767;
+  if (scaled < 0.0f)
+    return -32768;
+
+  return (signed int) scaled - 32768;
+# else
+  /* shifting before clipping gives the same results */
+
+  return pcm16_clip((sample + pcm16_dither(pcm)) >>
+		    (MAD_F_FRACBITS + 1 - 16));
+# endif
+}
+
+/*
+ * NAME:	pcm16_unbounce()
+ * DESCRIPTION:	move a slot of samples from the bounce buffer to the ring
+ */
+static
+void pcm16_unbounce(struct mad_pcm16 *pcm, unsigned int index,
+		    signed short const bounce[32 * 2], unsigned int count,
+		    unsigned int ch, unsigned int nch)
+{
+  unsigned int i;
+
+  for (i = 0; i < count; ++i) {
+    pcm->buffer[2 * index + ch] = bounce[2 * i + ch];
+    if (nch == 1)
+      pcm->buffer[2 * index + 1] = bounce[2 * i];
+
+    if (++index == pcm->size)
+      index = 0;
+  }
+}
+
+/*
+ * NAME:	synth->slot16()
+ * DESCRIPTION:	calculate the 32 samples of a slot (reference filterbank)
+ */
+static inline
+void synth_slot16(mad_fixed_t (*fe)[8], mad_fixed_t (*fx)[8],
+		  mad_fixed_t (*fo)[8], unsigned int pe, unsigned int po,
+		  signed short *pcm1, struct mad_pcm16 *pcm)
+{
+  signed short *pcm2;
+  unsigned int sb;
+  register mad_fixed_t const (*Dptr)[32], *ptr;
+  register mad_fixed64hi_t hi;
+  register mad_fixed64lo_t lo;
+
+  Dptr = &D[0];
+
+  ptr = *Dptr + po;
+  ML0(hi, lo, (*fx)[0], ptr[ 0]);
+  MLA(hi, lo, (*fx)[1], ptr[14]);
+  MLA(hi, lo, (*fx)[2], ptr[12]);
+  MLA(hi, lo, (*fx)[3], ptr[10]);
+  MLA(hi, lo, (*fx)[4], ptr[ 8]);
+  MLA(hi, lo, (*fx)[5], ptr[ 6]);
+  MLA(hi, lo, (*fx)[6], ptr[ 4]);
+  MLA(hi, lo, (*fx)[7], ptr[ 2]);
+  MLN(hi, lo);
+
+  ptr = *Dptr + pe;
+  MLA(hi, lo, (*fe)[0], ptr[ 0]);
+  MLA(hi, lo, (*fe)[1], ptr[14]);
+  MLA(hi, lo, (*fe)[2], ptr[12]);
+  MLA(hi, lo, (*fe)[3], ptr[10]);
+  MLA(hi, lo, (*fe)[4], ptr[ 8]);
+  MLA(hi, lo, (*fe)[5], ptr[ 6]);
+  MLA(hi, lo, (*fe)[6], ptr[ 4]);
+  MLA(hi, lo, (*fe)[7], ptr[ 2]);
+
+  *pcm1 = pcm16(SHIFT(MLZ(hi, lo)), pcm);
+  pcm1 += 2;
+
+  pcm2 = pcm1 + 2 * 30;
+
+  for (sb = 1; sb < 16; ++sb) {
+    ++fe;
+    ++Dptr;
+
+    /* D[32 - sb][i] == -D[sb][31 - i] */
+
+    ptr = *Dptr + po;
+    ML0(hi, lo, (*fo)[0], ptr[ 0]);
+    MLA(hi, lo, (*fo)[1], ptr[14]);
+    MLA(hi, lo, (*fo)[2], ptr[12]);
+    MLA(hi, lo, (*fo)[3], ptr[10]);
+    MLA(hi, lo, (*fo)[4], ptr[ 8]);
+    MLA(hi, lo, (*fo)[5], ptr[ 6]);
+    MLA(hi, lo, (*fo)[6], ptr[ 4]);
+    MLA(hi, lo, (*fo)[7], ptr[ 2]);
+    MLN(hi, lo);
+
+    ptr = *Dptr + pe;
+    MLA(hi, lo, (*fe)[7], ptr[ 2]);
+    MLA(hi, lo, (*fe)[6], ptr[ 4]);
+    MLA(hi, lo, (*fe)[5], ptr[ 6]);
+    MLA(hi, lo, (*fe)[4], ptr[ 8]);
+    MLA(hi, lo, (*fe)[3], ptr[10]);
+    MLA(hi, lo, (*fe)[2], ptr[12]);
+    MLA(hi, lo, (*fe)[1], ptr[14]);
+    MLA(hi, lo, (*fe)[0], ptr[ 0]);
+
+    *pcm1 = pcm16(SHIFT(MLZ(hi, lo)), pcm);
+    pcm1 += 2;
+
+    ptr = *Dptr - pe;
+    ML0(hi, lo, (*fe)[0], ptr[31 - 16]);
+    MLA(hi, lo, (*fe)[1], ptr[31 - 14]);
+    MLA(hi, lo, (*fe)[2], ptr[31 - 12]);
+    MLA(hi, lo, (*fe)[3], ptr[31 - 10]);
+    MLA(hi, lo, (*fe)[4], ptr[31 -  8]);
+    MLA(hi, lo, (*fe)[5], ptr[31 -  6]);
+    MLA(hi, lo, (*fe)[6], ptr[31 -  4]);
+    MLA(hi, lo, (*fe)[7], ptr[31 -  2]);
+
+    ptr = *Dptr - po;
+    MLA(hi, lo, (*fo)[7], ptr[31 -  2]);
+    MLA(hi, lo, (*fo)[6], ptr[31 -  4]);
+    MLA(hi, lo, (*fo)[5], ptr[31 -  6]);
+    MLA(hi, lo, (*fo)[4], ptr[31 -  8]);
+    MLA(hi, lo, (*fo)[3], ptr[31 - 10]);
+    MLA(hi, lo, (*fo)[2], ptr[31 - 12]);
+    MLA(hi, lo, (*fo)[1], ptr[31 - 14]);
+    MLA(hi, lo, (*fo)[0], ptr[31 - 16]);
+
+    *pcm2 = pcm16(SHIFT(MLZ(hi, lo)), pcm);
+    pcm2 -= 2;
+
+    ++fo;
+  }
+
+  ++Dptr;
+
+  ptr = *Dptr + po;
+  ML0(hi, lo, (*fo)[0], ptr[ 0]);
+  MLA(hi, lo, (*fo)[1], ptr[14]);
+  MLA(hi, lo, (*fo)[2], ptr[12]);
+  MLA(hi, lo, (*fo)[3], ptr[10]);
+  MLA(hi, lo, (*fo)[4], ptr[ 8]);
+  MLA(hi, lo, (*fo)[5], ptr[ 6]);
+  MLA(hi, lo, (*fo)[6], ptr[ 4]);
+  MLA(hi, lo, (*fo)[7], ptr[ 2]);
+
+  *pcm1 = pcm16(SHIFT(-MLZ(hi, lo)), pcm);
+}
+
+/*
+ * The optimized filterbanks below share the loads between the samples sb and
+ * 32 - sb of a slot, which use the same filter values: each value is loaded
+ * once for two multiply-accumulates, into two accumulators. They are selected
+ * with OPT_SYNTH_BLOCKED (32-bit coefficients of D[], the same results as the
+ * reference) or OPT_SYNTH_D16 (16-bit coefficients packed in pairs, for the
+ * dual 32x16 multiply-accumulates of the ARMv7E-M DSP extension).
+ */
+
+# if defined(OPT_SYNTH_BLOCKED)
+/*
+ * NAME:	synth->slot16_blocked()
+ * DESCRIPTION:	calculate the 32 samples of a slot, two at a time
+ */
+static inline
+void synth_slot16_blocked(mad_fixed_t (*fe)[8], mad_fixed_t (*fx)[8],
+			  mad_fixed_t (*fo)[8], unsigned int pe,
+			  unsigned int po, signed short *pcm1,
+			  struct mad_pcm16 *pcm)
+{
+  signed short *pcm2;
+  unsigned int sb;
+  register mad_fixed_t const (*Dptr)[32], *ptr1, *ptr2;
+  register mad_fixed_t x;
+  register mad_fixed64hi_t hi1, hi2;
+  register mad_fixed64lo_t lo1, lo2;
+
+  /* D[32 - sb][i] == -D[sb][31 - i]: the sample 32 - sb uses D[sb] too */
+
+#  define ML2(op, f, k, o1, o2)  \
+    x = (*f)[k];  \
+    op(hi1, lo1, x, ptr1[o1]);  \
+    op(hi2, lo2, x, ptr2[o2])
+
+  Dptr = &D[0];
+
+  ptr1 = *Dptr + po;
+  ML0(hi1, lo1, (*fx)[0], ptr1[ 0]);
+  MLA(hi1, lo1, (*fx)[1], ptr1[14]);
+  MLA(hi1, lo1, (*fx)[2], ptr1[12]);
+  MLA(hi1, lo1, (*fx)[3], ptr1[10]);
+  MLA(hi1, lo1, (*fx)[4], ptr1[ 8]);
+  MLA(hi1, lo1, (*fx)[5], ptr1[ 6]);
+  MLA(hi1, lo1, (*fx)[6], ptr1[ 4]);
+  MLA(hi1, lo1, (*fx)[7], ptr1[ 2]);
+  MLN(hi1, lo1);
+
+  ptr1 = *Dptr + pe;
+  MLA(hi1, lo1, (*fe)[0], ptr1[ 0]);
+  MLA(hi1, lo1, (*fe)[1], ptr1[14]);
+  MLA(hi1, lo1, (*fe)[2], ptr1[12]);
+  MLA(hi1, lo1, (*fe)[3], ptr1[10]);
+  MLA(hi1, lo1, (*fe)[4], ptr1[ 8]);
+  MLA(hi1, lo1, (*fe)[5], ptr1[ 6]);
+  MLA(hi1, lo1, (*fe)[6], ptr1[ 4]);
+  MLA(hi1, lo1, (*fe)[7], ptr1[ 2]);
+
+  *pcm1 = pcm16(SHIFT(MLZ(hi1, lo1)), pcm);
+  pcm1 += 2;
+
+  pcm2 = pcm1 + 2 * 30;
+
+  for (sb = 1; sb < 16; ++sb) {
+    ++fe;
+    ++Dptr;
+
+    ptr1 = *Dptr + po;
+    ptr2 = *Dptr + 15 - po;
+    ML2(ML0, fo, 0,  0,  0);
+    ML2(MLA, fo, 1, 14,  2);
+    ML2(MLA, fo, 2, 12,  4);
+    ML2(MLA, fo, 3, 10,  6);
+    ML2(MLA, fo, 4,  8,  8);
+    ML2(MLA, fo, 5,  6, 10);
+    ML2(MLA, fo, 6,  4, 12);
+    ML2(MLA, fo, 7,  2, 14);
+    MLN(hi1, lo1);
+
+    ptr1 = *Dptr + pe;
+    ptr2 = *Dptr + 15 - pe;
+    ML2(MLA, fe, 0,  0,  0);
+    ML2(MLA, fe, 1, 14,  2);
+    ML2(MLA, fe, 2, 12,  4);
+    ML2(MLA, fe, 3, 10,  6);
+    ML2(MLA, fe, 4,  8,  8);
+    ML2(MLA, fe, 5,  6, 10);
+    ML2(MLA, fe, 6,  4, 12);
+    ML2(MLA, fe, 7,  2, 14);
+
+    *pcm1 = pcm16(SHIFT(MLZ(hi1, lo1)), pcm);
+    pcm1 += 2;
+
+    *pcm2 = pcm16(SHIFT(MLZ(hi2, lo2)), pcm);
+    pcm2 -= 2;
+
+    ++fo;
+  }
+
+#  undef ML2
+
+  ++Dptr;
+
+  ptr1 = *Dptr + po;
+  ML0(hi1, lo1, (*fo)[0], ptr1[ 0]);
+  MLA(hi1, lo1, (*fo)[1], ptr1[14]);
+  MLA(hi1, lo1, (*fo)[2], ptr1[12]);
+  MLA(hi1, lo1, (*fo)[3], ptr1[10]);
+  MLA(hi1, lo1, (*fo)[4], ptr1[ 8]);
+  MLA(hi1, lo1, (*fo)[5], ptr1[ 6]);
+  MLA(hi1, lo1, (*fo)[6], ptr1[ 4]);
+  MLA(hi1, lo1, (*fo)[7], ptr1[ 2]);
+
+  *pcm1 = pcm16(SHIFT(-MLZ(hi1, lo1)), pcm);
+}
+# endif  /* OPT_SYNTH_BLOCKED */
+
+# if defined(OPT_SYNTH_D16)
+#  if defined(FPM_FLOAT) || defined(OPT_SSO)
+#   error "OPT_SYNTH_D16 needs the filter values with 28 fractional bits"
+#  endif
+
+/*
+ * The coefficients are rounded to 14 fractional bits (the largest one is
+ * 1.14), and the sums keep 26: they only wrap if the output is 30 dB over
+ * full scale, where it would be clipped anyway. The loss of accuracy is
+ * below the 16-bit output's LSB most of the time.
+ */
+
+#  define PAIR(lo, hi)  \
+    ((unsigned int) ((lo) & 0xffff) | ((unsigned int) (hi) << 16))
+
+static
+unsigned int const D16[17][16][8] = {
+#  include "D16.dat"
+};
+
+#  undef PAIR
+
+/* acc += x * the low or the high half of w, >> 16 */
+
+#  if defined(__thumb2__) && defined(__ARM_FEATURE_DSP)
+#   define MLW_B(acc, x, w)  \
+    asm ("smlawb	%0, %1, %2, %0"  \
+	 : "+r" (acc)  \
+	 : "r" (x), "r" (w))
+#   define MLW_T(acc, x, w)  \
+    asm ("smlawt	%0, %1, %2, %0"  \
+	 : "+r" (acc)  \
+	 : "r" (x), "r" (w))
+#  else
+#   define MLW_B(acc, x, w)  \
+    ((acc) += (mad_fixed_t)  \
+	      (((signed long long) (x) * (signed short) (w)) >> 16))
+#   define MLW_T(acc, x, w)  \
+    ((acc) += (mad_fixed_t)  \
+	      (((signed long long) (x) * (signed short) ((w) >> 16)) >> 16))
+#  endif
+
+/*
+ * NAME:	pcm16_d16()
+ * DESCRIPTION:	clip and scale a sum with 26 fractional bits to 16 bits
+ */
+static inline
+signed short pcm16_d16(mad_fixed_t sample, struct mad_pcm16 *pcm)
+{
+  return pcm16_clip((sample + (pcm16_dither(pcm) >> 2)) >> (26 + 1 - 16));
+}
+
+/*
+ * NAME:	synth->slot16_d16()
+ * DESCRIPTION:	calculate the 32 samples of a slot with 16-bit coefficients
+ */
+static inline
+void synth_slot16_d16(mad_fixed_t (*fe)[8], mad_fixed_t (*fx)[8],
+		      mad_fixed_t (*fo)[8], unsigned int pe, unsigned int po,
+		      signed short *pcm1, struct mad_pcm16 *pcm)
+{
+  signed short *pcm2;
+  unsigned int sb;
+  register unsigned int const (*Dptr)[16][8], *ptr;
+  register mad_fixed_t x, acc1, acc2;
+
+#  define MLW1(f, k)  \
+    MLW_B(acc1, (*f)[k], ptr[k])
+
+#  define MLW2(f, k)  \
+    x = (*f)[k];  \
+    MLW_B(acc1, x, ptr[k]);  \
+    MLW_T(acc2, x, ptr[k])
+
+  Dptr = &D16[0];
+
+  acc1 = 0;
+
+  ptr = (*Dptr)[po];
+  MLW1(fx, 0); MLW1(fx, 1); MLW1(fx, 2); MLW1(fx, 3);
+  MLW1(fx, 4); MLW1(fx, 5); MLW1(fx, 6); MLW1(fx, 7);
+  acc1 = -acc1;
+
+  ptr = (*Dptr)[pe];
+  MLW1(fe, 0); MLW1(fe, 1); MLW1(fe, 2); MLW1(fe, 3);
+  MLW1(fe, 4); MLW1(fe, 5); MLW1(fe, 6); MLW1(fe, 7);
+
+  *pcm1 = pcm16_d16(acc1, pcm);
+  pcm1 += 2;
+
+  pcm2 = pcm1 + 2 * 30;
+
+  for (sb = 1; sb < 16; ++sb) {
+    ++fe;
+    ++Dptr;
+
+    acc1 = acc2 = 0;
+
+    ptr = (*Dptr)[po];
+    MLW2(fo, 0); MLW2(fo, 1); MLW2(fo, 2); MLW2(fo, 3);
+    MLW2(fo, 4); MLW2(fo, 5); MLW2(fo, 6); MLW2(fo, 7);
+    acc1 = -acc1;
+
+    ptr = (*Dptr)[pe];
+    MLW2(fe, 0); MLW2(fe, 1); MLW2(fe, 2); MLW2(fe, 3);
+    MLW2(fe, 4); MLW2(fe, 5); MLW2(fe, 6); MLW2(fe, 7);
+
+    *pcm1 = pcm16_d16(acc1, pcm);
+    pcm1 += 2;
+
+    *pcm2 = pcm16_d16(acc2, pcm);
+    pcm2 -= 2;
+
+    ++fo;
+  }
+
+  ++Dptr;
+
+  acc1 = 0;
+
+  ptr = (*Dptr)[po];
+  MLW1(fo, 0); MLW1(fo, 1); MLW1(fo, 2); MLW1(fo, 3);
+  MLW1(fo, 4); MLW1(fo, 5); MLW1(fo, 6); MLW1(fo, 7);
+
+  *pcm1 = pcm16_d16(-acc1, pcm);
+
+#  undef MLW1
+#  undef MLW2
+}
+# endif  /* OPT_SYNTH_D16 */
+
+/*
+ * NAME:	synth->slot16_decimated()
+ * DESCRIPTION:	calculate one sample out of 1 << shift of a slot, whose
+ *		subbands from 32 >> shift onwards are zero (the same samples
+ *		as the reference filterbank, two at a time)
+ */
+static
+void synth_slot16_decimated(mad_fixed_t (*fe)[8], mad_fixed_t (*fx)[8],
+			    mad_fixed_t (*fo)[8], unsigned int pe,
+			    unsigned int po, signed short *pcm1,
+			    struct mad_pcm16 *pcm, unsigned int shift)
+{
+  signed short *pcm2;
+  unsigned int sb, step;
+  mad_fixed_t (*fs)[8], (*fp)[8];
+  register mad_fixed_t const (*Dptr)[32], *ptr1, *ptr2;
+  register mad_fixed_t x;
+  register mad_fixed64hi_t hi1, hi2;
+  register mad_fixed64lo_t lo1, lo2;
+
+# define ML2(op, f, k, o1, o2)  \
+    x = (*f)[k];  \
+    op(hi1, lo1, x, ptr1[o1]);  \
+    op(hi2, lo2, x, ptr2[o2])
+
+  step = 1 << shift;
+  Dptr = &D[0];
+
+  ptr1 = *Dptr + po;
+  ML0(hi1, lo1, (*fx)[0], ptr1[ 0]);
+  MLA(hi1, lo1, (*fx)[1], ptr1[14]);
+  MLA(hi1, lo1, (*fx)[2], ptr1[12]);
+  MLA(hi1, lo1, (*fx)[3], ptr1[10]);
+  MLA(hi1, lo1, (*fx)[4], ptr1[ 8]);
+  MLA(hi1, lo1, (*fx)[5], ptr1[ 6]);
+  MLA(hi1, lo1, (*fx)[6], ptr1[ 4]);
+  MLA(hi1, lo1, (*fx)[7], ptr1[ 2]);
+  MLN(hi1, lo1);
+
+  ptr1 = *Dptr + pe;
+  MLA(hi1, lo1, (*fe)[0], ptr1[ 0]);
+  MLA(hi1, lo1, (*fe)[1], ptr1[14]);
+  MLA(hi1, lo1, (*fe)[2], ptr1[12]);
+  MLA(hi1, lo1, (*fe)[3], ptr1[10]);
+  MLA(hi1, lo1, (*fe)[4], ptr1[ 8]);
+  MLA(hi1, lo1, (*fe)[5], ptr1[ 6]);
+  MLA(hi1, lo1, (*fe)[6], ptr1[ 4]);
+  MLA(hi1, lo1, (*fe)[7], ptr1[ 2]);
+
+  *pcm1 = pcm16(SHIFT(MLZ(hi1, lo1)), pcm);
+  pcm1 += 2;
+
+  /* the samples sb and 32 - sb, for sb multiple of step */
+
+  pcm2 = pcm1 + 2 * ((32 >> shift) - 2);
+
+  for (sb = step; sb < 16; sb += step) {
+    fs   = fe + sb;
+    fp   = fo + sb - 1;
+    Dptr = &D[sb];
+
+    ptr1 = *Dptr + po;
+    ptr2 = *Dptr + 15 - po;
+    ML2(ML0, fp, 0,  0,  0);
+    ML2(MLA, fp, 1, 14,  2);
+    ML2(MLA, fp, 2, 12,  4);
+    ML2(MLA, fp, 3, 10,  6);
+    ML2(MLA, fp, 4,  8,  8);
+    ML2(MLA, fp, 5,  6, 10);
+    ML2(MLA, fp, 6,  4, 12);
+    ML2(MLA, fp, 7,  2, 14);
+    MLN(hi1, lo1);
+
+    ptr1 = *Dptr + pe;
+    ptr2 = *Dptr + 15 - pe;
+    ML2(MLA, fs, 0,  0,  0);
+    ML2(MLA, fs, 1, 14,  2);
+    ML2(MLA, fs, 2, 12,  4);
+    ML2(MLA, fs, 3, 10,  6);
+    ML2(MLA, fs, 4,  8,  8);
+    ML2(MLA, fs, 5,  6, 10);
+    ML2(MLA, fs, 6,  4, 12);
+    ML2(MLA, fs, 7,  2, 14);
+
+    *pcm1 = pcm16(SHIFT(MLZ(hi1, lo1)), pcm);
+    pcm1 += 2;
+
+    *pcm2 = pcm16(SHIFT(MLZ(hi2, lo2)), pcm);
+    pcm2 -= 2;
+  }
+
+# undef ML2
+
+  /* the sample 16 */
+
+  fp   = fo + 15;
+  Dptr = &D[16];
+
+  ptr1 = *Dptr + po;
+  ML0(hi1, lo1, (*fp)[0], ptr1[ 0]);
+  MLA(hi1, lo1, (*fp)[1], ptr1[14]);
+  MLA(hi1, lo1, (*fp)[2], ptr1[12]);
+  MLA(hi1, lo1, (*fp)[3], ptr1[10]);
+  MLA(hi1, lo1, (*fp)[4], ptr1[ 8]);
+  MLA(hi1, lo1, (*fp)[5], ptr1[ 6]);
+  MLA(hi1, lo1, (*fp)[6], ptr1[ 4]);
+  MLA(hi1, lo1, (*fp)[7], ptr1[ 2]);
+
+  *pcm1 = pcm16(SHIFT(-MLZ(hi1, lo1)), pcm);
+}
+
+# if defined(OPT_SYNTH_D16)
+#  define synth_slot16_opt  synth_slot16_d16
+# elif defined(OPT_SYNTH_BLOCKED)
+#  define synth_slot16_opt  synth_slot16_blocked
+# else
+#  define synth_slot16_opt  synth_slot16
+# endif
+
+/*
+ * NAME:	synth->full16()
+ * DESCRIPTION:	perform full frequency PCM synthesis to 16-bit samples, or
+ *		1/2 or 1/4 frequency synthesis with shift 1 or 2 (the
+ *		subbands above the reduced bandwidth are dropped, since
+ *		they would alias)
+ */
+static
+void synth_full16(struct mad_synth *synth, struct mad_frame const *frame,
+		  unsigned int nch, unsigned int s0, unsigned int ns,
+		  unsigned int shift, struct mad_pcm16 *pcm)
+{
+  unsigned int phase, ch, s, sb, pe, po, index, bounced, count;
+  signed short *pcm1, bounce[32 * 2];
+  mad_fixed_t (*filter)[2][2][16][8];
+  mad_fixed_t const (*sbsample)[36][32];
+  mad_fixed_t (*fe)[8], (*fx)[8], (*fo)[8];
+  mad_fixed_t lowpass[32];
+
+  count = 32 >> shift;
+
+  for (sb = count; sb < 32; ++sb)
+    lowpass[sb] = 0;
+
+  for (ch = 0; ch < nch; ++ch) {
+    sbsample = &frame->sbsample[ch];
+    filter   = &synth->filter[ch];
+    phase    = synth->phase;
+    index    = pcm->index;
+
+    for (s = s0; s < s0 + ns; ++s) {
+      /* the slots which cross the end of the ring, or mono, are bounced */
+
+      bounced = (nch == 1 || index + count > pcm->size);
+      pcm1 = bounced ? &bounce[ch] : &pcm->buffer[2 * index + ch];
+
+      if (shift) {
+	for (sb = 0; sb < count; ++sb)
+	  lowpass[sb] = (*sbsample)[s][sb];
+
+	dct32(lowpass, phase >> 1,
+	      (*filter)[0][phase & 1], (*filter)[1][phase & 1]);
+      }
+      else
+	dct32((*sbsample)[s], phase >> 1,
+	      (*filter)[0][phase & 1], (*filter)[1][phase & 1]);
+
+      pe = phase & ~1;
+      po = ((phase - 1) & 0xf) | 1;
+
+      /* calculate 32 >> shift samples */
+
+      fe = &(*filter)[0][ phase & 1][0];
+      fx = &(*filter)[0][~phase & 1][0];
+      fo = &(*filter)[1][~phase & 1][0];
+
+      if (shift)
+	synth_slot16_decimated(fe, fx, fo, pe, po, pcm1, pcm, shift);
+      else if (pcm->options & MAD_PCM16_REFERENCE)
+	synth_slot16(fe, fx, fo, pe, po, pcm1, pcm);
+      else
+	synth_slot16_opt(fe, fx, fo, pe, po, pcm1, pcm);
+
+      if (bounced)
+	pcm16_unbounce(pcm, index, bounce, count, ch, nch);
+
+      index += count;
+      if (index >= pcm->size)
+	index -= pcm->size;
+
+      phase = (phase + 1) % 16;
+    }
+  }
+
+  pcm->index = index;
+}
+
+/*
+ * NAME:	synth->pcm16()
+ * DESCRIPTION:	perform PCM synthesis of ns slots of subband samples, from
+ *		slot s0, to 16-bit samples
+ */
+static
+void synth_pcm16(struct mad_synth *synth, struct mad_frame const *frame,
+		 unsigned int s0, unsigned int ns, struct mad_pcm16 *pcm)
+{
+  unsigned int nch, shift;
+
+  nch = MAD_NCHANNELS(&frame->header);
+
+  shift = 0;
+  if (frame->options & MAD_OPTION_QUARTERSAMPLERATE)
+    shift = 2;
+  else if (frame->options & MAD_OPTION_HALFSAMPLERATE)
+    shift = 1;
+
+  synth->pcm.samplerate = frame->header.samplerate >> shift;
+  synth->pcm.channels   = nch;
+  synth->pcm.length     = (32 * ns) >> shift;
+
+  synth_full16(synth, frame, nch, s0, ns, shift, pcm);
+
+  synth->phase = (synth->phase + ns) % 16;
+}
+
+/*
+ * NAME:	synth->frame_pcm16()
+ * DESCRIPTION:	perform PCM synthesis of frame subband samples straight to
+ *		interleaved 16-bit samples, from pcm->index onwards (the
+ *		ring must have room for them), at 1/2 or 1/4 of the sample
+ *		rate with MAD_OPTION_HALFSAMPLERATE or
+ *		MAD_OPTION_QUARTERSAMPLERATE
+ */
+void mad_synth_frame_pcm16(struct mad_synth *synth,
+			   struct mad_frame const *frame,
+			   struct mad_pcm16 *pcm)
+{
+  synth_pcm16(synth, frame, 0, MAD_NSBSAMPLES(&frame->header), pcm);
+}
+
+/*
+ * NAME:	synth->granule_pcm16()
+ * DESCRIPTION:	same as mad_synth_frame_pcm16(), but only for the subband
+ *		samples of a Layer III granule (18 slots), once it has been
+ *		filtered by mad_frame_decode_granule()
+ */
+void mad_synth_granule_pcm16(struct mad_synth *synth,
+			     struct mad_frame const *frame, unsigned int gr,
+			     struct mad_pcm16 *pcm)
+{
+  synth_pcm16(synth, frame, 18 * gr, 18, pcm);
+}
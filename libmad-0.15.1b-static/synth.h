@@ -29,7 +29,27 @@ struct mad_pcm {
   unsigned int samplerate;		/* sampling frequency (Hz) */
   unsigned short channels;		/* number of channels */
   unsigned short length;		/* number of samples per channel */
+# if !defined(OPT_PCM16_ONLY)
   mad_fixed_t samples[2][1152];		/* PCM output samples [ch][sample] */
+# endif
+};
+
+/*
+ * 16-bit PCM output of mad_synth_frame_pcm16(): stereo samples interleaved
+ * into a ring buffer, mono ones duplicated. With OPT_PCM16_ONLY it is the
+ * only output, and struct mad_pcm loses its samples.
+ */
+struct mad_pcm16 {
+  signed short *buffer;			/* ring buffer [sample][ch] */
+  unsigned short size;			/* ring size (samples) */
+  unsigned short index;			/* where the next sample goes */
+  int options;				/* MAD_PCM16_* */
+  unsigned int seed;			/* dither generator state */
+};
+
+enum {
+  MAD_PCM16_DITHER    = 0x0001,	/* add triangular dither of 1 LSB */
+  MAD_PCM16_REFERENCE = 0x0002		/* use the reference filterbank */
 };
 
 struct mad_synth {
@@ -64,6 +84,12 @@ void mad_synth_init(struct mad_synth *);
 
 void mad_synth_mute(struct mad_synth *);
 
+# if !defined(OPT_PCM16_ONLY)
 void mad_synth_frame(struct mad_synth *, struct mad_frame const *);
+# endif
+void mad_synth_frame_pcm16(struct mad_synth *, struct mad_frame const *,
+			   struct mad_pcm16 *);
+void mad_synth_granule_pcm16(struct mad_synth *, struct mad_frame const *,
+			     unsigned int, struct mad_pcm16 *);
 
 # endif
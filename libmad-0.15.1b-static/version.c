@@ -42,12 +42,16 @@ char const mad_build[] = ""
   "EXPERIMENTAL "
 # endif
 
-# if defined(FPM_64BIT)
+# if defined(FPM_FLOAT)
+  "FPM_FLOAT "
+# elif defined(FPM_64BIT)
   "FPM_64BIT "
 # elif defined(FPM_INTEL)
   "FPM_INTEL "
 # elif defined(FPM_ARM)
   "FPM_ARM "
+# elif defined(FPM_CORTEXM4)
+  "FPM_CORTEXM4 "
 # elif defined(FPM_MIPS)
   "FPM_MIPS "
 # elif defined(FPM_SPARC)
@@ -88,4 +92,14 @@ char const mad_build[] = ""
 # if defined(OPT_STRICT)
   "OPT_STRICT "
 # endif
+
+# if defined(OPT_HUFF_LOOKUP)
+  "OPT_HUFF_LOOKUP "
+# endif
+
+# if defined(OPT_SYNTH_D16)
+  "OPT_SYNTH_D16 "
+# elif defined(OPT_SYNTH_BLOCKED)
+  "OPT_SYNTH_BLOCKED "
+# endif
 ;
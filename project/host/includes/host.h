@@ -0,0 +1,63 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "stdint.h"
+#include <stm32f407xx.h>		// through the search path, see stm32f407xx.h here
+
+/*
+ * Options selected on the command line (see main.c)
+ */
+struct HOST_OPTIONS {
+	const char* sd_image;		// FAT formatted image file used as SD card
+	const char* wav_file;		// Sink for the audio sent to the I2S
+	const char* display_file;	// PGM file rewritten at every display refresh
+	uint8_t display_ascii;		// Print the display on stdout at every refresh
+	uint8_t fast;				// Skip the idle periods instead of sleeping
+	uint32_t cpu_factor;		// Slow-down of the simulated CPU (0 = host's speed)
+	uint32_t duration_ms;		// Stop the simulation after this time (0 = never)
+};
+
+extern struct HOST_OPTIONS host_options;
+
+/*
+ * Simulation events: the callback runs in the "interrupt" context, so it usually
+ * updates the peripheral's registers and sets the related IRQ pending
+ */
+struct HOST_TIMER {
+	uint64_t expire_at_us;
+	void (*callback)(void);
+	struct HOST_TIMER* next;
+};
+
+// Simulated MCU (mcu.c)
+void host_mcu_init(void);
+uint64_t host_time_ns(void);
+uint64_t host_time_us(void);
+void host_timer_start(struct HOST_TIMER* timer, uint64_t expire_at_us);
+void host_timer_stop(struct HOST_TIMER* timer);
+void host_wait_until(uint64_t target_us);
+void host_delay_us(uint32_t us);
+void host_exit(int code);
+
+// Peripherals' simulation
+uint8_t host_console_update(uint64_t now_us);
+int32_t host_console_fd(void);
+void host_console_restore(void);
+void host_keypad_press(uint8_t key, uint32_t hold_ms);
+void host_display_update(uint64_t now_us);
+void host_display_print(void);
+void host_display_close(void);
+void host_i2s_init(void);
+void host_i2s_close(void);
+int32_t host_sd_card_open(const char* path);
+void host_Si468x_select(void);
+uint8_t host_Si468x_transfer(uint8_t value);
+void host_Si468x_release(void);
+
+// Shell commands of the host build
+int host_sched_bench(int argc, char *argv[]);
+int host_isr_stress(int argc, char *argv[]);
+int host_key_stats(int argc, char *argv[]);
+int host_ui_load(int argc, char *argv[]);
+
+#endif // _HOST_H_
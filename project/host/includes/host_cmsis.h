@@ -0,0 +1,78 @@
+#ifndef _HOST_CMSIS_H_
+#define _HOST_CMSIS_H_
+
+#include "stdint.h"
+
+/*
+ * Replacement for the CMSIS intrinsics of cmsis_gcc.h, which are ARM inline assembly.
+ * PRIMASK, BASEPRI and WFI are simulated by mcu.c: interrupts requested while they mask
+ * them are served as soon as they are cleared, exactly as the NVIC does. The same
+ * happens after an ISB, which is where a pended PendSV is taken.
+ */
+#define __CMSIS_GCC_H
+
+#define __ASM				__asm
+#define __INLINE			inline
+#define __STATIC_INLINE		static inline
+
+extern volatile uint32_t host_primask;
+extern volatile uint32_t host_basepri;
+void host_irq_service(void);
+void host_wait_for_interrupt(void);
+
+__STATIC_INLINE void __disable_irq(void)
+{
+	host_primask = 1;
+}
+
+__STATIC_INLINE void __enable_irq(void)
+{
+	host_primask = 0;
+	host_irq_service();
+}
+
+__STATIC_INLINE uint32_t __get_BASEPRI(void)
+{
+	return host_basepri;
+}
+
+__STATIC_INLINE void __set_BASEPRI(uint32_t value)
+{
+	host_basepri = value;
+	if (value == 0)
+		host_irq_service();
+}
+
+__STATIC_INLINE void __WFI(void)
+{
+	host_wait_for_interrupt();
+}
+
+__STATIC_INLINE void __DSB(void)	{ __sync_synchronize(); }
+__STATIC_INLINE void __ISB(void)	{ __sync_synchronize(); host_irq_service(); }
+__STATIC_INLINE void __DMB(void)	{ __sync_synchronize(); }
+__STATIC_INLINE void __NOP(void)	{ }
+
+__STATIC_INLINE uint32_t __REV(uint32_t value)
+{
+	return __builtin_bswap32(value);
+}
+
+__STATIC_INLINE uint32_t __RBIT(uint32_t value)
+{
+	uint32_t result = 0;
+	uint8_t bit;
+
+	for (bit=0; bit<32; bit++) {
+		result = (result << 1) | (value & 0x1);
+		value >>= 1;
+	}
+	return result;
+}
+
+__STATIC_INLINE uint8_t __CLZ(uint32_t value)
+{
+	return (value != 0) ? __builtin_clz(value) : 32;
+}
+
+#endif // _HOST_CMSIS_H_
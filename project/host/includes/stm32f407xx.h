@@ -0,0 +1,48 @@
+#ifndef _HOST_STM32F407XX_H_
+#define _HOST_STM32F407XX_H_
+
+/*
+ * Host build: the device header is used as it is, but the CMSIS intrinsics are
+ * replaced by the simulated ones. Peripherals' registers are backed by memory
+ * mapped at their real addresses (see mcu.c).
+ */
+#include "host_cmsis.h"
+
+// The NVIC's set/clear registers are write-1-to-set/clear, while the memory
+// which backs them is plain RAM: CMSIS's accessors are renamed and replaced below
+#define NVIC_EnableIRQ			cmsis_NVIC_EnableIRQ
+#define NVIC_DisableIRQ			cmsis_NVIC_DisableIRQ
+#define NVIC_SetPendingIRQ		cmsis_NVIC_SetPendingIRQ
+#define NVIC_ClearPendingIRQ	cmsis_NVIC_ClearPendingIRQ
+
+#include_next "stm32f407xx.h"
+
+#undef NVIC_EnableIRQ
+#undef NVIC_DisableIRQ
+#undef NVIC_SetPendingIRQ
+#undef NVIC_ClearPendingIRQ
+
+#define HOST_NVIC_INDEX(irqn)	(((uint32_t)(irqn)) >> 5)
+#define HOST_NVIC_MASK(irqn)	(1UL << (((uint32_t)(irqn)) & 0x1F))
+
+__STATIC_INLINE void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+	__sync_fetch_and_or(&NVIC->ISER[HOST_NVIC_INDEX(IRQn)], HOST_NVIC_MASK(IRQn));
+}
+
+__STATIC_INLINE void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+	__sync_fetch_and_and(&NVIC->ISER[HOST_NVIC_INDEX(IRQn)], ~HOST_NVIC_MASK(IRQn));
+}
+
+__STATIC_INLINE void NVIC_SetPendingIRQ(IRQn_Type IRQn)
+{
+	__sync_fetch_and_or(&NVIC->ISPR[HOST_NVIC_INDEX(IRQn)], HOST_NVIC_MASK(IRQn));
+}
+
+__STATIC_INLINE void NVIC_ClearPendingIRQ(IRQn_Type IRQn)
+{
+	__sync_fetch_and_and(&NVIC->ISPR[HOST_NVIC_INDEX(IRQn)], ~HOST_NVIC_MASK(IRQn));
+}
+
+#endif // _HOST_STM32F407XX_H_
@@ -0,0 +1,19 @@
+#include "cycle_counter.h"
+#include "host.h"
+
+/*
+ * Host version: there's no DWT, so the simulated time is converted to the cycles
+ * that the core would count at CYCLE_COUNTER_FREQ. Run times measured on the host
+ * are the host's ones, not the target's.
+ */
+void cycle_counter_init()
+{
+}
+
+/*
+ * Return the current value of the cycle counter
+ */
+uint32_t cycle_counter_get()
+{
+	return (uint32_t)((host_time_ns() * CYCLES_PER_US) / 1000);
+}
@@ -0,0 +1,43 @@
+#include "utils.h"
+#include "host.h"
+#include <stdlib.h>
+
+/*
+ * Host version of what has no simulation: the embedded tuner's images and the reset.
+ * The I2C bus and the codec are simulated by i2c.c, the SPI devices by spi.c and tuner.c.
+ */
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+/*
+ * The tuner's images are always taken from the (simulated) eeprom, as with NO_EXT_FIRMWARES
+ */
+int8_t utils_is_fw_embedded(Tuner_FW_type type)
+{
+	(void)type;
+	return FALSE;
+}
+
+uint8_t* utils_get_embedded_FW_start_address(Tuner_FW_type type)
+{
+	(void)type;
+	return NULL;
+}
+
+uint32_t utils_get_embedded_FW_size(Tuner_FW_type type)
+{
+	(void)type;
+	return 0;
+}
+
+/*
+ * A reset ends the simulation
+ */
+int reset(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	host_exit(EXIT_SUCCESS);
+	return 0;
+}
@@ -0,0 +1,195 @@
+#include "fsmc.h"
+#include "oled.h"
+#include "host.h"
+#include "utils.h"
+#include "string.h"
+#include <stdio.h>
+
+/*
+ * Host version: the OLED's SSD1306 controller is simulated behind the FSMC, so that
+ * the oled driver runs unchanged. Its graphic RAM is dumped, at most once every
+ * DISPLAY_REFRESH_US, as a PGM image and/or as text on stdout.
+ */
+#define DISPLAY_PAGES				(OLED_HEIGTH/OLED_VERTICAL_PAGE_SIZE)
+#define DISPLAY_REFRESH_US			40000UL
+#define DISPLAY_PGM_SCALE			4
+
+// Commands
+#define SET_DISPLAY_OFF				0xAE
+#define SET_DISPLAY_ON				0xAF
+#define SET_NORMAL_DISPLAY			0xA6
+#define SET_INVERSE_DISPLAY			0xA7
+#define SET_PAGE_START_ADDRESS		0xB0
+
+static struct {
+	uint8_t gddram[DISPLAY_PAGES][OLED_WIDTH];
+	uint8_t page;
+	uint8_t column;
+	uint8_t is_on;
+	uint8_t is_inverted;
+	uint8_t pending_arguments;	// bytes still expected by the last command
+	uint8_t is_dirty;
+	uint64_t last_refresh_us;
+} display;
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+static void host_display_command(uint8_t value)
+{
+	if (display.pending_arguments > 0) {
+		// Arguments only affect the analog part of the panel
+		display.pending_arguments--;
+		return;
+	}
+
+	if (value <= 0x0F) {
+		display.column = (display.column & 0xF0) | value;
+	} else if (value <= 0x1F) {
+		display.column = (display.column & 0x0F) | ((value & 0x0F) << 4);
+	} else if ((value & 0xF8) == SET_PAGE_START_ADDRESS) {
+		display.page = value & 0x07;
+	} else {
+		switch (value) {
+			case SET_DISPLAY_OFF:
+			case SET_DISPLAY_ON:
+				display.is_on = (value == SET_DISPLAY_ON);
+				break;
+			case SET_NORMAL_DISPLAY:
+			case SET_INVERSE_DISPLAY:
+				display.is_inverted = (value == SET_INVERSE_DISPLAY);
+				break;
+			case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3:
+			case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+				display.pending_arguments = 1;
+				break;
+			case 0x21: case 0x22:
+				display.pending_arguments = 2;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+static uint8_t host_display_get_pixel(uint8_t x, uint8_t y)
+{
+	uint8_t pixel = (display.gddram[y/OLED_VERTICAL_PAGE_SIZE][x] >> (y%OLED_VERTICAL_PAGE_SIZE)) & 0x1;
+
+	return display.is_on && (pixel ^ display.is_inverted);
+}
+
+/*
+ * Write the PGM image. A temporary file is renamed, so that viewers never load
+ * a partially written image.
+ */
+static void host_display_write_pgm()
+{
+	char tmp_path[256];
+	uint8_t row[OLED_WIDTH*DISPLAY_PGM_SCALE];
+	uint16_t x, y, scale;
+	FILE* file;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", host_options.display_file);
+	file = fopen(tmp_path, "wb");
+	if (file == NULL)
+		return;
+
+	fprintf(file, "P5\n%d %d\n255\n", OLED_WIDTH*DISPLAY_PGM_SCALE, OLED_HEIGTH*DISPLAY_PGM_SCALE);
+	for (y=0; y<OLED_HEIGTH; y++) {
+		for (x=0; x<sizeof(row); x++)
+			row[x] = host_display_get_pixel(x/DISPLAY_PGM_SCALE, y) ? 0xFF : 0x00;
+		for (scale=0; scale<DISPLAY_PGM_SCALE; scale++)
+			fwrite(row, 1, sizeof(row), file);
+	}
+	fclose(file);
+	rename(tmp_path, host_options.display_file);
+}
+
+static void host_display_refresh()
+{
+	if (host_options.display_file != NULL)
+		host_display_write_pgm();
+	if (host_options.display_ascii)
+		host_display_print();
+	display.is_dirty = FALSE;
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+void fsmc_init()
+{
+}
+
+/*
+ * Bus cycles toward the display: D/C selects between commands and graphic RAM
+ */
+void fsmc_host_write(uint8_t dc, uint8_t value)
+{
+	if (dc == FSMC_COMMAND_ADDRESS) {
+		host_display_command(value);
+	} else {
+		display.gddram[display.page][display.column] = value;
+		display.column = (display.column + 1) % OLED_WIDTH;
+	}
+	display.is_dirty = TRUE;
+}
+
+uint8_t fsmc_host_read(uint8_t dc)
+{
+	uint8_t value;
+
+	if (dc == FSMC_COMMAND_ADDRESS)
+		return 0x00;	// status: display on, not busy
+
+	value = display.gddram[display.page][display.column];
+	display.column = (display.column + 1) % OLED_WIDTH;
+	return value;
+}
+
+/*
+ * Called periodically by the simulation
+ */
+void host_display_update(uint64_t now_us)
+{
+	if (!display.is_dirty || ((now_us - display.last_refresh_us) < DISPLAY_REFRESH_US))
+		return;
+	display.last_refresh_us = now_us;
+	host_display_refresh();
+}
+
+/*
+ * Print the display as text (two pixel rows per line)
+ */
+void host_display_print()
+{
+	char line[OLED_WIDTH + 3];
+	uint8_t x, y, top, bottom;
+
+	memset(line, '-', sizeof(line) - 1);
+	line[0] = line[OLED_WIDTH+1] = '+';
+	line[OLED_WIDTH+2] = '\0';
+	puts(line);
+	for (y=0; y<OLED_HEIGTH; y+=2) {
+		line[0] = line[OLED_WIDTH+1] = '|';
+		for (x=0; x<OLED_WIDTH; x++) {
+			top = host_display_get_pixel(x, y);
+			bottom = host_display_get_pixel(x, y+1);
+			line[x+1] = (top && bottom) ? ':' : (top ? '\'' : (bottom ? '.' : ' '));
+		}
+		puts(line);
+	}
+	memset(line, '-', sizeof(line) - 1);
+	line[0] = line[OLED_WIDTH+1] = '+';
+	puts(line);
+}
+
+/*
+ * Flush the last changes
+ */
+void host_display_close()
+{
+	if (display.is_dirty)
+		host_display_refresh();
+}
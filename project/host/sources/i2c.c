@@ -0,0 +1,133 @@
+#include "i2c.h"
+#include "host.h"
+#include "utils.h"
+#include "debug_printf.h"
+
+#define debug_msg(format, ...)		debug_printf("[i2c] " format, ##__VA_ARGS__)
+
+/*
+ * Host version: the I2C1 bus and the SGTL5000 codec, simulated as a set of 16 bit
+ * registers with their reset values. A transfer takes the time it takes at 100kHz
+ * (9 clocks per byte, address included, plus the start and the stop conditions), so
+ * that the codec's configuration costs what it costs on the target.
+ */
+#define I2C_BYTE_TIME_US			90		// 9 bits at 100kHz
+#define I2C_START_STOP_TIME_US		10
+
+#define SGTL5000_I2C_ADDRESS		0x0A
+#define SGTL5000_REGISTERS			0x40	// addresses from 0x0000 to 0x003E, the DAP isn't simulated
+
+static const struct {
+	uint16_t address;
+	uint16_t value;
+} sgtl5000_reset_values[] = {
+	{ 0x0000, 0xA011 },		// CHIP_ID
+	{ 0x0004, 0x0008 },		// CHIP_CLK_CTRL
+	{ 0x0006, 0x0010 },		// CHIP_I2S_CTRL
+	{ 0x000A, 0x0010 },		// CHIP_SSS_CTRL
+	{ 0x000E, 0x020C },		// CHIP_ADCDAC_CTRL
+	{ 0x0010, 0x3C3C },		// CHIP_DAC_VOL
+	{ 0x0014, 0x015F },		// CHIP_PAD_STRENGTH
+	{ 0x0022, 0x1818 },		// CHIP_ANA_HP_CTRL
+	{ 0x0024, 0x0111 },		// CHIP_ANA_CTRL
+	{ 0x002E, 0x0404 },		// CHIP_LINE_OUT_VOL
+	{ 0x0030, 0x7060 },		// CHIP_ANA_POWER
+	{ 0x0032, 0x5000 },		// CHIP_PLL_CTRL
+	{ 0x0038, 0x01C0 },		// CHIP_ANA_TEST1
+};
+
+static struct {
+	uint16_t registers[SGTL5000_REGISTERS / 2];
+	uint16_t address;			// auto-incremented by each register accessed
+} sgtl5000;
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+static uint16_t* host_sgtl5000_register()
+{
+	static uint16_t unused;
+
+	if (sgtl5000.address >= SGTL5000_REGISTERS) {
+		unused = 0;
+		return &unused;
+	}
+	return &sgtl5000.registers[sgtl5000.address / 2];
+}
+
+/*
+ * Duration of a transfer of "length" bytes besides the address
+ */
+static void host_i2c_transfer_time(uint8_t length)
+{
+	host_delay_us((2 * I2C_START_STOP_TIME_US) + ((1 + length) * I2C_BYTE_TIME_US));
+}
+
+/*
+ * The address isn't acknowledged by anyone else
+ */
+static int32_t host_i2c_check_address(uint8_t addr)
+{
+	if (addr == SGTL5000_I2C_ADDRESS)
+		return 0;
+	host_i2c_transfer_time(0);
+	debug_msg("ACK bit not received for address 0x%x\n", addr);
+	return -1;
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+int32_t i2c_init()
+{
+	uint8_t index;
+
+	for (index=0; index<array_size(sgtl5000_reset_values); index++)
+		sgtl5000.registers[sgtl5000_reset_values[index].address / 2] = sgtl5000_reset_values[index].value;
+	return 0;
+}
+
+/*
+ * The codec takes the register's address first, followed by the values to write
+ */
+int32_t i2c_write_buffer(uint8_t addr, uint8_t* data, uint8_t length)
+{
+	uint8_t index;
+
+	if (host_i2c_check_address(addr) != 0)
+		return -1;
+	if (length >= 2)
+		sgtl5000.address = (((uint16_t)data[0] << 8) | data[1]) & ~1U;
+	for (index=2; index+1<length; index+=2) {
+		*host_sgtl5000_register() = ((uint16_t)data[index] << 8) | data[index + 1];
+		sgtl5000.address += 2;
+	}
+	host_i2c_transfer_time(length);
+	return 0;
+}
+
+int32_t i2c_read_buffer(uint8_t addr, uint8_t* data, uint8_t length)
+{
+	uint8_t index;
+
+	if (host_i2c_check_address(addr) != 0)
+		return -1;
+	for (index=0; index<length; index+=2) {
+		data[index] = *host_sgtl5000_register() >> 8;
+		if (index + 1 < length)
+			data[index + 1] = *host_sgtl5000_register() & 0xFF;
+		sgtl5000.address += 2;
+	}
+	host_i2c_transfer_time(length);
+	return 0;
+}
+
+int32_t i2c_write_byte(uint8_t addr, uint8_t data)
+{
+	return i2c_write_buffer(addr, &data, 1);
+}
+
+int32_t i2c_read_byte(uint8_t addr, uint8_t* data)
+{
+	return i2c_read_buffer(addr, data, 1);
+}
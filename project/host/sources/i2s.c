@@ -0,0 +1,189 @@
+#include "output_i2s.h"
+#include "clock_configuration.h"
+#include "host.h"
+#include "utils.h"
+#include "debug_printf.h"
+#include <stdio.h>
+#include <unistd.h>
+
+#define debug_msg(format, ...)		debug_printf("[i2s] " format, ##__VA_ARGS__)
+
+/*
+ * Host version of the I2S3 + DMA1 stream 7 pair which feeds the codec. The output_i2s
+ * driver runs unchanged: once the stream is enabled, every buffer period the buffer
+ * selected by CT is considered played, CT is toggled and the transfer complete
+ * interrupt is raised. Played buffers are appended to a WAV file, without the silence
+ * before the first sound and after the last one.
+ */
+#define I2S_DISABLED_POLL_US		1000
+#define WAV_HEADER_SIZE				44
+#define WAV_FRAME_SIZE				sizeof(audio_sample_t)
+
+// Rates generated by the PLLI2S configurations are only close to the nominal ones
+static const uint32_t standard_rates[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 96000 };
+
+static void host_i2s_transfer_complete(void);
+
+static struct {
+	struct HOST_TIMER timer;
+	FILE* wav;
+	uint32_t wav_rate;
+	uint32_t written_frames;	// including the trailing silence
+	uint32_t sound_frames;		// up to the last buffer which was not silent
+	uint8_t rate_mismatch;
+} i2s = {
+	.timer = { .callback = host_i2s_transfer_complete },
+};
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+/*
+ * Sample rate which results from the clock configuration (0 if not configured):
+ * Fs = I2SCLK / (256 * (2*DIV + ODD)), since the master clock output is enabled
+ */
+static uint32_t host_i2s_get_sample_rate()
+{
+	uint32_t pll_m = READ_BIT(RCC->PLLCFGR, RCC_PLLCFGR_PLLM) >> RCC_PLLCFGR_PLLM_Pos;
+	uint32_t pll_n = READ_BIT(RCC->PLLI2SCFGR, RCC_PLLI2SCFGR_PLLI2SN) >> RCC_PLLI2SCFGR_PLLI2SN_Pos;
+	uint32_t pll_r = READ_BIT(RCC->PLLI2SCFGR, RCC_PLLI2SCFGR_PLLI2SR) >> RCC_PLLI2SCFGR_PLLI2SR_Pos;
+	uint32_t div = READ_BIT(SPI3->I2SPR, SPI_I2SPR_I2SDIV) >> SPI_I2SPR_I2SDIV_Pos;
+	uint32_t odd = READ_BIT(SPI3->I2SPR, SPI_I2SPR_ODD) >> SPI_I2SPR_ODD_Pos;
+	uint64_t i2s_clk;
+
+	if ((pll_m == 0) || (pll_r == 0) || (div < 2))
+		return 0;
+
+	i2s_clk = ((uint64_t)HSE_CRYST_FREQ * pll_n) / (pll_m * pll_r);
+	return (uint32_t)(i2s_clk / (256 * (2*div + odd)));
+}
+
+static uint32_t host_i2s_get_nominal_rate(uint32_t rate)
+{
+	uint8_t index;
+
+	for (index=0; index<array_size(standard_rates); index++) {
+		if ((rate > (standard_rates[index] - standard_rates[index]/100)) &&
+				(rate < (standard_rates[index] + standard_rates[index]/100)))
+			return standard_rates[index];
+	}
+	return rate;
+}
+
+static void host_i2s_write_wav_header(uint32_t frames)
+{
+	uint32_t data_size = frames * WAV_FRAME_SIZE;
+	uint8_t header[WAV_HEADER_SIZE] = {
+		'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ', 16, 0, 0, 0,
+		1, 0,			// PCM
+		2, 0,			// channels
+		0, 0, 0, 0,		// sample rate
+		0, 0, 0, 0,		// byte rate
+		4, 0,			// block align
+		16, 0,			// bits per sample
+		'd', 'a', 't', 'a', 0, 0, 0, 0,
+	};
+
+	#define put_le32(offset, value)		do { \
+		header[(offset)] = (value) & 0xFF; header[(offset)+1] = ((value) >> 8) & 0xFF; \
+		header[(offset)+2] = ((value) >> 16) & 0xFF; header[(offset)+3] = ((value) >> 24) & 0xFF; \
+	} while(0)
+	put_le32(4, WAV_HEADER_SIZE - 8 + data_size);
+	put_le32(24, i2s.wav_rate);
+	put_le32(28, i2s.wav_rate * WAV_FRAME_SIZE);
+	put_le32(40, data_size);
+	#undef put_le32
+
+	fseek(i2s.wav, 0, SEEK_SET);
+	fwrite(header, 1, sizeof(header), i2s.wav);
+}
+
+static uint8_t host_i2s_is_silent(audio_sample_t* samples, uint32_t frames)
+{
+	uint32_t index;
+
+	for (index=0; index<frames; index++) {
+		if ((samples[index].left_ch != 0) || (samples[index].right_ch != 0))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void host_i2s_write_wav(audio_sample_t* samples, uint32_t frames, uint32_t rate)
+{
+	uint8_t is_silent = host_i2s_is_silent(samples, frames);
+
+	if ((i2s.wav == NULL) || ((i2s.written_frames == 0) && is_silent))
+		return;
+
+	if (i2s.written_frames == 0) {
+		i2s.wav_rate = rate;
+		host_i2s_write_wav_header(0);
+	} else if ((rate != i2s.wav_rate) && !i2s.rate_mismatch) {
+		debug_msg("sample rate changed to %u Hz, the WAV file keeps %u Hz\n", rate, i2s.wav_rate);
+		i2s.rate_mismatch = TRUE;
+	}
+
+	fwrite(samples, WAV_FRAME_SIZE, frames, i2s.wav);
+	i2s.written_frames += frames;
+	if (!is_silent)
+		i2s.sound_frames = i2s.written_frames;
+}
+
+/*
+ * End of a DMA buffer (or polling for the stream to be enabled)
+ */
+static void host_i2s_transfer_complete()
+{
+	uint32_t rate = host_i2s_get_sample_rate();
+	uint32_t frames = DMA1_Stream7->NDTR / 2;	// 2 halfwords per frame
+	uint64_t period_us = I2S_DISABLED_POLL_US;
+	uint32_t buffer_address;
+
+	if (READ_BIT(DMA1_Stream7->CR, DMA_SxCR_EN) && READ_BIT(SPI3->I2SCFGR, SPI_I2SCFGR_I2SE) &&
+			(rate != 0) && (frames != 0)) {
+		buffer_address = READ_BIT(DMA1_Stream7->CR, DMA_SxCR_CT) ? DMA1_Stream7->M1AR : DMA1_Stream7->M0AR;
+		host_i2s_write_wav((audio_sample_t*)(uintptr_t)buffer_address, frames, host_i2s_get_nominal_rate(rate));
+
+		DMA1_Stream7->CR ^= DMA_SxCR_CT;
+		SET_BIT(DMA1->HISR, DMA_HISR_TCIF7);
+		if (READ_BIT(DMA1_Stream7->CR, DMA_SxCR_TCIE))
+			NVIC_SetPendingIRQ(DMA1_Stream7_IRQn);
+		period_us = ((uint64_t)frames * 1000000UL) / rate;
+	}
+
+	host_timer_start(&i2s.timer, i2s.timer.expire_at_us + period_us);
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+void host_i2s_init()
+{
+	if (host_options.wav_file != NULL) {
+		i2s.wav = fopen(host_options.wav_file, "wb");
+		if (i2s.wav == NULL)
+			debug_msg("cannot create %s\n", host_options.wav_file);
+		i2s.wav_rate = 48000;	// until the first sound
+	}
+	host_timer_start(&i2s.timer, host_time_us() + I2S_DISABLED_POLL_US);
+}
+
+/*
+ * Complete the WAV file
+ */
+void host_i2s_close()
+{
+	if (i2s.wav == NULL)
+		return;
+
+	fflush(i2s.wav);
+	if (ftruncate(fileno(i2s.wav), WAV_HEADER_SIZE + (off_t)i2s.sound_frames * WAV_FRAME_SIZE) != 0)
+		i2s.sound_frames = i2s.written_frames;
+	host_i2s_write_wav_header(i2s.sound_frames);
+	fclose(i2s.wav);
+	i2s.wav = NULL;
+
+	debug_msg("%u frames at %u Hz written to %s\n", i2s.sound_frames, i2s.wav_rate, host_options.wav_file);
+}
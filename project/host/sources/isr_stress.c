@@ -0,0 +1,183 @@
+#include "host.h"
+#include "kernel.h"
+#include "debug_printf.h"
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define debug_msg(format, ...)		debug_printf("[isr_stress] " format, ##__VA_ARGS__)
+
+/*
+ * Stress test of the ISRs' activation ring: a second thread plays the ISRs and posts
+ * activations of a set of tasks for some time, as fast as it can (a random short spin
+ * between two posts varies the phase with the scheduler's loop), while the scheduler
+ * drains the ring. With a single host CPU the threads interleave only where the host
+ * preempts them, so the test should run for a while. Before each post the poster
+ * increments the task's sequence number, which the task copies when it runs, so that:
+ *	- no activation is lost if every task has seen its last sequence number
+ *	- no activation is duplicated if no task has run more times than it was posted and
+ *	  the kernel never found a task twice in the ring
+ * and the ring never overflows, since a task can be queued only once and they're fewer
+ * than its slots. A failure ends the simulation with an error.
+ */
+#define ISR_STRESS_TASKS			16		// less than KERNEL_ISR_RING_SIZE
+#define ISR_STRESS_DEFAULT_MS		2000	// host's time
+#define ISR_STRESS_MAX_SPIN			64
+#define ISR_STRESS_DRAIN_MS			10		// after the last post
+
+ALLOCATE_TASK(isr_stress, 250);		// below the receivers, since it yields continuously
+static struct TASK isr_stress_receivers[ISR_STRESS_TASKS];
+
+static struct {
+	struct COROUTINE co;
+	pthread_t poster;
+	uint32_t duration_ms;
+	uint32_t posts;
+	uint8_t poster_done;
+	uint8_t is_running;
+	uint32_t posted[ISR_STRESS_TASKS];		// sequence numbers, written by the poster only
+	uint32_t seen[ISR_STRESS_TASKS];		// last sequence number seen by each task
+	uint32_t runs[ISR_STRESS_TASKS];
+	struct SCHEDULER_STATS start;
+} isr_stress_ctx;
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+/*
+ * The "ISRs": activations posted round robin
+ */
+static void* isr_stress_poster(void* arg)
+{
+	struct timespec now;
+	uint64_t end_ms;
+	uint32_t receiver, seed = 1;
+	volatile uint32_t spin;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	end_ms = ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000) + isr_stress_ctx.duration_ms;
+	do {
+		receiver = isr_stress_ctx.posts % ISR_STRESS_TASKS;
+		__atomic_store_n(&isr_stress_ctx.posted[receiver], isr_stress_ctx.posted[receiver] + 1, __ATOMIC_RELEASE);
+		kernel_activate_task_from_isr(&isr_stress_receivers[receiver]);
+		isr_stress_ctx.posts++;
+
+		seed = (seed * 1103515245) + 12345;
+		for (spin=(seed >> 16) % ISR_STRESS_MAX_SPIN; spin>0; spin--);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000)) < end_ms);
+	__atomic_store_n(&isr_stress_ctx.poster_done, TRUE, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * The receivers share this function: the one being run is the one in running state
+ */
+static int32_t isr_stress_receiver_func()
+{
+	uint32_t index;
+
+	for (index=0; index<ISR_STRESS_TASKS; index++) {
+		if (kernel_get_task_status(&isr_stress_receivers[index]) == TASK_STATE_RUNNING) {
+			isr_stress_ctx.seen[index] = __atomic_load_n(&isr_stress_ctx.posted[index], __ATOMIC_ACQUIRE);
+			isr_stress_ctx.runs[index]++;
+			break;
+		}
+	}
+	return WAIT_FOR_RESUME;
+}
+
+/*
+ * Compare what the receivers have seen with what was posted
+ */
+static uint8_t isr_stress_check()
+{
+	struct SCHEDULER_STATS end;
+	uint32_t index, runs = 0, lost = 0, extra_runs = 0;
+
+	for (index=0; index<ISR_STRESS_TASKS; index++) {
+		runs += isr_stress_ctx.runs[index];
+		if (isr_stress_ctx.seen[index] != isr_stress_ctx.posted[index])
+			lost++;
+		if (isr_stress_ctx.runs[index] > isr_stress_ctx.posted[index])
+			extra_runs++;
+	}
+	kernel_get_scheduler_stats(&end);
+
+	debug_msg("%u activations posted to %u tasks, %u runs (the others were coalesced)\n",
+				isr_stress_ctx.posts, ISR_STRESS_TASKS, runs);
+	debug_msg("%u tasks missed their last activation, %u ran more than posted\n", lost, extra_runs);
+	debug_msg("ring: %u overflows, %u duplicates\n", end.isr_overflows - isr_stress_ctx.start.isr_overflows,
+				end.isr_duplicates - isr_stress_ctx.start.isr_duplicates);
+
+	return (lost == 0) && (extra_runs == 0) &&
+			(end.isr_overflows == isr_stress_ctx.start.isr_overflows) &&
+			(end.isr_duplicates == isr_stress_ctx.start.isr_duplicates);
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+/*
+ * Wait for the poster to complete and check the results
+ */
+int32_t isr_stress_task_func()
+{
+	struct COROUTINE* co = &isr_stress_ctx.co;
+
+	CO_BEGIN(co);
+	// Keep the scheduler busy meanwhile: the idle time isn't skipped (-f), so the
+	// simulated time goes on as the poster's one
+	while (!__atomic_load_n(&isr_stress_ctx.poster_done, __ATOMIC_ACQUIRE))
+		CO_YIELD(co);
+	CO_SLEEP(co, ISR_STRESS_DRAIN_MS);
+	pthread_join(isr_stress_ctx.poster, NULL);
+	isr_stress_ctx.is_running = FALSE;
+
+	if (!isr_stress_check()) {
+		debug_msg("FAILED\n");
+		host_exit(EXIT_FAILURE);
+	}
+	debug_msg("passed\n");
+	CO_END(co);
+}
+
+/*
+ * Shell command which runs the test: "isr_stress [<ms>]"
+ */
+int host_isr_stress(int argc, char *argv[])
+{
+	uint32_t index;
+
+	if (isr_stress_ctx.is_running) {
+		debug_msg("already running\n");
+		return -1;
+	}
+
+	isr_stress_ctx.duration_ms = (argc > 0) ? strtoul(argv[0], NULL, 0) : ISR_STRESS_DEFAULT_MS;
+	isr_stress_ctx.posts = 0;
+	isr_stress_ctx.poster_done = FALSE;
+	for (index=0; index<ISR_STRESS_TASKS; index++) {
+		// Registered at the first run only
+		if (isr_stress_receivers[index].func == NULL) {
+			isr_stress_receivers[index].name = "isr_stress_rx";
+			isr_stress_receivers[index].func = isr_stress_receiver_func;
+			isr_stress_receivers[index].priority = 100;
+			isr_stress_receivers[index].id = TASK_ID_NONE;
+			kernel_init_task(&isr_stress_receivers[index]);
+		}
+		isr_stress_ctx.posted[index] = 0;
+		isr_stress_ctx.seen[index] = 0;
+		isr_stress_ctx.runs[index] = 0;
+	}
+	kernel_get_scheduler_stats(&isr_stress_ctx.start);
+
+	if (pthread_create(&isr_stress_ctx.poster, NULL, isr_stress_poster, NULL) != 0) {
+		debug_msg("cannot start the poster\n");
+		return -1;
+	}
+	isr_stress_ctx.is_running = TRUE;
+	CO_RESET(&isr_stress_ctx.co);
+	kernel_activate_task_immediately(&isr_stress_task);
+	return 0;
+}
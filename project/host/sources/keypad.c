@@ -0,0 +1,195 @@
+#include "host.h"
+#include "buttons.h"
+#include "kernel.h"
+#include "utils.h"
+#include "debug_printf.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define debug_msg(format, ...)		debug_printf("[key_stats] " format, ##__VA_ARGS__)
+
+/*
+ * Simulation of the keys: they are active low (the GPIOs are pulled up) and the
+ * press' falling edge raises the EXTI interrupt if the driver has configured the line
+ * for that port and edge. The handlers serve one line per call, so a key whose
+ * interrupt is shared with a line still pending is raised after that one is served.
+ */
+#define GPIO_PORT_C		2
+#define GPIO_PORT_E		4
+
+static const struct {
+	GPIO_TypeDef* gpio;
+	uint8_t port;
+	uint8_t pin;
+} keypad_wiring[] = {
+	[KEY_UP] = { GPIOE, GPIO_PORT_E, 12 },
+	[KEY_DOWN] = { GPIOE, GPIO_PORT_E, 14 },
+	[KEY_LEFT] = { GPIOE, GPIO_PORT_E, 13 },
+	[KEY_RIGHT] = { GPIOC, GPIO_PORT_C, 5 },
+	[KEY_OK] = { GPIOC, GPIO_PORT_C, 4 },
+	[KEY_CANCEL] = { GPIOE, GPIO_PORT_E, 0 },
+	[KEY_VOL_UP] = { GPIOC, GPIO_PORT_C, 0 },
+	[KEY_VOL_DOWN] = { GPIOC, GPIO_PORT_C, 1 },
+};
+
+#define KEYS_COUNT		array_size(keypad_wiring)
+#define KEYPAD_RETRY_US		1		// raise the keys which were waiting for their interrupt
+
+// Mailbox which the buttons' driver is currently posting to
+extern struct MAILBOX* key_event_mailbox;
+
+static void host_keypad_release(void);
+static void host_keypad_raise_waiting(void);
+
+// Time at which each key will be released (0 = not pressed)
+static uint64_t release_at_us[KEYS_COUNT];
+static struct HOST_TIMER release_timer = { .callback = host_keypad_release };
+
+// Pressed keys whose interrupt is still pending for another line
+static uint8_t waiting_keys;
+static struct HOST_TIMER retry_timer = { .callback = host_keypad_raise_waiting };
+
+/*
+ * EXTI interrupt which serves the given pin
+ */
+static IRQn_Type host_keypad_get_irqn(uint8_t pin)
+{
+	if (pin <= 4)
+		return EXTI0_IRQn + pin;
+	else if (pin <= 9)
+		return EXTI9_5_IRQn;
+	else
+		return EXTI15_10_IRQn;
+}
+
+/*
+ * EXTI lines served by the same interrupt as the given pin
+ */
+static uint32_t host_keypad_get_lines(uint8_t pin)
+{
+	if (pin <= 4)
+		return 1UL << pin;
+	else if (pin <= 9)
+		return 0x03E0;
+	else
+		return 0xFC00;
+}
+
+/*
+ * Raise the EXTI interrupt of the key, unless it's still pending for another line
+ * (returns FALSE). PR is "write 1 to clear" on the target, so the handler's
+ * acknowledgment leaves the bit set here: among the lines of this interrupt, only
+ * the new one is left pending.
+ */
+static uint8_t host_keypad_raise(uint8_t key)
+{
+	uint8_t pin = keypad_wiring[key].pin;
+	IRQn_Type irqn = host_keypad_get_irqn(pin);
+
+	if (NVIC->ISPR[HOST_NVIC_INDEX(irqn)] & HOST_NVIC_MASK(irqn))
+		return FALSE;
+
+	EXTI->PR = (EXTI->PR & ~host_keypad_get_lines(pin)) | (1UL << pin);
+	NVIC_SetPendingIRQ(irqn);
+	return TRUE;
+}
+
+/*
+ * Raise the interrupts of the keys which were waiting for theirs to be served
+ */
+static void host_keypad_raise_waiting()
+{
+	uint8_t key;
+
+	for (key=0; key<KEYS_COUNT; key++) {
+		if ((waiting_keys & (1 << key)) && host_keypad_raise(key))
+			waiting_keys &= ~(1 << key);
+	}
+	if (waiting_keys != 0)
+		host_timer_start(&retry_timer, host_time_us() + KEYPAD_RETRY_US);
+}
+
+/*
+ * Release the keys whose hold time has expired
+ */
+static void host_keypad_release()
+{
+	uint64_t now = host_time_us();
+	uint64_t next_release = 0;
+	uint8_t key;
+
+	for (key=0; key<KEYS_COUNT; key++) {
+		if (release_at_us[key] == 0)
+			continue;
+		if (release_at_us[key] <= now) {
+			SET_BIT(keypad_wiring[key].gpio->IDR, 1UL << keypad_wiring[key].pin);
+			release_at_us[key] = 0;
+		} else if ((next_release == 0) || (release_at_us[key] < next_release)) {
+			next_release = release_at_us[key];
+		}
+	}
+
+	if (next_release != 0)
+		host_timer_start(&release_timer, next_release);
+}
+
+/*
+ * Press the key and keep it pressed for the given time
+ */
+void host_keypad_press(uint8_t key, uint32_t hold_ms)
+{
+	uint8_t pin = keypad_wiring[key].pin;
+	uint32_t line = 1UL << pin;
+	uint32_t exti_port = (SYSCFG->EXTICR[pin/4] >> ((pin%4)*4)) & 0xF;
+
+	CLEAR_BIT(keypad_wiring[key].gpio->IDR, line);
+
+	if ((exti_port == keypad_wiring[key].port) && (EXTI->IMR & line) && (EXTI->FTSR & line) &&
+			!host_keypad_raise(key)) {
+		waiting_keys |= (1 << key);
+		host_timer_start(&retry_timer, host_time_us() + KEYPAD_RETRY_US);
+	}
+
+	release_at_us[key] = host_time_us() + ((uint64_t)hold_ms * 1000);
+	host_keypad_release();
+}
+
+/*
+ * Shell command which checks the delivery of the key events to the mailbox the
+ * buttons are currently posting to (the receiver drains it, so a burst of keys pressed
+ * together must be delivered with a single wake-up):
+ *	- "key_stats" prints the events received, the wake-ups and the rejected posts
+ *	- "key_stats reset" clears them
+ *	- "key_stats <events> <bursts>" fails the simulation unless exactly that many
+ *	  events were received with one wake-up per burst and no rejected post
+ */
+int host_key_stats(int argc, char *argv[])
+{
+	struct MAILBOX* mailbox = key_event_mailbox;
+
+	if (mailbox == NULL) {
+		debug_msg("no mailbox is registered\n");
+		return -1;
+	}
+	if ((argc == 1) && (strcmp(argv[0], "reset") == 0)) {
+		mailbox->received = mailbox->wakeups = mailbox->overflows = 0;
+		return 0;
+	}
+	if ((argc != 0) && (argc != 2)) {
+		debug_msg("usage: key_stats [reset | <events> <bursts>]\n");
+		return -1;
+	}
+
+	debug_msg("%u events received, %u wake-ups, %u rejected posts, %u queued\n",
+				mailbox->received, mailbox->wakeups, mailbox->overflows, mailbox->count);
+	if (argc == 0)
+		return 0;
+
+	if ((mailbox->received != strtoul(argv[0], NULL, 0)) || (mailbox->wakeups != strtoul(argv[1], NULL, 0)) ||
+			(mailbox->overflows != 0)) {
+		debug_msg("FAILED\n");
+		host_exit(EXIT_FAILURE);
+	}
+	debug_msg("passed\n");
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include "kernel.h"
+#include "host.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Entry point of the host build: it replaces the reset handler
+ */
+struct HOST_OPTIONS host_options;
+
+static void host_usage(const char* name)
+{
+	printf("Usage: %s [options]\n", name);
+	printf("  -s <image>   FAT formatted image used as SD card\n");
+	printf("  -w <file>    write the audio output to a WAV file\n");
+	printf("  -d <file>    write the display to a PGM image at every refresh\n");
+	printf("  -a           print the display on stdout at every refresh\n");
+	printf("  -f           fast mode: skip the idle periods instead of sleeping\n");
+	printf("  -c <factor>  the simulated CPU is <factor> times slower than the host (implies -f)\n");
+	printf("  -t <ms>      stop after the specified (simulated) time\n");
+	printf("  -b           run the boot steps one after the other instead of in parallel\n");
+	printf("  -h           show this help\n");
+	printf("Lines typed on stdin go to the shell, except for the directives:\n");
+	printf("  @key <up|down|left|right|ok|cancel|vol+|vol-> [hold_ms]\n");
+	printf("  @wait <ms>\n");
+	printf("  @display\n");
+	printf("  @quit\n");
+}
+
+int main(int argc, char* argv[])
+{
+	int option;
+
+	while ((option = getopt(argc, argv, "s:w:d:afc:t:bh")) != -1) {
+		switch (option) {
+			case 's':
+				host_options.sd_image = optarg;
+				break;
+			case 'w':
+				host_options.wav_file = optarg;
+				break;
+			case 'd':
+				host_options.display_file = optarg;
+				break;
+			case 'a':
+				host_options.display_ascii = 1;
+				break;
+			case 'f':
+				host_options.fast = 1;
+				break;
+			case 'c':
+				host_options.cpu_factor = strtoul(optarg, NULL, 0);
+				host_options.fast = 1;
+				break;
+			case 't':
+				host_options.duration_ms = strtoul(optarg, NULL, 0);
+				break;
+			case 'b':
+				kernel_boot_set_serial(TRUE);
+				break;
+			case 'h':
+				host_usage(argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				host_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	host_mcu_init();
+	if ((host_options.sd_image != NULL) && (host_sd_card_open(host_options.sd_image) != 0))
+		return EXIT_FAILURE;
+	host_i2s_init();
+
+	kernel_main();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include "host.h"
+#include "kernel.h"
+#include "systick.h"
+#include "buttons.h"
+#include "output_i2s.h"
+#include "sd_card.h"
+#include "uart.h"
+#include "debug_printf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#define debug_msg(format, ...)		debug_printf("[host] " format, ##__VA_ARGS__)
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE		0x100000
+#endif
+
+// Simulated PRIMASK: while set, pending interrupts are not served
+volatile uint32_t host_primask;
+
+// Simulated BASEPRI: it's only used for masking PendSV, which has the lowest priority
+volatile uint32_t host_basepri;
+
+// Memory which backs the peripherals' registers at their real addresses, so that the
+// drivers (and the CMSIS inline functions) can access them unchanged
+static const struct {
+	uintptr_t base;
+	size_t size;
+} host_memory_regions[] = {
+	{ PERIPH_BASE, 0x00080000UL },	// APB1, APB2 and AHB1 peripherals
+	{ 0xE0000000UL, 0x00010000UL },	// Cortex-M4 private peripherals (ITM, DWT, SCS)
+};
+
+// Interrupts raised by the simulated peripherals. As on the real core, an interrupt is
+// served only if it is both pending and enabled in the NVIC's registers.
+static const struct {
+	IRQn_Type irqn;
+	void (*handler)(void);
+} host_vectors[] = {
+	{ EXTI0_IRQn, EXTI0_IRQHandler },
+	{ EXTI1_IRQn, EXTI1_IRQHandler },
+	{ EXTI4_IRQn, EXTI4_IRQHandler },
+	{ EXTI9_5_IRQn, EXTI9_5_IRQHandler },
+	{ EXTI15_10_IRQn, EXTI15_10_IRQHandler },
+	{ DMA1_Stream7_IRQn, DMA1_Stream7_IRQHandler },
+	{ SDIO_IRQn, SDIO_IRQHandler },
+	{ USART2_IRQn, USART2_IRQHandler },
+};
+
+#define HOST_VECTORS_COUNT		(sizeof(host_vectors)/sizeof(host_vectors[0]))
+
+// Pending simulation events, sorted by expiration time
+static struct HOST_TIMER* host_timers;
+
+// Simulated time = host's monotonic time + idle periods skipped in fast mode. With a
+// slow-down factor (-c) the running time is the thread's CPU time multiplied by it, so
+// that the firmware's run times get close to the target's ones and the host's other
+// processes don't stretch them.
+static uint64_t host_start_ns;
+static uint64_t host_skipped_ns;
+
+static volatile sig_atomic_t host_stop_requested;
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+static uint64_t host_monotonic_ns()
+{
+	struct timespec now;
+
+	if (host_options.cpu_factor > 1) {
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		return (((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec) * host_options.cpu_factor;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+static void host_signal_handler(int signum)
+{
+	host_stop_requested = 1;
+}
+
+/*
+ * Check whether the interrupt is both enabled and pending in the NVIC
+ */
+static uint8_t host_is_irq_active(IRQn_Type irqn)
+{
+	uint32_t mask = 1UL << ((uint32_t)irqn & 0x1F);
+
+	return (NVIC->ISER[((uint32_t)irqn) >> 5] & mask) && (NVIC->ISPR[((uint32_t)irqn) >> 5] & mask);
+}
+
+/*
+ * Check whether any enabled interrupt is pending
+ */
+static uint8_t host_is_irq_pending()
+{
+	uint8_t index;
+
+	for (index=0; index<HOST_VECTORS_COUNT; index++) {
+		if (host_is_irq_active(host_vectors[index].irqn))
+			return TRUE;
+	}
+	return (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk) ? TRUE : FALSE;
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+/*
+ * Map the peripherals' memory and set the reset values of the registers which are
+ * polled by the drivers: oscillators and PLLs lock immediately and the GPIO inputs
+ * are pulled up.
+ */
+void host_mcu_init()
+{
+	uint8_t index;
+	void* ptr;
+
+	for (index=0; index<(sizeof(host_memory_regions)/sizeof(host_memory_regions[0])); index++) {
+		ptr = mmap((void*)host_memory_regions[index].base, host_memory_regions[index].size,
+					PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (ptr != (void*)host_memory_regions[index].base) {
+			fprintf(stderr, "Error: cannot map the peripherals at 0x%lx\n", (unsigned long)host_memory_regions[index].base);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	RCC->CR = RCC_CR_HSIRDY | RCC_CR_HSERDY | RCC_CR_PLLRDY | RCC_CR_PLLI2SRDY;
+	RCC->CFGR = RCC_CFGR_SWS_PLL;
+	GPIOA->IDR = 0xFFFF;
+	GPIOB->IDR = 0xFFFF;
+	GPIOC->IDR = 0xFFFF;
+	GPIOD->IDR = 0xFFFF;
+	GPIOE->IDR = 0xFFFF;
+
+	signal(SIGINT, host_signal_handler);
+	signal(SIGTERM, host_signal_handler);
+
+	host_start_ns = host_monotonic_ns();
+}
+
+/*
+ * Simulated time since the start-up
+ */
+uint64_t host_time_ns()
+{
+	return host_monotonic_ns() - host_start_ns + host_skipped_ns;
+}
+
+uint64_t host_time_us()
+{
+	return host_time_ns() / 1000;
+}
+
+/*
+ * Schedule (or re-schedule) a simulation event
+ */
+void host_timer_start(struct HOST_TIMER* timer, uint64_t expire_at_us)
+{
+	struct HOST_TIMER** curr = &host_timers;
+
+	host_timer_stop(timer);
+	timer->expire_at_us = expire_at_us;
+	while ((*curr != NULL) && ((*curr)->expire_at_us <= expire_at_us))
+		curr = &(*curr)->next;
+	timer->next = *curr;
+	*curr = timer;
+}
+
+void host_timer_stop(struct HOST_TIMER* timer)
+{
+	struct HOST_TIMER** curr = &host_timers;
+
+	while (*curr != NULL) {
+		if (*curr == timer) {
+			*curr = timer->next;
+			timer->next = NULL;
+			return;
+		}
+		curr = &(*curr)->next;
+	}
+}
+
+/*
+ * Run the expired simulation events and serve the pending interrupts. This is called
+ * whenever the firmware reads the time or clears PRIMASK, which is where a real
+ * interrupt would preempt it, at the latest.
+ */
+void host_irq_service()
+{
+	static uint8_t in_service = FALSE;
+	static uint8_t in_pendsv = FALSE;
+	struct HOST_TIMER* timer;
+	uint64_t now;
+	uint8_t index;
+
+	if (host_primask || in_service)
+		return;
+	in_service = TRUE;
+
+	now = host_time_us();
+	if (host_stop_requested ||
+			((host_options.duration_ms != 0) && (now >= (uint64_t)host_options.duration_ms * 1000)))
+		host_exit(EXIT_SUCCESS);
+
+	while ((host_timers != NULL) && (host_timers->expire_at_us <= now)) {
+		timer = host_timers;
+		host_timers = timer->next;
+		timer->next = NULL;
+		timer->callback();
+	}
+	host_console_update(now);
+	host_display_update(now);
+
+	for (index=0; index<HOST_VECTORS_COUNT; index++) {
+		if (host_is_irq_active(host_vectors[index].irqn)) {
+			NVIC_ClearPendingIRQ(host_vectors[index].irqn);
+			host_vectors[index].handler();
+		}
+	}
+
+	in_service = FALSE;
+
+	// PendSV has the lowest priority: it's served last and the other interrupts can
+	// preempt it (at the points where they're served)
+	if (!in_pendsv && (host_basepri == 0) && (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk)) {
+		in_pendsv = TRUE;
+		__sync_fetch_and_and(&SCB->ICSR, ~SCB_ICSR_PENDSVSET_Msk);
+		PendSV_Handler();
+		in_pendsv = FALSE;
+	}
+}
+
+/*
+ * Sleep until the specified time or until an interrupt is pending, like the WFI does
+ * (PRIMASK doesn't prevent the wake-up). In fast mode the time is skipped instead.
+ */
+void host_wait_until(uint64_t target_us)
+{
+	uint64_t now = host_time_us();
+	uint64_t wake_up_at;
+	uint64_t now_ns;
+	struct pollfd console;
+	struct timespec timeout;
+
+	while (now < target_us) {
+		if (host_console_update(now) || host_is_irq_pending())
+			return;
+		if (host_stop_requested)
+			return;
+
+		wake_up_at = target_us;
+		if ((host_timers != NULL) && (host_timers->expire_at_us < wake_up_at))
+			wake_up_at = host_timers->expire_at_us;
+		if ((host_options.duration_ms != 0) && (((uint64_t)host_options.duration_ms * 1000) < wake_up_at))
+			wake_up_at = (uint64_t)host_options.duration_ms * 1000;
+		if (wake_up_at <= now)
+			return;
+
+		if (host_options.fast) {
+			now_ns = host_time_ns();
+			if ((wake_up_at * 1000) > now_ns)
+				host_skipped_ns += (wake_up_at * 1000) - now_ns;
+			return;
+		}
+
+		// Keys and commands typed on the console wake the core up too
+		console.fd = host_console_fd();
+		console.events = POLLIN;
+		timeout.tv_sec = (wake_up_at - now) / 1000000;
+		timeout.tv_nsec = ((wake_up_at - now) % 1000000) * 1000;
+		ppoll(&console, (console.fd >= 0) ? 1 : 0, &timeout, NULL);
+		now = host_time_us();
+	}
+}
+
+/*
+ * WFI outside the idle task: the SysTick wakes the core up at the next tick at most
+ */
+void host_wait_for_interrupt()
+{
+	host_wait_until(((host_time_us() / 1000) + 1) * 1000);
+	host_irq_service();
+}
+
+/*
+ * Busy wait (interrupts are still served at the end)
+ */
+void host_delay_us(uint32_t us)
+{
+	struct timespec delay;
+
+	if (host_options.fast) {
+		host_skipped_ns += (uint64_t)us * 1000;
+	} else {
+		delay.tv_sec = us / 1000000;
+		delay.tv_nsec = (us % 1000000) * 1000;
+		nanosleep(&delay, NULL);
+	}
+	host_irq_service();
+}
+
+/*
+ * Print the final statistics, flush the outputs and leave. The run fails when
+ * a task exceeded its declared budget (see kernel_set_task_budget).
+ */
+void host_exit(int code)
+{
+	debug_msg("simulation stopped after %u ms\n", (uint32_t)(host_time_us() / 1000));
+	kernel_top(0, NULL);
+	systick_idle_stats(0, NULL);
+
+	// A task which runs longer than its declared budget fails the run
+	if ((code == EXIT_SUCCESS) && (kernel_watchdog_get_budget_violations() != 0)) {
+		debug_msg("%u task budget violations\n", kernel_watchdog_get_budget_violations());
+		kernel_watchdog(0, NULL);
+		code = EXIT_FAILURE;
+	}
+
+	// So does any audio underrun
+	if ((code == EXIT_SUCCESS) && (output_i2s_get_underruns() != 0)) {
+		debug_msg("%u audio underruns\n", output_i2s_get_underruns());
+		code = EXIT_FAILURE;
+	}
+	host_i2s_close();
+	host_display_close();
+	host_console_restore();
+	fflush(stdout);
+	exit(code);
+}
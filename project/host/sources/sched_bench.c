@@ -0,0 +1,116 @@
+#include "host.h"
+#include "kernel.h"
+#include "debug_printf.h"
+
+#define debug_msg(format, ...)		debug_printf("[sched_bench] " format, ##__VA_ARGS__)
+
+/*
+ * Scheduler's benchmark: tasks which sleep for a random time are added step by step,
+ * and at each step the scheduler's own cycles per loop are measured (they're the
+ * host's cycles, see cycle_counter.c). Tasks can't be unregistered, so the steps add
+ * up and the bench can run once: the host build raises KERNEL_MAX_TASKS for it.
+ */
+#define SCHED_BENCH_MAX_WORKERS		300
+#define SCHED_BENCH_MAX_SLEEP_MS	16		// workers sleep from 1 to this
+#define SCHED_BENCH_SETTLE_MS		100		// before measuring, so that the wake-ups spread
+#define SCHED_BENCH_WINDOW_MS		500
+
+static const uint16_t sched_bench_steps[] = { 10, 20, 50, 100, 150, 200, 250, 300 };
+
+ALLOCATE_TASK(sched_bench, 5);
+static struct TASK sched_bench_workers[SCHED_BENCH_MAX_WORKERS];
+
+static struct {
+	struct COROUTINE co;
+	uint8_t step;
+	uint16_t workers;
+	uint32_t seed;
+	struct SCHEDULER_STATS start;
+} sched_bench_ctx;
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+static uint32_t sched_bench_random(uint32_t range)
+{
+	sched_bench_ctx.seed = (sched_bench_ctx.seed * 1103515245) + 12345;
+	return (sched_bench_ctx.seed >> 16) % range;
+}
+
+/*
+ * The workers do nothing, so that the loop's cost isn't hidden by theirs
+ */
+static int32_t sched_bench_worker_func()
+{
+	return 1 + sched_bench_random(SCHED_BENCH_MAX_SLEEP_MS);
+}
+
+/*
+ * Register and start the workers up to the given count. Returns FALSE if the kernel
+ * has no room for them.
+ */
+static uint8_t sched_bench_add_workers(uint16_t count)
+{
+	struct TASK* task_ptr;
+
+	while (sched_bench_ctx.workers < count) {
+		task_ptr = &sched_bench_workers[sched_bench_ctx.workers];
+		task_ptr->name = "sched_bench_worker";
+		task_ptr->func = sched_bench_worker_func;
+		task_ptr->priority = 100 + sched_bench_random(100);
+		task_ptr->id = TASK_ID_NONE;
+		task_ptr->status = TASK_STATE_DEAD;
+		kernel_init_task(task_ptr);
+		if (task_ptr->id == TASK_ID_NONE)
+			return FALSE;
+		kernel_activate_task_after_ms(task_ptr, sched_bench_random(SCHED_BENCH_MAX_SLEEP_MS));
+		sched_bench_ctx.workers++;
+	}
+	return TRUE;
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+int32_t sched_bench_task_func()
+{
+	struct COROUTINE* co = &sched_bench_ctx.co;
+	struct SCHEDULER_STATS end;
+	uint32_t loops;
+
+	CO_BEGIN(co);
+	debug_msg("%8s %10s %10s %12s\n", "tasks", "loops/s", "runs/s", "cycles/loop");
+	for (sched_bench_ctx.step=0; sched_bench_ctx.step<array_size(sched_bench_steps); sched_bench_ctx.step++) {
+		if (!sched_bench_add_workers(sched_bench_steps[sched_bench_ctx.step])) {
+			debug_msg("no room for %u tasks (KERNEL_MAX_TASKS = %u)\n", sched_bench_steps[sched_bench_ctx.step], KERNEL_MAX_TASKS);
+			CO_EXIT(co);
+		}
+		CO_SLEEP(co, SCHED_BENCH_SETTLE_MS);
+		kernel_get_scheduler_stats(&sched_bench_ctx.start);
+		CO_SLEEP(co, SCHED_BENCH_WINDOW_MS);
+		kernel_get_scheduler_stats(&end);
+
+		loops = end.loops - sched_bench_ctx.start.loops;
+		debug_msg("%8u %10u %10u %12u\n", sched_bench_ctx.workers,
+					(loops * 1000) / SCHED_BENCH_WINDOW_MS,
+					((end.dispatches - sched_bench_ctx.start.dispatches) * 1000) / SCHED_BENCH_WINDOW_MS,
+					(loops != 0) ? (uint32_t)((end.cycles - sched_bench_ctx.start.cycles) / loops) : 0);
+	}
+	CO_END(co);
+}
+
+/*
+ * Shell command which runs the benchmark (once)
+ */
+int host_sched_bench(int argc, char *argv[])
+{
+	if (sched_bench_ctx.workers != 0) {
+		debug_msg("the benchmark can run only once\n");
+		return -1;
+	}
+
+	sched_bench_ctx.seed = 1;
+	CO_RESET(&sched_bench_ctx.co);
+	kernel_activate_task_immediately(&sched_bench_task);
+	return 0;
+}
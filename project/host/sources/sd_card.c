@@ -0,0 +1,154 @@
+#include "sd_card.h"
+#include "kernel.h"
+#include "host.h"
+#include "debug_printf.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define debug_msg(format, ...)		debug_printf("[sd_card] " format, ##__VA_ARGS__)
+
+/*
+ * Host version: the card is an image file. Reads complete asynchronously, after
+ * a delay similar to the real one, through the SDIO interrupt as on the target.
+ */
+#define SD_ACCESS_TIME_US			100
+#define SD_BLOCK_TRANSFER_TIME_US	40
+
+static void host_sd_card_transfer_complete(void);
+
+static struct {
+	int32_t fd;
+	SD_HandleTypeDef handle;
+	uint8_t* data;
+	uint32_t block_address;
+	uint32_t block_count;
+	struct HOST_TIMER timer;
+} sd_card = {
+	.fd = -1,
+	.timer = { .callback = host_sd_card_transfer_complete },
+};
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+static void host_sd_card_transfer_complete()
+{
+	NVIC_SetPendingIRQ(SDIO_IRQn);
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+/*
+ * Use the specified file as card
+ */
+int32_t host_sd_card_open(const char* path)
+{
+	struct stat info;
+
+	sd_card.fd = open(path, O_RDONLY);
+	if ((sd_card.fd < 0) || (fstat(sd_card.fd, &info) != 0)) {
+		debug_msg("cannot open %s\n", path);
+		return -1;
+	}
+
+	sd_card.handle.SdCard.BlockSize = BLOCKSIZE;
+	sd_card.handle.SdCard.BlockNbr = info.st_size / BLOCKSIZE;
+	sd_card.handle.SdCard.LogBlockSize = BLOCKSIZE;
+	sd_card.handle.SdCard.LogBlockNbr = sd_card.handle.SdCard.BlockNbr;
+
+	return 0;
+}
+
+uint32_t SD_Init()
+{
+	NVIC_EnableIRQ(SDIO_IRQn);
+	return SD_InitCard();
+}
+
+uint32_t SD_InitCard()
+{
+	if (sd_card.fd < 0)
+		return SD_ERROR_GENERAL_UNKNOWN_ERR;
+	return SD_ERROR_NONE;
+}
+
+/*
+ * Start reading the blocks: the data is copied when the transfer completes
+ */
+uint32_t SD_ReadBlocks_DMA(uint8_t *pData, uint32_t BlockAdd, uint32_t NumberOfBlocks)
+{
+	if (sd_card.fd < 0)
+		return SD_ERROR_GENERAL_UNKNOWN_ERR;
+	if (sd_card.handle.Context != SD_CONTEXT_NONE)
+		return SD_ERROR_BUSY;
+	if ((BlockAdd + NumberOfBlocks) > sd_card.handle.SdCard.BlockNbr)
+		return SD_ERROR_ADDR_OUT_OF_RANGE;
+
+	sd_card.data = pData;
+	sd_card.block_address = BlockAdd;
+	sd_card.block_count = NumberOfBlocks;
+	sd_card.handle.Context = ((NumberOfBlocks > 1) ? SD_CONTEXT_READ_MULTIPLE_BLOCK : SD_CONTEXT_READ_SINGLE_BLOCK) | SD_CONTEXT_DMA;
+	host_timer_start(&sd_card.timer, host_time_us() + SD_ACCESS_TIME_US + (NumberOfBlocks * SD_BLOCK_TRANSFER_TIME_US));
+
+	return SD_ERROR_NONE;
+}
+
+uint32_t SD_Erase(uint32_t BlockStartAdd, uint32_t BlockEndAdd)
+{
+	(void)BlockStartAdd;
+	(void)BlockEndAdd;
+	return SD_ERROR_REQUEST_NOT_APPLICABLE;
+}
+
+void SDIO_IRQHandler()
+{
+	KERNEL_ISR_ENTER(sdio);
+	ssize_t length = (ssize_t)sd_card.block_count * BLOCKSIZE;
+
+	if (sd_card.handle.Context != SD_CONTEXT_NONE) {
+		if (pread(sd_card.fd, sd_card.data, length, (off_t)sd_card.block_address * BLOCKSIZE) != length)
+			debug_msg("read error at block %u\n", sd_card.block_address);
+		sd_card.handle.Context = SD_CONTEXT_NONE;
+	}
+
+	KERNEL_ISR_EXIT(sdio);
+}
+
+void DMA2_Stream3_IRQHandler()
+{
+}
+
+uint32_t SD_ConfigWideBusOperation(uint32_t WideMode)
+{
+	(void)WideMode;
+	return SD_ERROR_NONE;
+}
+
+SD_CardStateTypeDef SD_GetCardState()
+{
+	return (sd_card.fd < 0) ? SD_CARD_ERROR : SD_CARD_TRANSFER;
+}
+
+int32_t SD_GetCardInfo(SD_CardInfoTypeDef *pCardInfo)
+{
+	*pCardInfo = sd_card.handle.SdCard;
+	return SD_ERROR_NONE;
+}
+
+/*
+ * Return the current context of the peripheral
+ */
+uint32_t SD_GetContext()
+{
+	return sd_card.handle.Context;
+}
+
+uint32_t SD_Abort()
+{
+	host_timer_stop(&sd_card.timer);
+	sd_card.handle.Context = SD_CONTEXT_NONE;
+	return SD_ERROR_NONE;
+}
@@ -0,0 +1,166 @@
+#include "spi.h"
+#include "eeprom.h"
+#include "host.h"
+#include "string.h"
+
+/*
+ * Host version: the SPI1 bus and its two devices, the W25Q16 EEPROM which stores the
+ * tuner's images (simulated here) and the tuner (see tuner.c). The bytes take
+ * the time they take at 10.5MHz, so that the firmware download keeps the CPU as busy
+ * as on the target; interrupts are served at the end of each transfer.
+ */
+#define SPI_BYTE_TIME_NS			762		// 8 bits at 10.5MHz
+
+#define EEPROM_SIZE_IN_BYTES		(2UL * 1024 * 1024)
+#define EEPROM_SECTOR_SIZE			4096
+#define EEPROM_JEDEC_ID				0xEF4015	// Winbond, W25Q16
+
+// Commands
+#define EEPROM_CMD_PAGE_PROGRAM			0x02
+#define EEPROM_CMD_READ_DATA			0x03
+#define EEPROM_CMD_WRITE_DISABLE		0x04
+#define EEPROM_CMD_READ_STATUS_REG_1	0x05
+#define EEPROM_CMD_WRITE_ENABLE			0x06
+#define EEPROM_CMD_SECTOR_ERASE			0x20
+#define EEPROM_CMD_READ_JEDEC_ID		0x9F
+
+#define STATUS_REG_WEL				0x02
+
+/*
+ * Partitions programmed on the simulated EEPROM: the images' sizes are close to the
+ * ones of rom00_patch.016, fmhd_radio_5_0_4 and dab_radio_5_0_5, which the tuner
+ * model counts but doesn't check
+ */
+static const struct {
+	const char* name;
+	uint32_t data_size;
+} eeprom_images[] = {
+	{ "bootloader", 5796 },
+	{ "fm_radio", 530000 },
+	{ "dab_radio", 500000 },
+};
+
+static struct {
+	uint8_t selected[2];		// indexed by SPI_HOST_EEPROM/SPI_HOST_SI468X
+	uint8_t memory[EEPROM_SIZE_IN_BYTES];
+	uint8_t command;
+	uint32_t byte_index;		// within the current transaction
+	uint32_t address;
+	uint8_t status_reg_1;
+} spi_bus;
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+/*
+ * One byte exchanged with the EEPROM: the command, 3 address bytes if any and data
+ */
+static uint8_t host_eeprom_transfer(uint8_t value)
+{
+	uint8_t result = 0xFF;
+	uint32_t index = spi_bus.byte_index++;
+
+	if (index == 0) {
+		spi_bus.command = value;
+		spi_bus.address = 0;
+		if (value == EEPROM_CMD_WRITE_ENABLE)
+			spi_bus.status_reg_1 |= STATUS_REG_WEL;
+		else if (value == EEPROM_CMD_WRITE_DISABLE)
+			spi_bus.status_reg_1 &= ~STATUS_REG_WEL;
+		return result;
+	}
+
+	switch (spi_bus.command) {
+	case EEPROM_CMD_READ_JEDEC_ID:
+		if (index <= 3)
+			result = (EEPROM_JEDEC_ID >> (8 * (3 - index))) & 0xFF;
+		break;
+	case EEPROM_CMD_READ_STATUS_REG_1:
+		// Programming and erasing complete immediately
+		result = spi_bus.status_reg_1;
+		break;
+	case EEPROM_CMD_READ_DATA:
+	case EEPROM_CMD_PAGE_PROGRAM:
+	case EEPROM_CMD_SECTOR_ERASE:
+		if (index <= 3) {
+			spi_bus.address = ((spi_bus.address << 8) | value) % EEPROM_SIZE_IN_BYTES;
+			if ((index == 3) && (spi_bus.command == EEPROM_CMD_SECTOR_ERASE) && (spi_bus.status_reg_1 & STATUS_REG_WEL))
+				memset(&spi_bus.memory[spi_bus.address & ~(EEPROM_SECTOR_SIZE - 1)], 0xFF, EEPROM_SECTOR_SIZE);
+		} else if (spi_bus.command == EEPROM_CMD_READ_DATA) {
+			result = spi_bus.memory[spi_bus.address];
+			spi_bus.address = (spi_bus.address + 1) % EEPROM_SIZE_IN_BYTES;
+		} else if ((spi_bus.command == EEPROM_CMD_PAGE_PROGRAM) && (spi_bus.status_reg_1 & STATUS_REG_WEL)) {
+			// Programming clears bits only and wraps around within the page
+			spi_bus.memory[spi_bus.address] &= value;
+			spi_bus.address = (spi_bus.address & ~(EEPROM_PAGE_SIZE_IN_BYTES - 1)) |
+								((spi_bus.address + 1) & (EEPROM_PAGE_SIZE_IN_BYTES - 1));
+		}
+		break;
+	}
+	return result;
+}
+
+static uint8_t host_spi_transfer(uint8_t value)
+{
+	if (spi_bus.selected[SPI_HOST_EEPROM])
+		return host_eeprom_transfer(value);
+	if (spi_bus.selected[SPI_HOST_SI468X])
+		return host_Si468x_transfer(value);
+	return 0xFF;
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+/*
+ * Program the partition table and the (blank) images on the EEPROM
+ */
+void spi_init()
+{
+	PARTITION_INFO partition;
+	uint32_t index, start_page = 1;
+
+	memset(spi_bus.memory, 0xFF, sizeof(spi_bus.memory));
+	for (index=0; index<array_size(eeprom_images); index++) {
+		memset(&partition, 0, sizeof(partition));
+		strcpy(partition.name, eeprom_images[index].name);
+		partition.start_page = start_page;
+		partition.data_size = eeprom_images[index].data_size;
+		partition.final_page = start_page + ((partition.data_size + EEPROM_PAGE_SIZE_IN_BYTES - 1) / EEPROM_PAGE_SIZE_IN_BYTES);
+		memcpy(&spi_bus.memory[index * sizeof(partition)], &partition, sizeof(partition));
+		start_page = partition.final_page;
+	}
+}
+
+void spi_host_set_CS(uint8_t device, uint8_t is_selected)
+{
+	if (is_selected && !spi_bus.selected[device]) {
+		spi_bus.byte_index = 0;
+		if (device == SPI_HOST_SI468X)
+			host_Si468x_select();
+	} else if (!is_selected && spi_bus.selected[device]) {
+		if (device == SPI_HOST_SI468X)
+			host_Si468x_release();
+	}
+	spi_bus.selected[device] = is_selected;
+}
+
+int32_t spi_read(uint8_t* data, uint32_t len)
+{
+	uint32_t index;
+
+	for (index=0; index<len; index++)
+		data[index] = host_spi_transfer(0x00);
+	host_delay_us(((uint64_t)len * SPI_BYTE_TIME_NS + 999) / 1000);
+	return SPI_SUCCESS;
+}
+
+int32_t spi_write(uint8_t* data, uint32_t len)
+{
+	uint32_t index;
+
+	for (index=0; index<len; index++)
+		host_spi_transfer(data[index]);
+	host_delay_us(((uint64_t)len * SPI_BYTE_TIME_NS + 999) / 1000);
+	return SPI_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#include "systick.h"
+#include "host.h"
+#include "debug_printf.h"
+
+#define debug_msg(format, ...)		debug_printf("[systick] " format, ##__VA_ARGS__)
+
+// Host version: the tick count is derived from the simulated time, so that there's
+// no need to simulate the SysTick's interrupt
+
+// Idle statistics (the ones used for the shell report are sampled at every call)
+struct {
+	uint64_t idle_us;
+	uint32_t wakeups;
+	uint64_t last_report_idle_us;
+	uint32_t last_report_wakeups;
+	uint32_t last_report_tick;
+} idle_stats;
+
+/*
+ *	Initialize the SysTick timer
+ */
+void systick_initialize()
+{
+}
+
+/*
+ * 	Get the current SysTick value
+ */
+uint32_t systick_get_tick_count()
+{
+	host_irq_service();
+	return (uint32_t)(host_time_us() / 1000);
+}
+
+/*
+ *
+ */
+void systick_wait_for_ms(uint32_t delay)
+{
+	host_delay_us(delay * 1000);
+}
+
+/*
+ *	Sleep for up to "ticks" milliseconds or until an interrupt occurs. Like on the
+ *	target, it is called with PRIMASK set and the pending ISR is served once it is
+ *	cleared.
+ */
+void systick_sleep_for_ticks(uint32_t ticks)
+{
+	uint64_t start_us;
+
+	if (ticks == 0)
+		return;
+	if (ticks > SYSTICK_MAX_IDLE_TICKS)
+		ticks = SYSTICK_MAX_IDLE_TICKS;
+
+	start_us = host_time_us();
+	host_wait_until(((start_us / 1000) + ticks) * 1000);
+
+	idle_stats.idle_us += host_time_us() - start_us;
+	idle_stats.wakeups++;
+}
+
+/*
+ * Shell command for reading the current tick count
+ */
+int systick_gettime(int argc, char *argv[])
+{
+	debug_msg("Current time = %d\n", systick_get_tick_count());
+}
+
+/*
+ * Shell command which reports the idle percentage and the number of wake-ups per
+ * second since its previous call
+ */
+int systick_idle_stats(int argc, char *argv[])
+{
+	uint32_t curr_tick = systick_get_tick_count();
+	uint32_t elapsed_ms = curr_tick - idle_stats.last_report_tick;
+	uint32_t idle_ms = (uint32_t)((idle_stats.idle_us - idle_stats.last_report_idle_us) / 1000);
+	uint32_t wakeups = idle_stats.wakeups - idle_stats.last_report_wakeups;
+
+	if (elapsed_ms == 0) {
+		debug_msg("No time elapsed since the last report\n");
+		return -1;
+	}
+
+	debug_msg("Idle = %d%% (%d ms over %d ms)\n", (idle_ms * 100) / elapsed_ms, idle_ms, elapsed_ms);
+	debug_msg("Wake-ups = %d/s\n", (uint32_t)(((uint64_t)wakeups * 1000) / elapsed_ms));
+
+	idle_stats.last_report_tick = curr_tick;
+	idle_stats.last_report_idle_us = idle_stats.idle_us;
+	idle_stats.last_report_wakeups = idle_stats.wakeups;
+
+	return 0;
+}
@@ -0,0 +1,17 @@
+#include "timer.h"
+#include "host.h"
+
+/*
+ * Host version: TIM2 is not simulated, delays are taken from the simulated time
+ */
+void timer_init()
+{
+}
+
+/*
+ *	Wait for the specified amount of microseconds
+ */
+void timer_wait_us(uint32_t us_delay)
+{
+	host_delay_us(us_delay);
+}
@@ -0,0 +1,268 @@
+#include "host.h"
+#include "utils.h"
+#include "debug_printf.h"
+#include "string.h"
+
+#define debug_msg(format, ...)		debug_printf("[tuner] " format, ##__VA_ARGS__)
+
+/*
+ * Simulation of the Si4684 tuner behind the SPI (see spi.c), as far as the driver's
+ * boot sequence and commands need it. A command is executed when the chip select is
+ * released and CTS is cleared until it completes: after TUNER_COMMAND_US for most of
+ * them, after TUNER_BOOT_MS for the BOOT of the application image. The images are
+ * counted but not checked, and commands sent while CTS is clear (or in the wrong
+ * state) set ERRCMD. The reset line (PD8) is sampled at each chip select: a pulse
+ * since the previous one restarts the tuner.
+ */
+#define TUNER_COMMAND_US			20
+#define TUNER_BOOT_MS				400
+#define TUNER_REPLY_SIZE			32
+#define TUNER_MAX_PROPERTIES		32
+
+// Commands
+#define CMD_RD_REPLY				0x00
+#define CMD_POWER_UP				0x01
+#define CMD_HOST_LOAD				0x04
+#define CMD_LOAD_INIT				0x06
+#define CMD_BOOT					0x07
+#define CMD_GET_PART_INFO			0x08
+#define CMD_SET_PROPERTY			0x13
+#define CMD_GET_PROPERTY			0x14
+#define CMD_FM_TUNE_FREQ			0x30
+#define CMD_DAB_TUNE_FREQ			0xB0
+#define CMD_DAB_GET_FREQ_LIST		0xB9
+
+// Status
+#define STATUS0_STCINT				0x01
+#define STATUS0_ERRCMD				0x40
+#define STATUS0_CTS					0x80
+#define PUP_STATE_BOOTLOADER		0x80
+#define PUP_STATE_APPLICATION		0xC0
+
+// Part info and default DAB frequency list (band III)
+#define TUNER_PART_NUMBER			4684
+#define TUNER_CHIP_REV				2
+#define TUNER_ROM_ID				6
+#define TUNER_DAB_FREQS				41
+#define TUNER_DAB_FIRST_FREQ_KHZ	174928
+
+typedef enum {
+	TUNER_RESET,			// reset asserted or not powered up yet
+	TUNER_BOOTLOADER,
+	TUNER_APPLICATION,
+} TUNER_STATE;
+
+static struct {
+	TUNER_STATE state;
+	uint8_t in_reset;
+	uint8_t status0;
+	uint64_t cts_at_us;				// completion of the last command
+	uint64_t powered_up_at_us;
+	uint8_t cmd[16];				// first bytes of the current transaction
+	uint32_t byte_index;
+	uint8_t reply[TUNER_REPLY_SIZE];	// reply to the last command, after the status bytes
+	uint8_t loading;				// LOAD_INIT received, HOST_LOAD accepted
+	uint8_t images;					// images completely sent
+	uint32_t image_bytes;
+	struct {
+		uint16_t id;
+		uint16_t value;
+	} properties[TUNER_MAX_PROPERTIES];
+	uint8_t properties_count;
+} tuner;
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+static uint8_t host_Si468x_is_cts()
+{
+	return host_time_us() >= tuner.cts_at_us;
+}
+
+static void host_Si468x_put_u32(uint8_t* dest, uint32_t value)
+{
+	dest[0] = value & 0xFF;
+	dest[1] = (value >> 8) & 0xFF;
+	dest[2] = (value >> 16) & 0xFF;
+	dest[3] = (value >> 24) & 0xFF;
+}
+
+static uint16_t* host_Si468x_property(uint16_t id)
+{
+	uint8_t index;
+
+	for (index=0; index<tuner.properties_count; index++) {
+		if (tuner.properties[index].id == id)
+			return &tuner.properties[index].value;
+	}
+	if (tuner.properties_count == TUNER_MAX_PROPERTIES)
+		return NULL;
+	tuner.properties[index].id = id;
+	tuner.properties[index].value = 0;
+	tuner.properties_count++;
+	return &tuner.properties[index].value;
+}
+
+/*
+ * Execute the command just received. Returns FALSE if it's not valid in the current state.
+ */
+static uint8_t host_Si468x_execute(uint8_t length)
+{
+	uint32_t busy_us = TUNER_COMMAND_US;
+	uint16_t* property;
+
+	memset(tuner.reply, 0, sizeof(tuner.reply));
+	tuner.status0 &= ~STATUS0_STCINT;
+
+	switch (tuner.cmd[0]) {
+	case CMD_POWER_UP:
+		if (tuner.state != TUNER_RESET)
+			return FALSE;
+		tuner.state = TUNER_BOOTLOADER;
+		tuner.powered_up_at_us = host_time_us();
+		tuner.images = 0;
+		tuner.loading = FALSE;
+		break;
+	case CMD_LOAD_INIT:
+		if (tuner.state != TUNER_BOOTLOADER)
+			return FALSE;
+		if (tuner.loading && (tuner.image_bytes > 0))
+			tuner.images++;
+		tuner.loading = TRUE;
+		tuner.image_bytes = 0;
+		break;
+	case CMD_HOST_LOAD:
+		if ((tuner.state != TUNER_BOOTLOADER) || !tuner.loading)
+			return FALSE;
+		break;
+	case CMD_BOOT:
+		// The patch and the application image must have been sent
+		if ((tuner.state != TUNER_BOOTLOADER) || !tuner.loading || (tuner.image_bytes == 0) || (tuner.images == 0))
+			return FALSE;
+		debug_msg("booting a %u bytes image, %u ms after the power-up\n", tuner.image_bytes,
+					(uint32_t)((host_time_us() - tuner.powered_up_at_us) / 1000));
+		tuner.loading = FALSE;
+		tuner.state = TUNER_APPLICATION;
+		busy_us = TUNER_BOOT_MS * 1000;
+		break;
+	case CMD_GET_PART_INFO:
+		tuner.reply[0] = TUNER_CHIP_REV;
+		tuner.reply[1] = TUNER_ROM_ID;
+		tuner.reply[4] = TUNER_PART_NUMBER & 0xFF;
+		tuner.reply[5] = TUNER_PART_NUMBER >> 8;
+		break;
+	case CMD_SET_PROPERTY:
+	case CMD_GET_PROPERTY:
+		if ((tuner.state != TUNER_APPLICATION) || (length < 4))
+			return FALSE;
+		property = host_Si468x_property(tuner.cmd[2] | ((uint16_t)tuner.cmd[3] << 8));
+		if (property == NULL)
+			return FALSE;
+		if (tuner.cmd[0] == CMD_SET_PROPERTY) {
+			if (length < 6)
+				return FALSE;
+			*property = tuner.cmd[4] | ((uint16_t)tuner.cmd[5] << 8);
+		} else {
+			tuner.reply[0] = *property & 0xFF;
+			tuner.reply[1] = *property >> 8;
+		}
+		break;
+	case CMD_DAB_GET_FREQ_LIST:
+		if (tuner.state != TUNER_APPLICATION)
+			return FALSE;
+		tuner.reply[0] = TUNER_DAB_FREQS;
+		host_Si468x_put_u32(&tuner.reply[4], TUNER_DAB_FIRST_FREQ_KHZ);
+		break;
+	case CMD_FM_TUNE_FREQ:
+	case CMD_DAB_TUNE_FREQ:
+		if (tuner.state != TUNER_APPLICATION)
+			return FALSE;
+		// There's no signal: the tune completes at once
+		tuner.status0 |= STATUS0_STCINT;
+		break;
+	default:
+		// The other commands of the application reply with zeros
+		if (tuner.state != TUNER_APPLICATION)
+			return FALSE;
+		break;
+	}
+	tuner.cts_at_us = host_time_us() + busy_us;
+	return TRUE;
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+void host_Si468x_select()
+{
+	uint32_t bsrr = GPIOD->BSRR;
+
+	if (bsrr & GPIO_BSRR_BR8) {
+		tuner.state = TUNER_RESET;
+		tuner.status0 = 0;
+		tuner.cts_at_us = 0;
+		tuner.properties_count = 0;
+	}
+	// The set has priority, as on the target
+	if (bsrr & GPIO_BSRR_BS8)
+		tuner.in_reset = FALSE;
+	else if (bsrr & GPIO_BSRR_BR8)
+		tuner.in_reset = TRUE;
+	GPIOD->BSRR = bsrr & ~(GPIO_BSRR_BR8 | GPIO_BSRR_BS8);
+
+	tuner.byte_index = 0;
+}
+
+/*
+ * One byte exchanged with the tuner: a reply is read through RD_REPLY, whose first
+ * 4 bytes are the status
+ */
+uint8_t host_Si468x_transfer(uint8_t value)
+{
+	uint32_t index = tuner.byte_index++;
+
+	if (tuner.in_reset)
+		return 0x00;
+
+	if (index < sizeof(tuner.cmd))
+		tuner.cmd[index] = value;
+	if (tuner.cmd[0] == CMD_HOST_LOAD) {
+		if (index >= 4)
+			tuner.image_bytes++;
+		return 0x00;
+	}
+	if ((tuner.cmd[0] != CMD_RD_REPLY) || (index == 0))
+		return 0x00;
+
+	switch (index) {
+	case 1:
+		return tuner.status0 | (host_Si468x_is_cts() ? STATUS0_CTS : 0);
+	case 2:
+	case 3:
+		return 0x00;
+	case 4:
+		if (tuner.state == TUNER_BOOTLOADER)
+			return PUP_STATE_BOOTLOADER;
+		return (tuner.state == TUNER_APPLICATION) ? PUP_STATE_APPLICATION : 0x00;
+	default:
+		return (index - 5 < sizeof(tuner.reply)) ? tuner.reply[index - 5] : 0x00;
+	}
+}
+
+/*
+ * A command is complete when the chip select is released
+ */
+void host_Si468x_release()
+{
+	uint8_t length = min(tuner.byte_index, sizeof(tuner.cmd));
+
+	if (tuner.in_reset || (tuner.byte_index == 0) || (tuner.cmd[0] == CMD_RD_REPLY))
+		return;
+
+	if (!host_Si468x_is_cts() || !host_Si468x_execute(length)) {
+		debug_msg("command 0x%02x rejected\n", tuner.cmd[0]);
+		tuner.status0 |= STATUS0_ERRCMD;
+		return;
+	}
+	tuner.status0 &= ~STATUS0_ERRCMD;
+}
@@ -0,0 +1,298 @@
+#include "uart.h"
+#include "shell.h"
+#include "kernel.h"
+#include "buttons.h"
+#include "host.h"
+#include "debug_printf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+
+#define debug_msg(format, ...)		debug_printf("[console] " format, ##__VA_ARGS__)
+
+// Constants
+#define ESC_ASCII_CODE		0x1B
+
+/*
+ * Host version: stdout is the UART's TX line and stdin feeds the RX interrupt.
+ * Lines starting with '@' are not sent to the firmware, but they're directives for
+ * the simulator:
+ *		@key <up|down|left|right|ok|cancel|vol+|vol-> [hold_ms]
+ *		@wait <ms>
+ *		@display
+ *		@quit
+ * When stdin is not a terminal (i.e. a script), a line is sent to the shell only once
+ * the previous one was processed.
+ */
+#define CONSOLE_FIFO_SIZE				1024
+#define CONSOLE_DIRECTIVE_MAX_LENGTH	64
+#define CONSOLE_POLL_INTERVAL_US		1000
+#define CONSOLE_KEY_HOLD_MS				150
+
+extern struct KERNEL_TIMER shell_timer;
+
+static const struct {
+	const char* name;
+	uint8_t key;
+} console_keys[] = {
+	{ "up", KEY_UP },
+	{ "down", KEY_DOWN },
+	{ "left", KEY_LEFT },
+	{ "right", KEY_RIGHT },
+	{ "ok", KEY_OK },
+	{ "cancel", KEY_CANCEL },
+	{ "vol+", KEY_VOL_UP },
+	{ "vol-", KEY_VOL_DOWN },
+};
+
+static void host_console_resume(void);
+
+static struct {
+	int32_t fd;				// -1 once stdin is closed
+	uint8_t is_tty;
+	struct termios saved_termios;
+	uint64_t last_poll_us;
+	uint8_t fifo[CONSOLE_FIFO_SIZE];
+	uint16_t fifo_start;
+	uint16_t fifo_count;
+	uint8_t at_line_start;
+	uint8_t in_directive;
+	char directive[CONSOLE_DIRECTIVE_MAX_LENGTH];
+	uint8_t directive_length;
+	uint64_t hold_until_us;			// set by @wait
+	uint8_t waiting_for_shell;
+	uint32_t shell_calls;
+	struct HOST_TIMER resume_timer;
+} console = {
+	.fd = -1,
+	.resume_timer = { .callback = host_console_resume },
+};
+
+/*******************************************************************************/
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+static void host_console_resume()
+{
+	NVIC_SetPendingIRQ(USART2_IRQn);
+}
+
+static void host_console_echo(char* text)
+{
+	if (!console.is_tty)
+		return;
+	while (*text != '\0')
+		uart_put_char(*text++);
+}
+
+/*
+ * Execute a directive line (without the leading '@')
+ */
+static void host_console_run_directive(char* line)
+{
+	char* cmd = strtok(line, " ");
+	char* arg1 = strtok(NULL, " ");
+	char* arg2 = strtok(NULL, " ");
+	uint8_t index;
+
+	if (cmd == NULL)
+		return;
+
+	if ((strcmp(cmd, "key") == 0) && (arg1 != NULL)) {
+		for (index=0; index<array_size(console_keys); index++) {
+			if (strcmp(console_keys[index].name, arg1) == 0) {
+				host_keypad_press(console_keys[index].key, (arg2 != NULL) ? atoi(arg2) : CONSOLE_KEY_HOLD_MS);
+				return;
+			}
+		}
+		debug_msg("unknown key %s\n", arg1);
+	} else if ((strcmp(cmd, "wait") == 0) && (arg1 != NULL)) {
+		console.hold_until_us = host_time_us() + ((uint64_t)atoi(arg1) * 1000);
+		host_timer_start(&console.resume_timer, console.hold_until_us);
+	} else if (strcmp(cmd, "display") == 0) {
+		host_display_print();
+	} else if (strcmp(cmd, "quit") == 0) {
+		host_exit(EXIT_SUCCESS);
+	} else {
+		debug_msg("usage: @key <name> [hold_ms] | @wait <ms> | @display | @quit\n");
+	}
+}
+
+/*
+ * Collect the chars of a directive line
+ */
+static void host_console_directive_char(uint8_t c)
+{
+	char echo[2] = { c, '\0' };
+
+	if ((c == '\n') || (c == '\r')) {
+		console.directive[console.directive_length] = '\0';
+		console.in_directive = FALSE;
+		console.at_line_start = TRUE;
+		host_console_echo("\n");
+		host_console_run_directive(console.directive);
+	} else if ((c == '\b') || (c == 0x7F)) {
+		if (console.directive_length > 0) {
+			console.directive_length--;
+			host_console_echo("\b \b");
+		}
+	} else if (console.directive_length < (CONSOLE_DIRECTIVE_MAX_LENGTH-1)) {
+		console.directive[console.directive_length++] = c;
+		host_console_echo(echo);
+	}
+}
+
+static uint8_t host_console_is_on_hold(uint64_t now_us)
+{
+	return (console.waiting_for_shell || (now_us < console.hold_until_us));
+}
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+/*
+ * Initialize the UART
+ */
+int uart_init()
+{
+	struct termios raw_termios;
+
+	console.fd = STDIN_FILENO;
+	console.at_line_start = TRUE;
+	console.is_tty = isatty(console.fd);
+	if (console.is_tty) {
+		// Chars are sent as they're typed and the shell echoes them back, as with
+		// a serial terminal
+		tcgetattr(console.fd, &console.saved_termios);
+		raw_termios = console.saved_termios;
+		raw_termios.c_lflag &= ~(ICANON | ECHO);
+		raw_termios.c_cc[VMIN] = 1;
+		raw_termios.c_cc[VTIME] = 0;
+		tcsetattr(console.fd, TCSANOW, &raw_termios);
+		setvbuf(stdout, NULL, _IONBF, 0);
+	} else {
+		setvbuf(stdout, NULL, _IOLBF, 0);
+	}
+
+	NVIC_EnableIRQ(USART2_IRQn);
+
+	return UART_SUCCECSS;
+}
+
+/*
+ * Clear the terminal on the PC side (for a clearer reading)
+ */
+void uart_erase_console()
+{
+	uart_put_char(ESC_ASCII_CODE);
+	uart_put_char('[');
+	uart_put_char('2');
+	uart_put_char('J');
+}
+
+/*
+ * Cancel only the current line from the console
+ */
+void uart_erase_line()
+{
+	uart_put_char(ESC_ASCII_CODE);
+	uart_put_char('[');
+	uart_put_char('K');
+}
+
+/*
+ * Output a single character
+ */
+int uart_put_char(uint8_t c)
+{
+	putchar(c);
+	return UART_SUCCECSS;
+}
+
+/*
+ * This is the ISR for the UART
+ */
+void USART2_IRQHandler()
+{
+	KERNEL_ISR_ENTER(usart2);
+	uint8_t c;
+
+	while ((console.fifo_count > 0) && !host_console_is_on_hold(host_time_us())) {
+		c = console.fifo[console.fifo_start];
+		console.fifo_start = (console.fifo_start + 1) % CONSOLE_FIFO_SIZE;
+		console.fifo_count--;
+
+		if (console.in_directive) {
+			host_console_directive_char(c);
+		} else if (console.at_line_start && (c == '@')) {
+			console.in_directive = TRUE;
+			console.directive_length = 0;
+			host_console_echo("@");
+		} else {
+			console.at_line_start = ((c == '\n') || (c == '\r'));
+			shell_add_char(c);
+			if (console.at_line_start && !console.is_tty) {
+				console.waiting_for_shell = TRUE;
+				console.shell_calls = shell_timer.calls;
+			}
+		}
+	}
+
+	KERNEL_ISR_EXIT(usart2);
+}
+
+/*
+ * Read what was typed (at most once per millisecond) and raise the RX interrupt if
+ * there's something to deliver. Returns TRUE if the interrupt was raised.
+ */
+uint8_t host_console_update(uint64_t now_us)
+{
+	struct pollfd input = { .fd = console.fd, .events = POLLIN };
+	uint8_t buffer[256];
+	ssize_t length, index;
+	size_t free_space = CONSOLE_FIFO_SIZE - console.fifo_count;
+
+	if ((console.fd >= 0) && (free_space > 0) && ((now_us - console.last_poll_us) >= CONSOLE_POLL_INTERVAL_US)) {
+		console.last_poll_us = now_us;
+		if (poll(&input, 1, 0) > 0) {
+			length = read(console.fd, buffer, (free_space < sizeof(buffer)) ? free_space : sizeof(buffer));
+			if (length <= 0)
+				console.fd = -1;
+			for (index=0; index<length; index++) {
+				console.fifo[(console.fifo_start + console.fifo_count) % CONSOLE_FIFO_SIZE] = buffer[index];
+				console.fifo_count++;
+			}
+		}
+	}
+
+	// The shell has processed the previous line once its timer's callback completed
+	if (console.waiting_for_shell && (shell_timer.calls != console.shell_calls)) {
+		console.waiting_for_shell = FALSE;
+	}
+
+	if ((console.fifo_count == 0) || host_console_is_on_hold(now_us))
+		return FALSE;
+	NVIC_SetPendingIRQ(USART2_IRQn);
+	return TRUE;
+}
+
+/*
+ * File descriptor to be watched while sleeping (-1 if there's nothing to read)
+ */
+int32_t host_console_fd()
+{
+	if ((console.fd < 0) || (console.fifo_count == CONSOLE_FIFO_SIZE))
+		return -1;
+	return console.fd;
+}
+
+/*
+ * Restore the terminal's settings
+ */
+void host_console_restore()
+{
+	if (console.is_tty)
+		tcsetattr(STDIN_FILENO, TCSANOW, &console.saved_termios);
+}
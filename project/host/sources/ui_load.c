@@ -0,0 +1,68 @@
+#include "host.h"
+#include "kernel.h"
+#include "debug_printf.h"
+#include "string.h"
+#include <stdlib.h>
+
+#define debug_msg(format, ...)		debug_printf("[ui_load] " format, ##__VA_ARGS__)
+
+/*
+ * Slow user interface: a task with the UI's priority which is always ready, like an
+ * animation whose redraws take "run_ms" each, yielding between two of them. A redraw
+ * is split into short busy waits, so that the interrupts and the real-time tasks
+ * preempt it as they would on the target. The cooperative tasks with a lower priority
+ * (such as the decoder's one) don't run until the load stops, while the ones of the
+ * deadline class are served first.
+ */
+#define UI_LOAD_PRIORITY			200		// as the UI's tasks
+#define UI_LOAD_STEP_US				100
+
+ALLOCATE_TASK(ui_load, UI_LOAD_PRIORITY);
+
+static struct {
+	uint32_t run_us;
+	uint32_t end_tick;
+	uint8_t is_running;
+	uint32_t redraws;
+} ui_load_ctx;
+
+/*******************************************************************************/
+/*	PUBLIC FUNCTIONS
+/*******************************************************************************/
+int32_t ui_load_task_func()
+{
+	uint32_t elapsed_us;
+
+	if (!ui_load_ctx.is_running || kernel_is_tick_reached(systick_get_tick_count(), ui_load_ctx.end_tick)) {
+		debug_msg("stopped after %u redraws\n", ui_load_ctx.redraws);
+		ui_load_ctx.is_running = FALSE;
+		return DIE;
+	}
+
+	for (elapsed_us=0; elapsed_us<ui_load_ctx.run_us; elapsed_us+=UI_LOAD_STEP_US)
+		host_delay_us(UI_LOAD_STEP_US);
+	ui_load_ctx.redraws++;
+	return IMMEDIATELY;
+}
+
+/*
+ * Shell command which starts the load: "ui_load <run_ms> <ms>", "ui_load off" stops it
+ */
+int host_ui_load(int argc, char *argv[])
+{
+	if ((argc == 1) && (strcmp(argv[0], "off") == 0)) {
+		ui_load_ctx.is_running = FALSE;
+		return 0;
+	}
+	if (argc != 2) {
+		debug_msg("usage: ui_load <run_ms> <ms> | off\n");
+		return -1;
+	}
+
+	ui_load_ctx.run_us = strtoul(argv[0], NULL, 0) * 1000;
+	ui_load_ctx.end_tick = systick_get_tick_count() + strtoul(argv[1], NULL, 0);
+	ui_load_ctx.redraws = 0;
+	ui_load_ctx.is_running = TRUE;
+	kernel_activate_task_immediately(&ui_load_task);
+	return 0;
+}
@@ -2,6 +2,7 @@
 #define _BUTTONS_H_
 
 #include "stdint.h"
+#include "kernel.h"
 
 #define KEY_RELEASED			0
 #define KEY_PRESSED_DEBOUNCING	1
@@ -17,10 +18,20 @@
 #define KEY_VOL_DOWN	7
 #define KEY_NONE		0xFF
 
+// Item posted to the registered key events' mailbox
+struct KEY_EVENT {
+	uint8_t key;
+	uint8_t event;	// KEY_PRESSED or KEY_RELEASED
+};
+
+// Flags for buttons_register_key_event_mailbox()
+#define KEY_EVENTS_PRESS_ONLY		0x00
+#define KEY_EVENTS_WITH_RELEASE		0x01
+
 // Public functions
 void buttons_init(void);
-int32_t buttons_register_key_event_callback(void (*func)(uint8_t, uint8_t));
-int32_t buttons_remove_key_event_callback(void);
+int32_t buttons_register_key_event_mailbox(struct MAILBOX* mailbox, uint8_t flags);
+int32_t buttons_remove_key_event_mailbox(void);
 
 // Interrupts
 void EXTI0_IRQHandler(void);
@@ -0,0 +1,13 @@
+#ifndef _CYCLE_COUNTER_H_
+#define _CYCLE_COUNTER_H_
+
+#include "stdint.h"
+
+// The counter is incremented at every core clock cycle
+#define CYCLE_COUNTER_FREQ		168000000UL
+#define CYCLES_PER_US			(CYCLE_COUNTER_FREQ/1000000UL)
+
+void cycle_counter_init(void);
+uint32_t cycle_counter_get(void);
+
+#endif // _CYCLE_COUNTER_H_
@@ -6,7 +6,7 @@
 #define EEPROM_PAGE_SIZE_IN_BYTES      256
 #define MAX_PARTITION_NAME_LENGTH		16
 
-#pragma pack(1)
+#pragma pack(push, 1)
 typedef struct {
 	char name[MAX_PARTITION_NAME_LENGTH];
 	uint32_t start_page;
@@ -14,7 +14,7 @@ typedef struct {
     uint32_t data_size;
 	uint32_t checksum;
 } PARTITION_INFO;
-#pragma pop
+#pragma pack(pop)
 
 // public functions
 void eeprom_init(void);
@@ -3,11 +3,22 @@
 
 #include "stdint.h"
 
+#ifndef HOST_BUILD
 #define FSMC_DATA_ADDRESS			((volatile uint8_t*) 0x60010000) 	// D/C = 1
 #define FSMC_COMMAND_ADDRESS		((volatile uint8_t*) 0x60000000) 	// D/C = 0
 
 #define fsmc_read(addr)				((*addr))
 #define fsmc_write(addr, val)		((*addr) = (val))
+#else
+// Host build: bus cycles are forwarded to the simulated display controller
+#define FSMC_DATA_ADDRESS			1 	// D/C = 1
+#define FSMC_COMMAND_ADDRESS		0 	// D/C = 0
+
+#define fsmc_read(addr)				fsmc_host_read(addr)
+#define fsmc_write(addr, val)		fsmc_host_write(addr, val)
+uint8_t fsmc_host_read(uint8_t dc);
+void fsmc_host_write(uint8_t dc, uint8_t value);
+#endif
 void fsmc_init(void);
 
 #endif //_FSMC_H_
@@ -3,24 +3,102 @@
 
 #include "stdint.h"
 #include "utils.h"
+#include "systick.h"
+#include "cycle_counter.h"
 
 // Allowed task states
 #define TASK_STATE_DEAD 					0x00
 #define TASK_STATE_RUNNING 					0x01
 #define TASK_STATE_SLEEPING					0x02
 #define TASK_STATE_WAITING_FOR_RESUME		0x04
+#define TASK_STATE_READY					0x08
 
 // Task return options (other than "real" sleeping values)
 #define IMMEDIATELY     	((int32_t)0)
 #define WAIT_FOR_RESUME     ((int32_t)-1)
 #define DIE		            ((int32_t)-2)
 
+// Scheduler sizing
+#ifndef KERNEL_MAX_TASKS
+#define KERNEL_MAX_TASKS					32
+#endif
+#define KERNEL_PRIORITY_LEVELS				256
+#define TASK_ID_NONE						((uint16_t)0xFFFF)
+#define KERNEL_ISR_RING_SIZE				32		// must be a power of 2
+#define KERNEL_MAX_ISRS						16		// ISRs monitored by the watchdog
+#define KERNEL_WATCHDOG_RING_SIZE			16		// must be a power of 2
+#define KERNEL_TIMERS_PRIORITY				10		// priority of the task which runs the timers' callbacks
+#define KERNEL_BOOT_PRIORITY				50		// priority of the tasks which initialize the peripherals
+#define KERNEL_BOOT_SETTLE_MS				50		// supplies' settling time before the peripherals are initialized
+#define KERNEL_MAX_BOOT_STEPS				8
+#define KERNEL_MAX_RT_TASKS					8
+#define RT_TASK_ID_NONE						((uint8_t)0xFF)
+#ifndef KERNEL_RT_STACK_SIZE
+#define KERNEL_RT_STACK_SIZE				8192	// bytes, shared with the ISRs which preempt them
+#endif
+#define KERNEL_RT_PRIORITY					((1UL << __NVIC_PRIO_BITS) - 1)	// PendSV: lowest among the exceptions
+
+// Non-yield watchdog: default longest allowed run for tasks without a declared
+// budget and for ISRs (both can be changed from the shell)
+#ifndef KERNEL_WATCHDOG_TASK_THRESHOLD_US
+#define KERNEL_WATCHDOG_TASK_THRESHOLD_US	10000
+#endif
+#ifndef KERNEL_WATCHDOG_ISR_THRESHOLD_US
+#define KERNEL_WATCHDOG_ISR_THRESHOLD_US	100
+#endif
+
+// Wraparound-safe comparison between two tick counts: TRUE if "_tick_" is at
+// or after "_reference_" (valid as long as they are less than 2^31 ticks apart)
+#define kernel_is_tick_reached(_tick_, _reference_)	((int32_t)((uint32_t)(_tick_) - (uint32_t)(_reference_)) >= 0)
+
 // Global interrupt control macros
 #define kernel_disable_configurable_interrupts()		//__asm("cpsid i")
 #define kernel_enable_configurable_interrupts()			//__asm("cpsie i")
 #define kernel_disable_all_interrupts()					//__asm("cpsid f")
 #define kernel_enable_all_interrupts()					//__asm("cpsie f")
 
+// Execution statistics of a task (times are expressed in CPU cycles)
+#define TASK_STATS_HISTOGRAM_BINS		32
+struct TASK_STATS {
+	uint32_t calls;
+	uint64_t total_cycles;
+	uint32_t max_cycles;
+	uint32_t histogram[TASK_STATS_HISTOGRAM_BINS];	// bin "n" counts the runs lasting [2^n, 2^(n+1)) cycles
+	uint32_t watchdog_violations;	// runs longer than the budget (or the watchdog's threshold)
+	uint32_t deadline_misses;		// deadline class: runs completed after their absolute deadline
+	uint32_t max_lateness;			// deadline class: worst completion delay after the deadline (ms)
+};
+
+// Execution statistics of an ISR. Handlers must enclose their whole body between
+// KERNEL_ISR_ENTER() and KERNEL_ISR_EXIT(), without returning in the middle. The
+// time spent in nested ISRs is accounted also to the preempted one.
+struct ISR_STATS {
+	const char* name;
+	uint32_t calls;
+	uint32_t max_cycles;
+	uint32_t watchdog_violations;
+	uint8_t is_registered;
+};
+
+// Activity of the scheduler's loop (since the last "top reset"). Its own cycles are
+// the ones spent choosing and accounting the tasks, without their runs and the idle
+// time (the ISRs which preempt the loop are included). The ISRs' activation ring's
+// errors are counted since the reset instead.
+struct SCHEDULER_STATS {
+	uint32_t loops;
+	uint32_t dispatches;		// tasks executed
+	uint64_t cycles;
+	uint32_t isr_overflows;		// activations lost because the ring was full
+	uint32_t isr_duplicates;	// tasks found twice in the ring
+};
+
+#define KERNEL_ISR_ENTER(_name_)	\
+	static struct ISR_STATS _name_##_isr_stats = { .name = #_name_ };	\
+	uint32_t _name_##_isr_start_cycles = cycle_counter_get()
+
+#define KERNEL_ISR_EXIT(_name_)	\
+	kernel_isr_completed(&_name_##_isr_stats, cycle_counter_get() - _name_##_isr_start_cycles)
+
 // Task structure
 struct TASK {
 	uint8_t status;		// status of the task
@@ -29,7 +107,17 @@ struct TASK {
 	char* name;
 	int32_t (*func)(void);
 	uint32_t resume_at_tickcount;
-	struct TASK* next_task;
+	struct TASK* next_task;		// link inside the ready queue of its priority level
+	uint16_t heap_index;		// position inside the sleeping (or deadline) tasks' heap
+	uint8_t activation_pending;	// activation requested while the task was running
+	uint8_t isr_activation_queued;	// the task is already in the ISRs' activation ring
+	uint16_t period;				// deadline class: minimum time between two releases (ms, 0 = none)
+	uint16_t relative_deadline;		// deadline class: 0 = best-effort task (ms)
+	uint32_t release_tickcount;		// deadline class: tick at which the current job was released
+	uint32_t absolute_deadline;		// deadline class: tick by which the current job must complete
+	uint32_t budget_us;				// longest run allowed by the watchdog (0 = global threshold)
+	uint8_t is_boot_step;			// the boot is not completed until the task dies
+	struct TASK_STATS stats;
 };
 
 #define ALLOCATE_TASK(_name_, _priority_)	\
@@ -40,9 +128,194 @@ struct TASK {
 		.name = #_name_, \
 		.func = _name_##_task_func, \
 		.next_task = NULL,	\
+		.id = TASK_ID_NONE,	\
 		.status = TASK_STATE_DEAD,	\
 	};
 
+// Tasks of the deadline class are scheduled Earliest-Deadline-First before any
+// best-effort task (their priority only orders them once they're made best-effort).
+// Each activation, or resume, releases a job which must complete within "_deadline_"
+// ms (if 0 then it's the period). Jobs are released at most once every "_period_" ms:
+// earlier activations are deferred, so that they can't starve the best-effort tasks.
+#define ALLOCATE_DEADLINE_TASK(_name_, _priority_, _period_, _deadline_)	\
+    int32_t _name_##_task_func(); \
+	struct TASK _name_##_task = {	\
+		.priority = _priority_, \
+		.resume_at_tickcount = 0,	\
+		.name = #_name_, \
+		.func = _name_##_task_func, \
+		.next_task = NULL,	\
+		.id = TASK_ID_NONE,	\
+		.status = TASK_STATE_DEAD,	\
+		.period = _period_,	\
+		.relative_deadline = ((_deadline_) != 0) ? (_deadline_) : (_period_),	\
+	};
+
+// Mailbox: fixed-capacity FIFO of items of the same type. The receiver task is
+// activated only when the mailbox goes from empty to not-empty, so it should
+// drain all the items every time it runs.
+struct MAILBOX {
+	uint8_t* items;
+	uint16_t item_size;
+	uint16_t capacity;
+	uint16_t head;			// index of the oldest item
+	uint16_t count;
+	uint32_t overflows;		// items rejected because the mailbox was full
+	uint32_t received;		// items extracted by the receiver
+	uint32_t wakeups;		// activations of the receiver
+	struct TASK* receiver;	// task to be woken up (can be NULL)
+};
+
+#define ALLOCATE_MAILBOX(_name_, _type_, _capacity_)	\
+	_type_ _name_##_mailbox_items[_capacity_];	\
+	struct MAILBOX _name_##_mailbox = {	\
+		.items = (uint8_t*)_name_##_mailbox_items, \
+		.item_size = sizeof(_type_), \
+		.capacity = _capacity_, \
+		.head = 0,	\
+		.count = 0,	\
+		.overflows = 0,	\
+		.received = 0,	\
+		.wakeups = 0,	\
+		.receiver = NULL,	\
+	};
+
+// Software timer: its callback is executed once (period = 0) or periodically by the
+// kernel's timers task. Active timers are kept in a list sorted by expiration, so any
+// number of them costs a single task to the scheduler. Callbacks run in task context,
+// they must be short and they can start, stop or reschedule any timer (also their own).
+struct KERNEL_TIMER {
+	char* name;
+	void (*callback)(void);
+	uint32_t expire_at_tickcount;
+	uint32_t period;					// ms between two expirations (0 = one-shot)
+	struct KERNEL_TIMER* next_timer;	// link inside the sorted list of active timers
+	struct KERNEL_TIMER* next_fired;	// link inside the list of timers fired from ISRs
+	uint8_t is_active;
+	uint8_t fire_queued;				// the timer is already in the list of fired ones
+	uint32_t calls;						// completed executions of the callback
+};
+
+#define ALLOCATE_TIMER(_name_)	\
+	void _name_##_timer_func(void); \
+	struct KERNEL_TIMER _name_##_timer = {	\
+		.name = #_name_, \
+		.callback = _name_##_timer_func, \
+		.next_timer = NULL,	\
+		.is_active = FALSE,	\
+	};
+
+// Real-time tasks: short jobs run from the PendSV exception, so they preempt any
+// cooperative task (but not the ISRs) and they run on their own stack. A pending
+// real-time task runs to completion before the cooperative loop resumes; if more
+// are pending they run in registration order. Like ISRs, real-time tasks:
+//	- must not call the kernel's functions, apart from kernel_rt_activate(),
+//	  kernel_activate_task_from_isr() and kernel_timer_fire_from_isr()
+//	- must not use FatFs, the blocking drivers (I2C, SPI, UART) or debug_printf
+//	- exchange data with the cooperative tasks either through single-producer
+//	  single-consumer buffers with atomic counters, or by handing the ownership of
+//	  the data over, or inside kernel_rt_lock()/kernel_rt_unlock() sections (which
+//	  must be short, since they delay all the real-time tasks)
+struct RT_TASK {
+	char* name;
+	void (*func)(void);
+	uint8_t id;
+	uint32_t calls;
+	uint64_t total_cycles;
+	uint32_t max_cycles;
+};
+
+#define ALLOCATE_RT_TASK(_name_)	\
+	void _name_##_rt_func(void); \
+	struct RT_TASK _name_##_rt_task = {	\
+		.name = #_name_, \
+		.func = _name_##_rt_func, \
+		.id = RT_TASK_ID_NONE,	\
+	};
+
+// Stackless coroutines. A task function (or a function called by it) can suspend
+// in the middle of its body and continue from the same point the next time it is
+// executed, while the scheduler runs other tasks. Only the resume point is saved:
+// local variables are lost across CO_* suspension points (keep them in static
+// storage) and "switch" statements cannot contain suspension points.
+struct COROUTINE {
+	uint16_t line;			// resume point (0 = beginning)
+	uint8_t timed_out;		// result of the last CO_AWAIT_TIMEOUT()
+	uint32_t timeout_tick;
+};
+
+#define CO_FINISHED					((int32_t)-3)	// the coroutine completed (a task returning it is killed)
+#define CO_POLL_INTERVAL_MS			1
+
+#define CO_BEGIN(_co_)				switch ((_co_)->line) { case 0:
+#define CO_END(_co_)				} (_co_)->line = 0; return CO_FINISHED
+#define CO_EXIT(_co_)				do { (_co_)->line = 0; return CO_FINISHED; } while (0)
+#define CO_RESET(_co_)				do { (_co_)->line = 0; } while (0)
+
+// Suspend and return "_ret_" to the scheduler (or to the parent coroutine)
+#define CO_SUSPEND(_co_, _ret_)		do { (_co_)->line = __LINE__; return (_ret_); case __LINE__:; } while (0)
+
+// Let the other ready tasks run
+#define CO_YIELD(_co_)				CO_SUSPEND(_co_, IMMEDIATELY)
+
+// Wait for at least "_ms_" milliseconds
+#define CO_SLEEP(_co_, _ms_)	\
+	do {	\
+		(_co_)->timeout_tick = systick_get_tick_count() + (_ms_) + 1;	\
+		(_co_)->line = __LINE__; case __LINE__:	\
+		if (!kernel_is_tick_reached(systick_get_tick_count(), (_co_)->timeout_tick))	\
+			return (int32_t)((_co_)->timeout_tick - systick_get_tick_count());	\
+	} while (0)
+
+// Wait until "_cond_" is true. The condition is checked only when the task is
+// activated, so the event's source must activate it.
+#define CO_AWAIT_EVENT(_co_, _cond_)	\
+	do {	\
+		(_co_)->line = __LINE__; case __LINE__:	\
+		if (!(_cond_))	\
+			return WAIT_FOR_RESUME;	\
+	} while (0)
+
+// Wait until "_cond_" is true or "_timeout_ms_" expire ("timed_out" tells which one).
+// The condition is polled every CO_POLL_INTERVAL_MS or on activation.
+#define CO_AWAIT_TIMEOUT(_co_, _cond_, _timeout_ms_)	\
+	do {	\
+		(_co_)->timeout_tick = systick_get_tick_count() + (_timeout_ms_);	\
+		(_co_)->line = __LINE__; case __LINE__:	\
+		(_co_)->timed_out = FALSE;	\
+		if (!(_cond_)) {	\
+			if (!kernel_is_tick_reached(systick_get_tick_count(), (_co_)->timeout_tick))	\
+				return CO_POLL_INTERVAL_MS;	\
+			(_co_)->timed_out = TRUE;	\
+		}	\
+	} while (0)
+
+// Same as CO_AWAIT_TIMEOUT() but the condition is checked only on activation (the
+// event's source must activate the task) or once the timeout expires
+#define CO_AWAIT_EVENT_TIMEOUT(_co_, _cond_, _timeout_ms_)	\
+	do {	\
+		(_co_)->timeout_tick = systick_get_tick_count() + (_timeout_ms_);	\
+		(_co_)->line = __LINE__; case __LINE__:	\
+		(_co_)->timed_out = FALSE;	\
+		if (!(_cond_)) {	\
+			if (!kernel_is_tick_reached(systick_get_tick_count(), (_co_)->timeout_tick))	\
+				return (int32_t)((_co_)->timeout_tick - systick_get_tick_count());	\
+			(_co_)->timed_out = TRUE;	\
+		}	\
+	} while (0)
+
+// Run a child coroutine until it completes. "_call_" is evaluated every time the
+// parent is resumed, and whatever the child suspends with is returned to the scheduler.
+#define CO_AWAIT_CHILD(_co_, _call_)	\
+	do {	\
+		(_co_)->line = __LINE__; case __LINE__:	\
+		{	\
+			int32_t _child_ret_ = (_call_);	\
+			if (_child_ret_ != CO_FINISHED)	\
+				return _child_ret_;	\
+		}	\
+	} while (0)
+
 // Core functions
 void kernel_main(void);
 
@@ -50,7 +323,52 @@ void kernel_main(void);
 void kernel_init_task(struct TASK* task_ptr);
 void kernel_activate_task_after_ms(struct TASK* task, int32_t delay);
 void kernel_activate_task_immediately(struct TASK* task);
+void kernel_activate_task_from_isr(struct TASK* task);
 uint8_t kernel_get_task_status(struct TASK* task_ptr);
 void kernel_kill_task(struct TASK* task_ptr);
+void kernel_get_scheduler_stats(struct SCHEDULER_STATS* stats);
+void kernel_set_task_deadline(struct TASK* task_ptr, uint16_t period, uint16_t relative_deadline);
+
+// Boot. Peripherals which have to wait for the hardware are initialized by their
+// own task (usually a coroutine), started with kernel_boot_add_step(): these run in
+// parallel once the supplies have settled and the boot completes when all of them die.
+// In serial mode (kernel_boot_set_serial(), before the boot) each step starts when the
+// previous one dies instead, to measure what the overlapping of their waits saves.
+void kernel_boot_add_step(struct TASK* task_ptr);
+void kernel_boot_set_serial(uint8_t is_serial);
+void kernel_boot_set_completion_task(struct TASK* task_ptr);
+uint8_t kernel_boot_is_completed(void);
+
+// Non-yield watchdog
+void kernel_set_task_budget(struct TASK* task_ptr, uint32_t budget_us);
+void kernel_isr_completed(struct ISR_STATS* isr_stats, uint32_t cycles);
+uint32_t kernel_watchdog_get_budget_violations(void);
+
+// Software timers (only kernel_timer_fire_from_isr() can be used from ISRs)
+void kernel_timer_start(struct KERNEL_TIMER* timer, uint32_t delay, uint32_t period);
+void kernel_timer_reschedule(struct KERNEL_TIMER* timer, uint32_t delay);
+void kernel_timer_stop(struct KERNEL_TIMER* timer);
+uint8_t kernel_timer_is_active(struct KERNEL_TIMER* timer);
+void kernel_timer_fire_from_isr(struct KERNEL_TIMER* timer);
+
+// Real-time tasks
+void kernel_rt_init_task(struct RT_TASK* rt_task);
+void kernel_rt_activate(struct RT_TASK* rt_task);
+void kernel_rt_lock(void);
+void kernel_rt_unlock(void);
+void PendSV_Handler(void);
+
+// Mailbox functions (not to be used from ISRs)
+void kernel_mailbox_set_receiver(struct MAILBOX* mailbox, struct TASK* task_ptr);
+int32_t kernel_mailbox_post(struct MAILBOX* mailbox, const void* item);
+int32_t kernel_mailbox_peek(struct MAILBOX* mailbox, void* item);
+int32_t kernel_mailbox_receive(struct MAILBOX* mailbox, void* item);
+void kernel_mailbox_flush(struct MAILBOX* mailbox);
+
+// Shell commands
+int kernel_top(int argc, char *argv[]);
+int kernel_watchdog(int argc, char *argv[]);
+int kernel_deadline(int argc, char *argv[]);
+int kernel_stall(int argc, char *argv[]);
 
 #endif // _KERNEL_H_
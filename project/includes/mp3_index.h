@@ -0,0 +1,33 @@
+#ifndef _MP3_INDEX_H_
+#define _MP3_INDEX_H_
+
+#include "stdint.h"
+#include "ff.h"
+
+struct mad_header;
+
+// Information for the gapless playback, from the Xing/Info or VBRI frame (which holds
+// no audio) and from the LAME extension of the Xing/Info header
+struct MP3_INDEX_INFO {
+	uint8_t has_info_frame;
+	uint8_t has_encoder_delay;
+	uint16_t encoder_delay;		// samples added by the encoder before the audio
+	uint16_t encoder_padding;	// and after it, in the last frame
+	uint32_t frames;			// audio frames, 0 if not known
+};
+
+int32_t mp3_index_open(char* path, FIL* file, struct mad_header const* header,
+						uint8_t const* frame, uint32_t length, uint32_t offset);
+void mp3_index_close(void);
+int32_t mp3_index_seek(uint32_t* frame, uint32_t* offset);
+uint32_t mp3_index_get_frames(void);
+int32_t mp3_index_get_info(struct MP3_INDEX_INFO* info);
+int mp3_index_benchmark(int argc, char *argv[]);
+
+// Where the index of a file comes from
+#define MP3_INDEX_NONE		0x00
+#define MP3_INDEX_XING		0x01	// TOC of the Xing/Info header
+#define MP3_INDEX_VBRI		0x02	// TOC of the VBRI header
+#define MP3_INDEX_SCAN		0x03	// headers of all the frames
+
+#endif //_MP3_INDEX_H_
@@ -2,16 +2,35 @@
 #define _MP3_PLAYER_H_
 
 #include "stdint.h"
+#include "mp3_tags.h"
 
 int32_t mp3_player_play(char* path);
 int32_t mp3_player_resume(void);
 int32_t mp3_player_pause(void);
 int32_t mp3_player_stop(void);
 uint8_t mp3_player_get_status(void);
+int32_t mp3_player_queue(char* path);
+void mp3_player_register_callback(void (*func)(void));
+int32_t mp3_player_seek(uint32_t time_ms);
+struct MP3_TAGS const* mp3_player_get_tags(void);
+uint32_t mp3_player_get_position(void);
+uint32_t mp3_player_get_duration(void);
+int mp3_player_seek_command(int argc, char *argv[]);
+int32_t mp3_player_set_low_power(uint8_t mode);
+uint8_t mp3_player_get_low_power(void);
+int mp3_player_low_power(int argc, char *argv[]);
+int mp3_decoder_command(int argc, char *argv[]);
+int mp3_player_benchmark(int argc, char *argv[]);
+int mp3_player_benchmark_file(int argc, char *argv[]);
 
 #define MP3_PLAYER_IDLE		0x00
 #define MP3_PLAYER_PLAYING	0x01
 #define MP3_PLAYER_PAUSED	0x02
 #define MP3_PLAYER_ERROR	0x03
 
+// Low power modes: the synthesis rate is the stream's one divided by 1 << mode
+#define MP3_PLAYER_FULL_RATE		0x00
+#define MP3_PLAYER_HALF_RATE		0x01
+#define MP3_PLAYER_QUARTER_RATE		0x02
+
 #endif //_MP3_PLAYER_H_
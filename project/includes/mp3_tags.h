@@ -0,0 +1,20 @@
+#ifndef _MP3_TAGS_H_
+#define _MP3_TAGS_H_
+
+#include "stdint.h"
+#include "ff.h"
+
+// Metadata of a file, as ASCII strings (the other characters are replaced by '?')
+#define MP3_TAGS_TEXT_SIZE		32
+struct MP3_TAGS {
+	char title[MP3_TAGS_TEXT_SIZE];
+	char artist[MP3_TAGS_TEXT_SIZE];
+	char album[MP3_TAGS_TEXT_SIZE];
+	uint16_t track;			// 0 if not known
+};
+
+uint32_t mp3_tags_read_id3v2(FIL* file, struct MP3_TAGS* tags);
+void mp3_tags_read_footers(FIL* file, struct MP3_TAGS* tags);
+uint8_t mp3_tags_is_complete(struct MP3_TAGS const* tags);
+
+#endif //_MP3_TAGS_H_
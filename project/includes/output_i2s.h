@@ -11,8 +11,14 @@ typedef struct {
 int32_t output_i2s_init(void);
 int32_t output_i2s_ConfigurePLL(uint32_t samplig_freq);
 int32_t output_i2s_enqueue_samples(audio_sample_t* data, uint16_t samples_count);
+audio_sample_t* output_i2s_get_ring(uint16_t* size, uint16_t* write_index);
+void output_i2s_commit_samples(uint16_t samples_count);
 uint32_t output_i2s_get_buffer_free_space(void);
+uint32_t output_i2s_get_buffered_samples(void);
+void output_i2s_flush(void);
 void output_i2s_register_callback(void (*func)(void));
+uint32_t output_i2s_get_underruns(void);
+uint32_t output_i2s_get_dropouts(uint32_t* refills);
 
 void DMA1_Stream7_IRQHandler(void);
 
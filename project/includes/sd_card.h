@@ -3,6 +3,7 @@
 
 #include "stdint.h"
 #include "sdio.h"
+#include "kernel.h"
 /* 
  * SD State enumeration structure 
  */   
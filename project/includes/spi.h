@@ -9,10 +9,22 @@
 void spi_init(void);
 int32_t spi_read(uint8_t* data, uint32_t len);
 int32_t spi_write(uint8_t* data, uint32_t len);
+#ifndef HOST_BUILD
 #define spi_set_eeprom_CS()			SET_BIT(GPIOA->BSRR, GPIO_BSRR_BR0)
 #define spi_release_eeprom_CS()		SET_BIT(GPIOA->BSRR, GPIO_BSRR_BS0)
 #define spi_set_Si468x_CS()			SET_BIT(GPIOD->BSRR, GPIO_BSRR_BR10)
 #define spi_release_Si468x_CS()		SET_BIT(GPIOD->BSRR, GPIO_BSRR_BS10)
+#else
+// Host build: the chip selects are forwarded to the simulated devices
+#define SPI_HOST_EEPROM				0
+#define SPI_HOST_SI468X				1
+
+#define spi_set_eeprom_CS()			spi_host_set_CS(SPI_HOST_EEPROM, TRUE)
+#define spi_release_eeprom_CS()		spi_host_set_CS(SPI_HOST_EEPROM, FALSE)
+#define spi_set_Si468x_CS()			spi_host_set_CS(SPI_HOST_SI468X, TRUE)
+#define spi_release_Si468x_CS()		spi_host_set_CS(SPI_HOST_SI468X, FALSE)
+void spi_host_set_CS(uint8_t device, uint8_t is_selected);
+#endif
 
 // Functions' return values
 #define SPI_SUCCESS			0L
@@ -3,13 +3,18 @@
 
 #include "stdint.h"
 
+// Longest sleep that fits into the 24-bit SysTick's reload register
+#define SYSTICK_MAX_IDLE_TICKS		99UL
+
 void systick_initialize(void);
 uint32_t systick_get_tick_count(void);
 void systick_wait_for_ms(uint32_t delay);
+void systick_sleep_for_ticks(uint32_t ticks);
 
 void SysTick_Handler(void);
 
 // Shell commands
 int systick_gettime(int argc, char *argv[]);
+int systick_idle_stats(int argc, char *argv[]);
 
 #endif
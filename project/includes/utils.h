@@ -21,6 +21,8 @@
 #define TRUE 	(!FALSE)
 
 #define array_size(_x_)		(sizeof(_x_)/sizeof(_x_[0]))
+#define min(_a_, _b_)		(((_a_) < (_b_)) ? (_a_) : (_b_))
+#define max(_a_, _b_)		(((_a_) > (_b_)) ? (_a_) : (_b_))
 
 int reset(int argc, char *argv[]);
 
@@ -10,6 +10,7 @@
 #include "eeprom.h"
 #include "stdlib.h"
 #include "systick.h"
+#include "kernel.h"
 
 #define debug_msg(format, ...)		debug_printf("[si4684] " format, ##__VA_ARGS__)
 
@@ -35,19 +36,22 @@ static int Si468x_send_cmd(uint8_t* data_out, uint32_t data_out_size, uint8_t* d
 static int Si468x_rd_reply(uint32_t extra_data_len);
 static int Si468x_powerup(void);
 static int Si468x_load_init(void);
-static int Si468x_host_load_from_flash(uint8_t* img_data, uint32_t len);
-static int Si468x_host_load_from_eeprom(uint8_t img_identifier);
+static void Si468x_select_image(uint8_t fw_identifier, uint8_t img_identifier);
+static int32_t Si468x_host_load(struct COROUTINE* co);
+static int32_t Si468x_host_load_from_flash(struct COROUTINE* co);
+static int32_t Si468x_host_load_from_eeprom(struct COROUTINE* co);
 	#define LOAD_BOOTLOADER_IMAGE		0x00
 	#define LOAD_FM_IMAGE				0x01
 	#define LOAD_DAB_IMAGE				0x02
 static int Si468x_boot(void);
+static uint8_t Si468x_is_cts(void);
 static int Si468x_get_sys_state(void);
 // Private functions for advanced management
 void Si468x_wait_for_cts(Si468x_wait_type type);
 void Si468x_wait_for_stcint(Si468x_wait_type type);
 
 // DAB
-static int Si468x_start_dab(void);
+static int Si468x_configure_dab(void);
 static int Si468x_dab_get_digital_service_list(void);
 static int Si468x_dab_get_freq_list(Si468x_DAB_freq_list *list);
 void Si468x_get_part_info(Si468x_info *info);
@@ -60,7 +64,7 @@ static int Si468x_dab_set_property(uint16_t property, uint16_t value);
 static int Si468x_dab_get_time(void);
 
 // FM
-static int Si468x_start_fm(void);
+static int Si468x_configure_fm(void);
 static int Si468x_fm_tune_freq(uint16_t freq);
 
 // List of commands for DAB mode
@@ -178,6 +182,25 @@ uint8_t data_out[IN_OUT_BUFF_SIZE];
 uint8_t data_in[IN_OUT_BUFF_SIZE];
 uint8_t Si468x_DAB_active;
 
+// Boot sequence. It's run by its own task as a coroutine so that the firmware download
+// and the delays required by the tuner don't stall the rest of the system.
+#define SI468X_MODE_FM				0
+#define SI468X_MODE_DAB				1
+#define SI468X_CTS_TIMEOUT_MS		1000
+ALLOCATE_TASK(Si468x_boot, 50);
+struct {
+	struct COROUTINE co;
+	struct COROUTINE load_co;	// firmware download (child coroutine)
+	uint8_t mode;
+	uint8_t error;
+	uint8_t from_flash;			// image embedded into the STM32's firmware or stored on the eeprom
+	uint8_t img_identifier;
+	uint8_t* img_data;
+	uint32_t len;
+	uint32_t curr_page;
+} Si468x_boot_ctx;
+uint8_t Si468x_img_buff[EEPROM_PAGE_SIZE_IN_BYTES];
+
 // status register bits
 #define PUP_STATE_mask				0xC0
 #define PUP_STATE_BOOTLOADER		0x80
@@ -201,9 +224,10 @@ void Si468x_init()
 	// Configure GPIOs
 	//	PD8 -> RSTB (output, push-pull, low at startup)
 	//	PD6 -> INT (input with pull-up)
+	// The reset is kept asserted until the tuner is started: its boot sequence
+	// provides the required timings
 	RCC_GPIOD_CLK_ENABLE();
 	Si468x_assert_reset();
-	timer_wait_us(3000);
 	MODIFY_REG(GPIOD->MODER, GPIO_MODER_MODE8_Msk, MODER_GENERAL_PURPOSE_OUTPUT << GPIO_MODER_MODE8_Pos);
 	MODIFY_REG(GPIOD->OSPEEDR, GPIO_MODER_MODE8_Msk, OSPEEDR_50MHZ << GPIO_MODER_MODE8_Pos);
 	MODIFY_REG(GPIOD->MODER, GPIO_MODER_MODE6_Msk, MODER_INPUT << GPIO_MODER_MODE6_Pos);
@@ -269,11 +293,6 @@ static int Si468x_powerup()
 	data_out[15] = 0x00;	// fixed
 
 	Si468x_send_cmd(data_out, 16, NULL, 0);
-	Si468x_wait_for_cts(POLLING);
-
-	// data_in[3] contains informations about the current device's state
-	if ((data_in[3] & PUP_STATE_mask) != PUP_STATE_BOOTLOADER)
-		debug_msg("powerup failure\n");
 }
 
 /*
@@ -285,17 +304,42 @@ static int Si468x_load_init()
 	data_out[1] = 0x00;
 
 	Si468x_send_cmd(data_out, 2, NULL, 0);
+}
 
-	Si468x_wait_for_cts(POLLING);
+/*
+ * Select the image that will be sent by Si468x_host_load(): the one embedded into the
+ * STM32's firmware if present, otherwise the one stored on the eeprom
+ */
+static void Si468x_select_image(uint8_t fw_identifier, uint8_t img_identifier)
+{
+	Si468x_boot_ctx.from_flash = utils_is_fw_embedded(fw_identifier);
+	Si468x_boot_ctx.img_identifier = img_identifier;
+	if (Si468x_boot_ctx.from_flash) {
+		Si468x_boot_ctx.img_data = utils_get_embedded_FW_start_address(fw_identifier);
+		Si468x_boot_ctx.len = utils_get_embedded_FW_size(fw_identifier);
+	}
+	CO_RESET(&Si468x_boot_ctx.load_co);
+}
+
+/*
+ * Send the selected image to the tuner
+ */
+static int32_t Si468x_host_load(struct COROUTINE* co)
+{
+	if (Si468x_boot_ctx.from_flash)
+		return Si468x_host_load_from_flash(co);
+	else
+		return Si468x_host_load_from_eeprom(co);
 }
 
 /*
  * Loads the binary image which is included into the SMT32's fimrware
  */
-static int Si468x_host_load_from_flash(uint8_t* img_data, uint32_t len)
+static int32_t Si468x_host_load_from_flash(struct COROUTINE* co)
 {
 	uint32_t curr_len;
 
+	CO_BEGIN(co);
 	// Each command can send up to 4096 bytes. Therefore, if the sent
 	// image is bigger, then split it into consecutive chucks
 	do {
@@ -304,31 +348,38 @@ static int Si468x_host_load_from_flash(uint8_t* img_data, uint32_t len)
 		data_out[2] = 0x00;
 		data_out[3] = 0x00;
 
-		curr_len = (len > 4096) ? 4096 : len;
+		curr_len = (Si468x_boot_ctx.len > 4096) ? 4096 : Si468x_boot_ctx.len;
 
 		spi_set_Si468x_CS();
 		timer_wait_us(1);
 		spi_write(data_out, 4);
-		spi_write(img_data, curr_len);
+		spi_write(Si468x_boot_ctx.img_data, curr_len);
 		timer_wait_us(1);
 		spi_release_Si468x_CS();
 
-		Si468x_wait_for_cts(POLLING);
+		Si468x_boot_ctx.len -= curr_len;
+		Si468x_boot_ctx.img_data += curr_len;
 
-		len -= curr_len;
-		img_data += curr_len;
-	} while(len > 0);
+		CO_AWAIT_TIMEOUT(co, Si468x_is_cts(), SI468X_CTS_TIMEOUT_MS);
+		if (co->timed_out) {
+			debug_msg("error: timeout while loading the image\n");
+			Si468x_boot_ctx.error = TRUE;
+			CO_EXIT(co);
+		}
+	} while(Si468x_boot_ctx.len > 0);
+	CO_END(co);
 }
 
 /*
  * Load the binary taking it from the eeprom
  */
-static int Si468x_host_load_from_eeprom(uint8_t img_identifier)
+static int32_t Si468x_host_load_from_eeprom(struct COROUTINE* co)
 {
 	PARTITION_INFO* eeprom_part_info;
-	uint8_t img_buff[EEPROM_PAGE_SIZE_IN_BYTES];
+	uint32_t curr_len;
 
-	switch(img_identifier) {
+	CO_BEGIN(co);
+	switch(Si468x_boot_ctx.img_identifier) {
 	case LOAD_BOOTLOADER_IMAGE:
 		eeprom_part_info = eeprom_get_partition_infos("bootloader");
 		break;
@@ -340,35 +391,41 @@ static int Si468x_host_load_from_eeprom(uint8_t img_identifier)
 		break;
 	default:
 		debug_msg("error: image not found on the eeprom");
-		return -1;
+		Si468x_boot_ctx.error = TRUE;
+		CO_EXIT(co);
 	}
 
-	uint32_t len = eeprom_part_info->data_size;
-	uint32_t curr_page = eeprom_part_info->start_page;
-	uint32_t curr_len;
+	Si468x_boot_ctx.len = eeprom_part_info->data_size;
+	Si468x_boot_ctx.curr_page = eeprom_part_info->start_page;
 
 	// Read the eeprom page-by-page and send it to the tuner
 	do {
-		eeprom_page_read(curr_page, img_buff);
+		eeprom_page_read(Si468x_boot_ctx.curr_page, Si468x_img_buff);
 		data_out[0] = SI468X_CMD_HOST_LOAD;
 		data_out[1] = 0x00;
 		data_out[2] = 0x00;
 		data_out[3] = 0x00;
 
-		curr_len = (len > sizeof(img_buff)) ? sizeof(img_buff) : len;
+		curr_len = (Si468x_boot_ctx.len > sizeof(Si468x_img_buff)) ? sizeof(Si468x_img_buff) : Si468x_boot_ctx.len;
 
 		spi_set_Si468x_CS();
 		timer_wait_us(1);
 		spi_write(data_out, 4);
-		spi_write(img_buff, curr_len);
+		spi_write(Si468x_img_buff, curr_len);
 		timer_wait_us(1);
 		spi_release_Si468x_CS();
 
-		Si468x_wait_for_cts(POLLING);
+		Si468x_boot_ctx.curr_page++;
+		Si468x_boot_ctx.len -= curr_len;
 
-		curr_page++;
-		len -= curr_len;
-	} while(len > 0);
+		CO_AWAIT_TIMEOUT(co, Si468x_is_cts(), SI468X_CTS_TIMEOUT_MS);
+		if (co->timed_out) {
+			debug_msg("error: timeout while loading the image\n");
+			Si468x_boot_ctx.error = TRUE;
+			CO_EXIT(co);
+		}
+	} while(Si468x_boot_ctx.len > 0);
+	CO_END(co);
 }
 
 /*
@@ -380,12 +437,6 @@ static int Si468x_boot()
 	data_out[1] = 0x00;
 
 	Si468x_send_cmd(data_out, 2, NULL, 0);
-
-	Si468x_wait_for_cts(POLLING);
-
-	// data_in[3] contains informations about the current device's state
-	if ((data_in[3] & PUP_STATE_mask) != PUP_STATE_APPLICATION)
-		debug_msg("boot failure\n");
 }
 
 /*
@@ -854,6 +905,15 @@ void Si468x_wait_for_cts(Si468x_wait_type type)
 	}
 }
 
+/*
+ * Read the status and return TRUE if the tuner is ready to accept a new command
+ */
+static uint8_t Si468x_is_cts()
+{
+	Si468x_rd_reply(0);
+	return ((data_in[0] & STATUS0_CTS) != 0);
+}
+
 /*
  *
  */
@@ -877,47 +937,87 @@ void Si468x_wait_for_stcint(Si468x_wait_type type)
 /*
  *
  */
-static int Si468x_start_dab()
+/*
+ * Boot sequence of the tuner. It loads the bootloader and then the application image
+ * of the selected mode, which is finally configured.
+ */
+int32_t Si468x_boot_task_func()
 {
-	uint8_t actual_freq;
-	int32_t varb, varm;
-	uint8_t varcap_index;
-	volatile uint32_t size = 0;
-	volatile uint32_t initial = 0, final = 0;
+	struct COROUTINE* co = &Si468x_boot_ctx.co;
 
+	CO_BEGIN(co);
+	// Reset the tuner and wait for 50ms before reloading the new image
+	Si468x_DAB_active = 0;
+	Si468x_boot_ctx.error = FALSE;
+	Si468x_assert_reset();
+	CO_SLEEP(co, 50);
 	// Take the tuner out of reset and wait for 3ms
 	Si468x_deassert_reset();
-	timer_wait_us(3000);
+	CO_SLEEP(co, 3);
 	// Send power-up and then wait 20us
 	Si468x_powerup();
+	CO_AWAIT_TIMEOUT(co, Si468x_is_cts(), SI468X_CTS_TIMEOUT_MS);
+	// data_in[3] contains informations about the current device's state
+	if (co->timed_out || ((data_in[3] & PUP_STATE_mask) != PUP_STATE_BOOTLOADER)) {
+		debug_msg("powerup failure\n");
+		CO_EXIT(co);
+	}
 	timer_wait_us(20);
 	// Begin firmware loading phase
 	Si468x_load_init();
+	CO_AWAIT_TIMEOUT(co, Si468x_is_cts(), SI468X_CTS_TIMEOUT_MS);
 	// Send the bootloader image
-	if (utils_is_fw_embedded(SI468X_BOOT_FW)) {
-		Si468x_host_load_from_eeprom(LOAD_BOOTLOADER_IMAGE);
-	} else {
-		Si468x_host_load_from_flash(utils_get_embedded_FW_start_address(SI468X_BOOT_FW), utils_get_embedded_FW_size(SI468X_BOOT_FW));
-	}
+	Si468x_select_image(SI468X_BOOT_FW, LOAD_BOOTLOADER_IMAGE);
+	CO_AWAIT_CHILD(co, Si468x_host_load(&Si468x_boot_ctx.load_co));
+	if (Si468x_boot_ctx.error)
+		CO_EXIT(co);
 	// Wait for 4ms
-	timer_wait_us(4000);
+	CO_SLEEP(co, 4);
 	// Begin firmware loading phase
 	Si468x_load_init();
-	// Send the application image (DAB)
-	if (utils_is_fw_embedded(SI468X_DAB_FW)) {
-		Si468x_host_load_from_flash(utils_get_embedded_FW_start_address(SI468X_DAB_FW), utils_get_embedded_FW_size(SI468X_DAB_FW));
+	CO_AWAIT_TIMEOUT(co, Si468x_is_cts(), SI468X_CTS_TIMEOUT_MS);
+	// Send the application image
+	if (Si468x_boot_ctx.mode == SI468X_MODE_DAB) {
+		Si468x_select_image(SI468X_DAB_FW, LOAD_DAB_IMAGE);
 	} else {
-		Si468x_host_load_from_eeprom(LOAD_DAB_IMAGE);
+		Si468x_select_image(SI468X_FM_FW, LOAD_FM_IMAGE);
 	}
+	CO_AWAIT_CHILD(co, Si468x_host_load(&Si468x_boot_ctx.load_co));
+	if (Si468x_boot_ctx.error)
+		CO_EXIT(co);
 	// Wait for 4ms
-	timer_wait_us(4000);
+	CO_SLEEP(co, 4);
 	// Boot the image
 	Si468x_boot();
+	CO_AWAIT_TIMEOUT(co, Si468x_is_cts(), SI468X_CTS_TIMEOUT_MS);
+	if (co->timed_out || ((data_in[3] & PUP_STATE_mask) != PUP_STATE_APPLICATION)) {
+		debug_msg("boot failure\n");
+		CO_EXIT(co);
+	}
 
-	timer_wait_us(400000);
+	CO_SLEEP(co, 400);
 
 	Si468x_get_part_info(&Si468x_info_part);
 
+	if (Si468x_boot_ctx.mode == SI468X_MODE_DAB) {
+		Si468x_configure_dab();
+		debug_msg("DAB firmware loaded\n");
+	} else {
+		Si468x_configure_fm();
+		debug_msg("FM firmware loaded\n");
+	}
+	CO_END(co);
+}
+
+/*
+ * Configure the tuner once the DAB image has been booted
+ */
+static int Si468x_configure_dab()
+{
+	uint8_t actual_freq;
+	int32_t varb, varm;
+	uint8_t varcap_index;
+
 	Si468x_dab_set_property(SI468X_PROP_INT_CTL_ENABLE, 0x0081);
 	//Si468x_dab_set_property(SI468X_PROP_DAB_CTRL_DAB_MUTE_SIGNAL_LEVEL_THRESHOLD, 0x0000);
 	//Si468x_dab_set_property(SI468X_PROP_DAB_CTRL_DAB_MUTE_SIGLOW_THRESHOLD, 0x0000);
@@ -1002,41 +1102,11 @@ static int Si468x_start_dab()
 /*
  *
  */
-static int Si468x_start_fm()
+/*
+ * Configure the tuner once the FM image has been booted
+ */
+static int Si468x_configure_fm()
 {
-	// Take the tuner out of reset and wait for 3ms
-	Si468x_deassert_reset();
-	timer_wait_us(3000);
-	// Send power-up and then wait 20us
-	Si468x_powerup();
-	timer_wait_us(20);
-	// Begin firmware loading phase
-	Si468x_load_init();
-	// Send the bootloader image
-	if (utils_is_fw_embedded(SI468X_BOOT_FW)) {
-		Si468x_host_load_from_flash(utils_get_embedded_FW_start_address(SI468X_BOOT_FW), utils_get_embedded_FW_size(SI468X_BOOT_FW));
-	} else {
-		Si468x_host_load_from_eeprom(LOAD_BOOTLOADER_IMAGE);
-	}
-	// Wait for 4ms
-	timer_wait_us(4000);
-	// Begin firmware loading phase
-	Si468x_load_init();
-	// Send the application image (FM)
-	if (utils_is_fw_embedded(SI468X_FM_FW)) {
-		Si468x_host_load_from_flash(utils_get_embedded_FW_start_address(SI468X_FM_FW), utils_get_embedded_FW_size(SI468X_FM_FW));
-	} else {
-		Si468x_host_load_from_eeprom(LOAD_FM_IMAGE);
-	}
-	// Wait for 4ms
-	timer_wait_us(4000);
-	// Boot the image
-	Si468x_boot();
-
-	timer_wait_us(400000);
-
-	Si468x_get_part_info(&Si468x_info_part);
-
 	Si468x_dab_set_property(SI468X_PROP_PIN_CONFIG_ENABLE, 0x0001);	// Analog audio output
 	Si468x_dab_set_property(SI468X_PROP_FM_TUNE_FE_CFG, 0x0000);
 	Si468x_dab_set_property(SI468X_PROP_FM_RDS_CONFIG, 0x0001);
@@ -1084,7 +1154,8 @@ int fm_tune(int argc, char *argv[])
 }
 
 /*
- * Start the tuner either in FM or DAB mode
+ * Start the tuner either in FM or DAB mode. The boot is performed in background by
+ * the Si468x_boot task.
  */
 int start_tuner(int argc, char *argv[])
 {
@@ -1093,20 +1164,22 @@ int start_tuner(int argc, char *argv[])
         return -1;
 	}   
     
-    // Reset the tuner and wait for 50ms before reloading the new image
-    Si468x_assert_reset();
-    systick_wait_for_ms(50);
-    
+    if (kernel_get_task_status(&Si468x_boot_task) != TASK_STATE_DEAD) {
+        debug_msg("boot already in progress\n");
+        return -1;
+    }
+
     if (strcmp(argv[0], "fm") == 0) {
-        Si468x_start_fm();
-        debug_msg("FM firmware loaded\n");
+        Si468x_boot_ctx.mode = SI468X_MODE_FM;
     } else if (strcmp(argv[0], "dab") == 0) {
-        Si468x_start_dab();
-        debug_msg("DAB firmware loaded\n");
+        Si468x_boot_ctx.mode = SI468X_MODE_DAB;
     } else {
         debug_msg("wrong firmware image selected\n");
         return -1;
     }
+
+    CO_RESET(&Si468x_boot_ctx.co);
+    kernel_activate_task_immediately(&Si468x_boot_task);
     return 0;
 }
 
@@ -19,7 +19,9 @@ uint8_t is_UP_pressed() 		{ return (READ_BIT(GPIOE->IDR, GPIO_IDR_IDR_12) == 0);
 uint8_t is_LEFT_pressed()    	{ return (READ_BIT(GPIOE->IDR, GPIO_IDR_IDR_13) == 0); }
 uint8_t is_DOWN_pressed()    	{ return (READ_BIT(GPIOE->IDR, GPIO_IDR_IDR_14) == 0); }
 
-void (*keypress_callback_func)(uint8_t, uint8_t);
+// Mailbox which receives the key events (NULL if nobody is listening)
+struct MAILBOX* key_event_mailbox;
+uint8_t key_event_flags;
 
 typedef struct {
 	uint8_t id;
@@ -39,7 +41,9 @@ BUTTON_STATE buttons[] = {
 	{ .id = KEY_VOL_DOWN, .status = KEY_RELEASED, .press_start_tick = 0, .is_pressed_func = is_VOL_DOWN_pressed },
 };
 
-ALLOCATE_TASK(buttons, 10);
+// Buttons are scanned by a timer which is fired by the EXTI interrupts and which is
+// kept running only while some button is pressed (or debouncing)
+ALLOCATE_TIMER(buttons);
 #define BUTTON_SCAN_INTERVAL		25
 #define BUTTON_DEBOUNCE_INTERVAL	100
 
@@ -116,23 +120,56 @@ void buttons_init()
 	// NOTE: the CANCEL button cannot be tied to any interrupt line in the current HW design
 }
 
-int32_t buttons_register_key_event_callback(void (*func)(uint8_t, uint8_t))
+/*
+ * Key events will be posted to the selected mailbox. Release events are posted only
+ * if KEY_EVENTS_WITH_RELEASE is specified, so that they don't wake up the receiver
+ * for nothing.
+ */
+int32_t buttons_register_key_event_mailbox(struct MAILBOX* mailbox, uint8_t flags)
 {
-	keypress_callback_func = func;
+	key_event_flags = flags;
+	key_event_mailbox = mailbox;
 	return 0;
 }
 
-int32_t buttons_remove_key_event_callback(void)
+int32_t buttons_remove_key_event_mailbox(void)
 {
-	keypress_callback_func = NULL;
+	key_event_mailbox = NULL;
 	return 0;
 }
 
 /*******************************************************************************/
-/*	TASK
+/*	PRIVATE FUNCTIONS
+/*******************************************************************************/
+/*
+ * Forward the key event to the registered mailbox
+ */
+static void buttons_post_key_event(uint8_t key, uint8_t event)
+{
+	struct KEY_EVENT key_event = { .key = key, .event = event };
+
+	if (key_event_mailbox == NULL)
+		return;
+	if ((event == KEY_RELEASED) && !(key_event_flags & KEY_EVENTS_WITH_RELEASE))
+		return;
+
+	if (kernel_mailbox_post(key_event_mailbox, &key_event) < 0)
+		debug_msg("key event mailbox is full, event dropped\n");
+}
+
+/*******************************************************************************/
+/*	TIMER
 /*******************************************************************************/
-int32_t buttons_task_func()
+/*
+ * Scan the buttons which are pressed or debouncing. Debouncing ones are checked
+ * again only when their debounce interval expires, pressed ones every
+ * BUTTON_SCAN_INTERVAL until they are released.
+ */
+void buttons_timer_func()
 {
+	uint32_t current_tick_count = systick_get_tick_count();
+	uint32_t next_scan = UINT32_MAX;
+	uint32_t debounce_end;
 	uint8_t is_any_button_pressed = FALSE;
 	uint8_t index;
 
@@ -142,12 +179,15 @@ int32_t buttons_task_func()
 			// Is it still pressed?
 			if (buttons[index].is_pressed_func()) {
 				is_any_button_pressed = TRUE;
-				if (systick_get_tick_count() - buttons[index].press_start_tick > BUTTON_DEBOUNCE_INTERVAL) {
+				debounce_end = buttons[index].press_start_tick + BUTTON_DEBOUNCE_INTERVAL + 1;
+				if (kernel_is_tick_reached(current_tick_count, debounce_end)) {
 					// If the debounce time is expired then change state and generate the press event
 					buttons[index].status = KEY_PRESSED;
-					if (keypress_callback_func != NULL) {
-						keypress_callback_func(index, KEY_PRESSED);
-					}
+					buttons_post_key_event(index, KEY_PRESSED);
+					if (next_scan > BUTTON_SCAN_INTERVAL)
+						next_scan = BUTTON_SCAN_INTERVAL;
+				} else if ((debounce_end - current_tick_count) < next_scan) {
+					next_scan = debounce_end - current_tick_count;
 				}
 			} else {
 				// the button is no more pressed
@@ -158,20 +198,20 @@ int32_t buttons_task_func()
 				// if the button was previously pressed but has been released, then generate
 				// the release event
 				buttons[index].status = KEY_RELEASED;
-				if (keypress_callback_func != NULL) {
-					keypress_callback_func(index, KEY_RELEASED);
-				}
+				buttons_post_key_event(index, KEY_RELEASED);
 			} else {
-				// If the button is still pressed then just update the proper flag
+				// If the button is still pressed then just update the proper flags
 				is_any_button_pressed = TRUE;
+				if (next_scan > BUTTON_SCAN_INTERVAL)
+					next_scan = BUTTON_SCAN_INTERVAL;
 			}
 		}
 	}
 
 	if (is_any_button_pressed) {
-		return BUTTON_SCAN_INTERVAL;
+		kernel_timer_start(&buttons_timer, next_scan, 0);
 	} else {
-		return WAIT_FOR_RESUME;
+		kernel_timer_stop(&buttons_timer);
 	}
 }
 
@@ -180,44 +220,58 @@ int32_t buttons_task_func()
 /*******************************************************************************/
 void EXTI0_IRQHandler()
 {
+	KERNEL_ISR_ENTER(exti0);
+
 	if (buttons[KEY_CANCEL].status == KEY_RELEASED) {
 		buttons[KEY_CANCEL].status = KEY_PRESSED_DEBOUNCING;
 		buttons[KEY_CANCEL].press_start_tick = systick_get_tick_count();
-		kernel_activate_task_immediately(&buttons_task);
+		kernel_timer_fire_from_isr(&buttons_timer);
 	}
 
 	SET_BIT(EXTI->PR, EXTI_PR_PR0);
+
+	KERNEL_ISR_EXIT(exti0);
 }
 
 void EXTI1_IRQHandler()
 {
+	KERNEL_ISR_ENTER(exti1);
+
 	if (buttons[KEY_VOL_DOWN].status == KEY_RELEASED) {
 		buttons[KEY_VOL_DOWN].status = KEY_PRESSED_DEBOUNCING;
 		buttons[KEY_VOL_DOWN].press_start_tick = systick_get_tick_count();
-		kernel_activate_task_immediately(&buttons_task);
+		kernel_timer_fire_from_isr(&buttons_timer);
 	}
 
 	SET_BIT(EXTI->PR, EXTI_PR_PR1);
+
+	KERNEL_ISR_EXIT(exti1);
 }
 
 void EXTI4_IRQHandler()
 {
+	KERNEL_ISR_ENTER(exti4);
+
 	if (buttons[KEY_OK].status == KEY_RELEASED) {
 		buttons[KEY_OK].status = KEY_PRESSED_DEBOUNCING;
 		buttons[KEY_OK].press_start_tick = systick_get_tick_count();
-		kernel_activate_task_immediately(&buttons_task);
+		kernel_timer_fire_from_isr(&buttons_timer);
 	}
 
 	SET_BIT(EXTI->PR, EXTI_PR_PR4);
+
+	KERNEL_ISR_EXIT(exti4);
 }
 
 void EXTI9_5_IRQHandler()
 {
+	KERNEL_ISR_ENTER(exti9_5);
+
 	if (EXTI->PR & EXTI_PR_PR5) {	// RIGHT button
 		if (buttons[KEY_RIGHT].status == KEY_RELEASED) {
 			buttons[KEY_RIGHT].status = KEY_PRESSED_DEBOUNCING;
 			buttons[KEY_RIGHT].press_start_tick = systick_get_tick_count();
-			kernel_activate_task_immediately(&buttons_task);
+			kernel_timer_fire_from_isr(&buttons_timer);
 		}
 
 		SET_BIT(EXTI->PR, EXTI_PR_PR5);
@@ -225,15 +279,19 @@ void EXTI9_5_IRQHandler()
 		debug_msg("Unknown interrupt source for EXTI9_5_IRQ. EXTI->PR=0x%x\n", EXTI->PR);
 		MODIFY_REG(EXTI->PR, EXTI_PR_PR5 | EXTI_PR_PR6 | EXTI_PR_PR7 | EXTI_PR_PR8 | EXTI_PR_PR9, 0xFFFF);
 	}
+
+	KERNEL_ISR_EXIT(exti9_5);
 }
 
 void EXTI15_10_IRQHandler()
 {
+	KERNEL_ISR_ENTER(exti15_10);
+
 	if (EXTI->PR & EXTI_PR_PR12) {	// UP button
 		if (buttons[KEY_UP].status == KEY_RELEASED) {
 			buttons[KEY_UP].status = KEY_PRESSED_DEBOUNCING;
 			buttons[KEY_UP].press_start_tick = systick_get_tick_count();
-			kernel_activate_task_immediately(&buttons_task);
+			kernel_timer_fire_from_isr(&buttons_timer);
 		}
 
 		SET_BIT(EXTI->PR, EXTI_PR_PR12);
@@ -242,7 +300,7 @@ void EXTI15_10_IRQHandler()
 		if (buttons[KEY_LEFT].status == KEY_RELEASED) {
 			buttons[KEY_LEFT].status = KEY_PRESSED_DEBOUNCING;
 			buttons[KEY_LEFT].press_start_tick = systick_get_tick_count();
-			kernel_activate_task_immediately(&buttons_task);
+			kernel_timer_fire_from_isr(&buttons_timer);
 		}
 
 		SET_BIT(EXTI->PR, EXTI_PR_PR13);
@@ -251,7 +309,7 @@ void EXTI15_10_IRQHandler()
 		if (buttons[KEY_DOWN].status == KEY_RELEASED) {
 			buttons[KEY_DOWN].status = KEY_PRESSED_DEBOUNCING;
 			buttons[KEY_DOWN].press_start_tick = systick_get_tick_count();
-			kernel_activate_task_immediately(&buttons_task);
+			kernel_timer_fire_from_isr(&buttons_timer);
 		}
 
 		SET_BIT(EXTI->PR, EXTI_PR_PR14);
@@ -259,6 +317,8 @@ void EXTI15_10_IRQHandler()
 		debug_msg("Unknown interrupt source for EXTI15_10_IRQ. EXTI->PR=0x%x\n", EXTI->PR);
 		MODIFY_REG(EXTI->PR, EXTI_PR_PR10 | EXTI_PR_PR11 | EXTI_PR_PR12 | EXTI_PR_PR13 | EXTI_PR_PR14 | EXTI_PR_PR15, 0xFFFF);
 	}
+
+	KERNEL_ISR_EXIT(exti15_10);
 }
 
 /*******************************************************************************/
@@ -0,0 +1,23 @@
+#include "cycle_counter.h"
+#include "stm32f407xx.h"
+#include "utils.h"
+
+/*
+ * Enable the DWT's cycle counter. It is a free running 32bit counter, so at 168MHz
+ * it wraps around every ~25 seconds: only differences between close readings are
+ * meaningful.
+ */
+void cycle_counter_init()
+{
+	SET_BIT(CoreDebug->DEMCR, CoreDebug_DEMCR_TRCENA_Msk);
+	DWT->CYCCNT = 0;
+	SET_BIT(DWT->CTRL, DWT_CTRL_CYCCNTENA_Msk);
+}
+
+/*
+ * Return the current value of the cycle counter
+ */
+uint32_t cycle_counter_get()
+{
+	return DWT->CYCCNT;
+}
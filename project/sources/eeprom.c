@@ -15,6 +15,7 @@
 #include "string.h"
 #include "stdlib.h"
 #include "Si468x.h"
+#include "kernel.h"
 
 // Macros
 #define debug_msg(format, ...)		debug_printf("[eeprom] " format, ##__VA_ARGS__)
@@ -26,19 +27,22 @@
 int32_t eeprom_page_program(uint32_t start_address, uint8_t* data);
 int32_t eeprom_page_erase(uint32_t start_address);
 
+// Boot step: the partition table is read while the other peripherals are waiting
+ALLOCATE_TASK(eeprom_boot, KERNEL_BOOT_PRIORITY);
+
 /*
  * The EEPROM will be divided into different sections in order to save all the
  * firmwares. The first page (256 bytes) will store informations about the other
  * partitions using the following structures.
  */
-#pragma pack(1)
+#pragma pack(push, 1)
 struct {
     PARTITION_INFO bootloader;
     PARTITION_INFO fm_radio;
     PARTITION_INFO dab_radio;
     PARTITION_INFO general_purpose_data;
 } eeprom_partitions_table;
-#pragma pop
+#pragma pack(pop)
 
 // Commands
 #define EEPROM_CMD_WRITE_STATUS_REG		0x01
@@ -326,8 +330,17 @@ void eeprom_init()
 	MODIFY_REG(GPIOE->MODER, GPIO_MODER_MODE15_Msk, MODER_GENERAL_PURPOSE_OUTPUT << GPIO_MODER_MODE15_Pos);
 	MODIFY_REG(GPIOE->OSPEEDR, GPIO_MODER_MODE15_Msk, OSPEEDR_50MHZ << GPIO_MODER_MODE15_Pos);
     
+	kernel_boot_add_step(&eeprom_boot_task);
+}
+
+/*
+ * Read the chip's ID and the partition table
+ */
+int32_t eeprom_boot_task_func()
+{
 	eeprom_read_jedec_id();
     eeprom_get_partition_table();
+	return DIE;
 }
 
 PARTITION_INFO* eeprom_get_partition_infos(char* partition_name)
@@ -20,18 +20,150 @@
 #include "buttons.h"
 #include "main_menu.h"
 #include "file_browser.h"
+#include "cycle_counter.h"
+#include "string.h"
+#include "stddef.h"
+#include "stdlib.h"
 
 #define debug_msg(_format_, ...)	debug_printf("[Kernel] " _format_, ##__VA_ARGS__)
 
 // Private variables
 uint32_t tasks_count = 0;
-struct TASK* active_tasks_list = NULL;  // list of active tasks (ordered based on priority)
-struct TASK* dead_tasks_list = NULL;  // list of dead tasks (this is not ordered, of course)
+struct TASK* registered_tasks[KERNEL_MAX_TASKS];	// all the tasks known by the kernel (indexed by id)
 struct TASK* active_task = NULL;  // pointer to the current active task (NULL if there's no active task)
 
+// Ready tasks: one FIFO for each priority level plus a 2-level bitmap which tells
+// which FIFOs are not empty (lower priority value = higher priority)
+struct TASK* ready_queue_head[KERNEL_PRIORITY_LEVELS];
+struct TASK* ready_queue_tail[KERNEL_PRIORITY_LEVELS];
+uint32_t ready_bitmap[KERNEL_PRIORITY_LEVELS/32];
+uint32_t ready_group;
+
+// Binary min-heap of tasks ordered by one of their tick fields (each task keeps its
+// position in "heap_index", so it can be in a single heap at a time)
+struct TASK_HEAP {
+	struct TASK* items[KERNEL_MAX_TASKS];
+	uint32_t count;
+	uint32_t key_offset;	// offset of the ordering tick inside struct TASK
+};
+#define HEAP_INDEX_NONE			((uint16_t)0xFFFF)
+
+// Sleeping tasks: ordered by "resume_at_tickcount"
+struct TASK_HEAP sleeping_tasks = { .count = 0, .key_offset = offsetof(struct TASK, resume_at_tickcount) };
+
+// Ready tasks of the deadline class: ordered by "absolute_deadline" (EDF)
+struct TASK_HEAP deadline_tasks = { .count = 0, .key_offset = offsetof(struct TASK, absolute_deadline) };
+
+// Activations requested from ISRs. ISRs only append tasks to this ring (the
+// scheduling structures are never touched from interrupt context) and the
+// scheduler drains it at the beginning of each loop.
+struct {
+	struct TASK* slots[KERNEL_ISR_RING_SIZE];
+	uint32_t write_index;
+	uint32_t read_index;
+	uint32_t overflows;		// activations lost because the ring was full
+	uint32_t duplicates;	// tasks found twice in the ring (it must never happen)
+} isr_activations;
+#define ISR_RING_MASK			(KERNEL_ISR_RING_SIZE - 1)
+
+// Software timers: the active ones sorted by expiration, and the ones fired from
+// ISRs (pushed atomically, in reverse order) which must run as soon as possible
+ALLOCATE_TASK(timers, KERNEL_TIMERS_PRIORITY);
+struct KERNEL_TIMER* active_timers = NULL;
+struct KERNEL_TIMER* fired_timers = NULL;
+
+// Real-time tasks: the registered ones (their id is their position, which is also
+// their priority) and the bitmap of the pending ones, which is set from any context.
+// They run from PendSV on a dedicated stack (see PendSV_Handler).
+struct {
+	struct RT_TASK* tasks[KERNEL_MAX_RT_TASKS];
+	uint32_t count;
+	uint32_t pending;
+} rt;
+__attribute__((aligned(8))) uint8_t kernel_rt_stack[KERNEL_RT_STACK_SIZE];
+uint8_t* const kernel_rt_stack_top = &kernel_rt_stack[KERNEL_RT_STACK_SIZE];
+
+// Boot: steps with the ticks at which they started and died, the ones which are still
+// running, tick at which they can start (the supplies have settled) and tick at which
+// the last one completed
+struct {
+	struct {
+		struct TASK* task;
+		uint32_t started_tick;
+		uint32_t completed_tick;
+	} steps[KERNEL_MAX_BOOT_STEPS];
+	uint32_t steps_count;
+	uint32_t started_steps;
+	uint32_t pending_steps;
+	uint32_t settled_tick;
+	uint32_t completed_tick;
+	uint8_t is_completed;
+	uint8_t is_serial;
+	struct TASK* completion_task;
+} boot;
+
+// Background load of the "stall" command: a timer which keeps the CPU busy for a
+// random time every period (its callback is deliberately a long one)
+ALLOCATE_TIMER(stall);
+struct {
+	uint32_t max_ms;
+	uint32_t seed;
+} stall_load;
+
+// Tick at which the tasks' statistics were cleared for the last time
+uint32_t stats_start_tick = 0;
+
+// Scheduler's activity since the same tick
+struct SCHEDULER_STATS scheduler_stats;
+
+// Non-yield watchdog: runs of tasks and ISRs longer than their limit are recorded
+// into a ring which keeps the latest KERNEL_WATCHDOG_RING_SIZE ones. Entries can
+// be added also from ISRs, so each writer reserves its slot atomically.
+struct WATCHDOG_VIOLATION {
+	const char* name;
+	uint32_t tick;
+	uint32_t run_us;
+	uint8_t is_isr;
+};
+
+struct {
+	uint32_t task_threshold_us;
+	uint32_t isr_threshold_us;
+	struct WATCHDOG_VIOLATION ring[KERNEL_WATCHDOG_RING_SIZE];
+	uint32_t write_index;			// number of violations since the last reset
+	uint32_t budget_violations;		// runs of tasks which exceeded their declared budget
+	struct ISR_STATS* isrs[KERNEL_MAX_ISRS];
+	uint32_t isrs_count;
+} watchdog = {
+	.task_threshold_us = KERNEL_WATCHDOG_TASK_THRESHOLD_US,
+	.isr_threshold_us = KERNEL_WATCHDOG_ISR_THRESHOLD_US,
+};
+#define WATCHDOG_RING_MASK		(KERNEL_WATCHDOG_RING_SIZE - 1)
+
 // Private functions
-static void kernel_add_task_to_list(struct TASK* input_task_ptr, struct TASK** task_list_ptr);
+static void kernel_ready_queue_push(struct TASK* task_ptr);
+static struct TASK* kernel_ready_queue_pop(void);
+static void kernel_ready_queue_remove(struct TASK* task_ptr);
+static void kernel_heap_insert(struct TASK_HEAP* heap, struct TASK* task_ptr);
+static void kernel_heap_remove(struct TASK_HEAP* heap, struct TASK* task_ptr);
+static void kernel_make_task_ready(struct TASK* task_ptr);
+static void kernel_wake_up_expired_tasks(uint32_t current_tick_count);
+static void kernel_detach_task(struct TASK* task_ptr);
+static void kernel_schedule_task(struct TASK* task_ptr, uint32_t resume_at_tickcount);
+static void kernel_process_isr_activations(void);
 static struct TASK* kernel_get_next_task_to_run();
+static void kernel_idle(void);
+static void kernel_update_task_stats(struct TASK* task_ptr, uint32_t cycles);
+static void kernel_check_task_deadline(struct TASK* task_ptr, uint32_t current_tick_count);
+static void kernel_watchdog_record(const char* name, uint32_t cycles, uint8_t is_isr);
+static void kernel_watchdog_check_task(struct TASK* task_ptr, uint32_t cycles);
+static uint8_t kernel_timer_insert(struct KERNEL_TIMER* timer);
+static void kernel_timer_remove(struct KERNEL_TIMER* timer);
+static void kernel_timers_wake_up(void);
+static void kernel_rt_init(void);
+static void kernel_rt_dispatch(void) __attribute__((used));
+static void kernel_boot_start_step(void);
+static void kernel_boot_step_completed(struct TASK* task_ptr);
 static void kernel_initialize_modules();
 
 /********************************************************************/
@@ -41,6 +173,7 @@ static void kernel_initialize_modules()
 {
 	// Low level drivers
 	uart_init();
+	cycle_counter_init();
 	timer_init();
 	i2c_init();
 	spi_init();
@@ -50,9 +183,9 @@ static void kernel_initialize_modules()
 	systick_initialize();
 	buttons_init();
 
-	systick_wait_for_ms(50);
-
-	// Peripherals
+	// Peripherals: the ones which need to wait add their boot steps, which start
+	// once the supplies have settled
+	boot.settled_tick = systick_get_tick_count() + KERNEL_BOOT_SETTLE_MS;
 	eeprom_init();
 	Si468x_init();
 	sgtl5000_init();
@@ -62,7 +195,9 @@ static void kernel_initialize_modules()
 	main_menu_init();
 	file_browser_init();
 
-	debug_msg("Initialization completed\n");
+	// No step has been added
+	if (boot.pending_steps == 0)
+		kernel_boot_step_completed(NULL);
 }
 
 static void kernel_suspend_modules()
@@ -79,118 +214,412 @@ static void kernel_resume_modules()
 /*	KERNEL - PRIVATE FUNCTIONS	*/
 /********************************************************************/
 /*
- * Add a the task to the specified list
+ * Append the task to the FIFO of its priority level and flag the level as not empty
  */
-static void kernel_add_task_to_list(struct TASK* input_task_ptr, struct TASK** task_list_ptr)
+static void kernel_ready_queue_push(struct TASK* task_ptr)
 {
-	// first task in the list
-	if (*task_list_ptr == NULL) {
-		*task_list_ptr = input_task_ptr;
-	} else { // following elements
-		// look for the right place on the list based on the task's priority
-		struct TASK* curr_task_ptr = *task_list_ptr;
-		struct TASK* prev_task_ptr = NULL;
-		while ((curr_task_ptr != NULL) && ((input_task_ptr->priority)>(curr_task_ptr->priority))) {
-			prev_task_ptr = curr_task_ptr;
-			curr_task_ptr = curr_task_ptr->next_task;
-		}
-		
-		if (prev_task_ptr == NULL) {	
-			// replace the first element in the list
-			input_task_ptr->next_task = curr_task_ptr;
-			*task_list_ptr = input_task_ptr;
-		} else if (curr_task_ptr == NULL) {
-			// add to the end of the list
-			prev_task_ptr->next_task = input_task_ptr;
-		} else {
-			// add the element in the middle of the list
-			prev_task_ptr->next_task = input_task_ptr;
-			input_task_ptr->next_task = curr_task_ptr;
-		}
+	uint8_t prio = task_ptr->priority;
+
+	task_ptr->next_task = NULL;
+	if (ready_queue_head[prio] == NULL) {
+		ready_queue_head[prio] = task_ptr;
+	} else {
+		ready_queue_tail[prio]->next_task = task_ptr;
 	}
-	input_task_ptr->id = tasks_count;
-	tasks_count ++;
+	ready_queue_tail[prio] = task_ptr;
+
+	ready_bitmap[prio >> 5] |= (1UL << (prio & 0x1F));
+	ready_group |= (1UL << (prio >> 5));
+	task_ptr->status = TASK_STATE_READY;
 }
 
 /*
- * Remove the selected task from the specified list
+ * Extract the first task of the highest priority level which is not empty.
+ * A NULL value is returned if there's no ready task.
  */
-static int32_t kernel_remove_task_from_list(struct TASK* task_ptr, struct TASK** task_list_ptr)
+static struct TASK* kernel_ready_queue_pop()
 {
-	// If the list is empty there's no task which can be removed
-	if (*task_list_ptr == NULL) {
-		return -1;
+	if (ready_group == 0)
+		return NULL;
+
+	uint32_t group = POSITION_VAL(ready_group);
+	uint8_t prio = (uint8_t)((group << 5) | POSITION_VAL(ready_bitmap[group]));
+	struct TASK* task_ptr = ready_queue_head[prio];
+
+	ready_queue_head[prio] = task_ptr->next_task;
+	if (ready_queue_head[prio] == NULL) {
+		ready_queue_tail[prio] = NULL;
+		ready_bitmap[group] &= ~(1UL << (prio & 0x1F));
+		if (ready_bitmap[group] == 0)
+			ready_group &= ~(1UL << group);
 	}
-	
+	task_ptr->next_task = NULL;
+
+	return task_ptr;
+}
+
+/*
+ * Remove a specific task from the FIFO of its priority level. This is only
+ * needed when a ready task is killed or suspended before being executed.
+ */
+static void kernel_ready_queue_remove(struct TASK* task_ptr)
+{
+	uint8_t prio = task_ptr->priority;
 	struct TASK* prev_ptr = NULL;
-	struct TASK* curr_ptr = *task_list_ptr;
-	
-	// Find the specified task
-	while (curr_ptr != task_ptr) {
-		if (curr_ptr->next_task != NULL) {
-			// Move to the next element
-			prev_ptr = curr_ptr;
-			curr_ptr = curr_ptr->next_task;
+	struct TASK* curr_ptr = ready_queue_head[prio];
+
+	while ((curr_ptr != NULL) && (curr_ptr != task_ptr)) {
+		prev_ptr = curr_ptr;
+		curr_ptr = curr_ptr->next_task;
+	}
+	if (curr_ptr == NULL)
+		return;
+
+	if (prev_ptr == NULL) {
+		ready_queue_head[prio] = curr_ptr->next_task;
+	} else {
+		prev_ptr->next_task = curr_ptr->next_task;
+	}
+	if (ready_queue_tail[prio] == curr_ptr)
+		ready_queue_tail[prio] = prev_ptr;
+	if (ready_queue_head[prio] == NULL) {
+		ready_bitmap[prio >> 5] &= ~(1UL << (prio & 0x1F));
+		if (ready_bitmap[prio >> 5] == 0)
+			ready_group &= ~(1UL << (prio >> 5));
+	}
+	task_ptr->next_task = NULL;
+}
+
+/*
+ * Helpers for the tasks' heaps
+ */
+#define heap_parent(_i_)		(((_i_) - 1) >> 1)
+#define heap_left_child(_i_)	(((_i_) << 1) + 1)
+#define heap_key(_heap_, _task_)	(*(uint32_t*)((uint8_t*)(_task_) + (_heap_)->key_offset))
+#define heap_is_before(_heap_, _a_, _b_)	(!kernel_is_tick_reached(heap_key(_heap_, _a_), heap_key(_heap_, _b_)))
+
+static void kernel_heap_place(struct TASK_HEAP* heap, struct TASK* task_ptr, uint32_t index)
+{
+	heap->items[index] = task_ptr;
+	task_ptr->heap_index = (uint16_t)index;
+}
+
+static void kernel_heap_sift_up(struct TASK_HEAP* heap, uint32_t index)
+{
+	struct TASK* task_ptr = heap->items[index];
+
+	while ((index > 0) && heap_is_before(heap, task_ptr, heap->items[heap_parent(index)])) {
+		kernel_heap_place(heap, heap->items[heap_parent(index)], index);
+		index = heap_parent(index);
+	}
+	kernel_heap_place(heap, task_ptr, index);
+}
+
+static void kernel_heap_sift_down(struct TASK_HEAP* heap, uint32_t index)
+{
+	struct TASK* task_ptr = heap->items[index];
+	uint32_t child;
+
+	while ((child = heap_left_child(index)) < heap->count) {
+		if ((child + 1 < heap->count) && heap_is_before(heap, heap->items[child+1], heap->items[child]))
+			child++;
+		if (!heap_is_before(heap, heap->items[child], task_ptr))
+			break;
+		kernel_heap_place(heap, heap->items[child], index);
+		index = child;
+	}
+	kernel_heap_place(heap, task_ptr, index);
+}
+
+/*
+ * Add the task to the heap (its ordering tick must be already set)
+ */
+static void kernel_heap_insert(struct TASK_HEAP* heap, struct TASK* task_ptr)
+{
+	heap->items[heap->count] = task_ptr;
+	heap->count++;
+	kernel_heap_sift_up(heap, heap->count - 1);
+}
+
+/*
+ * Remove the task from any position of the heap
+ */
+static void kernel_heap_remove(struct TASK_HEAP* heap, struct TASK* task_ptr)
+{
+	uint32_t index = task_ptr->heap_index;
+
+	if ((index >= heap->count) || (heap->items[index] != task_ptr))
+		return;
+
+	task_ptr->heap_index = HEAP_INDEX_NONE;
+	heap->count--;
+	if (index == heap->count)
+		return;
+
+	// Move the last element into the hole and restore the heap property
+	kernel_heap_place(heap, heap->items[heap->count], index);
+	if ((index > 0) && heap_is_before(heap, heap->items[index], heap->items[heap_parent(index)])) {
+		kernel_heap_sift_up(heap, index);
+	} else {
+		kernel_heap_sift_down(heap, index);
+	}
+}
+
+/*
+ * Make the task runnable. Tasks of the deadline class release a new job whose deadline
+ * is relative to the tick at which they were supposed to resume, unless the previous
+ * one was released less than a period before: then they sleep until the period ends.
+ */
+static void kernel_make_task_ready(struct TASK* task_ptr)
+{
+	uint32_t next_release_tickcount = task_ptr->release_tickcount + task_ptr->period;
+
+	if (task_ptr->relative_deadline == 0) {
+		kernel_ready_queue_push(task_ptr);
+		return;
+	}
+
+	if ((task_ptr->period != 0) && !kernel_is_tick_reached(task_ptr->resume_at_tickcount, next_release_tickcount)) {
+		task_ptr->resume_at_tickcount = next_release_tickcount;
+		kernel_heap_insert(&sleeping_tasks, task_ptr);
+		task_ptr->status = TASK_STATE_SLEEPING;
+		return;
+	}
+
+	task_ptr->release_tickcount = task_ptr->resume_at_tickcount;
+	task_ptr->absolute_deadline = task_ptr->resume_at_tickcount + task_ptr->relative_deadline;
+	kernel_heap_insert(&deadline_tasks, task_ptr);
+	task_ptr->status = TASK_STATE_READY;
+}
+
+/*
+ * Move all the sleeping tasks whose timeout is expired to the ready set
+ */
+static void kernel_wake_up_expired_tasks(uint32_t current_tick_count)
+{
+	while ((sleeping_tasks.count > 0) &&
+			kernel_is_tick_reached(current_tick_count, sleeping_tasks.items[0]->resume_at_tickcount)) {
+		struct TASK* task_ptr = sleeping_tasks.items[0];
+		kernel_heap_remove(&sleeping_tasks, task_ptr);
+		kernel_make_task_ready(task_ptr);
+	}
+}
+
+/*
+ * Remove the task from whatever scheduling structure it is currently in
+ */
+static void kernel_detach_task(struct TASK* task_ptr)
+{
+	if (task_ptr->status == TASK_STATE_SLEEPING) {
+		kernel_heap_remove(&sleeping_tasks, task_ptr);
+	} else if (task_ptr->status == TASK_STATE_READY) {
+		if (task_ptr->relative_deadline != 0) {
+			kernel_heap_remove(&deadline_tasks, task_ptr);
 		} else {
-			// End of the list reached but the task was not found!
-			return -1;
+			kernel_ready_queue_remove(task_ptr);
 		}
 	}
-	
-	if (prev_ptr == NULL) {	// The task is at the beginning of the list
-		*task_list_ptr = curr_ptr->next_task;
-	} else { // The task is in the middle or at the end of the list
-		prev_ptr->next_task = curr_ptr->next_task;
+}
+
+/*
+ * Put the (detached) task either in the ready set or in the sleeping heap
+ * depending on when it should be resumed
+ */
+static void kernel_schedule_task(struct TASK* task_ptr, uint32_t resume_at_tickcount)
+{
+	task_ptr->resume_at_tickcount = resume_at_tickcount;
+	if (kernel_is_tick_reached(systick_get_tick_count(), resume_at_tickcount)) {
+		kernel_make_task_ready(task_ptr);
+	} else {
+		kernel_heap_insert(&sleeping_tasks, task_ptr);
+		task_ptr->status = TASK_STATE_SLEEPING;
 	}
-	
-	return 0;
 }
 
 /*
- * Returns a pointer to the next active task which should be set on execution.
- * A NULL value is returned if there's no ready task to run.
+ * Consume the activations posted by ISRs. This is the only reader of the ring.
+ */
+static void kernel_process_isr_activations()
+{
+	uint32_t read_index = isr_activations.read_index;
+	struct TASK* task_ptr;
+
+	// A NULL slot is either the end of the ring or a slot which has been reserved by
+	// an ISR that has not written it yet: in both cases stop here
+	while ((task_ptr = __atomic_load_n(&isr_activations.slots[read_index & ISR_RING_MASK], __ATOMIC_ACQUIRE)) != NULL) {
+		isr_activations.slots[read_index & ISR_RING_MASK] = NULL;
+		read_index++;
+		__atomic_store_n(&isr_activations.read_index, read_index, __ATOMIC_RELEASE);
+		if (!__atomic_exchange_n(&task_ptr->isr_activation_queued, FALSE, __ATOMIC_ACQ_REL))
+			isr_activations.duplicates++;
+		kernel_activate_task_immediately(task_ptr);
+	}
+}
+
+/*
+ * Returns a pointer to the next active task which should be set on execution:
+ * ready tasks of the deadline class (earliest deadline first) are always served
+ * before the best-effort ones. A NULL value is returned if there's no ready task.
  */
 static struct TASK* kernel_get_next_task_to_run()
 {
-	uint32_t current_tick_count = systick_get_tick_count();
-	struct TASK* curr_task_ptr = active_tasks_list;
-	
-	while (curr_task_ptr != NULL) {
-		if (curr_task_ptr->status == TASK_STATE_SLEEPING) {
-			if (current_tick_count >= curr_task_ptr->resume_at_tickcount)
-				return curr_task_ptr;
-		} 
-		curr_task_ptr = curr_task_ptr->next_task;
+	struct TASK* task_ptr;
+
+	kernel_wake_up_expired_tasks(systick_get_tick_count());
+	if (deadline_tasks.count > 0) {
+		task_ptr = deadline_tasks.items[0];
+		kernel_heap_remove(&deadline_tasks, task_ptr);
+		return task_ptr;
 	}
-	return NULL;
+	return kernel_ready_queue_pop();
+}
+
+/*
+ * Account for a single execution of the task
+ */
+static void kernel_update_task_stats(struct TASK* task_ptr, uint32_t cycles)
+{
+	struct TASK_STATS* stats = &task_ptr->stats;
+
+	stats->calls++;
+	stats->total_cycles += cycles;
+	if (cycles > stats->max_cycles)
+		stats->max_cycles = cycles;
+	stats->histogram[(cycles != 0) ? (31 - __CLZ(cycles)) : 0]++;
+}
+
+/*
+ * Check whether the job of a deadline task has been completed in time
+ */
+static void kernel_check_task_deadline(struct TASK* task_ptr, uint32_t current_tick_count)
+{
+	struct TASK_STATS* stats = &task_ptr->stats;
+	uint32_t lateness;
+
+	if (task_ptr->relative_deadline == 0)
+		return;
+	if (kernel_is_tick_reached(task_ptr->absolute_deadline, current_tick_count))
+		return;
+
+	lateness = current_tick_count - task_ptr->absolute_deadline;
+	stats->deadline_misses++;
+	if (lateness > stats->max_lateness)
+		stats->max_lateness = lateness;
+}
+
+/*
+ * Add a violation to the watchdog's ring (the oldest one is overwritten)
+ */
+static void kernel_watchdog_record(const char* name, uint32_t cycles, uint8_t is_isr)
+{
+	uint32_t index = __atomic_fetch_add(&watchdog.write_index, 1, __ATOMIC_RELAXED) & WATCHDOG_RING_MASK;
+	struct WATCHDOG_VIOLATION* violation = &watchdog.ring[index];
+
+	violation->name = name;
+	violation->tick = systick_get_tick_count();
+	violation->run_us = cycles / CYCLES_PER_US;
+	violation->is_isr = is_isr;
+}
+
+/*
+ * Check the run of a task against its budget, or the global threshold if it has not
+ * declared one
+ */
+static void kernel_watchdog_check_task(struct TASK* task_ptr, uint32_t cycles)
+{
+	uint32_t limit_us = (task_ptr->budget_us != 0) ? task_ptr->budget_us : watchdog.task_threshold_us;
+
+	if (cycles <= (limit_us * CYCLES_PER_US))
+		return;
+
+	task_ptr->stats.watchdog_violations++;
+	if (task_ptr->budget_us != 0)
+		watchdog.budget_violations++;
+	kernel_watchdog_record(task_ptr->name, cycles, FALSE);
+}
+
+/*
+ * Called by the scheduler when there's no task to run: the core is put in sleep
+ * until the earliest sleeping task should be resumed or an interrupt occurs.
+ */
+static void kernel_idle()
+{
+	uint32_t idle_ticks = SYSTICK_MAX_IDLE_TICKS;
+
+	__disable_irq();
+	// An ISR could have activated a task after the scheduler's last check. If this
+	// happens from now on, the pending interrupt will prevent the WFI from sleeping.
+	if ((ready_group == 0) && (deadline_tasks.count == 0) &&
+			(isr_activations.write_index == isr_activations.read_index)) {
+		if (sleeping_tasks.count > 0) {
+			uint32_t current_tick_count = systick_get_tick_count();
+			uint32_t resume_at_tickcount = sleeping_tasks.items[0]->resume_at_tickcount;
+			idle_ticks = kernel_is_tick_reached(current_tick_count, resume_at_tickcount) ?
+							0 : (resume_at_tickcount - current_tick_count);
+		}
+		systick_sleep_for_ticks(idle_ticks);
+	}
+	__enable_irq();
 }
 
 /*
  * This is the first kernel function called after reset and it includes the scheduler.
  * The function is "naked" because we don't need any prologue/epilogue as we're never 
- * supposed to exit from this looping function.
+ * supposed to exit from this looping function (on the host it's a normal function).
  */
-__attribute__((naked)) void kernel_main(void)
+#ifndef HOST_BUILD
+__attribute__((naked))
+#endif
+void kernel_main(void)
 {
     int32_t task_ret_val;
+    uint32_t loop_cycles, start_cycles, run_cycles;
     
     // Configure the main clock
 	ClockConfig_SetMainClockAndPrescalers(); 
+	// kernel's own services
+	kernel_init_task(&timers_task);
+	kernel_rt_init();
 	// initialize all the modules
 	kernel_initialize_modules();
 	// Scheduler loop
 	while (1) {
+		loop_cycles = cycle_counter_get();
+		scheduler_stats.loops++;
+		kernel_process_isr_activations();
 		active_task = kernel_get_next_task_to_run();
 		if (active_task != NULL) {
+			scheduler_stats.dispatches++;
+			active_task->status = TASK_STATE_RUNNING;
+			active_task->activation_pending = FALSE;
+			start_cycles = cycle_counter_get();
             task_ret_val = (active_task->func)();
+			run_cycles = cycle_counter_get() - start_cycles;
+			kernel_update_task_stats(active_task, run_cycles);
+			kernel_watchdog_check_task(active_task, run_cycles);
+			kernel_check_task_deadline(active_task, systick_get_tick_count());
             if (task_ret_val >= 0) {
-                active_task->resume_at_tickcount = systick_get_tick_count() + (int32_t)task_ret_val;
+                uint32_t resume_at_tickcount = systick_get_tick_count() + (int32_t)task_ret_val;
+                // An activation received while running can only anticipate the wake-up
+                if (active_task->activation_pending &&
+                		!kernel_is_tick_reached(active_task->resume_at_tickcount, resume_at_tickcount)) {
+                	resume_at_tickcount = active_task->resume_at_tickcount;
+                }
+                kernel_schedule_task(active_task, resume_at_tickcount);
             } else if (task_ret_val == WAIT_FOR_RESUME) {
-                active_task->status = TASK_STATE_WAITING_FOR_RESUME;
+                if (active_task->activation_pending) {
+                	kernel_schedule_task(active_task, active_task->resume_at_tickcount);
+                } else {
+                	active_task->status = TASK_STATE_WAITING_FOR_RESUME;
+                }
             } else {
                 kernel_kill_task(active_task);
             }
 			active_task = NULL;
+			scheduler_stats.cycles += cycle_counter_get() - loop_cycles - run_cycles;
+		} else {
+			scheduler_stats.cycles += cycle_counter_get() - loop_cycles;
+			kernel_idle();
 		}
 	}
 }
@@ -199,11 +628,26 @@ __attribute__((naked)) void kernel_main(void)
 /*	KERNEL - PUBLIC FUNCTIONS	*/
 /********************************************************************/
 /*
- * Initialize the task's stack and add it to the tasks' list
+ * Register the task into the kernel. Tasks which are activated without being
+ * initialized are registered on their first activation.
  */
 void kernel_init_task(struct TASK* task_ptr)
 {
-	kernel_add_task_to_list(task_ptr, &dead_tasks_list);
+	if (task_ptr->id != TASK_ID_NONE)
+		return;
+
+	if (tasks_count >= KERNEL_MAX_TASKS) {
+		debug_msg("Error: too many tasks, \"%s\" cannot be registered\n", task_ptr->name);
+		return;
+	}
+
+	task_ptr->id = tasks_count;
+	task_ptr->status = TASK_STATE_DEAD;
+	task_ptr->heap_index = HEAP_INDEX_NONE;
+	task_ptr->activation_pending = FALSE;
+	task_ptr->next_task = NULL;
+	registered_tasks[tasks_count] = task_ptr;
+	tasks_count ++;
 }
 
 /*
@@ -211,15 +655,28 @@ void kernel_init_task(struct TASK* task_ptr)
  */
 void kernel_activate_task_after_ms(struct TASK* task_ptr, int32_t delay)
 {
-	// If the task was dead, then move it to the active tasks' list
-	if (task_ptr->status == TASK_STATE_DEAD) {
-		kernel_remove_task_from_list(task_ptr, &dead_tasks_list);
-		kernel_add_task_to_list(task_ptr, &active_tasks_list);
+	uint32_t current_tick_count = systick_get_tick_count();
+
+	kernel_init_task(task_ptr);
+	if (task_ptr->id == TASK_ID_NONE)
+		return;
+
+	// The task is being executed: the activation will be processed once it returns
+	if (task_ptr->status == TASK_STATE_RUNNING) {
+		if (delay >= 0) {
+			task_ptr->resume_at_tickcount = current_tick_count + delay;
+			task_ptr->activation_pending = TRUE;
+		}
+		return;
 	}
 
+	// Do not lose the position in the ready queue if it's already there
+	if ((task_ptr->status == TASK_STATE_READY) && (delay == 0))
+		return;
+
+	kernel_detach_task(task_ptr);
 	if (delay >= 0) {
-		task_ptr->status = TASK_STATE_SLEEPING;
-		task_ptr->resume_at_tickcount = systick_get_tick_count() + delay;
+		kernel_schedule_task(task_ptr, current_tick_count + delay);
 	} else {
 		task_ptr->status = TASK_STATE_WAITING_FOR_RESUME;
 	}
@@ -233,14 +690,46 @@ void kernel_activate_task_immediately(struct TASK* task_ptr)
 	kernel_activate_task_after_ms(task_ptr, 0UL);
 }
 
+/*
+ * ISR-safe version of kernel_activate_task_immediately(): the activation is only
+ * queued and it is processed by the scheduler at its next loop. This takes a bounded
+ * amount of time and it can be called from ISRs with any priority (also nested ones).
+ */
+void kernel_activate_task_from_isr(struct TASK* task_ptr)
+{
+	uint32_t write_index;
+
+	// If the task is already queued then there's nothing else to do
+	if (__atomic_exchange_n(&task_ptr->isr_activation_queued, TRUE, __ATOMIC_ACQUIRE))
+		return;
+
+	// Reserve a slot: this ISR could preempt (or be preempted by) another one which
+	// is posting to the ring at the same time
+	write_index = __atomic_load_n(&isr_activations.write_index, __ATOMIC_RELAXED);
+	do {
+		if ((write_index - __atomic_load_n(&isr_activations.read_index, __ATOMIC_ACQUIRE)) >= KERNEL_ISR_RING_SIZE) {
+			isr_activations.overflows++;
+			__atomic_store_n(&task_ptr->isr_activation_queued, FALSE, __ATOMIC_RELEASE);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&isr_activations.write_index, &write_index, write_index + 1,
+											FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	__atomic_store_n(&isr_activations.slots[write_index & ISR_RING_MASK], task_ptr, __ATOMIC_RELEASE);
+}
+
 /*
  * This simply kills a task
  */
 void kernel_kill_task(struct TASK* task_ptr)
 {
+	kernel_detach_task(task_ptr);
+	task_ptr->activation_pending = FALSE;
 	task_ptr->status = TASK_STATE_DEAD;
-	if (kernel_remove_task_from_list(task_ptr, &active_tasks_list) >= 0) {
-		kernel_add_task_to_list(task_ptr, &dead_tasks_list);
+
+	if (task_ptr->is_boot_step) {
+		task_ptr->is_boot_step = FALSE;
+		kernel_boot_step_completed(task_ptr);
 	}
 }
 
@@ -251,3 +740,754 @@ uint8_t kernel_get_task_status(struct TASK* task_ptr)
 {
 	return task_ptr->status;
 }
+
+/*
+ * Copy the scheduler's statistics
+ */
+void kernel_get_scheduler_stats(struct SCHEDULER_STATS* stats)
+{
+	*stats = scheduler_stats;
+	stats->isr_overflows = isr_activations.overflows;
+	stats->isr_duplicates = isr_activations.duplicates;
+}
+
+/*
+ * Move the task to the deadline class (or back to the best-effort one if the deadline
+ * and the period are 0): a ready or sleeping task is rescheduled in its new class
+ */
+void kernel_set_task_deadline(struct TASK* task_ptr, uint16_t period, uint16_t relative_deadline)
+{
+	uint8_t is_scheduled = (task_ptr->status == TASK_STATE_READY) || (task_ptr->status == TASK_STATE_SLEEPING);
+
+	if (is_scheduled)
+		kernel_detach_task(task_ptr);
+	task_ptr->period = period;
+	task_ptr->relative_deadline = (relative_deadline != 0) ? relative_deadline : period;
+	if (is_scheduled)
+		kernel_schedule_task(task_ptr, task_ptr->resume_at_tickcount);
+}
+
+/********************************************************************/
+/*	KERNEL - BOOT	*/
+/********************************************************************/
+/*
+ * Activate the next step, once the supplies have settled
+ */
+static void kernel_boot_start_step()
+{
+	uint32_t current_tick_count = systick_get_tick_count();
+	uint32_t delay = kernel_is_tick_reached(current_tick_count, boot.settled_tick) ?
+						0 : (boot.settled_tick - current_tick_count);
+
+	boot.steps[boot.started_steps].started_tick = current_tick_count + delay;
+	kernel_activate_task_after_ms(boot.steps[boot.started_steps].task, delay);
+	boot.started_steps++;
+}
+
+/*
+ * One of the boot steps died (NULL if there's none): when it's the last one the boot
+ * is completed, otherwise in serial mode the next one starts
+ */
+static void kernel_boot_step_completed(struct TASK* task_ptr)
+{
+	uint32_t index;
+
+	for (index=0; index<boot.steps_count; index++) {
+		if (boot.steps[index].task == task_ptr)
+			boot.steps[index].completed_tick = systick_get_tick_count();
+	}
+	if (boot.pending_steps > 0)
+		boot.pending_steps--;
+	if (boot.pending_steps > 0) {
+		if (boot.is_serial)
+			kernel_boot_start_step();
+		return;
+	}
+
+	boot.is_completed = TRUE;
+	boot.completed_tick = systick_get_tick_count();
+	debug_msg("Initialization completed in %d ms (%s steps)\n", boot.completed_tick,
+				boot.is_serial ? "serial" : "parallel");
+	for (index=0; index<boot.steps_count; index++) {
+		debug_msg("  %-16s %4d ms to %4d ms\n", boot.steps[index].task->name,
+					boot.steps[index].started_tick, boot.steps[index].completed_tick);
+	}
+	if (boot.completion_task != NULL)
+		kernel_activate_task_immediately(boot.completion_task);
+}
+
+/*
+ * Run the task as part of the boot: it's activated once the supplies have settled
+ * (in serial mode, once the previous step died) and the boot is completed when it
+ * dies (whatever the result)
+ */
+void kernel_boot_add_step(struct TASK* task_ptr)
+{
+	if (boot.is_completed || (boot.steps_count == KERNEL_MAX_BOOT_STEPS)) {
+		debug_msg("Error: \"%s\" cannot be added to the boot\n", task_ptr->name);
+		return;
+	}
+
+	kernel_init_task(task_ptr);
+	if (task_ptr->id == TASK_ID_NONE)
+		return;
+
+	task_ptr->is_boot_step = TRUE;
+	boot.steps[boot.steps_count].task = task_ptr;
+	boot.steps_count++;
+	boot.pending_steps++;
+	if (!boot.is_serial || (boot.pending_steps == 1))
+		kernel_boot_start_step();
+}
+
+/*
+ * Run the boot steps one after the other (it must be set before the boot)
+ */
+void kernel_boot_set_serial(uint8_t is_serial)
+{
+	boot.is_serial = is_serial;
+}
+
+/*
+ * Task to be activated when the boot completes (immediately if it already did)
+ */
+void kernel_boot_set_completion_task(struct TASK* task_ptr)
+{
+	boot.completion_task = task_ptr;
+	if (boot.is_completed)
+		kernel_activate_task_immediately(task_ptr);
+}
+
+uint8_t kernel_boot_is_completed()
+{
+	return boot.is_completed;
+}
+
+/********************************************************************/
+/*	KERNEL - WATCHDOG	*/
+/********************************************************************/
+/*
+ * Declare the longest time the task is allowed to run without returning to the
+ * scheduler (0 = use the watchdog's global threshold)
+ */
+void kernel_set_task_budget(struct TASK* task_ptr, uint32_t budget_us)
+{
+	task_ptr->budget_us = budget_us;
+}
+
+/*
+ * Account for a single execution of an ISR (see KERNEL_ISR_EXIT). ISRs are
+ * registered the first time they run.
+ */
+void kernel_isr_completed(struct ISR_STATS* isr_stats, uint32_t cycles)
+{
+	uint32_t index;
+
+	if (!__atomic_exchange_n(&isr_stats->is_registered, TRUE, __ATOMIC_ACQ_REL)) {
+		index = __atomic_fetch_add(&watchdog.isrs_count, 1, __ATOMIC_ACQ_REL);
+		if (index < KERNEL_MAX_ISRS)
+			__atomic_store_n(&watchdog.isrs[index], isr_stats, __ATOMIC_RELEASE);
+	}
+
+	isr_stats->calls++;
+	if (cycles > isr_stats->max_cycles)
+		isr_stats->max_cycles = cycles;
+	if (cycles > (watchdog.isr_threshold_us * CYCLES_PER_US)) {
+		isr_stats->watchdog_violations++;
+		kernel_watchdog_record(isr_stats->name, cycles, TRUE);
+	}
+}
+
+/*
+ * Return how many runs of tasks exceeded their declared budget
+ */
+uint32_t kernel_watchdog_get_budget_violations()
+{
+	return watchdog.budget_violations;
+}
+
+/********************************************************************/
+/*	KERNEL - TIMERS	*/
+/********************************************************************/
+/*
+ * Add the timer to the sorted list, after the ones which expire at the same tick.
+ * Returns TRUE if it is the first one to expire.
+ */
+static uint8_t kernel_timer_insert(struct KERNEL_TIMER* timer)
+{
+	struct KERNEL_TIMER** link = &active_timers;
+
+	while ((*link != NULL) && kernel_is_tick_reached(timer->expire_at_tickcount, (*link)->expire_at_tickcount))
+		link = &(*link)->next_timer;
+	timer->next_timer = *link;
+	*link = timer;
+	timer->is_active = TRUE;
+
+	return (link == &active_timers);
+}
+
+static void kernel_timer_remove(struct KERNEL_TIMER* timer)
+{
+	struct KERNEL_TIMER** link = &active_timers;
+
+	while ((*link != NULL) && (*link != timer))
+		link = &(*link)->next_timer;
+	if (*link != NULL)
+		*link = timer->next_timer;
+	timer->next_timer = NULL;
+	timer->is_active = FALSE;
+}
+
+/*
+ * Make the timers task resume when the first timer expires. A ready task is left
+ * where it is, since it will run before that anyway.
+ */
+static void kernel_timers_wake_up()
+{
+	uint32_t current_tick_count = systick_get_tick_count();
+	uint32_t expire_at_tickcount;
+
+	if ((active_timers == NULL) || (timers_task.status == TASK_STATE_READY))
+		return;
+
+	expire_at_tickcount = active_timers->expire_at_tickcount;
+	kernel_activate_task_after_ms(&timers_task, kernel_is_tick_reached(current_tick_count, expire_at_tickcount) ?
+									0 : (int32_t)(expire_at_tickcount - current_tick_count));
+}
+
+/*
+ * Start the timer: the callback is executed after "delay" ms and then every "period"
+ * ms (0 = only once). If the timer was already active it's restarted.
+ */
+void kernel_timer_start(struct KERNEL_TIMER* timer, uint32_t delay, uint32_t period)
+{
+	if (timer->is_active)
+		kernel_timer_remove(timer);
+
+	timer->period = period;
+	timer->expire_at_tickcount = systick_get_tick_count() + delay;
+	if (kernel_timer_insert(timer))
+		kernel_timers_wake_up();
+}
+
+/*
+ * Move the next expiration of the timer (active or not) "delay" ms from now,
+ * keeping its period
+ */
+void kernel_timer_reschedule(struct KERNEL_TIMER* timer, uint32_t delay)
+{
+	kernel_timer_start(timer, delay, timer->period);
+}
+
+void kernel_timer_stop(struct KERNEL_TIMER* timer)
+{
+	if (timer->is_active)
+		kernel_timer_remove(timer);
+}
+
+uint8_t kernel_timer_is_active(struct KERNEL_TIMER* timer)
+{
+	return timer->is_active;
+}
+
+/*
+ * Execute the timer's callback as soon as possible, without changing its schedule.
+ * This can be called from ISRs with any priority: the timer is pushed to a lock-free
+ * list which is drained by the timers task.
+ */
+void kernel_timer_fire_from_isr(struct KERNEL_TIMER* timer)
+{
+	struct KERNEL_TIMER* head;
+
+	if (__atomic_exchange_n(&timer->fire_queued, TRUE, __ATOMIC_ACQUIRE))
+		return;
+
+	head = __atomic_load_n(&fired_timers, __ATOMIC_RELAXED);
+	do {
+		timer->next_fired = head;
+	} while (!__atomic_compare_exchange_n(&fired_timers, &head, timer, FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	kernel_activate_task_from_isr(&timers_task);
+}
+
+/*
+ * Timers task: run the callbacks of the fired timers and of the expired ones, then
+ * sleep until the next expiration. Periodic timers are rearmed before their callback,
+ * so that it can stop or reschedule them; missed periods are skipped.
+ */
+int32_t timers_task_func()
+{
+	struct KERNEL_TIMER* fired = __atomic_exchange_n(&fired_timers, NULL, __ATOMIC_ACQUIRE);
+	struct KERNEL_TIMER* in_order = NULL;
+	struct KERNEL_TIMER* timer;
+	uint32_t current_tick_count;
+
+	// Restore the order in which the timers were fired
+	while (fired != NULL) {
+		timer = fired;
+		fired = timer->next_fired;
+		timer->next_fired = in_order;
+		in_order = timer;
+	}
+	while (in_order != NULL) {
+		timer = in_order;
+		in_order = timer->next_fired;
+		__atomic_store_n(&timer->fire_queued, FALSE, __ATOMIC_RELEASE);
+		timer->callback();
+		timer->calls++;
+	}
+
+	current_tick_count = systick_get_tick_count();
+	while ((active_timers != NULL) && kernel_is_tick_reached(current_tick_count, active_timers->expire_at_tickcount)) {
+		timer = active_timers;
+		kernel_timer_remove(timer);
+		if (timer->period != 0) {
+			timer->expire_at_tickcount += timer->period;
+			if (kernel_is_tick_reached(current_tick_count, timer->expire_at_tickcount))
+				timer->expire_at_tickcount = current_tick_count + timer->period;
+			kernel_timer_insert(timer);
+		}
+		timer->callback();
+		timer->calls++;
+	}
+
+	if (active_timers == NULL)
+		return WAIT_FOR_RESUME;
+	current_tick_count = systick_get_tick_count();
+	if (kernel_is_tick_reached(current_tick_count, active_timers->expire_at_tickcount))
+		return IMMEDIATELY;
+	return (int32_t)(active_timers->expire_at_tickcount - current_tick_count);
+}
+
+/********************************************************************/
+/*	KERNEL - REAL-TIME TASKS	*/
+/********************************************************************/
+/*
+ * PendSV gets the lowest priority, so that it preempts only the cooperative loop
+ */
+static void kernel_rt_init()
+{
+	NVIC_SetPriority(PendSV_IRQn, KERNEL_RT_PRIORITY);
+}
+
+/*
+ * Run the pending real-time tasks, in priority order, until there are no more.
+ * This is executed by PendSV.
+ */
+static void kernel_rt_dispatch()
+{
+	uint32_t pending, index, cycles;
+	struct RT_TASK* rt_task;
+
+	while ((pending = __atomic_exchange_n(&rt.pending, 0, __ATOMIC_ACQ_REL)) != 0) {
+		while (pending != 0) {
+			index = POSITION_VAL(pending);
+			pending &= ~(1UL << index);
+			rt_task = rt.tasks[index];
+
+			cycles = cycle_counter_get();
+			rt_task->func();
+			cycles = cycle_counter_get() - cycles;
+
+			rt_task->calls++;
+			rt_task->total_cycles += cycles;
+			if (cycles > rt_task->max_cycles)
+				rt_task->max_cycles = cycles;
+		}
+	}
+}
+
+/*
+ * PendSV switches to the real-time tasks' stack, runs them and goes back to the
+ * interrupted stack. Being the lowest priority exception, it's always entered from
+ * the cooperative loop (thread mode). On the host it's a normal function.
+ */
+#ifndef HOST_BUILD
+__attribute__((naked)) void PendSV_Handler(void)
+{
+	__asm volatile (
+		"	mov r0, sp					\n"
+		"	movw r1, #:lower16:kernel_rt_stack_top	\n"
+		"	movt r1, #:upper16:kernel_rt_stack_top	\n"
+		"	ldr r1, [r1]				\n"
+		"	mov sp, r1					\n"
+		"	push {r0, lr}				\n"	// interrupted stack and EXC_RETURN
+		"	bl kernel_rt_dispatch		\n"
+		"	pop {r0, lr}				\n"
+		"	mov sp, r0					\n"
+		"	bx lr						\n"
+	);
+}
+#else
+void PendSV_Handler(void)
+{
+	kernel_rt_dispatch();
+}
+#endif
+
+/*
+ * Register the real-time task. Tasks registered first have the higher priority.
+ */
+void kernel_rt_init_task(struct RT_TASK* rt_task)
+{
+	if (rt_task->id != RT_TASK_ID_NONE)
+		return;
+
+	if (rt.count >= KERNEL_MAX_RT_TASKS) {
+		debug_msg("Error: too many real-time tasks, \"%s\" cannot be registered\n", rt_task->name);
+		return;
+	}
+
+	rt_task->id = rt.count;
+	rt.tasks[rt.count] = rt_task;
+	rt.count++;
+}
+
+/*
+ * Make the real-time task run as soon as possible. This can be called from any
+ * context: from the cooperative tasks it runs before this function returns.
+ */
+void kernel_rt_activate(struct RT_TASK* rt_task)
+{
+	if (rt_task->id == RT_TASK_ID_NONE)
+		return;
+
+	__atomic_fetch_or(&rt.pending, 1UL << rt_task->id, __ATOMIC_RELEASE);
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+	__DSB();
+	__ISB();
+}
+
+/*
+ * Prevent (or allow again) the execution of the real-time tasks, without masking the
+ * ISRs. Sections can't be nested.
+ */
+void kernel_rt_lock()
+{
+	__set_BASEPRI(KERNEL_RT_PRIORITY << (8 - __NVIC_PRIO_BITS));
+}
+
+void kernel_rt_unlock()
+{
+	__set_BASEPRI(0);
+}
+
+/********************************************************************/
+/*	KERNEL - MAILBOXES	*/
+/********************************************************************/
+/*
+ * Select the task which will be activated when new items are posted to the mailbox
+ */
+void kernel_mailbox_set_receiver(struct MAILBOX* mailbox, struct TASK* task_ptr)
+{
+	mailbox->receiver = task_ptr;
+}
+
+/*
+ * Append a copy of the item to the mailbox. The receiver is activated only on the
+ * empty to not-empty transition: further posts are coalesced into the same wake-up.
+ * Returns -1 if the mailbox is full (the item is dropped and counted).
+ */
+int32_t kernel_mailbox_post(struct MAILBOX* mailbox, const void* item)
+{
+	uint16_t tail;
+
+	if (mailbox->count >= mailbox->capacity) {
+		mailbox->overflows++;
+		return -1;
+	}
+
+	tail = mailbox->head + mailbox->count;
+	if (tail >= mailbox->capacity)
+		tail -= mailbox->capacity;
+	memcpy(&mailbox->items[tail * mailbox->item_size], item, mailbox->item_size);
+	mailbox->count++;
+
+	if ((mailbox->count == 1) && (mailbox->receiver != NULL)) {
+		mailbox->wakeups++;
+		kernel_activate_task_immediately(mailbox->receiver);
+	}
+
+	return 0;
+}
+
+/*
+ * Copy the oldest item without removing it. Returns -1 if the mailbox is empty.
+ */
+int32_t kernel_mailbox_peek(struct MAILBOX* mailbox, void* item)
+{
+	if (mailbox->count == 0)
+		return -1;
+
+	memcpy(item, &mailbox->items[mailbox->head * mailbox->item_size], mailbox->item_size);
+	return 0;
+}
+
+/*
+ * Extract the oldest item. Returns -1 if the mailbox is empty.
+ */
+int32_t kernel_mailbox_receive(struct MAILBOX* mailbox, void* item)
+{
+	if (kernel_mailbox_peek(mailbox, item) < 0)
+		return -1;
+
+	mailbox->head++;
+	if (mailbox->head >= mailbox->capacity)
+		mailbox->head = 0;
+	mailbox->count--;
+	mailbox->received++;
+	return 0;
+}
+
+/*
+ * Discard all the items in the mailbox
+ */
+void kernel_mailbox_flush(struct MAILBOX* mailbox)
+{
+	mailbox->head = 0;
+	mailbox->count = 0;
+}
+
+/********************************************************************/
+/*	KERNEL - SHELL COMMANDS	*/
+/********************************************************************/
+/*
+ * Print the execution statistics of all the registered tasks:
+ *	- "top" prints calls, average/max run time and CPU load since the last reset.
+ *	  The scheduler's loops and executed tasks per second and its own cycles per loop
+ *	  are printed first, followed by the ISRs' activations lost or found twice in the ring.
+ *	- "top hist <task>" prints the run time histogram of the selected task
+ *	- "top reset" clears all the statistics
+ */
+int kernel_top(int argc, char *argv[])
+{
+	uint32_t index, bin;
+	uint32_t elapsed_ms = systick_get_tick_count() - stats_start_tick;
+	struct TASK* task_ptr;
+
+	if ((argc == 1) && (strcmp(argv[0], "reset") == 0)) {
+		for (index=0; index<tasks_count; index++) {
+			memset(&registered_tasks[index]->stats, 0, sizeof(struct TASK_STATS));
+		}
+		for (index=0; index<rt.count; index++) {
+			rt.tasks[index]->calls = 0;
+			rt.tasks[index]->total_cycles = 0;
+			rt.tasks[index]->max_cycles = 0;
+		}
+		stats_start_tick = systick_get_tick_count();
+		memset(&scheduler_stats, 0, sizeof(scheduler_stats));
+		return 0;
+	}
+
+	if ((argc == 2) && (strcmp(argv[0], "hist") == 0)) {
+		for (index=0; index<tasks_count; index++) {
+			task_ptr = registered_tasks[index];
+			if (strcmp(task_ptr->name, argv[1]) == 0) {
+				debug_msg("%s run time histogram (us)\n", task_ptr->name);
+				for (bin=0; bin<TASK_STATS_HISTOGRAM_BINS; bin++) {
+					if (task_ptr->stats.histogram[bin] != 0) {
+						debug_msg("  >= %u: %u\n", (1UL << bin)/CYCLES_PER_US, task_ptr->stats.histogram[bin]);
+					}
+				}
+				return 0;
+			}
+		}
+		debug_msg("task not found\n");
+		return -1;
+	}
+
+	if (argc != 0) {
+		debug_msg("usage: top [reset | hist <task>]\n");
+		return -1;
+	}
+
+	if (elapsed_ms != 0) {
+		debug_msg("scheduler: %u loops/s, %u tasks run/s, %u cycles/loop\n",
+					(uint32_t)(((uint64_t)scheduler_stats.loops * 1000) / elapsed_ms),
+					(uint32_t)(((uint64_t)scheduler_stats.dispatches * 1000) / elapsed_ms),
+					(scheduler_stats.loops != 0) ? (uint32_t)(scheduler_stats.cycles / scheduler_stats.loops) : 0);
+		debug_msg("ISRs' activations: %u lost (ring full), %u duplicated\n", isr_activations.overflows, isr_activations.duplicates);
+	}
+	debug_msg("%-16s %10s %10s %10s %6s\n", "task", "calls", "avg(us)", "max(us)", "cpu%");
+	for (index=0; index<tasks_count; index++) {
+		struct TASK_STATS* stats = &registered_tasks[index]->stats;
+		uint32_t avg_us = (stats->calls != 0) ? (uint32_t)((stats->total_cycles / stats->calls) / CYCLES_PER_US) : 0;
+		uint32_t cpu_load = (elapsed_ms != 0) ?
+				(uint32_t)((stats->total_cycles * 100) / ((uint64_t)elapsed_ms * (CYCLE_COUNTER_FREQ/1000))) : 0;
+		debug_msg("%-16s %10u %10u %10u %6u\n", registered_tasks[index]->name, stats->calls, avg_us,
+					stats->max_cycles / CYCLES_PER_US, cpu_load);
+	}
+	for (index=0; index<rt.count; index++) {
+		struct RT_TASK* rt_task = rt.tasks[index];
+		uint32_t avg_us = (rt_task->calls != 0) ? (uint32_t)((rt_task->total_cycles / rt_task->calls) / CYCLES_PER_US) : 0;
+		uint32_t cpu_load = (elapsed_ms != 0) ?
+				(uint32_t)((rt_task->total_cycles * 100) / ((uint64_t)elapsed_ms * (CYCLE_COUNTER_FREQ/1000))) : 0;
+		debug_msg("%-16s %10u %10u %10u %6u (rt)\n", rt_task->name, rt_task->calls, avg_us,
+					rt_task->max_cycles / CYCLES_PER_US, cpu_load);
+	}
+
+	return 0;
+}
+
+/*
+ * Busy wait for the specified time
+ */
+static void kernel_busy_wait(uint32_t ms)
+{
+	uint32_t end_tick = systick_get_tick_count() + ms;
+
+	while (!kernel_is_tick_reached(systick_get_tick_count(), end_tick));
+}
+
+/*
+ * Timer of the background load: stall for a random time, up to the maximum
+ */
+void stall_timer_func()
+{
+	stall_load.seed = (stall_load.seed * 1103515245) + 12345;
+	kernel_busy_wait((stall_load.seed >> 16) % (stall_load.max_ms + 1));
+}
+
+/*
+ * Keep the CPU busy inside the calling task for the specified time, as a long UI
+ * task would do (for testing the latency of what the scheduler can't preempt):
+ *	- "stall <ms>" stalls once
+ *	- "stall <ms> <period_ms>" stalls for a random time up to <ms> every <period_ms>
+ *	  (from a timer, so at a high priority), as a background load
+ *	- "stall off" stops the background load
+ */
+int kernel_stall(int argc, char *argv[])
+{
+	if ((argc == 1) && (strcmp(argv[0], "off") == 0)) {
+		kernel_timer_stop(&stall_timer);
+		return 0;
+	}
+	if (argc == 2) {
+		stall_load.max_ms = atoi(argv[0]);
+		kernel_timer_start(&stall_timer, atoi(argv[1]), atoi(argv[1]));
+		return 0;
+	}
+	if (argc != 1) {
+		debug_msg("usage: stall <ms> [<period_ms>] | off\n");
+		return -1;
+	}
+
+	kernel_busy_wait(atoi(argv[0]));
+
+	return 0;
+}
+
+/*
+ * Report of the non-yield watchdog:
+ *	- "watchdog" prints the longest run of every task (since the last "top reset") and
+ *	  of every ISR, their limit, how many times it was exceeded and the latest violations
+ *	- "watchdog threshold <task_us> [<isr_us>]" changes the global thresholds
+ *	- "watchdog reset" clears the violations and the ISRs' statistics
+ */
+int kernel_watchdog(int argc, char *argv[])
+{
+	uint32_t index, isrs_count, first;
+	struct TASK* task_ptr;
+	struct ISR_STATS* isr_stats;
+	struct WATCHDOG_VIOLATION* violation;
+
+	isrs_count = __atomic_load_n(&watchdog.isrs_count, __ATOMIC_ACQUIRE);
+	if (isrs_count > KERNEL_MAX_ISRS)
+		isrs_count = KERNEL_MAX_ISRS;
+
+	if ((argc == 1) && (strcmp(argv[0], "reset") == 0)) {
+		for (index=0; index<tasks_count; index++) {
+			registered_tasks[index]->stats.watchdog_violations = 0;
+		}
+		for (index=0; index<isrs_count; index++) {
+			isr_stats = __atomic_load_n(&watchdog.isrs[index], __ATOMIC_ACQUIRE);
+			if (isr_stats != NULL) {
+				isr_stats->calls = 0;
+				isr_stats->max_cycles = 0;
+				isr_stats->watchdog_violations = 0;
+			}
+		}
+		watchdog.budget_violations = 0;
+		watchdog.write_index = 0;
+		return 0;
+	}
+
+	if (((argc == 2) || (argc == 3)) && (strcmp(argv[0], "threshold") == 0)) {
+		watchdog.task_threshold_us = atoi(argv[1]);
+		if (argc == 3)
+			watchdog.isr_threshold_us = atoi(argv[2]);
+		return 0;
+	}
+
+	if (argc != 0) {
+		debug_msg("usage: watchdog [reset | threshold <task_us> [<isr_us>]]\n");
+		return -1;
+	}
+
+	debug_msg("%-16s %10s %10s %10s\n", "task/isr", "max(us)", "limit(us)", "violations");
+	for (index=0; index<tasks_count; index++) {
+		task_ptr = registered_tasks[index];
+		debug_msg("%-16s %10u %10u %10u\n", task_ptr->name, task_ptr->stats.max_cycles / CYCLES_PER_US,
+					(task_ptr->budget_us != 0) ? task_ptr->budget_us : watchdog.task_threshold_us,
+					task_ptr->stats.watchdog_violations);
+	}
+	for (index=0; index<isrs_count; index++) {
+		isr_stats = __atomic_load_n(&watchdog.isrs[index], __ATOMIC_ACQUIRE);
+		if (isr_stats != NULL) {
+			debug_msg("%-16s %10u %10u %10u (isr)\n", isr_stats->name, isr_stats->max_cycles / CYCLES_PER_US,
+						watchdog.isr_threshold_us, isr_stats->watchdog_violations);
+		}
+	}
+
+	debug_msg("%u violations (%u over a declared budget), latest ones:\n", watchdog.write_index, watchdog.budget_violations);
+	first = (watchdog.write_index > KERNEL_WATCHDOG_RING_SIZE) ? (watchdog.write_index - KERNEL_WATCHDOG_RING_SIZE) : 0;
+	for (index=first; index<watchdog.write_index; index++) {
+		violation = &watchdog.ring[index & WATCHDOG_RING_MASK];
+		debug_msg("  %10u ms: %s%s ran for %u us\n", violation->tick, violation->name,
+					violation->is_isr ? " (isr)" : "", violation->run_us);
+	}
+
+	return 0;
+}
+
+/*
+ * Report of the deadline class:
+ *	- "deadline" prints the period and the deadline of the tasks of the class, the jobs
+ *	  completed after their deadline and the worst lateness (since the last "top reset")
+ *	- "deadline <task> <period_ms> <deadline_ms>" moves the task to the class (or back
+ *	  to the best-effort one, with its priority, if both are 0)
+ */
+int kernel_deadline(int argc, char *argv[])
+{
+	uint32_t index;
+	struct TASK* task_ptr;
+
+	if (argc == 3) {
+		for (index=0; index<tasks_count; index++) {
+			task_ptr = registered_tasks[index];
+			if (strcmp(task_ptr->name, argv[0]) == 0) {
+				kernel_set_task_deadline(task_ptr, atoi(argv[1]), atoi(argv[2]));
+				return 0;
+			}
+		}
+		debug_msg("task not found\n");
+		return -1;
+	}
+
+	if (argc != 0) {
+		debug_msg("usage: deadline [<task> <period_ms> <deadline_ms>]\n");
+		return -1;
+	}
+
+	debug_msg("%-16s %10s %10s %10s %10s %10s\n", "task", "period", "deadline", "jobs", "misses", "late(ms)");
+	for (index=0; index<tasks_count; index++) {
+		task_ptr = registered_tasks[index];
+		if (task_ptr->relative_deadline != 0) {
+			debug_msg("%-16s %10u %10u %10u %10u %10u\n", task_ptr->name, task_ptr->period,
+						task_ptr->relative_deadline, task_ptr->stats.calls, task_ptr->stats.deadline_misses,
+						task_ptr->stats.max_lateness);
+		}
+	}
+
+	return 0;
+}
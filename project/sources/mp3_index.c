@@ -0,0 +1,482 @@
+#include "mp3_index.h"
+#include "mp3_tags.h"
+#include "frame.h"
+#include "kernel.h"
+#include "debug_printf.h"
+#include "string.h"
+#include "utils.h"
+
+#define debug_msg(format, ...)		debug_printf("[mp3_index] " format, ##__VA_ARGS__)
+
+// Index of the frames of a file, for seeking: entry "i" is the offset inside the file
+// of the frame i*frames_per_entry (24.8 fixed point, since a TOC splits the duration
+// in equal parts). The scan keeps one frame out of a power of 2, which is doubled
+// (dropping every other entry) whenever the entries are over.
+#define MP3_INDEX_ENTRIES			256
+struct MP3_INDEX {
+	uint32_t file_cluster;		// the file is identified by its first cluster and its size
+	uint32_t file_size;
+	uint32_t frames;			// frames of the stream (found so far, while scanning)
+	uint32_t frames_per_entry;
+	uint32_t last_used;
+	uint16_t entries;
+	uint8_t source;
+	uint8_t is_complete;
+	struct MP3_INDEX_INFO info;
+	uint32_t offsets[MP3_INDEX_ENTRIES];
+};
+
+// The indexes of the last files are kept, so that playing them again seeks at once
+#define MP3_INDEX_CACHE_SIZE		4
+__attribute__((section (".ccmram"))) struct MP3_INDEX index_cache[MP3_INDEX_CACHE_SIZE];
+struct MP3_INDEX* current_index;
+uint32_t index_use_count;
+
+// The files without a TOC are scanned by a low priority task, a chunk at a time and
+// decoding just the headers of the frames. Its buffer holds the longest frame (free
+// format at 640 kbps and 32 kHz) and the chunks are paced, so that the file reader of
+// the player is not delayed.
+#define MP3_INDEX_SCAN_CHUNK_SIZE		(8*512)
+#define MP3_INDEX_SCAN_PERIOD_MS		5
+ALLOCATE_TASK(mp3_index, 250);
+struct {
+	FIL file;
+	struct MP3_INDEX* index;
+	struct mad_stream stream;
+	struct mad_header header;
+	uint32_t buffer_offset;		// offset inside the file of the buffer's beginning
+	uint8_t is_file_over;
+	uint8_t is_running;
+} scan;
+__attribute__((aligned(4))) uint8_t scan_buffer[MP3_INDEX_SCAN_CHUNK_SIZE + MAD_BUFFER_GUARD];
+
+// Xing/Info header, after the side information of the first frame, and its LAME
+// extension (also written by FFmpeg), which holds the encoder delay and padding as two
+// 12-bit values
+#define XING_FRAMES_FLAG			0x0001
+#define XING_BYTES_FLAG				0x0002
+#define XING_TOC_FLAG				0x0004
+#define XING_QUALITY_FLAG			0x0008
+#define XING_TOC_ENTRIES			100
+#define LAME_DELAY_OFFSET			21
+
+// VBRI header, 32 bytes after the header of the first frame
+#define VBRI_OFFSET					(4 + 32)
+#define VBRI_FRAMES_OFFSET			14
+#define VBRI_ENTRIES_OFFSET			18
+#define VBRI_SCALE_OFFSET			20
+#define VBRI_ENTRY_SIZE_OFFSET		22
+#define VBRI_FRAMES_PER_ENTRY_OFFSET	24
+#define VBRI_TOC_OFFSET				26
+
+/*******************************************************************/
+/*		INTERNAL FUNCTIONS
+/*******************************************************************/
+/*
+ * Big endian value of the given size
+ */
+static uint32_t mp3_index_get_be(uint8_t const* data, uint8_t size)
+{
+	uint32_t value = 0;
+
+	while (size-- > 0)
+		value = (value << 8) | *data++;
+	return value;
+}
+
+/*
+ * Index from the TOC of the Xing/Info header: each of its entries is the position of
+ * a percent of the duration, in 1/256 of the stream's size. The information for the
+ * gapless playback is kept even if there's no TOC.
+ */
+static int32_t mp3_index_parse_xing(struct MP3_INDEX* index, struct mad_header const* header,
+									uint8_t const* frame, uint32_t length, uint32_t offset)
+{
+	uint32_t position, flags, frames = 0, bytes, entry, toc = 0;
+	uint8_t const* lame;
+
+	if (header->layer != MAD_LAYER_III)
+		return -1;
+	position = 4 + ((header->flags & MAD_FLAG_PROTECTION) ? 2 : 0);
+	if (header->flags & MAD_FLAG_LSF_EXT)
+		position += (header->mode == MAD_MODE_SINGLE_CHANNEL) ? 9 : 17;
+	else
+		position += (header->mode == MAD_MODE_SINGLE_CHANNEL) ? 17 : 32;
+
+	if ((length < position + 8) ||
+			((memcmp(frame + position, "Xing", 4) != 0) && (memcmp(frame + position, "Info", 4) != 0)))
+		return -1;
+	flags = mp3_index_get_be(frame + position + 4, 4);
+	position += 8;
+	// the frame holds no audio
+	index->info.has_info_frame = TRUE;
+	bytes = index->file_size - offset;
+
+	if ((flags & XING_FRAMES_FLAG) && (length >= position + 4)) {
+		frames = mp3_index_get_be(frame + position, 4);
+		position += 4;
+	}
+	if ((flags & XING_BYTES_FLAG) && (length >= position + 4)) {
+		if (mp3_index_get_be(frame + position, 4) != 0)
+			bytes = min(mp3_index_get_be(frame + position, 4), bytes);
+		position += 4;
+	}
+	if ((flags & XING_TOC_FLAG) && (length >= position + XING_TOC_ENTRIES)) {
+		toc = position;
+		position += XING_TOC_ENTRIES;
+	}
+	if (flags & XING_QUALITY_FLAG)
+		position += 4;
+
+	lame = frame + position;
+	if ((length >= position + LAME_DELAY_OFFSET + 3) && ((memcmp(lame, "LAME", 4) == 0) ||
+			(memcmp(lame, "Lavf", 4) == 0) || (memcmp(lame, "Lavc", 4) == 0))) {
+		index->info.has_encoder_delay = TRUE;
+		index->info.encoder_delay = (lame[LAME_DELAY_OFFSET] << 4) | (lame[LAME_DELAY_OFFSET + 1] >> 4);
+		index->info.encoder_padding = ((lame[LAME_DELAY_OFFSET + 1] & 0x0f) << 8) | lame[LAME_DELAY_OFFSET + 2];
+	}
+	index->info.frames = frames;
+
+	if ((frames == 0) || (toc == 0))
+		return -1;
+	for (entry=0; entry<XING_TOC_ENTRIES; entry++)
+		index->offsets[entry] = offset + (uint32_t)(((uint64_t)frame[toc + entry] * bytes) / 256);
+	index->entries = XING_TOC_ENTRIES;
+	index->frames = frames + 1;
+	index->frames_per_entry = (uint32_t)(((uint64_t)frames << 8) / XING_TOC_ENTRIES);
+	index->source = MP3_INDEX_XING;
+	return 0;
+}
+
+/*
+ * Index from the TOC of the VBRI header: each of its entries is the size of the next
+ * "frames per entry" frames. If they don't fit in the index, only one out of "step"
+ * is kept.
+ */
+static int32_t mp3_index_parse_vbri(struct MP3_INDEX* index, uint8_t const* frame, uint32_t length,
+									uint32_t offset)
+{
+	uint8_t const* vbri = frame + VBRI_OFFSET;
+	uint32_t frames, entries, scale, entry_size, frames_per_entry, step, entry, position;
+
+	if ((length < VBRI_OFFSET + VBRI_TOC_OFFSET) || (memcmp(vbri, "VBRI", 4) != 0))
+		return -1;
+	frames = mp3_index_get_be(vbri + VBRI_FRAMES_OFFSET, 4);
+	entries = mp3_index_get_be(vbri + VBRI_ENTRIES_OFFSET, 2);
+	scale = mp3_index_get_be(vbri + VBRI_SCALE_OFFSET, 2);
+	entry_size = mp3_index_get_be(vbri + VBRI_ENTRY_SIZE_OFFSET, 2);
+	frames_per_entry = mp3_index_get_be(vbri + VBRI_FRAMES_PER_ENTRY_OFFSET, 2);
+	if ((frames == 0) || (entries == 0) || (frames_per_entry == 0) || (entry_size == 0) || (entry_size > 4) ||
+			(length < VBRI_OFFSET + VBRI_TOC_OFFSET + entries * entry_size))
+		return -1;
+
+	step = (entries + MP3_INDEX_ENTRIES - 1) / MP3_INDEX_ENTRIES;
+	position = offset;
+	index->entries = 0;
+	for (entry=0; entry<entries; entry++) {
+		if ((entry % step) == 0)
+			index->offsets[index->entries++] = position;
+		position += mp3_index_get_be(vbri + VBRI_TOC_OFFSET + entry * entry_size, entry_size) * scale;
+	}
+	index->frames = frames + 1;
+	index->frames_per_entry = (frames_per_entry * step) << 8;
+	index->source = MP3_INDEX_VBRI;
+	index->info.has_info_frame = TRUE;
+	index->info.frames = frames;
+	return 0;
+}
+
+/*
+ * Add a frame found by the scan to the index
+ */
+static void mp3_index_add_frame(struct MP3_INDEX* index, uint32_t offset)
+{
+	uint16_t entry;
+
+	if ((index->frames % (index->frames_per_entry >> 8)) == 0) {
+		if (index->entries == MP3_INDEX_ENTRIES) {
+			for (entry=0; entry<(MP3_INDEX_ENTRIES/2); entry++)
+				index->offsets[entry] = index->offsets[2*entry];
+			index->entries = MP3_INDEX_ENTRIES/2;
+			index->frames_per_entry *= 2;
+		}
+		index->offsets[index->entries++] = offset;
+	}
+	index->frames++;
+}
+
+/*
+ * Start scanning the file from the given offset
+ */
+static int32_t mp3_index_start_scan(char* path, struct MP3_INDEX* index, uint32_t offset)
+{
+	if (f_open(&scan.file, path, FA_READ) != FR_OK)
+		return -1;
+	if (f_lseek(&scan.file, offset) != FR_OK) {
+		f_close(&scan.file);
+		return -1;
+	}
+
+	mad_stream_init(&scan.stream);
+	mad_header_init(&scan.header);
+	scan.index = index;
+	scan.buffer_offset = offset;
+	scan.is_file_over = FALSE;
+	scan.is_running = TRUE;
+	index->source = MP3_INDEX_SCAN;
+	index->frames_per_entry = 1 << 8;
+	return 0;
+}
+
+static void mp3_index_stop_scan()
+{
+	mad_stream_finish(&scan.stream);
+	f_close(&scan.file);
+	scan.is_running = FALSE;
+}
+
+/*
+ * Read the next chunk of the file and index the frames in it. Returns 1 if there's
+ * more to scan, 0 at the end of the file and -1 on errors.
+ */
+static int32_t mp3_index_scan_chunk()
+{
+	uint32_t remaining = 0;
+	unsigned int read_bytes;
+
+	// The frame left incomplete at the end of the buffer is moved to the beginning
+	if (scan.stream.next_frame != NULL) {
+		remaining = scan.stream.bufend - scan.stream.next_frame;
+		scan.buffer_offset += scan.stream.next_frame - scan.stream.buffer;
+		memmove(scan_buffer, scan.stream.next_frame, remaining);
+	}
+	if (scan.is_file_over)
+		return 0;
+
+	if (f_read(&scan.file, scan_buffer + remaining, MP3_INDEX_SCAN_CHUNK_SIZE - remaining, &read_bytes) != FR_OK)
+		return -1;
+	if (f_eof(&scan.file)) {
+		memset(scan_buffer + remaining + read_bytes, 0, MAD_BUFFER_GUARD);
+		read_bytes += MAD_BUFFER_GUARD;
+		scan.is_file_over = TRUE;
+	}
+	mad_stream_buffer(&scan.stream, scan_buffer, remaining + read_bytes);
+
+	while (1) {
+		if (mad_header_decode(&scan.header, &scan.stream) == 0)
+			mp3_index_add_frame(scan.index, scan.buffer_offset + (scan.stream.this_frame - scan_buffer));
+		else if (!MAD_RECOVERABLE(scan.stream.error))
+			break;
+	}
+	return scan.is_file_over ? 0 : 1;
+}
+
+/*
+ * Cached index of the file, if any
+ */
+static struct MP3_INDEX* mp3_index_find(uint32_t file_cluster, uint32_t file_size)
+{
+	uint8_t index;
+
+	for (index=0; index<MP3_INDEX_CACHE_SIZE; index++) {
+		if ((index_cache[index].source != MP3_INDEX_NONE) && (index_cache[index].file_cluster == file_cluster) &&
+				(index_cache[index].file_size == file_size))
+			return &index_cache[index];
+	}
+	return NULL;
+}
+
+/*
+ * Free index of the cache, or the least recently used one
+ */
+static struct MP3_INDEX* mp3_index_get_free()
+{
+	struct MP3_INDEX* oldest = &index_cache[0];
+	uint8_t index;
+
+	for (index=0; index<MP3_INDEX_CACHE_SIZE; index++) {
+		if (index_cache[index].source == MP3_INDEX_NONE)
+			return &index_cache[index];
+		if ((int32_t)(index_cache[index].last_used - oldest->last_used) < 0)
+			oldest = &index_cache[index];
+	}
+	return oldest;
+}
+
+/*******************************************************************/
+/*		TASK RELATED FUNCTIONS
+/*******************************************************************/
+/*
+ * Background scan of a file
+ */
+int32_t mp3_index_task_func()
+{
+	int32_t ret_val;
+
+	if (!scan.is_running)
+		return DIE;
+
+	ret_val = mp3_index_scan_chunk();
+	if (ret_val > 0)
+		return MP3_INDEX_SCAN_PERIOD_MS;
+
+	if (ret_val == 0) {
+		scan.index->is_complete = TRUE;
+		debug_msg("%u frames indexed\n", scan.index->frames);
+	} else {
+		debug_msg("error reading the file\n");
+		scan.index->source = MP3_INDEX_NONE;
+	}
+	mp3_index_stop_scan();
+	return DIE;
+}
+
+/*******************************************************************/
+/*		PUBLIC FUNCTIONS
+/*******************************************************************/
+/*
+ * Select the index of the file which is going to be played, starting from the given
+ * frame (offset inside the file, with the data available there): the cached one, the
+ * TOC of its Xing/Info or VBRI header or else a scan of the whole file
+ */
+int32_t mp3_index_open(char* path, FIL* file, struct mad_header const* header,
+						uint8_t const* frame, uint32_t length, uint32_t offset)
+{
+	struct MP3_INDEX* index;
+
+	mp3_index_close();
+
+	index = mp3_index_find(file->obj.sclust, f_size(file));
+	if (index == NULL) {
+		index = mp3_index_get_free();
+		memset(index, 0, sizeof(struct MP3_INDEX));
+		index->file_cluster = file->obj.sclust;
+		index->file_size = f_size(file);
+		if ((mp3_index_parse_xing(index, header, frame, length, offset) == 0) ||
+				(mp3_index_parse_vbri(index, frame, length, offset) == 0)) {
+			index->is_complete = TRUE;
+			debug_msg("%s TOC, %u frames\n", (index->source == MP3_INDEX_XING) ? "Xing" : "VBRI", index->frames);
+		} else if (mp3_index_start_scan(path, index, offset) == 0) {
+			kernel_activate_task_immediately(&mp3_index_task);
+		} else {
+			debug_msg("unable to scan the file\n");
+			index->source = MP3_INDEX_NONE;
+			return -1;
+		}
+	}
+
+	index->last_used = ++index_use_count;
+	current_index = index;
+	return 0;
+}
+
+/*
+ * Stop using the index of the file (the scan is dropped if not completed)
+ */
+void mp3_index_close()
+{
+	if (scan.is_running) {
+		scan.index->source = MP3_INDEX_NONE;
+		mp3_index_stop_scan();
+	}
+	current_index = NULL;
+}
+
+/*
+ * Find the indexed frame at or before the given one: "frame" becomes its number and
+ * "offset" its position inside the file. Returns -1 if the frame has not been reached
+ * by the scan yet.
+ */
+int32_t mp3_index_seek(uint32_t* frame, uint32_t* offset)
+{
+	struct MP3_INDEX* index = current_index;
+	uint32_t entry;
+
+	if ((index == NULL) || (index->entries == 0) || (!index->is_complete && (*frame >= index->frames)))
+		return -1;
+
+	entry = (uint32_t)(((uint64_t)*frame << 8) / index->frames_per_entry);
+	entry = min(entry, (uint32_t)(index->entries - 1));
+	*frame = (uint32_t)(((uint64_t)entry * index->frames_per_entry) >> 8);
+	*offset = index->offsets[entry];
+	return 0;
+}
+
+/*
+ * Information for the gapless playback of the stream: returns -1 if there's no index
+ */
+int32_t mp3_index_get_info(struct MP3_INDEX_INFO* info)
+{
+	if (current_index == NULL)
+		return -1;
+	*info = current_index->info;
+	return 0;
+}
+
+/*
+ * Frames of the stream (including the Info frame, if any), or 0 if they are not known
+ * yet
+ */
+uint32_t mp3_index_get_frames()
+{
+	if ((current_index == NULL) || !current_index->is_complete)
+		return 0;
+	return current_index->frames;
+}
+
+/*
+ * Shell command which scans a whole file for its index, as done in the background for
+ * the files without a TOC, and measures the time per MB ("mp3_index path"). The index
+ * is cached, so the next playback of the file seeks at once.
+ */
+int mp3_index_benchmark(int argc, char *argv[])
+{
+	struct MP3_INDEX *index, *cached;
+	uint32_t start_cycles, duration_ms, mb_cycles;
+	uint64_t cycles = 0;
+	int32_t ret_val;
+
+	if (argc != 1)
+		return -1;
+	if (scan.is_running) {
+		debug_msg("an index is being built\n");
+		return -1;
+	}
+
+	index = mp3_index_get_free();
+	memset(index, 0, sizeof(struct MP3_INDEX));
+	if (mp3_index_start_scan(argv[0], index, 0) < 0) {
+		debug_msg("error opening the file\n");
+		return -1;
+	}
+	// the audio starts after the ID3v2 tags, as for the playback
+	scan.buffer_offset = mp3_tags_read_id3v2(&scan.file, NULL);
+	f_lseek(&scan.file, scan.buffer_offset);
+	cached = mp3_index_find(scan.file.obj.sclust, f_size(&scan.file));
+	if (cached != NULL)
+		cached->source = MP3_INDEX_NONE;
+	index->file_cluster = scan.file.obj.sclust;
+	index->file_size = f_size(&scan.file);
+
+	do {
+		start_cycles = cycle_counter_get();
+		ret_val = mp3_index_scan_chunk();
+		cycles += cycle_counter_get() - start_cycles;
+	} while (ret_val > 0);
+	index->is_complete = (ret_val == 0);
+	if (!index->is_complete)
+		index->source = MP3_INDEX_NONE;
+	mp3_index_stop_scan();
+	if ((ret_val < 0) || (index->frames == 0) || (scan.header.samplerate == 0)) {
+		debug_msg("no frames\n");
+		return -1;
+	}
+	index->last_used = ++index_use_count;
+
+	duration_ms = (uint32_t)(((uint64_t)index->frames * 32 * MAD_NSBSAMPLES(&scan.header) * 1000) / scan.header.samplerate);
+	mb_cycles = (uint32_t)((cycles << 20) / max(index->file_size, 1));
+	debug_msg("%u bytes, %u frames, %u ms\n", index->file_size, index->frames, duration_ms);
+	debug_msg("%u entries, one every %u frames\n", index->entries, index->frames_per_entry >> 8);
+	debug_msg("%u cycles per MB (%u ms)\n", mb_cycles, mb_cycles / (CYCLE_COUNTER_FREQ / 1000));
+	return 0;
+}
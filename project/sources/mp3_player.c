@@ -7,33 +7,197 @@
 #include "output_i2s.h"
 #include "utils.h"
 #include "sgtl5000.h"
+#include "layer3.h"
+#include "version.h"
+#include "stdlib.h"
+#include "mp3_index.h"
+#include "mp3_tags.h"
+#include "file_manager.h"
 
 #define debug_msg(format, ...)		debug_printf("[mp3_player] " format, ##__VA_ARGS__)
 
+// The file is read by a cooperative task, while the frames are decoded by a real-time
+// one (so that decoding can't be delayed by the other tasks). The decoder works in
+// slices and a cooperative task resumes it when it yields (see decoder_slice): this
+// one belongs to the deadline class, so that a user interface which keeps the CPU
+// busy can't hold the resume back, while it's released at most once per tick.
+#define MP3_DECODER_RESUME_PERIOD_MS	1
+#define MP3_DECODER_RESUME_DEADLINE_MS	10
 ALLOCATE_TASK(mp3_player, 5);
+ALLOCATE_RT_TASK(mp3_decoder);
+ALLOCATE_DEADLINE_TASK(mp3_decoder, 220, MP3_DECODER_RESUME_PERIOD_MS, MP3_DECODER_RESUME_DEADLINE_MS);
 
 uint8_t internal_status = MP3_PLAYER_IDLE;
 FIL fp;
 
-#define FILE_BUFFER_SIZE		4096
-uint8_t file_buffer[FILE_BUFFER_SIZE];
+// Input ring: the file is read in chunks of whole sectors, at sector-aligned offsets
+// both in the file and in the buffer, so that FatFs transfers them directly from the
+// card. The reader refills a chunk as soon as it's free: the remaining data must cover
+// the longest time the reader task can be delayed (12 KB are 250 ms at 384 kbps).
+// libmad needs the frame being decoded to be contiguous: when it crosses the end of
+// the ring, its first part is copied just before the beginning (the ring is preceded
+// by room for the longest frame, free format at 640 kbps and 32 kHz).
+#define FILE_SECTOR_SIZE		512
+#define FILE_CHUNK_SIZE			(8*FILE_SECTOR_SIZE)
+#define FILE_RING_SIZE			(4*FILE_CHUNK_SIZE)
+#define FILE_FRAME_ROOM			(6*FILE_SECTOR_SIZE)
+__attribute__((aligned(4))) uint8_t file_buffer[FILE_FRAME_ROOM + FILE_RING_SIZE];
+#define file_ring				(file_buffer + FILE_FRAME_ROOM)
 
-#define OUTPUT_AUDIO_SAMPLES_MAX_SIZE 		(1152)
-audio_sample_t output_audio_samples[OUTPUT_AUDIO_SAMPLES_MAX_SIZE];
+// Offsets inside the file of the data written into the ring (changed by the reader,
+// with the decoder locked out) and of the data consumed by the decoder, which also
+// keeps the offsets of libmad's window and of the end of the ring inside the window
+struct {
+	uint32_t filled;
+	uint32_t consumed;
+	uint32_t window_start;
+	uint32_t window_ring_end;
+	uint8_t is_file_over;		// the file has been read and the guard has been appended
+} feeder;
+
+// Bytes copied while feeding the decoder, by the ring (frames which cross its end) and by
+// FatFs (the parts of the reads which are not whole sectors go through its own buffer)
+struct {
+	uint32_t moved_bytes;
+	uint32_t buffered_bytes;
+	uint32_t decoded_samples;
+	uint32_t sample_rate;
+	uint32_t start_cycles;			// when the playback has been requested
+	uint32_t first_samples_cycles;	// time taken by the first samples to be queued
+} feeder_stats;
+
+// Metadata of the file: the ID3v2 tags at its beginning are parsed when the playback
+// starts (and then skipped with a seek), the ID3v1/APEv2 ones at its end only if some
+// fields are missing, the first time the metadata is requested
+struct MP3_TAGS tags;
+uint8_t are_footers_read;
+char playing_path[MAX_PATH_LENGTH];
+
+// Gapless playback: the file queued by mp3_player_queue() follows the current one in the
+// same stream of samples. Once the current file has been read, the queued one is opened,
+// its ID3v2 tags are skipped and its first chunks are read into a spare buffer, where its
+// first frame is probed. When the decoder has consumed the current file, the reader hands
+// them over to the ring and the decoding goes on without any I/O in between. The clocks
+// are reconfigured only if the sample rate changes, after the queued samples have been
+// played.
+#define NEXT_TRACK_NONE				0x00
+#define NEXT_TRACK_QUEUED			0x01
+#define NEXT_TRACK_READY			0x02
+#define NEXT_TRACK_BUFFER_SIZE		(2*FILE_CHUNK_SIZE)
+#define MP3_PLAYER_DRAIN_PERIOD_MS	10
+struct {
+	FIL file;
+	char path[MAX_PATH_LENGTH];
+	struct MP3_TAGS tags;
+	uint32_t audio_start;		// offset of the audio inside the file
+	uint32_t length;			// bytes in the buffer, from the chunk of audio_start
+	uint32_t sample_rate;
+	uint8_t status;
+} next_track;
+__attribute__((aligned(4))) uint8_t next_track_buffer[NEXT_TRACK_BUFFER_SIZE];
+
+// Called (by the reader task) when the queued file starts
+void (*track_change_callback)(void);
+
+// Samples of the stream (at its own rate, counted from its first frame) which are played:
+// the Info frame and the encoder delay before them and the padding after them are trimmed,
+// so that consecutive tracks join seamlessly
+#define MP3_DECODER_DELAY			529		// samples added by the decoder's filterbanks
+struct {
+	uint32_t first_sample;
+	uint32_t end_sample;
+} trim;
+
+// Position of the playback, in frames of the stream: after a seek the decoder restarts
+// from the indexed frame before the target and skips the ones up to it, decoding just
+// their headers
+struct {
+	uint32_t frame;
+	uint32_t skip_frames;
+	uint32_t samples_per_frame;
+} position;
+
+// Low power playback: libmad only synthesizes the subbands below 1/2 or 1/4 of the
+// stream's Nyquist frequency, one sample out of 2 or 4 (MAD_OPTION_HALFSAMPLERATE or
+// MAD_OPTION_QUARTERSAMPLERATE), skipping most of the IMDCT and of the filterbank. Each
+// sample is then written 2 or 4 times, so that the I2S and the codec keep running at the
+// stream's rate. The mode applies to the next playbacks too.
+uint8_t low_power_mode = MP3_PLAYER_FULL_RATE;
+struct {
+	uint32_t stream_rate;
+	uint8_t mode;			// mode in use by the playback
+} output_config;
+
+// Cycles spent by the decoder (decoding and synthesis) in every mode since the beginning
+// of the playback, with the samples of the stream they have decoded (at its own rate)
+struct {
+	uint64_t cycles;
+	uint32_t samples;
+} decoder_load[MP3_PLAYER_QUARTER_RATE + 1];
+
+// Energy model for the savings: the core sleeps (WFI) when no task is running, so every
+// cycle saved moves from the Run to the Sleep current (roughly the typical ones of the
+// STM32F407 at 168 MHz with the peripherals disabled, at 3.3 V)
+#define MCU_RUN_CURRENT_MA		40
+#define MCU_SLEEP_CURRENT_MA	12
+#define MCU_SUPPLY_MV			3300
+
+// The synthesis writes the 16-bit samples straight into the output ring (libmad is built
+// with OPT_PCM16_ONLY, so mad_synth has no buffer for them). MAD_PCM16_DITHER in the
+// options dithers them instead of truncating them.
+#define MP3_FRAME_MAX_SAMPLES			(1152)
+#define MP3_PLAYER_PCM16_OPTIONS		0
 
 struct mad_stream mad_stream;
 struct mad_frame mad_frame;
 struct mad_synth mad_synth;
+struct mad_pcm16 mad_pcm16;
+
+// Decoder's status, handed over between the decoder (which sets the ones other than
+// DECODER_RUNNING) and the file reader (which sets DECODER_RUNNING after a refill)
+#define DECODER_RUNNING			0x00
+#define DECODER_NEEDS_DATA		0x01
+#define DECODER_ERROR			0x02
+volatile uint8_t decoder_status;
 
-uint8_t has_sample_rate_been_set;
+// Slices of the decoder: a real-time run decodes the main data of a frame (Huffman
+// decoding, requantization and joint stereo) or it filters and synthesizes one of its
+// granules, so that a slice never lasts more than a part of a frame.
+struct {
+	uint8_t granule;		// next granule of the frame to be filtered
+	uint8_t granules;		// granules of the frame (0 = the next slice decodes a frame)
+} decoder_slice;
 
-#define clip_audio_sample(sample) \
-	do { \
-		if (sample >= MAD_F_ONE) \
-			sample = MAD_F_ONE - 1; \
-		else if (sample < -MAD_F_ONE) \
-			sample = -MAD_F_ONE; \
-	} while (0) 
+// Decode-ahead control: after each slice the decoder either goes on or yields to the
+// cooperative tasks (its cooperative task, whose priority is just below the user
+// interface's, resumes it), depending on the samples still buffered for the output:
+//	- below the low watermark it goes on, since the output is about to run dry
+//	- between the watermarks it goes on as long as the next slice (estimated from the
+//	  average cost of the previous ones) fits in the batch budget of the run, to save
+//	  round trips through the scheduler
+//	- above the high watermark it yields after every slice
+// The low watermark defaults to one DMA buffer of the output, which the decoder must
+// refill before the DMA gets to it: below that, a long cooperative task delaying the
+// resume could make the output play silence.
+#define MP3_DECODER_LOW_WATERMARK		(2048)
+#define MP3_DECODER_HIGH_WATERMARK		(2560)
+#define MP3_DECODER_BATCH_US			(1000)
+#define MP3_DECODER_SLICE_AVG_SHIFT		3		// weight of the last slice in the average (1/8)
+struct {
+	uint32_t low_watermark;			// samples
+	uint32_t high_watermark;		// samples
+	uint32_t batch_cycles;			// longest run between the watermarks
+	uint32_t slice_cycles;			// average cost of a slice
+	// statistics
+	uint32_t runs;
+	uint32_t slices;
+	uint32_t yields;
+	uint32_t max_run_cycles;
+} decoder_control = {
+	.low_watermark = MP3_DECODER_LOW_WATERMARK,
+	.high_watermark = MP3_DECODER_HIGH_WATERMARK,
+	.batch_cycles = MP3_DECODER_BATCH_US * CYCLES_PER_US,
+};
 
 //>>> DEBUG
 /*int16_t sine_look_up_table[] = {
@@ -58,124 +222,565 @@ static void initialize_buffers()
 /*		INTERNAL FUNCTIONS
 /*******************************************************************/
 /*
- * Refill the internal buffer
+ * Bytes of a read which FatFs copies through its sector buffer
  */
-static int32_t mp3_player_refill_buffer(uint8_t adjust_offsets)
+static uint32_t mp3_player_get_buffered_bytes(uint32_t offset, uint32_t length)
 {
-	uint32_t bytes_to_drop = 0;
-	uint32_t bytes_to_keep = 0;
-	uint32_t read_bytes;
+	uint32_t head = (FILE_SECTOR_SIZE - (offset % FILE_SECTOR_SIZE)) % FILE_SECTOR_SIZE;
 	
-	// return a failure if the buffer cannot be filled with new data
-	if (f_eof(&fp)) {
-		debug_msg("EOF reached - cannot add more data to the buffer\n");
+	if (head >= length)
+		return length;
+	return head + ((length - head) % FILE_SECTOR_SIZE);
+}
+
+/*
+ * Read the next chunk of the file into the ring or, once the whole file has been
+ * read, append the zeros which libmad needs after the last frame for decoding it.
+ * Returns 1 if data has been added, 0 if there's no room for it and -1 if there's
+ * nothing left to read.
+ */
+static int32_t mp3_player_refill_buffer()
+{
+	uint32_t free_space = FILE_RING_SIZE - (feeder.filled - __atomic_load_n(&feeder.consumed, __ATOMIC_ACQUIRE));
+	uint32_t offset = feeder.filled % FILE_RING_SIZE;
+	uint32_t read_bytes = 0;
+	uint32_t guard_head;
+	
+	if (feeder.is_file_over)
 		return -1;
-	}
 	
-	if (adjust_offsets) {
-		bytes_to_drop = mad_stream.this_frame - mad_stream.buffer;
-		bytes_to_keep = mad_stream.bufend - mad_stream.this_frame;
-		memcpy((void*)mad_stream.buffer, mad_stream.this_frame, bytes_to_keep);
-		f_read(&fp, file_buffer + bytes_to_keep, bytes_to_drop, (unsigned int*)&read_bytes);
+	if (!f_eof(&fp)) {
+		if (free_space < FILE_CHUNK_SIZE)
+			return 0;
+		feeder_stats.buffered_bytes += mp3_player_get_buffered_bytes(f_tell(&fp),
+											min(FILE_CHUNK_SIZE, f_size(&fp) - f_tell(&fp)));
+		if (f_read(&fp, file_ring + offset, FILE_CHUNK_SIZE, (unsigned int*)&read_bytes) != FR_OK) {
+			debug_msg("error reading the file\n");
+			feeder.is_file_over = TRUE;
+			return -1;
+		}
 	} else {
-		f_read(&fp, file_buffer + bytes_to_keep, FILE_BUFFER_SIZE, (unsigned int*)&read_bytes);
+		if (free_space < MAD_BUFFER_GUARD)
+			return 0;
+		guard_head = min(MAD_BUFFER_GUARD, FILE_RING_SIZE - offset);
+		memset(file_ring + offset, 0, guard_head);
+		memset(file_ring, 0, MAD_BUFFER_GUARD - guard_head);
+		read_bytes = MAD_BUFFER_GUARD;
+		feeder.is_file_over = TRUE;
 	}
 	
-	//debug_msg("Read bytes = %u (%u%%)\n", read_bytes, (f_tell(&fp)*100)/(f_size(&fp)));
+	kernel_rt_lock();
+	__atomic_store_n(&feeder.filled, feeder.filled + read_bytes, __ATOMIC_RELEASE);
+	if (decoder_status == DECODER_NEEDS_DATA)
+		decoder_status = DECODER_RUNNING;
+	kernel_rt_unlock();
 	
-	if (adjust_offsets) {
-		mad_stream.this_frame -= bytes_to_drop;
-		mad_stream.next_frame -= bytes_to_drop;
-		mad_stream.ptr.byte -= bytes_to_drop;
+	return 1;
+}
+
+/*
+ * Extend libmad's window with the data read since the last call. If the window has
+ * reached the end of the ring, the frame which is left is first moved before the
+ * beginning, so that it continues with the data there. Returns FALSE if there's no
+ * new data (decoder's context).
+ */
+static uint8_t mp3_decoder_update_window()
+{
+	uint32_t filled = __atomic_load_n(&feeder.filled, __ATOMIC_ACQUIRE);
+	uint32_t window_end = feeder.window_start + (mad_stream.bufend - mad_stream.buffer);
+	uint32_t frame_size;
+	
+	if (filled == window_end)
+		return FALSE;
+	
+	if (window_end == feeder.window_ring_end) {
+		// Anything longer than a frame has to be skipped anyway
+		frame_size = min(mad_stream.bufend - mad_stream.next_frame, FILE_FRAME_ROOM);
+		memcpy(file_ring - frame_size, mad_stream.bufend - frame_size, frame_size);
+		mad_stream_buffer(&mad_stream, file_ring - frame_size, frame_size);
+		feeder.window_start = window_end - frame_size;
+		feeder.window_ring_end += FILE_RING_SIZE;
+		feeder_stats.moved_bytes += frame_size;
 	}
 	
+	if ((int32_t)(filled - feeder.window_ring_end) > 0)
+		filled = feeder.window_ring_end;
+	mad_stream.bufend += filled - window_end;
+	return TRUE;
+}
+
+/*
+ * Tell the reader how much of the ring has been decoded (decoder's context)
+ */
+static void mp3_decoder_update_consumed()
+{
+	__atomic_store_n(&feeder.consumed, feeder.window_start + (mad_stream.next_frame - mad_stream.buffer), __ATOMIC_RELEASE);
+}
+
+/*
+ * libmad's options for a low power mode
+ */
+static int mp3_player_get_mad_options(uint8_t mode)
+{
+	if (mode == MP3_PLAYER_QUARTER_RATE)
+		return MAD_OPTION_QUARTERSAMPLERATE;
+	if (mode == MP3_PLAYER_HALF_RATE)
+		return MAD_OPTION_HALFSAMPLERATE;
 	return 0;
 }
 
-static int32_t mp3_player_enqueue_decoded_audio_samples()
+/*
+ * Reset the feeder and libmad's stream to the given offset of the file: the ring is
+ * filled from the chunk which contains it (the reader fills it a whole chunk at a time,
+ * at the same offset of the file and of the ring) and libmad skips the bytes before it
+ */
+static void mp3_player_reset_stream(uint32_t offset)
 {
-	// for now only stereo files are supported
-	if (mad_synth.pcm.channels < 2)
+	uint32_t start = offset - (offset % FILE_CHUNK_SIZE);
+	
+	feeder.filled = feeder.consumed = feeder.window_start = start;
+	feeder.window_ring_end = start - (start % FILE_RING_SIZE) + FILE_RING_SIZE;
+	feeder.is_file_over = FALSE;
+	memset(&decoder_slice, 0, sizeof(decoder_slice));
+	
+	mad_stream_finish(&mad_stream);
+	mad_stream_init(&mad_stream);
+	mad_stream_options(&mad_stream, mp3_player_get_mad_options(output_config.mode));
+	mad_stream_buffer(&mad_stream, file_ring + (start % FILE_RING_SIZE), 0);
+	mad_stream_skip(&mad_stream, offset - start);
+}
+
+/*
+ * Restart the stream from the given offset of the file
+ */
+static int32_t mp3_player_restart_stream(uint32_t offset)
+{
+	if (f_lseek(&fp, offset - (offset % FILE_CHUNK_SIZE)) != FR_OK)
 		return -1;
-		
-	mad_fixed_t* pcm0_ptr = mad_synth.pcm.samples[0];
-	mad_fixed_t* pcm1_ptr = mad_synth.pcm.samples[1];
-	audio_sample_t* output_buf_ptr = output_audio_samples;
-		
-	// todo: downscale the decoded audio samples before streaming them!!!
-	register uint16_t curr_sample;
-	for (curr_sample = 0; curr_sample < mad_synth.pcm.length; curr_sample++, output_buf_ptr++) {
-		clip_audio_sample(*pcm0_ptr);
-		output_buf_ptr->left_ch = (int16_t)((*pcm0_ptr) >> (MAD_F_FRACBITS + 1 - 16));
-		pcm0_ptr++;
-		
-		clip_audio_sample(*pcm1_ptr);
-		output_buf_ptr->right_ch = (int16_t)((*pcm1_ptr) >> (MAD_F_FRACBITS + 1 - 16));
-		pcm1_ptr++;
+	mp3_player_reset_stream(offset);
+	return 0;
+}
+
+/*
+ * Find the first frame in the buffer, without consuming it: the probe stream is left
+ * on it
+ */
+static int32_t mp3_player_probe(struct mad_stream* probe_stream, struct mad_header* header)
+{
+	*probe_stream = mad_stream;
+	mad_header_init(header);
+	while (mad_header_decode(header, probe_stream) == -1) {
+		if (!MAD_RECOVERABLE(probe_stream->error))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Configure the output for the sample rate of the first frame, and the synthesis for
+ * the low power mode
+ */
+static void mp3_player_configure_output(struct mad_header const* header)
+{
+	output_config.stream_rate = header->samplerate;
+	output_config.mode = low_power_mode;
+	output_i2s_ConfigurePLL(header->samplerate);
+	sgtl5000_config_clocks(header->samplerate);
+	mad_stream_options(&mad_stream, mp3_player_get_mad_options(output_config.mode));
+}
+
+/*
+ * Samples to trim from the information of the Info frame, if any (without the encoder
+ * delay, just the frame itself is dropped)
+ */
+static void mp3_player_setup_trim()
+{
+	struct MP3_INDEX_INFO info;
+	
+	trim.first_sample = 0;
+	trim.end_sample = UINT32_MAX;
+	if (mp3_index_get_info(&info) < 0)
+		return;
+	if (info.has_info_frame)
+		trim.first_sample = position.samples_per_frame;
+	if (info.has_encoder_delay) {
+		trim.first_sample += info.encoder_delay + MP3_DECODER_DELAY;
+		if (info.frames != 0)
+			trim.end_sample = trim.first_sample + (info.frames * position.samples_per_frame) -
+								info.encoder_delay - info.encoder_padding;
+	}
+}
+
+/*
+ * Start decoding the file whose beginning is in the ring: configure the output for its
+ * first frame and open its index
+ */
+static int32_t mp3_player_start_stream(char* path)
+{
+	struct mad_stream probe_stream;
+	struct mad_header header;
+	
+	if (mp3_player_probe(&probe_stream, &header) < 0)
+		return -1;
+	mp3_player_configure_output(&header);
+	memset(&position, 0, sizeof(position));
+	position.samples_per_frame = 32 * MAD_NSBSAMPLES(&header);
+	
+	// without an index the playback can't seek, but it goes on anyway
+	mp3_index_open(path, &fp, &header, probe_stream.this_frame, probe_stream.bufend - probe_stream.this_frame,
+					feeder.window_start + (probe_stream.this_frame - mad_stream.buffer));
+	mp3_player_setup_trim();
+	return 0;
+}
+
+/*
+ * Open the queued file and read its first chunks, after its ID3v2 tags, into the spare
+ * buffer (its first frame must be there)
+ */
+static void mp3_player_prepare_next_track()
+{
+	struct mad_stream probe_stream;
+	struct mad_header header;
+	uint32_t start;
+	unsigned int read_bytes;
+	
+	next_track.status = NEXT_TRACK_NONE;
+	if (f_open(&next_track.file, next_track.path, FA_READ) != FR_OK) {
+		debug_msg("error opening the next file\n");
+		return;
+	}
+	next_track.audio_start = mp3_tags_read_id3v2(&next_track.file, &next_track.tags);
+	start = next_track.audio_start - (next_track.audio_start % FILE_CHUNK_SIZE);
+	if ((f_lseek(&next_track.file, start) != FR_OK) ||
+			(f_read(&next_track.file, next_track_buffer, NEXT_TRACK_BUFFER_SIZE, &read_bytes) != FR_OK)) {
+		debug_msg("error reading the next file\n");
+		f_close(&next_track.file);
+		return;
 	}
+	next_track.length = read_bytes;
 	
-	output_i2s_enqueue_samples(output_audio_samples, mad_synth.pcm.length);	
+	mad_stream_init(&probe_stream);
+	mad_stream_buffer(&probe_stream, next_track_buffer, read_bytes);
+	mad_stream_skip(&probe_stream, next_track.audio_start - start);
+	mad_header_init(&header);
+	while (mad_header_decode(&header, &probe_stream) == -1) {
+		if (!MAD_RECOVERABLE(probe_stream.error)) {
+			debug_msg("no valid frame found at the beginning of the next file\n");
+			f_close(&next_track.file);
+			return;
+		}
+	}
+	mad_stream_finish(&probe_stream);
+	next_track.sample_rate = header.samplerate;
+	next_track.status = NEXT_TRACK_READY;
+}
+
+/*
+ * Go on with the queued file, once the decoder has consumed the current one: its first
+ * chunks are moved from the spare buffer to the ring. If its sample rate is different,
+ * the samples queued at the current one are played first. Returns the value for the
+ * reader task.
+ */
+static int32_t mp3_player_start_next_track()
+{
+	uint32_t start = next_track.audio_start - (next_track.audio_start % FILE_CHUNK_SIZE);
+	uint32_t head = min(next_track.length, FILE_RING_SIZE - (start % FILE_RING_SIZE));
+	uint16_t ring_size, write_index;
+	
+	output_i2s_get_ring(&ring_size, &write_index);
+	if ((next_track.sample_rate != output_config.stream_rate) && (output_i2s_get_buffer_free_space() < ring_size))
+		return MP3_PLAYER_DRAIN_PERIOD_MS;
+	
+	mp3_index_close();
+	f_close(&fp);
+	fp = next_track.file;
+	tags = next_track.tags;
+	strncpy(playing_path, next_track.path, MAX_PATH_LENGTH - 1);
+	are_footers_read = FALSE;
+	next_track.status = NEXT_TRACK_NONE;
+	
+	mp3_player_reset_stream(next_track.audio_start);
+	memcpy(file_ring + (start % FILE_RING_SIZE), next_track_buffer, head);
+	memcpy(file_ring, next_track_buffer + head, next_track.length - head);
+	feeder.filled = start + next_track.length;
+	mp3_decoder_update_window();
+	if (mp3_player_start_stream(playing_path) < 0) {
+		debug_msg("no valid frame found\n");
+		mp3_player_stop();
+		return DIE;
+	}
+	// the file is decoded as if it were played alone
+	mad_frame_mute(&mad_frame);
+	mad_synth_mute(&mad_synth);
+	debug_msg("next track: %s\n", playing_path);
+	
+	kernel_rt_lock();
+	decoder_status = DECODER_RUNNING;
+	kernel_rt_unlock();
+	kernel_rt_activate(&mp3_decoder_rt_task);
+	if (track_change_callback != NULL)
+		track_change_callback();
+	return IMMEDIATELY;
+}
+
+/*
+ * Time in ms of the given number of samples of the stream
+ */
+static uint32_t mp3_player_samples_to_ms(uint64_t samples)
+{
+	if (output_config.stream_rate == 0)
+		return 0;
+	return (uint32_t)((samples * 1000) / output_config.stream_rate);
+}
+
+/*
+ * Write each sample synthesized at a reduced rate into the output ring from write_index
+ * 2 or 4 times, starting from the last one so that none is overwritten before it's
+ * copied: returns how many samples there are at the stream's rate. The frame's options
+ * tell the rate of its synthesis, even if the mode has been switched since its decoding.
+ */
+static uint32_t mp3_player_repeat_samples(audio_sample_t* ring, uint16_t write_index)
+{
+	uint32_t shift, index, copy;
+	audio_sample_t sample;
+	
+	if (mad_frame.options & MAD_OPTION_QUARTERSAMPLERATE)
+		shift = 2;
+	else if (mad_frame.options & MAD_OPTION_HALFSAMPLERATE)
+		shift = 1;
+	else
+		return mad_synth.pcm.length;
+	
+	for (index=mad_synth.pcm.length; index-->0; ) {
+		sample = ring[(write_index + index) % mad_pcm16.size];
+		for (copy=0; copy<(1U << shift); copy++)
+			ring[(write_index + (index << shift) + copy) % mad_pcm16.size] = sample;
+	}
+	return mad_synth.pcm.length << shift;
+}
+
+/*
+ * Hand the samples just synthesized into the output ring from write_index (the ones of
+ * the stream from "start" to "end") over to the DMA, apart from the trimmed ones:
+ * returns how many they are
+ */
+static uint16_t mp3_player_commit_samples(audio_sample_t* ring, uint16_t write_index, uint32_t start, uint32_t end)
+{
+	uint32_t first = 0, last, index;
+	
+	// the trimmed samples
+	last = mp3_player_repeat_samples(ring, write_index);
+	if (trim.end_sample < end)
+		last = min(last, max(trim.end_sample, start) - start);
+	if (trim.first_sample > start)
+		first = min(last, min(trim.first_sample, end) - start);
+	if (first > 0) {
+		for (index=0; index<(last - first); index++)
+			ring[(write_index + index) % mad_pcm16.size] = ring[(write_index + first + index) % mad_pcm16.size];
+	}
+	output_i2s_commit_samples(last - first);
+	return last - first;
+}
+
+/*
+ * Synthesize the decoded frame into the output ring (mono frames are duplicated on
+ * both channels) and commit its samples
+ */
+static uint16_t mp3_player_synth_frame()
+{
+	uint32_t start = position.frame * position.samples_per_frame;
+	audio_sample_t* ring;
+	uint16_t write_index;
+	
+	ring = output_i2s_get_ring(&mad_pcm16.size, &mad_pcm16.index);
+	write_index = mad_pcm16.index;
+	mad_pcm16.buffer = (signed short*)ring;
+	mad_synth_frame_pcm16(&mad_synth, &mad_frame, &mad_pcm16);
+	return mp3_player_commit_samples(ring, write_index, start, start + position.samples_per_frame);
+}
+
+/*
+ * Same as mp3_player_synth_frame(), for a single granule of a Layer III frame
+ */
+static uint16_t mp3_player_synth_granule(uint8_t granule)
+{
+	uint32_t length = position.samples_per_frame / decoder_slice.granules;
+	uint32_t start = (position.frame * position.samples_per_frame) + (granule * length);
+	audio_sample_t* ring;
+	uint16_t write_index;
+	
+	ring = output_i2s_get_ring(&mad_pcm16.size, &mad_pcm16.index);
+	write_index = mad_pcm16.index;
+	mad_pcm16.buffer = (signed short*)ring;
+	mad_synth_granule_pcm16(&mad_synth, &mad_frame, granule, &mad_pcm16);
+	return mp3_player_commit_samples(ring, write_index, start, start + length);
+}
+
+/*
+ * Decide whether the decoder yields to the cooperative tasks after a slice, given the
+ * cycles spent by its current run (see decoder_control)
+ */
+static uint8_t mp3_decoder_should_yield(uint32_t run_cycles)
+{
+	uint32_t buffered = output_i2s_get_buffered_samples();
+	
+	if (buffered < decoder_control.low_watermark)
+		return FALSE;
+	if (buffered >= decoder_control.high_watermark)
+		return TRUE;
+	return ((run_cycles + decoder_control.slice_cycles) > decoder_control.batch_cycles);
 }
 
 /*******************************************************************/
 /*		TASK RELATED FUNCTIONS
 /*******************************************************************/
-int32_t mp3_player_task_func()
+/*
+ * Real-time task: decode frames, one slice at a time, as long as the output buffer has
+ * room for them (see the rules in kernel.h). When the undecoded data is running low the
+ * file reader task is activated; if it runs out, the decoder stops until the reader has
+ * refilled it.
+ */
+void mp3_decoder_rt_func()
 {
-	uint8_t* data_buff_ptr;
+	uint32_t start_cycles, slice_cycles, run_cycles = 0;
+	uint16_t samples;
+	int result;
 	
-	//decode the current frame
-	if (mad_frame_decode(&mad_frame, &mad_stream) == -1) {
-		if (MAD_RECOVERABLE(mad_stream.error)) {
-			// refill the file buffer
-			if (mp3_player_refill_buffer(TRUE) < 0) {
-				debug_msg("Minor error (%x), but the buffer cannot be refilled\n", mad_stream.error);
-				mp3_player_stop();
-				return DIE;
+	decoder_control.runs++;
+	while ((internal_status == MP3_PLAYER_PLAYING) && (decoder_status == DECODER_RUNNING)) {
+		start_cycles = cycle_counter_get();
+		if (decoder_slice.granule < decoder_slice.granules) {
+			// filter and synthesize the next granule of the frame
+			mad_frame_decode_granule(&mad_frame, decoder_slice.granule);
+			samples = mp3_player_synth_granule(decoder_slice.granule);
+			decoder_slice.granule++;
+		} else {
+			// a new frame needs room for all of its samples
+			if (output_i2s_get_buffer_free_space() < MP3_FRAME_MAX_SAMPLES)
+				break;
+			
+			// decode the data of the next frame (just its header if it's skipped)
+			if (position.skip_frames > 0)
+				result = mad_header_decode(&mad_frame.header, &mad_stream);
+			else
+				result = mad_frame_decode_data(&mad_frame, &mad_stream);
+			if (result == -1) {
+				if (MAD_RECOVERABLE(mad_stream.error)) {
+					mp3_decoder_update_consumed();
+					continue;
+				}
+				if ((mad_stream.error == MAD_ERROR_BUFLEN) && mp3_decoder_update_window())
+					continue;
+				decoder_status = (mad_stream.error == MAD_ERROR_BUFLEN) ? DECODER_NEEDS_DATA : DECODER_ERROR;
+				kernel_activate_task_from_isr(&mp3_player_task);
+				return;
 			}
-			return IMMEDIATELY;
-		} else if (mad_stream.error == MAD_ERROR_BUFLEN) {
-			if (mp3_player_refill_buffer(TRUE) < 0) {
-				debug_msg("Major error (%x): %s, but the buffer cannot be refilled\n", mad_stream.error, mad_stream_errorstr(&mad_stream));
-				mp3_player_stop();
-				return DIE;
+			mp3_decoder_update_consumed();
+			if (!feeder.is_file_over &&
+					((FILE_RING_SIZE - (__atomic_load_n(&feeder.filled, __ATOMIC_ACQUIRE) - feeder.consumed)) >= FILE_CHUNK_SIZE))
+				kernel_activate_task_from_isr(&mp3_player_task);
+			if (position.skip_frames > 0) {
+				mad_frame.header.flags &= ~MAD_FLAG_INCOMPLETE;
+				position.frame++;
+				position.skip_frames--;
+				continue;
 			}
-		} else {
-			debug_msg("Major error (%x): %s\n", mad_stream.error, mad_stream_errorstr(&mad_stream));
-			mp3_player_stop();
-			return DIE;
+			
+			// Layer III frames are filtered and synthesized by the next slices, one
+			// granule at a time; the other layers are fully decoded
+			decoder_slice.granule = 0;
+			decoder_slice.granules = mad_frame.granules;
+			samples = 0;
+			if (decoder_slice.granules == 0)
+				samples = mp3_player_synth_frame();
+		}
+		
+		slice_cycles = cycle_counter_get() - start_cycles;
+		decoder_load[output_config.mode].cycles += slice_cycles;
+		decoder_control.slice_cycles += ((int32_t)(slice_cycles - decoder_control.slice_cycles)) >> MP3_DECODER_SLICE_AVG_SHIFT;
+		decoder_control.slices++;
+		run_cycles += slice_cycles;
+		feeder_stats.decoded_samples += samples;
+		if (decoder_slice.granule == decoder_slice.granules) {
+			// the frame is complete
+			position.frame++;
+			decoder_load[output_config.mode].samples += 32 * MAD_NSBSAMPLES(&mad_frame.header);
+			feeder_stats.sample_rate = mad_frame.header.samplerate;
+			if (feeder_stats.first_samples_cycles == 0)
+				feeder_stats.first_samples_cycles = cycle_counter_get() - feeder_stats.start_cycles;
+		}
+		
+		if (mp3_decoder_should_yield(run_cycles)) {
+			if ((decoder_slice.granule < decoder_slice.granules) ||
+					(output_i2s_get_buffer_free_space() >= MP3_FRAME_MAX_SAMPLES)) {
+				decoder_control.yields++;
+				kernel_activate_task_from_isr(&mp3_decoder_task);
+			}
+			break;
 		}
 	}
+	if (run_cycles > decoder_control.max_run_cycles)
+		decoder_control.max_run_cycles = run_cycles;
+}
+
+/*
+ * Cooperative side of the decoder: it resumes the real-time task after it has yielded,
+ * once the cooperative tasks with a higher priority have run
+ */
+int32_t mp3_decoder_task_func()
+{
+	if (internal_status == MP3_PLAYER_IDLE)
+		return DIE;
+	kernel_rt_activate(&mp3_decoder_rt_task);
+	return WAIT_FOR_RESUME;
+}
+
+/*
+ * File reader task: keep the input ring full, one chunk at a time, and stop the
+ * playback at the end of the file or on errors
+ */
+int32_t mp3_player_task_func()
+{
+	int32_t ret_val;
 	
-	if (!has_sample_rate_been_set) {
-		output_i2s_ConfigurePLL(mad_frame.header.samplerate);
-		sgtl5000_config_clocks(mad_frame.header.samplerate);
-		has_sample_rate_been_set = TRUE;
-	}
+	if (internal_status == MP3_PLAYER_IDLE)
+		return DIE;
 	
-	// enqueue decoded audio samples
-	mad_synth_frame(&mad_synth, &mad_frame);
-	mp3_player_enqueue_decoded_audio_samples();	
+	if (decoder_status == DECODER_ERROR) {
+		debug_msg("Major error (%x): %s\n", mad_stream.error, mad_stream_errorstr(&mad_stream));
+		mp3_player_stop();
+		return DIE;
+	}
 	
-	// refill the file buffer
-	mp3_player_refill_buffer(TRUE);
+	ret_val = mp3_player_refill_buffer();
+	if (ret_val < 0) {
+		// The next file is prepared while the decoder consumes the rest of this one
+		if (next_track.status == NEXT_TRACK_QUEUED)
+			mp3_player_prepare_next_track();
+		// The playback is over once the decoder has consumed all the data
+		if (decoder_status == DECODER_NEEDS_DATA) {
+			if (next_track.status == NEXT_TRACK_READY)
+				return mp3_player_start_next_track();
+			debug_msg("end of file\n");
+			mp3_player_stop();
+			return DIE;
+		}
+		return WAIT_FOR_RESUME;
+	}
 	
-	// if the output audio buffer is still partially free then reschedule immediately,
-	// otherwise wait for the callback
-	// Note = 1152 is the maximum audio samples size for an MP3 frame
-	if (output_i2s_get_buffer_free_space() > 1152) {
+	if (ret_val > 0) {
+		kernel_rt_activate(&mp3_decoder_rt_task);
 		return IMMEDIATELY;
-	} else {
-		return WAIT_FOR_RESUME;
 	}
+	return WAIT_FOR_RESUME;
 }
 
 /*
- * Callback function from the output_i2s
+ * Callback function from the output_i2s (real-time context)
  */
 void mp3_player_request_audio_samples()
 {
-	kernel_activate_task_immediately(&mp3_player_task);
+	kernel_rt_activate(&mp3_decoder_rt_task);
 }
 
 /*******************************************************************/
@@ -186,29 +791,57 @@ void mp3_player_request_audio_samples()
  */
 int32_t mp3_player_play(char* path)
 {
+	uint32_t start_cycles = cycle_counter_get();
+	
+	mp3_player_queue(NULL);
+	
 	// Initialize MAD library
     mad_stream_init(&mad_stream);
     mad_synth_init(&mad_synth);
     mad_frame_init(&mad_frame);
+    mad_pcm16.options = MP3_PLAYER_PCM16_OPTIONS;
+    memset(&feeder, 0, sizeof(feeder));
+    memset(&feeder_stats, 0, sizeof(feeder_stats));
+    memset(decoder_load, 0, sizeof(decoder_load));
+    feeder_stats.start_cycles = start_cycles;
     
-    has_sample_rate_been_set = FALSE;
+    kernel_rt_init_task(&mp3_decoder_rt_task);
+    decoder_status = DECODER_RUNNING;
     
 	// try to open the file
 	if (f_open(&fp, path, FA_READ) != FR_OK) {
 		debug_msg("error opening the file\n");
 		return -1;
 	}
+	strncpy(playing_path, path, MAX_PATH_LENGTH - 1);
+	are_footers_read = FALSE;
 	
-	if (mp3_player_refill_buffer(FALSE) < 0) {
+	// the audio starts after the ID3v2 tags, which can be long (pictures): libmad
+	// would look for a frame through all of them
+	if (mp3_player_restart_stream(mp3_tags_read_id3v2(&fp, &tags)) < 0) {
+		debug_msg("error seeking the file\n");
+		f_close(&fp);
+		return -1;
+	}
+	
+	// fill the ring (the decoder is not running yet)
+	while (mp3_player_refill_buffer() > 0);
+	if (!mp3_decoder_update_window()) {
 		debug_msg("unable to fill the internal buffer\n");
+		f_close(&fp);
+		return -1;
+	}
+	
+	if (mp3_player_start_stream(path) < 0) {
+		debug_msg("no valid frame found\n");
+		f_close(&fp);
 		return -1;
 	}
-	mad_stream_buffer(&mad_stream, file_buffer, FILE_BUFFER_SIZE);
-	mad_stream_sync(&mad_stream);
 	
 	// start the playback by activating the callback
 	internal_status = MP3_PLAYER_PLAYING;
 	output_i2s_register_callback(mp3_player_request_audio_samples);
+	kernel_rt_activate(&mp3_decoder_rt_task);
 
 	return 0;
 }
@@ -230,6 +863,7 @@ int32_t mp3_player_resume()
 {
 	output_i2s_register_callback(mp3_player_request_audio_samples);
 	internal_status = MP3_PLAYER_PLAYING;
+	kernel_rt_activate(&mp3_decoder_rt_task);
 	return 0;
 }
 
@@ -238,14 +872,26 @@ int32_t mp3_player_resume()
  */
 int32_t mp3_player_stop()
 {
+	// the decoder could be running: make sure it has seen the new status
+	kernel_rt_lock();
 	output_i2s_register_callback(NULL);
 	internal_status = MP3_PLAYER_IDLE;
+	kernel_rt_unlock();
+	if (feeder_stats.first_samples_cycles != 0)
+		debug_msg("first samples queued %u us after the start\n", feeder_stats.first_samples_cycles / CYCLES_PER_US);
+	if (feeder_stats.sample_rate != 0) {
+		uint32_t decoded_ms = (uint32_t)(((uint64_t)feeder_stats.decoded_samples * 1000) / feeder_stats.sample_rate);
+		debug_msg("decoded %u ms, copied per decoded second: %u bytes by the ring, %u bytes by FatFs\n", decoded_ms,
+					(uint32_t)(((uint64_t)feeder_stats.moved_bytes * 1000) / max(decoded_ms, 1)),
+					(uint32_t)(((uint64_t)feeder_stats.buffered_bytes * 1000) / max(decoded_ms, 1)));
+	}
+	mp3_index_close();
+	mp3_player_queue(NULL);
 	mad_stream_finish(&mad_stream);
     mad_synth_finish(&mad_synth);
     mad_frame_finish(&mad_frame);
 	f_close(&fp);
 	memset(file_buffer, 0, sizeof(file_buffer));
-	memset(output_audio_samples, 0, sizeof(output_audio_samples));
 	
 	return 0;
 }
@@ -257,3 +903,531 @@ uint8_t mp3_player_get_status()
 {
 	return internal_status;
 }
+
+/*
+ * Queue the file which follows the current one without any gap: only one file can be
+ * queued (a new one replaces it, NULL clears it)
+ */
+int32_t mp3_player_queue(char* path)
+{
+	if (next_track.status == NEXT_TRACK_READY)
+		f_close(&next_track.file);
+	next_track.status = NEXT_TRACK_NONE;
+	if (path == NULL)
+		return 0;
+	
+	strncpy(next_track.path, path, MAX_PATH_LENGTH - 1);
+	next_track.status = NEXT_TRACK_QUEUED;
+	// the reader may be waiting for the decoder to consume the end of the current file
+	if ((internal_status != MP3_PLAYER_IDLE) && feeder.is_file_over)
+		kernel_activate_task_immediately(&mp3_player_task);
+	return 0;
+}
+
+/*
+ * Register a function which is called (by a cooperative task) when the queued file
+ * starts. A NULL input parameter clears it.
+ */
+void mp3_player_register_callback(void (*func)(void))
+{
+	track_change_callback = func;
+}
+
+/*
+ * Move the playback to the given time (ms from the beginning of the stream): the
+ * stream restarts from the indexed frame before the target, with a single seek of the
+ * file. It's refused while the scan of a file without TOC has not reached the target
+ * yet.
+ */
+int32_t mp3_player_seek(uint32_t time_ms)
+{
+	uint32_t target, frame, offset;
+	
+	if ((internal_status == MP3_PLAYER_IDLE) || (output_config.stream_rate == 0))
+		return -1;
+	target = frame = (trim.first_sample + (uint32_t)(((uint64_t)time_ms * output_config.stream_rate) / 1000)) /
+						position.samples_per_frame;
+	if (mp3_index_seek(&frame, &offset) < 0)
+		return -1;
+	
+	// the decoder stops until the reader has refilled the ring from the new offset
+	kernel_rt_lock();
+	decoder_status = DECODER_NEEDS_DATA;
+	output_i2s_flush();
+	kernel_rt_unlock();
+	
+	if (mp3_player_restart_stream(offset) < 0) {
+		debug_msg("error seeking the file\n");
+		mp3_player_stop();
+		return -1;
+	}
+	mad_frame_mute(&mad_frame);
+	mad_frame.header.flags &= ~MAD_FLAG_INCOMPLETE;
+	mad_synth_mute(&mad_synth);
+	position.frame = frame;
+	position.skip_frames = target - frame;
+	
+	kernel_activate_task_immediately(&mp3_player_task);
+	return 0;
+}
+
+/*
+ * Metadata of the file being played, or NULL if idle
+ */
+struct MP3_TAGS const* mp3_player_get_tags()
+{
+	FIL file;
+	
+	if (internal_status == MP3_PLAYER_IDLE)
+		return NULL;
+	if (!are_footers_read && !mp3_tags_is_complete(&tags) && (f_open(&file, playing_path, FA_READ) == FR_OK)) {
+		mp3_tags_read_footers(&file, &tags);
+		f_close(&file);
+	}
+	are_footers_read = TRUE;
+	return &tags;
+}
+
+/*
+ * Time of the playback, in ms from the beginning of the stream
+ */
+uint32_t mp3_player_get_position()
+{
+	uint32_t sample = (position.frame + position.skip_frames) * position.samples_per_frame;
+	
+	return mp3_player_samples_to_ms((sample > trim.first_sample) ? (sample - trim.first_sample) : 0);
+}
+
+/*
+ * Duration of the stream in ms, or 0 if it's not known yet
+ */
+uint32_t mp3_player_get_duration()
+{
+	uint32_t frames = mp3_index_get_frames();
+	
+	if (trim.end_sample != UINT32_MAX)
+		return mp3_player_samples_to_ms(trim.end_sample - trim.first_sample);
+	if (frames * position.samples_per_frame <= trim.first_sample)
+		return 0;
+	return mp3_player_samples_to_ms(frames * position.samples_per_frame - trim.first_sample);
+}
+
+/*
+ * Shell command which moves the playback to the given time ("mp3_seek [seconds]") and
+ * shows its position
+ */
+int mp3_player_seek_command(int argc, char *argv[])
+{
+	if (internal_status == MP3_PLAYER_IDLE) {
+		debug_msg("nothing is playing\n");
+		return -1;
+	}
+	if ((argc > 0) && (mp3_player_seek(atoi(argv[0]) * 1000) < 0)) {
+		debug_msg("unable to seek (the file is still being indexed?)\n");
+		return -1;
+	}
+	debug_msg("position %u ms of %u ms\n", mp3_player_get_position(), mp3_player_get_duration());
+	return 0;
+}
+
+/*
+ * Select the low power mode (MP3_PLAYER_*_RATE). The playback in progress, if any,
+ * switches to it from the next frame: the output's rate doesn't change, so the samples
+ * already queued are played.
+ */
+int32_t mp3_player_set_low_power(uint8_t mode)
+{
+	if (mode > MP3_PLAYER_QUARTER_RATE)
+		return -1;
+	
+	if ((internal_status != MP3_PLAYER_IDLE) && (mode != output_config.mode)) {
+		// not while the decoder is running a slice
+		kernel_rt_lock();
+		output_config.mode = mode;
+		mad_stream_options(&mad_stream, mp3_player_get_mad_options(mode));
+		kernel_rt_unlock();
+	}
+	
+	low_power_mode = mode;
+	return 0;
+}
+
+/*
+ * 
+ */
+uint8_t mp3_player_get_low_power()
+{
+	return low_power_mode;
+}
+
+/*
+ * Shell command which selects the low power mode ("mp3_low_power [full|half|quarter]")
+ * and shows the decoder's CPU load in every mode used by the last playback, with the
+ * energy saved in an hour by the reduced rates compared to the full one
+ */
+static const char* const low_power_mode_names[] = { "full", "half", "quarter" };
+int mp3_player_low_power(int argc, char *argv[])
+{
+	uint32_t mode, decoded_ms, load, full_load = 0, saved_ua;
+	
+	if (argc > 0) {
+		for (mode=0; mode<array_size(low_power_mode_names); mode++) {
+			if (strcmp(argv[0], low_power_mode_names[mode]) == 0)
+				break;
+		}
+		if ((mode == array_size(low_power_mode_names)) || (mp3_player_set_low_power(mode) < 0))
+			return -1;
+	}
+	
+	debug_msg("low power mode: %s rate\n", low_power_mode_names[low_power_mode]);
+	if (internal_status != MP3_PLAYER_IDLE)
+		debug_msg("synthesis: %u Hz, output: %u Hz\n", output_config.stream_rate >> output_config.mode,
+					output_config.stream_rate);
+	
+	for (mode=0; mode<array_size(decoder_load); mode++) {
+		if (output_config.stream_rate == 0)
+			break;
+		decoded_ms = (uint32_t)(((uint64_t)decoder_load[mode].samples * 1000) / output_config.stream_rate);
+		if (decoded_ms == 0)
+			continue;
+		// hundredths of percent of the cycles available while the decoded audio is played
+		load = (uint32_t)((decoder_load[mode].cycles * 10000) / ((uint64_t)decoded_ms * (CYCLE_COUNTER_FREQ / 1000)));
+		debug_msg("%s rate: decoder load %u.%u%u%% over %u ms\n", low_power_mode_names[mode],
+					load / 100, (load / 10) % 10, load % 10, decoded_ms);
+		if (mode == MP3_PLAYER_FULL_RATE) {
+			full_load = load;
+		} else if (full_load > load) {
+			saved_ua = ((full_load - load) * (MCU_RUN_CURRENT_MA - MCU_SLEEP_CURRENT_MA)) / 10;
+			debug_msg("%s rate: saves about %u.%u mAh (%u mWh) per hour of playback\n",
+						low_power_mode_names[mode], saved_ua / 1000, (saved_ua % 1000) / 100,
+						(saved_ua * MCU_SUPPLY_MV) / 1000000);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Shell command which sets the tunables of the decode-ahead control ("mp3_decoder
+ * [<low_watermark> <high_watermark> <batch_us>]", watermarks in samples) and shows them,
+ * with the decoder's runs since the last call and the output's dropouts (DMA buffers
+ * which the decoder couldn't fill in time)
+ */
+int mp3_decoder_command(int argc, char *argv[])
+{
+	uint32_t dropouts, refills, slices_per_run = 0;
+	
+	if (argc == 3) {
+		if (atoi(argv[0]) >= atoi(argv[1]))
+			return -1;
+		kernel_rt_lock();
+		decoder_control.low_watermark = atoi(argv[0]);
+		decoder_control.high_watermark = atoi(argv[1]);
+		decoder_control.batch_cycles = atoi(argv[2]) * CYCLES_PER_US;
+		kernel_rt_unlock();
+	} else if (argc != 0) {
+		debug_msg("usage: mp3_decoder [<low_watermark> <high_watermark> <batch_us>]\n");
+		return -1;
+	}
+	
+	debug_msg("watermarks: %u-%u samples, batch %u us\n", decoder_control.low_watermark,
+				decoder_control.high_watermark, decoder_control.batch_cycles / CYCLES_PER_US);
+	if (decoder_control.runs != 0)
+		slices_per_run = (decoder_control.slices * 10) / decoder_control.runs;
+	debug_msg("runs %u (%u yields), %u.%u slices per run, average slice %u us, longest run %u us\n",
+				decoder_control.runs, decoder_control.yields, slices_per_run / 10, slices_per_run % 10,
+				decoder_control.slice_cycles / CYCLES_PER_US, decoder_control.max_run_cycles / CYCLES_PER_US);
+	dropouts = output_i2s_get_dropouts(&refills);
+	debug_msg("output: %u dropouts in %u refills\n", dropouts, refills);
+	
+	kernel_rt_lock();
+	decoder_control.runs = decoder_control.slices = decoder_control.yields = 0;
+	decoder_control.max_run_cycles = 0;
+	kernel_rt_unlock();
+	return 0;
+}
+
+/*
+ * Synthesize the benchmark frame the given number of times, from a muted filterbank:
+ * return the cycles spent and where the last frame's samples are
+ */
+static uint32_t mp3_bench_synth(uint32_t frames, int options, uint16_t* last_index)
+{
+	uint32_t start_cycles, index;
+	
+	mad_synth_init(&mad_synth);
+	mad_pcm16.options = options;
+	
+	start_cycles = cycle_counter_get();
+	for (index=0; index<frames; index++) {
+		*last_index = mad_pcm16.index;
+		mad_synth_frame_pcm16(&mad_synth, &mad_frame, &mad_pcm16);
+	}
+	return cycle_counter_get() - start_cycles;
+}
+
+/*
+ * Base 2 logarithm of a non zero value, with 8 fractional bits
+ */
+static uint32_t mp3_bench_log2(uint64_t value)
+{
+	uint32_t result = 0, bit;
+	
+	while (value >= (2ULL << 30)) {
+		value >>= 1;
+		result++;
+	}
+	while (value < (1ULL << 30)) {
+		value <<= 1;
+		result--;
+	}
+	// value is now the mantissa in [1, 2) with 30 fractional bits: squaring it gives
+	// the fractional bits one at a time
+	for (bit=0; bit<8; bit++) {
+		value = (value * value) >> 30;
+		result <<= 1;
+		if (value >= (2ULL << 30)) {
+			value >>= 1;
+			result |= 1;
+		}
+	}
+	return result + (30 << 8);
+}
+
+/*
+ * Shell command which measures the cycles per frame spent by the synthesis (up to the
+ * 16-bit samples in the output ring) and the cycles per granule spent by the IMDCT of
+ * Layer III long blocks on pseudo-random data ("mp3_bench [frames]").
+ * The synthesis is measured with the reference filterbank and with the one selected
+ * by the build (OPT_SYNTH_BLOCKED or OPT_SYNTH_D16), whose output is then compared to
+ * the reference one on a quieter frame, which doesn't clip: the PSNR is relative to
+ * the 16-bit full scale.
+ * The IMDCT is measured with the C version and with the one selected by the build
+ * (ASO_IMDCT), whose results are compared for every window.
+ * The checksum of the results (16-bit samples of the synthesis and IMDCT outputs) is
+ * the same for every fixed point implementation which rounds in the same way (the float
+ * one has its own): with the Makefile's default options it's 0xc7279f5, on the target
+ * as on the host.
+ */
+#define MP3_BENCH_DEFAULT_FRAMES		100
+#define MP3_BENCH_IMDCT_PER_GRANULE		(2*32)		// channels * subbands
+#define MP3_BENCH_IMDCT_PER_FRAME		(2*MP3_BENCH_IMDCT_PER_GRANULE)
+#define MP3_BENCH_QUIET_SHIFT			4
+int mp3_player_benchmark(int argc, char *argv[])
+{
+	uint32_t frames = (argc > 0) ? atoi(argv[0]) : MP3_BENCH_DEFAULT_FRAMES;
+	uint32_t seed = 1, checksum = 0;
+	uint32_t start_cycles, reference_cycles, synth_cycles, imdct_cycles, imdct_reference_cycles;
+	mad_fixed_t imdct_in[18], imdct_out[36], imdct_reference[36];
+	audio_sample_t* ring;
+	uint16_t first_index = 0, reference_index = 0;
+	uint32_t index, ch, s, sb, max_error = 0, imdct_max_error = 0, psnr;
+	static const uint8_t block_types[] = { 0, 1, 3 };
+	uint64_t squared_error = 0;
+	
+	if (internal_status != MP3_PLAYER_IDLE) {
+		debug_msg("the player must be idle\n");
+		return -1;
+	}
+	if (frames == 0)
+		return -1;
+	
+	// A stereo Layer III frame (its structures are not in use while idle)
+	mad_frame_init(&mad_frame);
+	mad_synth_init(&mad_synth);
+	mad_frame.header.layer = MAD_LAYER_III;
+	mad_frame.header.mode = MAD_MODE_STEREO;
+	mad_frame.header.samplerate = 44100;
+	#define bench_random()		(seed = (seed * 1664525) + 1013904223, mad_f_fromraw(((int32_t)seed) >> 4))
+	for (ch=0; ch<2; ch++)
+		for (s=0; s<36; s++)
+			for (sb=0; sb<32; sb++)
+				mad_frame.sbsample[ch][s][sb] = bench_random();
+	for (index=0; index<array_size(imdct_in); index++)
+		imdct_in[index] = bench_random();
+	#undef bench_random
+	
+	// The output ring is not in use either: the samples are written but not committed
+	ring = output_i2s_get_ring(&mad_pcm16.size, &mad_pcm16.index);
+	mad_pcm16.buffer = (signed short*)ring;
+	
+	synth_cycles = mp3_bench_synth(frames, 0, &first_index);
+	reference_cycles = mp3_bench_synth(frames, MAD_PCM16_REFERENCE, &first_index);
+	
+	start_cycles = cycle_counter_get();
+	for (index=0; index<(frames * MP3_BENCH_IMDCT_PER_FRAME); index++)
+		mad_layer_III_imdct_l(imdct_in, imdct_out, 0);
+	imdct_cycles = cycle_counter_get() - start_cycles;
+	start_cycles = cycle_counter_get();
+	for (index=0; index<(frames * MP3_BENCH_IMDCT_PER_FRAME); index++)
+		mad_layer_III_imdct_l_reference(imdct_in, imdct_out, 0);
+	imdct_reference_cycles = cycle_counter_get() - start_cycles;
+	
+	#define bench_raw(value)	((uint32_t)(int32_t)(mad_f_todouble(value) * (1L << MAD_F_FRACBITS)))
+	for (index=0; index<mad_synth.pcm.length; index++) {
+		audio_sample_t* sample = &ring[(first_index + index) % mad_pcm16.size];
+		checksum = ((checksum << 1) | (checksum >> 31)) ^ (uint16_t)sample->left_ch ^ ((uint32_t)(uint16_t)sample->right_ch << 16);
+	}
+	for (index=0; index<array_size(imdct_out); index++)
+		checksum = ((checksum << 1) | (checksum >> 31)) ^ bench_raw(imdct_out[index]);
+	for (s=0; s<array_size(block_types); s++) {
+		mad_layer_III_imdct_l_reference(imdct_in, imdct_reference, block_types[s]);
+		mad_layer_III_imdct_l(imdct_in, imdct_out, block_types[s]);
+		for (index=0; index<array_size(imdct_out); index++) {
+			int32_t error = (int32_t)(bench_raw(imdct_out[index]) - bench_raw(imdct_reference[index]));
+			
+			if (error < 0)
+				error = -error;
+			imdct_max_error = max(imdct_max_error, (uint32_t)error);
+		}
+	}
+	#undef bench_raw
+	
+	// Two frames of each filterbank, in separate parts of the ring: the second ones
+	// are compared
+	for (ch=0; ch<2; ch++)
+		for (s=0; s<36; s++)
+			for (sb=0; sb<32; sb++)
+				mad_frame.sbsample[ch][s][sb] /= (1 << MP3_BENCH_QUIET_SHIFT);
+	mp3_bench_synth(2, MAD_PCM16_REFERENCE, &reference_index);
+	mp3_bench_synth(2, 0, &first_index);
+	for (index=0; index<(2 * mad_synth.pcm.length); index++) {
+		signed short* reference = (signed short*)&ring[(reference_index + index/2) % mad_pcm16.size];
+		signed short* sample = (signed short*)&ring[(first_index + index/2) % mad_pcm16.size];
+		int32_t error = sample[index % 2] - reference[index % 2];
+		
+		if (error < 0)
+			error = -error;
+		max_error = max(max_error, (uint32_t)error);
+		squared_error += (uint32_t)(error * error);
+	}
+	
+	debug_msg("%s\n", mad_build);
+	debug_msg("synth_full16 (reference): %u cycles/frame\n", reference_cycles / frames);
+	debug_msg("synth_full16: %u cycles/frame\n", synth_cycles / frames);
+	if (squared_error == 0) {
+		debug_msg("synth_full16: same samples as the reference\n");
+	} else {
+		// 10*log10(32768^2 * samples / squared_error), log10(2) ~ 0.30103
+		psnr = (mp3_bench_log2(((uint64_t)2 * mad_synth.pcm.length) << 30) - mp3_bench_log2(squared_error));
+		psnr = (psnr * 30103) / (256 * 1000);
+		debug_msg("synth_full16: PSNR %u.%u dB, max error %u LSB\n", psnr / 10, psnr % 10, max_error);
+	}
+	debug_msg("III_imdct_l (reference): %u cycles/granule (%u per block)\n", imdct_reference_cycles / (2 * frames),
+				imdct_reference_cycles / (frames * MP3_BENCH_IMDCT_PER_FRAME));
+	debug_msg("III_imdct_l: %u cycles/granule (%u per block)\n", imdct_cycles / (2 * frames),
+				imdct_cycles / (frames * MP3_BENCH_IMDCT_PER_FRAME));
+	if (imdct_max_error == 0)
+		debug_msg("III_imdct_l: same results as the reference\n");
+	else
+		debug_msg("III_imdct_l: max error %u LSB\n", imdct_max_error);
+	debug_msg("checksum = 0x%x\n", checksum);
+	
+	mad_synth_finish(&mad_synth);
+	mad_frame_finish(&mad_frame);
+	return 0;
+}
+
+/*
+ * Decode the whole file with the given libmad options, counting the cycles spent
+ * by mad_frame_decode(), the frames and the Layer III granules of a channel (576
+ * spectral lines each), and making a checksum of the subband samples
+ */
+static int32_t mp3_bench_decode(char* path, int options, uint32_t* cycles, uint32_t* frames,
+								uint32_t* granules, uint32_t* checksum)
+{
+	uint32_t remaining, start_cycles, ch, s, sb;
+	unsigned int read_bytes;
+	int32_t result;
+	uint8_t is_file_over = FALSE;
+	
+	if (f_open(&fp, path, FA_READ) != FR_OK)
+		return -1;
+	
+	mad_stream_init(&mad_stream);
+	mad_frame_init(&mad_frame);
+	mad_stream_options(&mad_stream, options);
+	*cycles = *frames = *granules = *checksum = 0;
+	
+	// The input ring is used as a plain buffer: the frame left incomplete at its end
+	// is moved to the beginning, before the next part of the file
+	do {
+		remaining = 0;
+		if (mad_stream.next_frame != NULL) {
+			remaining = mad_stream.bufend - mad_stream.next_frame;
+			memmove(file_ring, mad_stream.next_frame, remaining);
+		}
+		if (f_read(&fp, file_ring + remaining, FILE_RING_SIZE - MAD_BUFFER_GUARD - remaining, &read_bytes) != FR_OK)
+			break;
+		if (read_bytes == 0) {
+			memset(file_ring + remaining, 0, MAD_BUFFER_GUARD);
+			read_bytes = MAD_BUFFER_GUARD;
+			is_file_over = TRUE;
+		}
+		mad_stream_buffer(&mad_stream, file_ring, remaining + read_bytes);
+		
+		while (1) {
+			start_cycles = cycle_counter_get();
+			result = mad_frame_decode(&mad_frame, &mad_stream);
+			*cycles += cycle_counter_get() - start_cycles;
+			if (result != 0) {
+				if (MAD_RECOVERABLE(mad_stream.error))
+					continue;
+				break;
+			}
+			
+			(*frames)++;
+			if (mad_frame.header.layer == MAD_LAYER_III)
+				*granules += (MAD_NSBSAMPLES(&mad_frame.header) / 18) * MAD_NCHANNELS(&mad_frame.header);
+			#define bench_raw(value)	((uint32_t)(int32_t)(mad_f_todouble(value) * (1L << MAD_F_FRACBITS)))
+			for (ch=0; ch<MAD_NCHANNELS(&mad_frame.header); ch++)
+				for (s=0; s<MAD_NSBSAMPLES(&mad_frame.header); s++)
+					for (sb=0; sb<32; sb++)
+						*checksum = ((*checksum << 1) | (*checksum >> 31)) ^ bench_raw(mad_frame.sbsample[ch][s][sb]);
+			#undef bench_raw
+		}
+	} while (!is_file_over && (mad_stream.error == MAD_ERROR_BUFLEN));
+	
+	f_close(&fp);
+	mad_frame_finish(&mad_frame);
+	mad_stream_finish(&mad_stream);
+	return 0;
+}
+
+/*
+ * Shell command which measures the cycles per frame spent decoding a file (up to
+ * the subband samples) with the reference Huffman decoder of Layer III and with
+ * the one selected by the build (OPT_HUFF_LOOKUP), and checks that their results
+ * are the same ("mp3_bench_file path")
+ */
+int mp3_player_benchmark_file(int argc, char *argv[])
+{
+	uint32_t reference_cycles, reference_checksum, cycles, checksum, frames, granules;
+	
+	if (internal_status != MP3_PLAYER_IDLE) {
+		debug_msg("the player must be idle\n");
+		return -1;
+	}
+	if (argc != 1)
+		return -1;
+	
+	if ((mp3_bench_decode(argv[0], MAD_OPTION_HUFFREFERENCE, &reference_cycles, &frames, &granules, &reference_checksum) < 0) ||
+		(mp3_bench_decode(argv[0], 0, &cycles, &frames, &granules, &checksum) < 0)) {
+		debug_msg("error opening the file\n");
+		return -1;
+	}
+	if (frames == 0) {
+		debug_msg("no frames\n");
+		return -1;
+	}
+	granules = max(granules, 1);
+	
+	debug_msg("%s\n", mad_build);
+	debug_msg("%u frames, %u Layer III granules (channels)\n", frames, granules);
+	debug_msg("reference Huffman decoder: %u cycles/frame, %u cycles/granule\n",
+				reference_cycles / frames, reference_cycles / granules);
+	debug_msg("Huffman decoder: %u cycles/frame, %u cycles/granule\n",
+				cycles / frames, cycles / granules);
+	debug_msg("Huffman decoder: %s the reference\n",
+				(checksum == reference_checksum) ? "same samples as" : "different samples from");
+	return 0;
+}
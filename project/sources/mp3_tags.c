@@ -0,0 +1,374 @@
+#include "mp3_tags.h"
+#include "debug_printf.h"
+#include "string.h"
+#include "utils.h"
+
+#define debug_msg(format, ...)		debug_printf("[mp3_tags] " format, ##__VA_ARGS__)
+
+// Fields of the metadata
+#define MP3_TAGS_TITLE				0
+#define MP3_TAGS_ARTIST				1
+#define MP3_TAGS_ALBUM				2
+#define MP3_TAGS_TRACK				3
+static const char* const id3v2_frame_ids[] = { "TIT2", "TPE1", "TALB", "TRCK" };
+static const char* const id3v22_frame_ids[] = { "TT2", "TP1", "TAL", "TRK" };
+static const char* const ape_item_keys[] = { "title", "artist", "album", "track" };
+
+// Only the beginning of the frames/items is read: enough for the text fields, in UTF-16 too
+#define MP3_TAGS_BUFFER_SIZE		128
+
+// ID3v2 tag: a 10-byte header ("ID3", version, revision, flags and the size of the rest
+// of the tag as a 28-bit syncsafe integer) followed by the frames, each with its own header
+// (6 bytes in version 2.2, 10 bytes in 2.3 and 2.4, with a syncsafe size in 2.4)
+#define ID3V2_HEADER_SIZE				10
+#define ID3V2_FLAG_UNSYNCHRONISATION	0x80
+#define ID3V2_FLAG_EXTENDED_HEADER		0x40
+#define ID3V2_FLAG_FOOTER				0x10
+#define ID3V22_FRAME_HEADER_SIZE		6
+#define ID3V2_FRAME_HEADER_SIZE			10
+// Format flags of the frames (2.3 and 2.4)
+#define ID3V23_FRAME_COMPRESSION		0x80
+#define ID3V23_FRAME_ENCRYPTION			0x40
+#define ID3V23_FRAME_GROUPING			0x20
+#define ID3V24_FRAME_GROUPING			0x40
+#define ID3V24_FRAME_COMPRESSION		0x08
+#define ID3V24_FRAME_ENCRYPTION			0x04
+#define ID3V24_FRAME_UNSYNCHRONISATION	0x02
+#define ID3V24_FRAME_DATA_LENGTH		0x01
+// Text encodings
+#define ID3V2_ENCODING_LATIN1			0
+#define ID3V2_ENCODING_UTF16			1
+#define ID3V2_ENCODING_UTF16BE			2
+#define ID3V2_ENCODING_UTF8				3
+
+// ID3v1 tag: the last 128 bytes of the file, with fixed size fields (ID3v1.1 stores the
+// track in the last byte of the comment)
+#define ID3V1_SIZE						128
+#define ID3V1_TITLE_OFFSET				3
+#define ID3V1_ARTIST_OFFSET				33
+#define ID3V1_ALBUM_OFFSET				63
+#define ID3V1_FIELD_SIZE				30
+#define ID3V1_TRACK_OFFSET				126
+
+// APEv2 tag: its footer is the last 32 bytes of the file (or the ones before the ID3v1
+// tag), with the size of the items and of the footer itself; each item has a little
+// endian header (value size and flags) and a nul terminated key, before its value
+#define APE_FOOTER_SIZE					32
+#define APE_SIZE_OFFSET					12
+#define APE_ITEM_HEADER_SIZE			8
+#define APE_ITEM_TYPE_MASK				0x06	// 0 = UTF-8 text
+
+/*******************************************************************/
+/*		INTERNAL FUNCTIONS
+/*******************************************************************/
+static uint32_t mp3_tags_get_be(uint8_t const* data, uint8_t size)
+{
+	uint32_t value = 0;
+
+	while (size-- > 0)
+		value = (value << 8) | *data++;
+	return value;
+}
+
+static uint32_t mp3_tags_get_le32(uint8_t const* data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint32_t mp3_tags_get_syncsafe(uint8_t const* data)
+{
+	return ((data[0] & 0x7f) << 21) | ((data[1] & 0x7f) << 14) | ((data[2] & 0x7f) << 7) | (data[3] & 0x7f);
+}
+
+/*
+ * Read the given bytes at the given offset of the file: returns the bytes read
+ */
+static uint32_t mp3_tags_read(FIL* file, uint32_t offset, uint8_t* buffer, uint32_t length)
+{
+	unsigned int read_bytes;
+
+	if ((f_lseek(file, offset) != FR_OK) || (f_read(file, buffer, length, &read_bytes) != FR_OK))
+		return 0;
+	return read_bytes;
+}
+
+/*
+ * Remove the zeros which the unsynchronisation inserts after every 0xff: returns the
+ * new length
+ */
+static uint32_t mp3_tags_resynchronise(uint8_t* data, uint32_t length)
+{
+	uint32_t index, size = 0;
+
+	for (index=0; index<length; index++) {
+		if ((index == 0) || (data[index] != 0x00) || (data[index-1] != 0xff))
+			data[size++] = data[index];
+	}
+	return size;
+}
+
+/*
+ * Convert a string to ASCII, up to its terminator or to the given length
+ */
+static void mp3_tags_copy_text(char* text, uint8_t const* data, uint32_t length, uint8_t encoding)
+{
+	uint32_t index = 0, size = 0;
+	uint16_t character;
+	uint8_t is_utf16 = ((encoding == ID3V2_ENCODING_UTF16) || (encoding == ID3V2_ENCODING_UTF16BE));
+	uint8_t is_big_endian = (encoding == ID3V2_ENCODING_UTF16BE);
+
+	if ((encoding == ID3V2_ENCODING_UTF16) && (length >= 2)) {
+		is_big_endian = (data[0] == 0xfe);
+		index = 2;
+	}
+
+	while ((index < length) && (size < (MP3_TAGS_TEXT_SIZE - 1))) {
+		if (is_utf16) {
+			if ((index + 1) >= length)
+				break;
+			character = is_big_endian ? ((data[index] << 8) | data[index+1]) : (data[index] | (data[index+1] << 8));
+			index += 2;
+			// the second half of a surrogate pair doesn't add a character
+			if ((character & 0xfc00) == 0xdc00)
+				continue;
+		} else {
+			character = data[index++];
+			// neither do the continuation bytes of UTF-8
+			if ((encoding == ID3V2_ENCODING_UTF8) && ((character & 0xc0) == 0x80))
+				continue;
+		}
+		if (character == 0)
+			break;
+		text[size++] = ((character >= 0x20) && (character < 0x7f)) ? character : '?';
+	}
+
+	// ID3v1 fields are padded with spaces
+	while ((size > 0) && (text[size-1] == ' '))
+		size--;
+	text[size] = '\0';
+}
+
+/*
+ * Set a field of the metadata, if it's still empty
+ */
+static void mp3_tags_set_field(struct MP3_TAGS* tags, uint8_t field, uint8_t const* data, uint32_t length,
+								uint8_t encoding)
+{
+	char* fields[] = { tags->title, tags->artist, tags->album };
+	char text[MP3_TAGS_TEXT_SIZE];
+	char* digit = text;
+
+	if (field == MP3_TAGS_TRACK) {
+		if (tags->track != 0)
+			return;
+		// "track" or "track/total"
+		mp3_tags_copy_text(text, data, length, encoding);
+		while ((*digit >= '0') && (*digit <= '9'))
+			tags->track = (tags->track * 10) + (*digit++ - '0');
+	} else if (fields[field][0] == '\0') {
+		mp3_tags_copy_text(fields[field], data, length, encoding);
+	}
+}
+
+/*
+ * Field which the given ID3v2 frame holds, or -1
+ */
+static int8_t mp3_tags_get_id3v2_field(uint8_t const* frame_id, uint8_t version)
+{
+	int8_t field;
+
+	for (field=MP3_TAGS_TITLE; field<=MP3_TAGS_TRACK; field++) {
+		if ((version == 2) && (memcmp(frame_id, id3v22_frame_ids[field], 3) == 0))
+			return field;
+		if ((version != 2) && (memcmp(frame_id, id3v2_frame_ids[field], 4) == 0))
+			return field;
+	}
+	return -1;
+}
+
+/*
+ * Read the text frames of the ID3v2 tag at the given offset (whose header is given).
+ * The frames are reached by seeking the file, so that the big ones (pictures) are
+ * never read.
+ */
+static void mp3_tags_parse_id3v2(FIL* file, struct MP3_TAGS* tags, uint32_t offset, uint8_t const* header)
+{
+	uint8_t buffer[MP3_TAGS_BUFFER_SIZE];
+	uint8_t version = header[3];
+	uint8_t header_size = (version == 2) ? ID3V22_FRAME_HEADER_SIZE : ID3V2_FRAME_HEADER_SIZE;
+	uint8_t is_unsynchronised = (header[5] & ID3V2_FLAG_UNSYNCHRONISATION) != 0;
+	uint32_t end = offset + ID3V2_HEADER_SIZE + mp3_tags_get_syncsafe(header + 6);
+	uint32_t position = offset + ID3V2_HEADER_SIZE;
+	uint32_t frame_size, length, skip;
+	uint8_t format_flags;
+	int8_t field;
+
+	if ((version < 2) || (version > 4))
+		return;
+	if ((version > 2) && (header[5] & ID3V2_FLAG_EXTENDED_HEADER)) {
+		if (mp3_tags_read(file, position, buffer, 4) != 4)
+			return;
+		// its size includes the size itself in version 2.4 only
+		frame_size = (version == 4) ? mp3_tags_get_syncsafe(buffer) : (4 + mp3_tags_get_be(buffer, 4));
+		if (frame_size > (end - position))
+			return;
+		position += frame_size;
+	}
+
+	// the sizes are checked against what's left of the tag before moving on, so that a
+	// corrupted one can't make the position wrap around (and the loop never end)
+	while ((end - position) >= header_size) {
+		if (mp3_tags_read(file, position, buffer, header_size) != header_size)
+			return;
+		// the padding after the last frame
+		if (buffer[0] == 0)
+			return;
+
+		skip = 0;
+		format_flags = 0;
+		if (version == 2) {
+			frame_size = mp3_tags_get_be(buffer + 3, 3);
+		} else if (version == 3) {
+			frame_size = mp3_tags_get_be(buffer + 4, 4);
+			format_flags = buffer[9];
+			if (format_flags & (ID3V23_FRAME_COMPRESSION | ID3V23_FRAME_ENCRYPTION))
+				format_flags = 0xff;
+			else if (format_flags & ID3V23_FRAME_GROUPING)
+				skip = 1;
+		} else {
+			frame_size = mp3_tags_get_syncsafe(buffer + 4);
+			format_flags = buffer[9];
+			if (format_flags & (ID3V24_FRAME_COMPRESSION | ID3V24_FRAME_ENCRYPTION))
+				format_flags = 0xff;
+			else
+				skip = ((format_flags & ID3V24_FRAME_GROUPING) ? 1 : 0) + ((format_flags & ID3V24_FRAME_DATA_LENGTH) ? 4 : 0);
+		}
+		if (frame_size > (end - position - header_size))
+			return;
+
+		field = mp3_tags_get_id3v2_field(buffer, version);
+		if ((field >= 0) && (format_flags != 0xff) && (frame_size > (skip + 1))) {
+			length = mp3_tags_read(file, position + header_size + skip, buffer, min(frame_size - skip, MP3_TAGS_BUFFER_SIZE));
+			if (is_unsynchronised || (format_flags & ID3V24_FRAME_UNSYNCHRONISATION))
+				length = mp3_tags_resynchronise(buffer, length);
+			// the first byte is the encoding of the text
+			if (length > 1)
+				mp3_tags_set_field(tags, field, buffer + 1, length - 1, buffer[0]);
+		}
+		position += header_size + frame_size;
+	}
+}
+
+/*
+ * Compare an APE item's key, case-insensitively, to a lowercase one
+ */
+static uint8_t mp3_tags_is_ape_key(char const* key, char const* name)
+{
+	while ((*name != '\0') && ((*key | 0x20) == *name)) {
+		key++;
+		name++;
+	}
+	return (*key == '\0') && (*name == '\0');
+}
+
+/*
+ * Read the text items of the APEv2 tag whose footer is at the given offset
+ */
+static void mp3_tags_parse_ape(FIL* file, struct MP3_TAGS* tags, uint32_t footer_offset)
+{
+	uint8_t buffer[MP3_TAGS_BUFFER_SIZE];
+	uint32_t position, end, value_size, key_length, length;
+	int8_t field;
+
+	if ((mp3_tags_read(file, footer_offset, buffer, APE_FOOTER_SIZE) != APE_FOOTER_SIZE) ||
+			(memcmp(buffer, "APETAGEX", 8) != 0) || (mp3_tags_get_le32(buffer + APE_SIZE_OFFSET) > (footer_offset + APE_FOOTER_SIZE)))
+		return;
+	position = footer_offset + APE_FOOTER_SIZE - mp3_tags_get_le32(buffer + APE_SIZE_OFFSET);
+	end = footer_offset;
+
+	while ((end - position) > APE_ITEM_HEADER_SIZE) {
+		length = mp3_tags_read(file, position, buffer, min(end - position, MP3_TAGS_BUFFER_SIZE - 1));
+		buffer[length] = '\0';
+		value_size = mp3_tags_get_le32(buffer);
+		key_length = strlen((char*)buffer + APE_ITEM_HEADER_SIZE);
+		// the keys don't exceed 255 characters: a longer one can't be skipped with this buffer
+		if ((APE_ITEM_HEADER_SIZE + key_length) >= length)
+			return;
+
+		for (field=MP3_TAGS_TITLE; field<=MP3_TAGS_TRACK; field++) {
+			if (mp3_tags_is_ape_key((char*)buffer + APE_ITEM_HEADER_SIZE, ape_item_keys[field]))
+				break;
+		}
+		position += APE_ITEM_HEADER_SIZE + key_length + 1;
+		// a corrupted size could make the position wrap around
+		if (value_size > (end - position))
+			return;
+		if ((field <= MP3_TAGS_TRACK) && ((mp3_tags_get_le32(buffer + 4) & APE_ITEM_TYPE_MASK) == 0)) {
+			length = mp3_tags_read(file, position, buffer, min(value_size, MP3_TAGS_BUFFER_SIZE));
+			mp3_tags_set_field(tags, field, buffer, length, ID3V2_ENCODING_UTF8);
+		}
+		position += value_size;
+	}
+}
+
+/*******************************************************************/
+/*		PUBLIC FUNCTIONS
+/*******************************************************************/
+/*
+ * Read the metadata of the ID3v2 tags at the beginning of the file (if "tags" is not
+ * NULL) and return their size, which is where the audio starts
+ */
+uint32_t mp3_tags_read_id3v2(FIL* file, struct MP3_TAGS* tags)
+{
+	uint8_t header[ID3V2_HEADER_SIZE];
+	uint32_t offset = 0;
+
+	if (tags != NULL)
+		memset(tags, 0, sizeof(struct MP3_TAGS));
+
+	// a file can have more than one tag (the first one takes precedence)
+	while ((mp3_tags_read(file, offset, header, ID3V2_HEADER_SIZE) == ID3V2_HEADER_SIZE) &&
+			(memcmp(header, "ID3", 3) == 0) && (header[3] != 0xff) && (header[4] != 0xff) &&
+			!((header[6] | header[7] | header[8] | header[9]) & 0x80)) {
+		if (tags != NULL)
+			mp3_tags_parse_id3v2(file, tags, offset, header);
+		offset += ID3V2_HEADER_SIZE + mp3_tags_get_syncsafe(header + 6) +
+					((header[5] & ID3V2_FLAG_FOOTER) ? ID3V2_HEADER_SIZE : 0);
+		debug_msg("ID3v2.%d tag, audio from %u\n", header[3], offset);
+	}
+
+	f_lseek(file, 0);
+	return (offset < f_size(file)) ? offset : 0;
+}
+
+/*
+ * Complete the metadata with the ID3v1 and APEv2 tags at the end of the file
+ */
+void mp3_tags_read_footers(FIL* file, struct MP3_TAGS* tags)
+{
+	uint8_t buffer[ID3V1_SIZE];
+	uint8_t has_id3v1 = (f_size(file) >= ID3V1_SIZE) &&
+						(mp3_tags_read(file, f_size(file) - ID3V1_SIZE, buffer, ID3V1_SIZE) == ID3V1_SIZE) &&
+						(memcmp(buffer, "TAG", 3) == 0);
+	uint32_t footer_offset = f_size(file) - (has_id3v1 ? ID3V1_SIZE : 0);
+
+	// the APEv2 fields first, since the ID3v1 ones are truncated
+	if (footer_offset >= APE_FOOTER_SIZE)
+		mp3_tags_parse_ape(file, tags, footer_offset - APE_FOOTER_SIZE);
+
+	if (has_id3v1) {
+		mp3_tags_set_field(tags, MP3_TAGS_TITLE, buffer + ID3V1_TITLE_OFFSET, ID3V1_FIELD_SIZE, ID3V2_ENCODING_LATIN1);
+		mp3_tags_set_field(tags, MP3_TAGS_ARTIST, buffer + ID3V1_ARTIST_OFFSET, ID3V1_FIELD_SIZE, ID3V2_ENCODING_LATIN1);
+		mp3_tags_set_field(tags, MP3_TAGS_ALBUM, buffer + ID3V1_ALBUM_OFFSET, ID3V1_FIELD_SIZE, ID3V2_ENCODING_LATIN1);
+		if ((buffer[ID3V1_TRACK_OFFSET - 1] == 0) && (tags->track == 0))
+			tags->track = buffer[ID3V1_TRACK_OFFSET];
+	}
+}
+
+/*
+ * Whether all the fields have been found
+ */
+uint8_t mp3_tags_is_complete(struct MP3_TAGS const* tags)
+{
+	return (tags->title[0] != '\0') && (tags->artist[0] != '\0') && (tags->album[0] != '\0') && (tags->track != 0);
+}
@@ -8,6 +8,7 @@
 #include "dabon_logo.h"
 #include "timer.h"
 #include "font-5x7.h"
+#include "kernel.h"
 
 #define debug_msg(format, ...)		debug_printf("[oled] " format, ##__VA_ARGS__)
 
@@ -19,6 +20,12 @@
 static int oled_power_on(void);
 static int oled_power_off(void);
 
+// Boot step: the panel needs some time to settle after being turned on, but its
+// RAM can be written in the meantime, so the logo appears as soon as possible
+#define OLED_POWER_ON_DELAY_MS		100
+ALLOCATE_TASK(oled_boot, KERNEL_BOOT_PRIORITY);
+struct COROUTINE oled_boot_co;
+
 // Commands
 #define SET_DISPLAY_ON											0xAF
 #define SET_DISPLAY_OFF											0xAE
@@ -60,6 +67,15 @@ void oled_init()
 	MODIFY_REG(GPIOD->MODER, GPIO_MODER_MODE9_Msk, (MODER_GENERAL_PURPOSE_OUTPUT << GPIO_MODER_MODE9_Pos) );
 	MODIFY_REG(GPIOD->OSPEEDR, GPIO_MODER_MODE9_Msk, OSPEEDR_50MHZ << GPIO_MODER_MODE9_Pos);
 
+	kernel_boot_add_step(&oled_boot_task);
+}
+
+/*
+ * Reset and power on the display, then draw the logo
+ */
+int32_t oled_boot_task_func()
+{
+	CO_BEGIN(&oled_boot_co);
 	oled_assert_reset();
 	// Keep LCD_RES pin low for at least 3us, then release it
 	timer_wait_us(5);
@@ -70,10 +86,13 @@ void oled_init()
 	// Draw the logo
 	oled_clear_display();
 	oled_draw_image_at_xy(dabon_logo_data, (OLED_WIDTH-dabon_logo_width)/2, 0, dabon_logo_width, dabon_logo_height);
+
+	CO_SLEEP(&oled_boot_co, OLED_POWER_ON_DELAY_MS);
+	CO_END(&oled_boot_co);
 }
 
 /*
- *
+ * Send the power on sequence: the panel is ready after OLED_POWER_ON_DELAY_MS
  */
 static int oled_power_on()
 {
@@ -118,8 +137,6 @@ static int oled_power_on()
 	fsmc_write(FSMC_COMMAND_ADDRESS, 0x40);
 	// turn on oled panel
 	fsmc_write(FSMC_COMMAND_ADDRESS, SET_DISPLAY_ON);
-
-	timer_wait_us(100000);
 }
 
 /*
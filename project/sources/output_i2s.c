@@ -35,7 +35,9 @@ I2S_PLL_CONFIG 	i2s_pll_configurations[] = {
 #define DMA_BUFFERS_SIZE	    (2048)
 audio_sample_t dma_buffers[2][DMA_BUFFERS_SIZE];
 
-// Output (circular) buffer which holds samples before being copied to the DMA ones
+// Output (circular) buffer which holds samples before being copied to the DMA ones.
+// It has a single producer (stop_index) and a single consumer (start_index), which can
+// preempt each other: only "count" is shared and it's updated atomically.
 #define OUTPUT_BUFFER_SIZE      (4096)
 struct {
     audio_sample_t samples[OUTPUT_BUFFER_SIZE];
@@ -44,11 +46,27 @@ struct {
     int16_t count;
 } output_buffer;
 
-// Callback function to signal that the buffer has been freed
+// Callback function to signal that the buffer has been freed (it's called by the
+// real-time refill task, so it must follow the rules in kernel.h)
 void (*free_buff_space_callback)(void);
 
-// Interrupt handling task
-ALLOCATE_TASK(output_i2s, 1);
+// Underruns: DMA buffers which were played again because the idle one had not been
+// refilled in time, while a player was registered
+uint8_t refill_pending;
+uint32_t underruns;
+
+// Dropouts: DMA buffers which were completed with silence because the local buffer
+// had run dry, out of the ones refilled while a player was registered
+uint32_t dropouts;
+uint32_t player_refills;
+
+// Sample rate the PLL is configured for (0 until the first configuration)
+uint32_t current_sample_freq;
+
+// Interrupt handling task. Each DMA buffer lasts 2048 samples (about 21 ms at 96 kHz,
+// the highest supported rate), so the idle one must be refilled within that time: the
+// refill is a real-time task, which no cooperative task can delay.
+ALLOCATE_RT_TASK(output_i2s);
 
 // Macros
 #define I2S3_enable()		do{ SET_BIT(SPI3->I2SCFGR, SPI_I2SCFGR_I2SE);	} while(0)
@@ -64,7 +82,7 @@ int32_t output_i2s_init()
 {
 	int ret_val;
     
-    kernel_init_task(&output_i2s_task);
+    kernel_rt_init_task(&output_i2s_rt_task);
     
     // Configure buffers
     output_buffer.count = 0;
@@ -135,7 +153,8 @@ int32_t output_i2s_init()
 }
 
 /*
- * Configure the PLL
+ * Configure the PLL (nothing is done if the sample rate doesn't change, so that the
+ * I2S is not stopped)
  */
 int32_t output_i2s_ConfigurePLL(uint32_t samplig_freq)
 {
@@ -149,6 +168,8 @@ int32_t output_i2s_ConfigurePLL(uint32_t samplig_freq)
 		debug_msg("Error: PLL configuration not found\n");
 		return -1;
 	}
+	if (samplig_freq == current_sample_freq)
+		return 0;
 	debug_msg("Configuring for %d Hz\n", samplig_freq);
 
 	// Disable the I2S peripheral and also its clock
@@ -178,6 +199,7 @@ int32_t output_i2s_ConfigurePLL(uint32_t samplig_freq)
 	SET_BIT(SPI3->CR2, SPI_CR2_TXDMAEN);
 	// Enable the I2S peripheral
 	I2S3_enable();
+	current_sample_freq = samplig_freq;
 
 	return 0;
 }
@@ -188,7 +210,7 @@ int32_t output_i2s_ConfigurePLL(uint32_t samplig_freq)
 int32_t output_i2s_enqueue_samples(audio_sample_t* data, uint16_t samples_count)
 {
 	// check if there's enough space to store incoming samples
-	if (samples_count > (OUTPUT_BUFFER_SIZE-output_buffer.count))
+	if (samples_count > output_i2s_get_buffer_free_space())
 		return -1;
 
 	uint16_t data_to_copy;
@@ -205,18 +227,58 @@ int32_t output_i2s_enqueue_samples(audio_sample_t* data, uint16_t samples_count)
 			output_buffer.stop_index = 0;
 		samples_count -= data_to_copy;
 		data += data_to_copy;
-		output_buffer.count += data_to_copy;
+		__atomic_fetch_add(&output_buffer.count, data_to_copy, __ATOMIC_RELEASE);
 	}
 
 	return 0;
 }
 
+/*
+ * Return the local buffer, so that a producer can write the samples directly into it
+ * instead of enqueuing them: they go from write_index onwards, wrapping at size, as
+ * long as there's free space, and then they're committed
+ */
+audio_sample_t* output_i2s_get_ring(uint16_t* size, uint16_t* write_index)
+{
+	*size = OUTPUT_BUFFER_SIZE;
+	*write_index = output_buffer.stop_index;
+	return output_buffer.samples;
+}
+
+/*
+ * Hand the samples written into the local buffer over to the DMA
+ */
+void output_i2s_commit_samples(uint16_t samples_count)
+{
+	output_buffer.stop_index = (output_buffer.stop_index + samples_count) % OUTPUT_BUFFER_SIZE;
+	__atomic_fetch_add(&output_buffer.count, samples_count, __ATOMIC_RELEASE);
+}
+
 /*
  * Return the free space of the local buffer
  */
 uint32_t output_i2s_get_buffer_free_space()
 {
-	return (OUTPUT_BUFFER_SIZE - output_buffer.count);
+	return (OUTPUT_BUFFER_SIZE - __atomic_load_n(&output_buffer.count, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Return the samples waiting in the local buffer
+ */
+uint32_t output_i2s_get_buffered_samples()
+{
+	return __atomic_load_n(&output_buffer.count, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Drop the samples waiting in the local buffer (the ones already copied to the DMA
+ * buffers are played anyway). The producer and the refill task must be locked out
+ * (kernel_rt_lock).
+ */
+void output_i2s_flush()
+{
+	output_buffer.start_index = output_buffer.stop_index;
+	__atomic_store_n(&output_buffer.count, 0, __ATOMIC_RELEASE);
 }
 
 /*
@@ -229,6 +291,26 @@ void output_i2s_register_callback(void (*func)(void))
 	free_buff_space_callback = func;
 }
 
+/*
+ * Return how many times the audio was interrupted because a DMA buffer was not refilled
+ * in time while playing
+ */
+uint32_t output_i2s_get_underruns()
+{
+	return underruns;
+}
+
+/*
+ * Return how many DMA buffers were padded with silence while playing, and how many
+ * have been refilled in total
+ */
+uint32_t output_i2s_get_dropouts(uint32_t* refills)
+{
+	if (refills != NULL)
+		*refills = player_refills;
+	return dropouts;
+}
+
 /*********************************************************************************************/
 /*		INTERRUPT HANDLING
 /*********************************************************************************************/
@@ -237,30 +319,39 @@ void output_i2s_register_callback(void (*func)(void))
  */
 void DMA1_Stream7_IRQHandler(void)
 {
+	KERNEL_ISR_ENTER(dma1_stream7);
+
     if (DMA1->HISR & (DMA_HISR_TEIF7 | DMA_HISR_DMEIF7)) {
 		debug_msg("Error in DMA transfer\n");
 	}
 	DMA1->HIFCR = (DMA_HIFCR_CTCIF7 | DMA_HIFCR_CHTIF7 | DMA_HIFCR_CTEIF7 | DMA_HIFCR_CDMEIF7 | DMA_HIFCR_CFEIF7);
 
-    kernel_activate_task_immediately(&output_i2s_task);
+	if (refill_pending && (free_buff_space_callback != NULL))
+		underruns++;
+	refill_pending = TRUE;
+    kernel_rt_activate(&output_i2s_rt_task);
+
+	KERNEL_ISR_EXIT(dma1_stream7);
 }
 
 /*
- * This task copies data from the input buffer to the DMA's ones
+ * This real-time task copies data from the input buffer to the DMA's ones
  */
-int32_t output_i2s_task_func(void* arg)
+void output_i2s_rt_func()
 {
     // Update the data on the buffer which is idle (if playing 1 then update 0 and viceversa)
     audio_sample_t* dma_ptr = (READ_BIT(DMA1_Stream7->CR, DMA_SxCR_CT)) ? dma_buffers[0] : dma_buffers[1];
     uint16_t remaining_dma_space = DMA_BUFFERS_SIZE;
     uint16_t data_to_copy;
+    int16_t available;
     
     while (remaining_dma_space > 0) {
         // Check if there's something valid inside the output_buffer, otherwise fill the remaining
         // space with 0
-        if (output_buffer.count > 0) {
+        available = __atomic_load_n(&output_buffer.count, __ATOMIC_ACQUIRE);
+        if (available > 0) {
         	// compute the amount of data that should be copied
-        	data_to_copy = (output_buffer.count<remaining_dma_space) ? output_buffer.count : remaining_dma_space;
+        	data_to_copy = (available<remaining_dma_space) ? available : remaining_dma_space;
         	// check if the copy can be performed with a single operation or in multiple steps
         	if (output_buffer.start_index + data_to_copy <= OUTPUT_BUFFER_SIZE) {
         		// do not limit data_to_copy in this case
@@ -273,18 +364,19 @@ int32_t output_i2s_task_func(void* arg)
         	if (output_buffer.start_index >= OUTPUT_BUFFER_SIZE)
 				output_buffer.start_index = 0;
         	dma_ptr += data_to_copy;
-        	output_buffer.count -= data_to_copy;
+        	__atomic_fetch_sub(&output_buffer.count, data_to_copy, __ATOMIC_RELEASE);
         	remaining_dma_space -= data_to_copy;
         } else {
-			if (remaining_dma_space > DMA_BUFFERS_SIZE)
-				debug_msg("this is goind to fail\n");
             memset(dma_ptr, 0, remaining_dma_space*sizeof(audio_sample_t));
+            if (free_buff_space_callback != NULL)
+                dropouts++;
             remaining_dma_space = 0;
         }
     }
 
-	if (free_buff_space_callback != NULL)
+	refill_pending = FALSE;
+	if (free_buff_space_callback != NULL) {
+		player_refills++;
 		(*free_buff_space_callback)();
-
-    return WAIT_FOR_RESUME;
+	}
 }
@@ -239,6 +239,7 @@ __attribute__((interrupt)) void DMA2_Stream3_IRQHandler()
  */
 __attribute__((interrupt)) void SDIO_IRQHandler()
 {
+	KERNEL_ISR_ENTER(sdio);
 	uint32_t errorstate = SD_ERROR_NONE;
 	
 	/* Check for SDIO interrupt flags */
@@ -275,6 +276,8 @@ __attribute__((interrupt)) void SDIO_IRQHandler()
 	}
 	SD_CLEAR_FLAG(SDIO_STATIC_FLAGS);
 	SD_DISABLE_IT(SDIO_IT_DATAEND | SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | SDIO_IT_TXUNDERR | SDIO_IT_RXOVERR);
+
+	KERNEL_ISR_EXIT(sdio);
 }
 
 /*
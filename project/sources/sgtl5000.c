@@ -5,11 +5,17 @@
 #include "utils.h"
 #include "systick.h"
 #include "stdlib.h"
+#include "kernel.h"
 
 #define debug_msg(format, ...)		debug_printf("[sgtl5000] " format, ##__VA_ARGS__)
 
 #define SGTL5000_I2C_ADDRESS		0x0A
 
+// Boot step: the configuration follows the power up after some time
+#define SGTL5000_POWER_UP_DELAY_MS		10
+ALLOCATE_TASK(sgtl5000_boot, KERNEL_BOOT_PRIORITY);
+struct COROUTINE sgtl5000_boot_co;
+
 /*
  * Registers addresses
  */
@@ -394,7 +400,8 @@
 #define SGTL5000_SYSCLK				0x00
 #define SGTL5000_LRCLK	0x01
 
-uint16_t current_sample_rate;
+// Sample rate the clocks are configured for (0 until the first configuration)
+uint32_t current_sample_rate;
 
 /****************************************************************/
 /*      PRIVATE FUNCTIONS
@@ -580,28 +587,39 @@ Exit:
 /*      PUBLIC FUNCTIONS
 /****************************************************************/
 /*
- * Configure MCLK to 256*Fs and the user selected sample rate
+ * Configure MCLK to 256*Fs and the user selected sample rate (one of the system rates:
+ * the low power playback repeats the samples instead of lowering it).
+ * Nothing is done if the rate is already the configured one.
  */
 int32_t sgtl5000_config_clocks(uint32_t sample_rate)
 {	
+	uint16_t sys_fs;
+	int32_t ret_val;
+	
+	if (sample_rate == current_sample_rate)
+		return 0;
 	debug_msg("Trying to set samplerate %d Hz\n", sample_rate);
 	switch (sample_rate) {
 		case 32000:
-			return sgtl5000_modify_reg(SGTL5000_CHIP_CLK_CTRL, SGTL5000_SYS_FS_MASK | SGTL5000_MCLK_FREQ_MASK,
-										(SGTL5000_SYS_FS_32k << SGTL5000_SYS_FS_SHIFT) | SGTL5000_MCLK_FREQ_256FS);
+			sys_fs = SGTL5000_SYS_FS_32k;
+			break;
 		case 44100:
-			return sgtl5000_modify_reg(SGTL5000_CHIP_CLK_CTRL, SGTL5000_SYS_FS_MASK | SGTL5000_MCLK_FREQ_MASK,
-										(SGTL5000_SYS_FS_44_1k << SGTL5000_SYS_FS_SHIFT) | SGTL5000_MCLK_FREQ_256FS);
+			sys_fs = SGTL5000_SYS_FS_44_1k;
+			break;
 		case 48000:
-			return sgtl5000_modify_reg(SGTL5000_CHIP_CLK_CTRL, SGTL5000_SYS_FS_MASK | SGTL5000_MCLK_FREQ_MASK,
-										(SGTL5000_SYS_FS_48k << SGTL5000_SYS_FS_SHIFT) | SGTL5000_MCLK_FREQ_256FS);
+			sys_fs = SGTL5000_SYS_FS_48k;
+			break;
 		case 96000:
-			return sgtl5000_modify_reg(SGTL5000_CHIP_CLK_CTRL, SGTL5000_SYS_FS_MASK | SGTL5000_MCLK_FREQ_MASK,
-										(SGTL5000_SYS_FS_96k << SGTL5000_SYS_FS_SHIFT) | SGTL5000_MCLK_FREQ_256FS);
+			sys_fs = SGTL5000_SYS_FS_96k;
+			break;
 		default:
 			debug_msg("Wrong sample rate %d\n", sample_rate);
 			return -1;
 	}
+	ret_val = sgtl5000_modify_reg(SGTL5000_CHIP_CLK_CTRL, SGTL5000_SYS_FS_MASK | SGTL5000_MCLK_FREQ_MASK,
+								(sys_fs << SGTL5000_SYS_FS_SHIFT) | SGTL5000_MCLK_FREQ_256FS);
+	current_sample_rate = (ret_val == 0) ? sample_rate : 0;
+	return ret_val;
 }
 
 /*
@@ -698,18 +716,12 @@ int32_t sgtl5000_get_hp_out_volume(int16_t* value)
 }
 
 /*
- * Initialize the codec
+ * Configure the codec once it has been powered up
  */
-int32_t sgtl5000_init()
+static int32_t sgtl5000_configure()
 {
 	int32_t ret_val = 0;
-	current_sample_rate = 0;
-	
-	ret_val = sgtl5000_power_up();
-	if (ret_val != 0)
-		return ret_val;
-	// wait some time
-	systick_wait_for_ms(10);
+
 	// Configure the sample frequency
 	ret_val = output_i2s_ConfigurePLL(44100);
 	if (ret_val != 0)
@@ -738,6 +750,31 @@ int32_t sgtl5000_init()
 	return ret_val;
 }
 
+/*
+ * Initialize the codec: this is completed by its boot step
+ */
+int32_t sgtl5000_init()
+{
+	current_sample_rate = 0;
+	kernel_boot_add_step(&sgtl5000_boot_task);
+	return 0;
+}
+
+/*
+ * Power up the codec and configure it after some time
+ */
+int32_t sgtl5000_boot_task_func()
+{
+	CO_BEGIN(&sgtl5000_boot_co);
+	if (sgtl5000_power_up() != 0)
+		CO_EXIT(&sgtl5000_boot_co);
+	// wait some time
+	CO_SLEEP(&sgtl5000_boot_co, SGTL5000_POWER_UP_DELAY_MS);
+	if (sgtl5000_configure() != 0)
+		debug_msg("Error in: %s\n", __func__);
+	CO_END(&sgtl5000_boot_co);
+}
+
 /*
  * Dump all the registers for debug
  */
@@ -9,6 +9,11 @@
 #include "eeprom.h"
 #include "kernel.h"
 #include "uart.h"
+#include "mp3_player.h"
+#include "mp3_index.h"
+#ifdef HOST_BUILD
+#include "host.h"
+#endif
 
 #define debug_msg(format, ...)		debug_printf("[shell] " format, ##__VA_ARGS__)
 
@@ -18,8 +23,8 @@ uint8_t command_buffer[COMMAND_LINE_MAX_LENGTH];
 uint16_t cmd_buff_pos = 0;
 
 
-ALLOCATE_TASK(shell, 200);
-#define SHELL_TASK_INTERVAL     100
+// Command lines are processed by a timer which is fired when the new line char is received
+ALLOCATE_TIMER(shell);
 static int shell_list_commands(int argc, char *argv[]);
 
 typedef struct {
@@ -30,6 +35,23 @@ typedef struct {
 SINGLE_SHELL_CMD shell_cmd_list[] = {
     {"list_cmds", shell_list_commands},
     {"systick_gettime", systick_gettime},
+    {"idle_stats", systick_idle_stats},
+    {"top", kernel_top},
+    {"watchdog", kernel_watchdog},
+    {"deadline", kernel_deadline},
+    {"stall", kernel_stall},
+    {"mp3_bench", mp3_player_benchmark},
+    {"mp3_bench_file", mp3_player_benchmark_file},
+    {"mp3_low_power", mp3_player_low_power},
+    {"mp3_seek", mp3_player_seek_command},
+    {"mp3_decoder", mp3_decoder_command},
+    {"mp3_index", mp3_index_benchmark},
+#ifdef HOST_BUILD
+    {"sched_bench", host_sched_bench},
+    {"isr_stress", host_isr_stress},
+    {"key_stats", host_key_stats},
+    {"ui_load", host_ui_load},
+#endif
     {"reset", reset},
     {"set_hp_out_volume", set_hp_out_volume},
     {"sgtl5000_dump_registers", sgtl5000_dump_registers},
@@ -53,8 +75,6 @@ SINGLE_SHELL_CMD shell_cmd_list[] = {
  */
 void shell_init()
 {
-	kernel_init_task(&shell_task);
-
 }
 
 /*
@@ -117,7 +137,7 @@ void shell_add_char(uint8_t input_char)
     	// Process the command
 		uart_put_char('\n');
 		uart_put_char('\r');
-		kernel_activate_task_immediately(&shell_task);
+		kernel_timer_fire_from_isr(&shell_timer);
     } else if (input_char == '\b') {
     	// Clear a char from the command line
     	if (cmd_buff_pos > 0) {
@@ -153,12 +173,10 @@ static int shell_list_commands(int argc, char *argv[])
 }
 
 /*
- * This is called by the main loop. Its main purpose is to process the
+ * This is called by the timers task. Its main purpose is to process the
  * command line once the new_line char is received
  */
-int32_t shell_task_func(void* arg)
+void shell_timer_func()
 {
     shell_process_cmd_line();
-
-    return WAIT_FOR_RESUME;
 }
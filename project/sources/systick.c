@@ -2,17 +2,30 @@
 #include "stm32f407xx.h"
 #include "debug_printf.h"
 #include "core_cm4.h"
+#include "utils.h"
 
 #define debug_msg(format, ...)		debug_printf("[systick] " format, ##__VA_ARGS__)
 
 uint32_t curr_tick;
 
+// SysTick runs from the 168MHz core clock and generates one tick every 1ms
+#define SYSTICK_CYCLES_PER_TICK		168000UL
+
+// Idle statistics (the ones used for the shell report are sampled at every call)
+struct {
+	uint64_t idle_cycles;
+	uint32_t wakeups;
+	uint64_t last_report_idle_cycles;
+	uint32_t last_report_wakeups;
+	uint32_t last_report_tick;
+} idle_stats;
+
 /*
  *	Initialize the SysTick timer
  */
 void systick_initialize()
 {
-	SysTick_Config(168000U);
+	SysTick_Config(SYSTICK_CYCLES_PER_TICK);
 	NVIC_EnableIRQ(SysTick_IRQn);
 }
 
@@ -33,6 +46,75 @@ void systick_wait_for_ms(uint32_t delay)
 	while((curr_tick - start_tick) < delay);
 }
 
+/*
+ *	Put the core in sleep (WFI) for up to "ticks" milliseconds or until an interrupt
+ *	occurs. If more than one tick should be skipped then the SysTick's reload value
+ *	is stretched, so that the core is not woken up every millisecond just to
+ *	increment the tick counter, and "curr_tick" is corrected on wake-up.
+ *	Note: it must be called with interrupts disabled (PRIMASK set) so that the
+ *	pending ISR, which woke up the core, is only served once the tick count has
+ *	been fixed.
+ */
+void systick_sleep_for_ticks(uint32_t ticks)
+{
+	uint32_t start_value, elapsed_cycles, reload_value, ctrl_value;
+
+	if (ticks == 0)
+		return;
+	if (ticks > SYSTICK_MAX_IDLE_TICKS)
+		ticks = SYSTICK_MAX_IDLE_TICKS;
+
+	if (ticks == 1) {
+		// The next regular tick is enough to wake the core up. Reading CTRL clears
+		// the COUNTFLAG so that it only tells if the tick expired during the sleep.
+		(void)SysTick->CTRL;
+		start_value = SysTick->VAL;
+		__DSB();
+		__WFI();
+		__ISB();
+		if (READ_BIT(SysTick->CTRL, SysTick_CTRL_COUNTFLAG_Msk)) {
+			elapsed_cycles = start_value + (SYSTICK_CYCLES_PER_TICK - SysTick->VAL);
+		} else {
+			elapsed_cycles = start_value - SysTick->VAL;
+		}
+	} else {
+		// Stop the SysTick and make it expire after the remaining part of the current
+		// tick plus "ticks-1" full ticks
+		CLEAR_BIT(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+		start_value = SysTick->VAL;
+		reload_value = start_value + ((ticks - 1) * SYSTICK_CYCLES_PER_TICK);
+		SysTick->LOAD = reload_value;
+		SysTick->VAL = 0;
+		SET_BIT(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+
+		__DSB();
+		__WFI();
+		__ISB();
+
+		// Note: COUNTFLAG is cleared on read, so CTRL must be read only once here
+		ctrl_value = SysTick->CTRL;
+		SysTick->CTRL = ctrl_value & ~SysTick_CTRL_ENABLE_Msk;
+		if (READ_BIT(ctrl_value, SysTick_CTRL_COUNTFLAG_Msk)) {
+			// The whole period expired: the pending SysTick ISR will account for the last tick
+			elapsed_cycles = reload_value;
+			curr_tick += ticks - 1;
+			SysTick->LOAD = SYSTICK_CYCLES_PER_TICK - 1;
+		} else {
+			// Another interrupt woke the core up: account for the completed ticks and
+			// keep the phase of the current one
+			elapsed_cycles = reload_value - SysTick->VAL;
+			curr_tick += elapsed_cycles / SYSTICK_CYCLES_PER_TICK;
+			SysTick->LOAD = SYSTICK_CYCLES_PER_TICK - (elapsed_cycles % SYSTICK_CYCLES_PER_TICK);
+		}
+		SysTick->VAL = 0;
+		SET_BIT(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+		SysTick->LOAD = SYSTICK_CYCLES_PER_TICK - 1;
+	}
+
+	idle_stats.idle_cycles += elapsed_cycles;
+	idle_stats.wakeups++;
+}
+
 /*
  * 	ISR() for SysTick overflow
  */
@@ -48,3 +130,28 @@ int systick_gettime(int argc, char *argv[])
 {
 	debug_msg("Current time = %d\n", systick_get_tick_count());
 }
+
+/*
+ * Shell command which reports the idle percentage and the number of wake-ups per
+ * second since its previous call
+ */
+int systick_idle_stats(int argc, char *argv[])
+{
+	uint32_t elapsed_ms = curr_tick - idle_stats.last_report_tick;
+	uint32_t idle_ms = (uint32_t)((idle_stats.idle_cycles - idle_stats.last_report_idle_cycles) / SYSTICK_CYCLES_PER_TICK);
+	uint32_t wakeups = idle_stats.wakeups - idle_stats.last_report_wakeups;
+
+	if (elapsed_ms == 0) {
+		debug_msg("No time elapsed since the last report\n");
+		return -1;
+	}
+
+	debug_msg("Idle = %d%% (%d ms over %d ms)\n", (idle_ms * 100) / elapsed_ms, idle_ms, elapsed_ms);
+	debug_msg("Wake-ups = %d/s\n", (uint32_t)(((uint64_t)wakeups * 1000) / elapsed_ms));
+
+	idle_stats.last_report_tick = curr_tick;
+	idle_stats.last_report_idle_cycles = idle_stats.idle_cycles;
+	idle_stats.last_report_wakeups = idle_stats.wakeups;
+
+	return 0;
+}
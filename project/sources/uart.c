@@ -3,6 +3,7 @@
 #include "clock_configuration.h"
 #include "gpio.h"
 #include "shell.h"
+#include "kernel.h"
 
 // Constants
 #define ESC_ASCII_CODE		0x1B
@@ -87,7 +88,9 @@ int uart_put_char(uint8_t c)
  */
 void USART2_IRQHandler()
 {
+	KERNEL_ISR_ENTER(usart2);
     shell_add_char(USART2->DR);
+	KERNEL_ISR_EXIT(usart2);
 }
 
 
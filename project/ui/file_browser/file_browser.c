@@ -13,7 +13,10 @@
 
 ALLOCATE_TASK(file_browser, 200);
 
-uint8_t received_key;
+// Key events received from the buttons' task
+#define FILE_BROWSER_KEYS_CAPACITY		8
+ALLOCATE_MAILBOX(file_browser_keys, struct KEY_EVENT, FILE_BROWSER_KEYS_CAPACITY);
+
 int16_t first_shown_item;
 int16_t selected_item;
 
@@ -23,21 +26,7 @@ int16_t selected_item;
 void file_browser_init()
 {
 	kernel_init_task(&file_browser_task);
-}
-
-/*
- * Callback function for key events
- */
-void file_browser_key_event(uint8_t key, uint8_t event)
-{
-	debug_msg("key %d - event %d\n", key, event);
-
-	// Ignore release events
-	if (event == KEY_RELEASED)
-		return;
-
-	received_key = key;
-	kernel_activate_task_immediately(&file_browser_task);
+	kernel_mailbox_set_receiver(&file_browser_keys_mailbox, &file_browser_task);
 }
 
 /*
@@ -90,7 +79,7 @@ static void file_browser_update_shown_files()
 static void file_browser_stop()
 {
 	f_mount(0, "", 0);	// unmount the registered file system
-	buttons_remove_key_event_callback();
+	buttons_remove_key_event_mailbox();
 	main_menu_start();
 }
 
@@ -99,7 +88,8 @@ static void file_browser_stop()
  */
 void file_browser_start()
 {
-	buttons_register_key_event_callback(&file_browser_key_event);
+	kernel_mailbox_flush(&file_browser_keys_mailbox);
+	buttons_register_key_event_mailbox(&file_browser_keys_mailbox, KEY_EVENTS_PRESS_ONLY);
 	kernel_activate_task_immediately(&file_browser_task);
 
 	if (file_manager_mount_disk() < 0) {
@@ -108,7 +98,6 @@ void file_browser_start()
 	}
 
 	file_browser_update_shown_files();
-	received_key = KEY_NONE;
 }
 
 /*
@@ -116,11 +105,11 @@ void file_browser_start()
  */
 void file_browser_resume()
 {
-	buttons_register_key_event_callback(&file_browser_key_event);
+	kernel_mailbox_flush(&file_browser_keys_mailbox);
+	buttons_register_key_event_mailbox(&file_browser_keys_mailbox, KEY_EVENTS_PRESS_ONLY);
 	kernel_activate_task_immediately(&file_browser_task);
 	
 	file_browser_update_shown_files();
-	received_key = KEY_NONE;
 }
 
 /*
@@ -128,62 +117,65 @@ void file_browser_resume()
  */
 int32_t file_browser_task_func()
 {
-	// Process key
-	if (received_key == KEY_DOWN) {
-		if ((selected_item < file_manager_get_item_count()-1)) {
-			selected_item += 1;
-		}
-		if ((selected_item - first_shown_item) >= MAX_SHOWN_ITEMS) {
-			first_shown_item = selected_item - MAX_SHOWN_ITEMS + 1;
-		}
-		file_browser_update_shown_files();
-	} else if (received_key == KEY_UP) {
-		if (selected_item > 0) {
-			selected_item -= 1;
-		}
-		if (selected_item < first_shown_item) {
-			first_shown_item = selected_item;
-		}
-		file_browser_update_shown_files();
-	} else if (received_key == KEY_OK) {
-		if (file_manager_is_item_a_dir(selected_item)) {
-			// enter into the directory
-			file_manager_enter_into_folder(file_manager_get_item_name(selected_item));
-			if (file_manager_get_item_count() > 0) {
-				first_shown_item = 0;
-				selected_item = 0;
-			} else {
-				first_shown_item = -1;
-				selected_item = -1;
+	struct KEY_EVENT key_event;
+
+	// Process all the received keys
+	while (kernel_mailbox_receive(&file_browser_keys_mailbox, &key_event) == 0) {
+		debug_msg("key %d - event %d\n", key_event.key, key_event.event);
+		if (key_event.key == KEY_DOWN) {
+			if ((selected_item < file_manager_get_item_count()-1)) {
+				selected_item += 1;
+			}
+			if ((selected_item - first_shown_item) >= MAX_SHOWN_ITEMS) {
+				first_shown_item = selected_item - MAX_SHOWN_ITEMS + 1;
 			}
 			file_browser_update_shown_files();
-		} else {
-			// play file
-			buttons_remove_key_event_callback();
-			music_player_start(selected_item);
-			return DIE;
-		}
-	} else if (received_key == KEY_CANCEL) {
-		// If we're already on the root folder, then return to the global interface, otherwise return
-		// to the above folder
-		if (file_manager_is_at_root()) {
-			file_browser_stop();
-			return DIE;
-		} else {
-			file_manager_exit_from_folder();
-			if (file_manager_get_item_count() > 0) {
-				first_shown_item = 0;
-				selected_item = 0;
-			} else {
-				first_shown_item = -1;
-				selected_item = -1;
+		} else if (key_event.key == KEY_UP) {
+			if (selected_item > 0) {
+				selected_item -= 1;
+			}
+			if (selected_item < first_shown_item) {
+				first_shown_item = selected_item;
 			}
 			file_browser_update_shown_files();
+		} else if (key_event.key == KEY_OK) {
+			if (file_manager_is_item_a_dir(selected_item)) {
+				// enter into the directory
+				file_manager_enter_into_folder(file_manager_get_item_name(selected_item));
+				if (file_manager_get_item_count() > 0) {
+					first_shown_item = 0;
+					selected_item = 0;
+				} else {
+					first_shown_item = -1;
+					selected_item = -1;
+				}
+				file_browser_update_shown_files();
+			} else {
+				// play file
+				buttons_remove_key_event_mailbox();
+				music_player_start(selected_item);
+				return DIE;
+			}
+		} else if (key_event.key == KEY_CANCEL) {
+			// If we're already on the root folder, then return to the global interface, otherwise return
+			// to the above folder
+			if (file_manager_is_at_root()) {
+				file_browser_stop();
+				return DIE;
+			} else {
+				file_manager_exit_from_folder();
+				if (file_manager_get_item_count() > 0) {
+					first_shown_item = 0;
+					selected_item = 0;
+				} else {
+					first_shown_item = -1;
+					selected_item = -1;
+				}
+				file_browser_update_shown_files();
+			}
 		}
 	}
 
-	received_key = KEY_NONE;
-
 	return WAIT_FOR_RESUME;
 }
 
@@ -15,6 +15,10 @@ ALLOCATE_TASK(main_menu, 200);
 
 uint8_t current_item = 0;
 
+// The logo drawn at boot is kept at least until this time since the reset
+#define MAIN_MENU_SPLASH_MS		500
+uint8_t is_menu_shown = FALSE;
+
 void FmRadioClick(void);
 void DabRadioClick(void);
 void SdCardClick(void);
@@ -30,22 +34,9 @@ static MENU_ITEM menu_items[] = {
 		{sd_card_icon_data, SdCardClick},
 };
 
-uint8_t received_key;
-
-/*
- * Callback function for key events
- */
-void main_menu_key_event(uint8_t key, uint8_t event)
-{
-	debug_msg("key %d - event %d\n", key, event);
-
-	// Ignore release events
-	if (event == KEY_RELEASED)
-		return;
-
-	received_key = key;
-	kernel_activate_task_immediately(&main_menu_task);
-}
+// Key events received from the buttons' task
+#define MAIN_MENU_KEYS_CAPACITY		8
+ALLOCATE_MAILBOX(main_menu_keys, struct KEY_EVENT, MAIN_MENU_KEYS_CAPACITY);
 
 /*
  * Initialization function for the main menu
@@ -53,8 +44,9 @@ void main_menu_key_event(uint8_t key, uint8_t event)
 void main_menu_init()
 {
 	kernel_init_task(&main_menu_task);
-	kernel_activate_task_after_ms(&main_menu_task, 2000);
-	buttons_register_key_event_callback(&main_menu_key_event);
+	kernel_mailbox_set_receiver(&main_menu_keys_mailbox, &main_menu_task);
+	kernel_boot_set_completion_task(&main_menu_task);
+	buttons_register_key_event_mailbox(&main_menu_keys_mailbox, KEY_EVENTS_PRESS_ONLY);
 }
 
 /*
@@ -62,8 +54,9 @@ void main_menu_init()
  */
 void main_menu_start()
 {
+	kernel_mailbox_flush(&main_menu_keys_mailbox);
 	kernel_activate_task_immediately(&main_menu_task);
-	buttons_register_key_event_callback(&main_menu_key_event);
+	buttons_register_key_event_mailbox(&main_menu_keys_mailbox, KEY_EVENTS_PRESS_ONLY);
 }
 
 /*
@@ -71,17 +64,32 @@ void main_menu_start()
  */
 int32_t main_menu_task_func()
 {
-	// Process key
-	if ((received_key == KEY_LEFT) || (received_key == KEY_RIGHT)) {
-		if (received_key == KEY_LEFT) {
+	struct KEY_EVENT key_event;
+	uint32_t current_tick_count;
+
+	// The first time wait for the boot to complete and leave the logo on the screen
+	if (!is_menu_shown) {
+		if (!kernel_boot_is_completed())
+			return WAIT_FOR_RESUME;
+		current_tick_count = systick_get_tick_count();
+		if (!kernel_is_tick_reached(current_tick_count, MAIN_MENU_SPLASH_MS))
+			return (int32_t)(MAIN_MENU_SPLASH_MS - current_tick_count);
+		is_menu_shown = TRUE;
+		debug_msg("shown %d ms after the reset\n", current_tick_count);
+	}
+
+	// Process all the received keys
+	while (kernel_mailbox_receive(&main_menu_keys_mailbox, &key_event) == 0) {
+		debug_msg("key %d - event %d\n", key_event.key, key_event.event);
+		if (key_event.key == KEY_LEFT) {
 			current_item = (current_item == 0) ? (array_size(menu_items)-1) : current_item-1;
-		} else { // KEY_RIGHT
+		} else if (key_event.key == KEY_RIGHT) {
 			current_item = (current_item == (array_size(menu_items)-1)) ? 0 : current_item+1;
+		} else if (key_event.key == KEY_OK) {
+			buttons_remove_key_event_mailbox();
+			menu_items[current_item].onClick();
+			return DIE;
 		}
-	} else if (received_key == KEY_OK) {
-		buttons_remove_key_event_callback();
-		menu_items[current_item].onClick();
-		return DIE;
 	}
 
 	oled_clear_display();
@@ -8,55 +8,127 @@
 #include "string.h"
 #include "mp3_player.h"
 #include "file_manager.h"
+#include "utils.h"
 
 #define debug_msg(format, ...)		debug_printf("[music_player] " format, ##__VA_ARGS__)
 
 ALLOCATE_TASK(music_player, 200);
 
-uint8_t received_key;
+// Key events received from the buttons' task
+#define MUSIC_PLAYER_KEYS_CAPACITY		8
+ALLOCATE_MAILBOX(music_player_keys, struct KEY_EVENT, MUSIC_PLAYER_KEYS_CAPACITY);
+
 uint16_t current_file_index;
 
 char local_path[MAX_PATH_LENGTH] = "";
 
+// File of the folder queued to follow the current one, and whether it has started
+uint16_t next_file_index;
+char next_path[MAX_PATH_LENGTH] = "";
+uint8_t is_track_changed;
+
+// Time skipped by KEY_UP (forward) and KEY_DOWN (backward)
+#define MUSIC_PLAYER_SEEK_STEP_MS		10000
+
+// Title, artist and album
+#define TAGS_LINE				2
+
+// Low power modes selected by KEY_RIGHT, in turn
+#define LOW_POWER_LINE			(OLED_MAX_NUMBER_OF_TEXT_LINES-1)
+static char* const low_power_labels[] = {
+		"Full rate      ",
+		"Low power: 1/2 ",
+		"Low power: 1/4 ",
+};
+
 /*
  * Initialization function for the module
  */
 void music_player_init()
 {
 	kernel_init_task(&music_player_task);
+	kernel_mailbox_set_receiver(&music_player_keys_mailbox, &music_player_task);
 }
 
 /*
- * Callback function for key events
+ * Concatenate the current folder's path to the file (of the given index) that should
+ * be played
  */
-void music_player_key_event(uint8_t key, uint8_t event)
+static int32_t music_player_prepare_path_for_playback(char* path, uint16_t file_index)
 {
-	debug_msg("key %d - event %d\n", key, event);
+	memset(path, '\0', MAX_PATH_LENGTH);
+	strncpy(path, file_manager_get_curr_path_pointer(), MAX_PATH_LENGTH);
+	uint16_t path_len = strlen(path);
+	if (path[path_len] != '/') {
+		path[path_len] = '/';
+		path_len ++;
+	}
+	uint16_t remaining_space = MAX_PATH_LENGTH - path_len;
+	strncpy(&path[path_len], file_manager_get_item_name(file_index), remaining_space);
+
+	return 0;
+}
 
-	// Ignore release events
-	if (event == KEY_RELEASED)
+/*
+ * Queue the file which follows the current one in the folder, if any, so that it's
+ * played without any gap
+ */
+static void music_player_queue_next_file()
+{
+	next_file_index = current_file_index + 1;
+	while ((next_file_index < file_manager_get_item_count()) && file_manager_is_item_a_dir(next_file_index))
+		next_file_index++;
+	if (next_file_index >= file_manager_get_item_count())
 		return;
+	
+	if (music_player_prepare_path_for_playback(next_path, next_file_index) >= 0)
+		mp3_player_queue(next_path);
+}
 
-	received_key = key;
+/*
+ * Called by the mp3 player when the queued file starts
+ */
+static void music_player_track_changed()
+{
+	is_track_changed = TRUE;
 	kernel_activate_task_immediately(&music_player_task);
 }
 
 /*
- * Concatenate the current folder's path to the file that should be played
+ * Show the low power mode on the last line
  */
-static int32_t music_player_prepare_path_for_playback()
+static void music_player_show_low_power()
 {
-	memset(local_path, '\0', sizeof(local_path));
-	strncpy(local_path, file_manager_get_curr_path_pointer(), MAX_PATH_LENGTH);
-	uint16_t local_path_len = strlen(local_path);
-	if (local_path[local_path_len] != '/') {
-		local_path[local_path_len] = '/';
-		local_path_len ++;
-	}
-	uint16_t remaining_space = MAX_PATH_LENGTH - local_path_len;
-	strncpy(&local_path[local_path_len], file_manager_get_item_name(current_file_index), remaining_space);
+	oled_print_text_at_xy(low_power_labels[mp3_player_get_low_power()], 0, LOW_POWER_LINE);
+}
 
-	return 0;
+/*
+ * Show the metadata of the file, if any, below its path
+ */
+static void music_player_show_tags()
+{
+	struct MP3_TAGS const* tags = mp3_player_get_tags();
+	
+	if (tags == NULL)
+		return;
+	if (tags->title[0] != '\0')
+		oled_print_text_at_xy((char*)tags->title, 0, TAGS_LINE);
+	if (tags->artist[0] != '\0')
+		oled_print_text_at_xy((char*)tags->artist, 0, TAGS_LINE + 1);
+	if (tags->album[0] != '\0')
+		oled_print_text_at_xy((char*)tags->album, 0, TAGS_LINE + 2);
+	debug_msg("track %d: %s - %s (%s)\n", tags->track, tags->artist, tags->title, tags->album);
+}
+
+/*
+ * Show the file which is being played
+ */
+static void music_player_show_track()
+{
+	oled_clear_display();
+	oled_print_text_at_xy(local_path, 0, 0);
+	music_player_show_tags();
+	music_player_show_low_power();
 }
 
 /*
@@ -64,19 +136,23 @@ static int32_t music_player_prepare_path_for_playback()
  */
 void music_player_start(uint16_t file_index)
 {
-	buttons_register_key_event_callback(&music_player_key_event);
+	// the task can be started without having been initialized
+	kernel_mailbox_set_receiver(&music_player_keys_mailbox, &music_player_task);
+	kernel_mailbox_flush(&music_player_keys_mailbox);
+	buttons_register_key_event_mailbox(&music_player_keys_mailbox, KEY_EVENTS_PRESS_ONLY);
 	kernel_activate_task_immediately(&music_player_task);
 
 	current_file_index = file_index;
+	is_track_changed = FALSE;
 
 	oled_clear_display();
 	
-	received_key = KEY_NONE;
-	
-	if (music_player_prepare_path_for_playback() >= 0) {
+	if (music_player_prepare_path_for_playback(local_path, current_file_index) >= 0) {
 		debug_msg("starting playback\n");
-		oled_print_text_at_xy(local_path, 0, 0);
 		mp3_player_play(local_path);
+		mp3_player_register_callback(music_player_track_changed);
+		music_player_queue_next_file();
+		music_player_show_track();
 	} else {
 		oled_print_text_at_xy("Error!", 0, 0);
 		debug_msg("error creating playback path\n");
@@ -88,9 +164,23 @@ void music_player_start(uint16_t file_index)
  */
 int32_t music_player_task_func()
 {
-	// Process key
-	if (received_key != KEY_NONE) {
-		if (received_key == KEY_OK) {
+	struct KEY_EVENT key_event;
+	uint32_t position_ms;
+
+	// The queued file has started: queue the following one
+	if (is_track_changed) {
+		is_track_changed = FALSE;
+		current_file_index = next_file_index;
+		strncpy(local_path, next_path, MAX_PATH_LENGTH);
+		debug_msg("playing the next file\n");
+		music_player_show_track();
+		music_player_queue_next_file();
+	}
+
+	// Process all the received keys
+	while (kernel_mailbox_receive(&music_player_keys_mailbox, &key_event) == 0) {
+		debug_msg("key %d - event %d\n", key_event.key, key_event.event);
+		if (key_event.key == KEY_OK) {
 			// If the music is stopped then start it
 			if (mp3_player_get_status() == MP3_PLAYER_PAUSED) {
 				debug_msg("resuming playback\n");
@@ -99,13 +189,29 @@ int32_t music_player_task_func()
 				debug_msg("playback paused\n");
 				mp3_player_pause();
 			}
-		} else if (received_key == KEY_CANCEL) {
+		} else if (key_event.key == KEY_RIGHT) {
+			// Switch to the next low power mode
+			mp3_player_set_low_power((mp3_player_get_low_power() + 1) % array_size(low_power_labels));
+			debug_msg("low power mode %d\n", mp3_player_get_low_power());
+			music_player_show_low_power();
+		} else if ((key_event.key == KEY_UP) || (key_event.key == KEY_DOWN)) {
+			// Seek forward/backward
+			position_ms = mp3_player_get_position();
+			if (key_event.key == KEY_UP)
+				position_ms += MUSIC_PLAYER_SEEK_STEP_MS;
+			else
+				position_ms = (position_ms > MUSIC_PLAYER_SEEK_STEP_MS) ? (position_ms - MUSIC_PLAYER_SEEK_STEP_MS) : 0;
+			if (mp3_player_seek(position_ms) < 0)
+				debug_msg("unable to seek\n");
+		} else if (key_event.key == KEY_CANCEL) {
+			mp3_player_register_callback(NULL);
 			mp3_player_stop();			
-			buttons_remove_key_event_callback();
+			buttons_remove_key_event_mailbox();
 			file_browser_resume();
 			return DIE;
 		}
-		received_key = KEY_NONE;
 	}
+
+	return WAIT_FOR_RESUME;
 }
 